@@ -0,0 +1,48 @@
+#include "AdaptiveInterval.h"
+
+using namespace std;
+
+AdaptiveInterval::AdaptiveInterval() {
+	//Constructor
+	min_interval = 1000000000ULL;
+	max_interval = 1000000000ULL;
+	interval = min_interval;
+	quiet_ticks = 0;
+	last_cause = none;
+	last_PID = -1;
+}
+
+void AdaptiveInterval::SetBounds(unsigned long long min_ns, unsigned long long max_ns) {
+	min_interval = min_ns;
+	max_interval = (max_ns < min_ns) ? min_ns : max_ns;
+	interval = min_interval;
+	quiet_ticks = 0;
+}
+
+unsigned long long AdaptiveInterval::Update(bool saturated, double utilization_pct, bottleneck_causes cause, int PID) {
+	//Processes are only known on both ticks outside quiet stretches
+	bool changed = (cause != last_cause) || ((PID != -1) && (last_PID != -1) && (PID != last_PID));
+	bool active = saturated || (utilization_pct >= BUSY_UTILIZATION_PCT) ||
+		(changed && (utilization_pct >= ACTIVE_UTILIZATION_PCT));
+	last_cause = cause;
+	last_PID = PID;
+
+	if (active) {
+		interval = min_interval;
+		quiet_ticks = 0;
+		return interval;
+	}
+	if (quiet_ticks < QUIET_TICKS) ++quiet_ticks;
+	else if (interval < max_interval) {
+		interval = (interval > max_interval / 2) ? max_interval : interval * 2;
+	}
+	return interval;
+}
+
+unsigned long long AdaptiveInterval::GetInterval() const {
+	return interval;
+}
+
+bool AdaptiveInterval::IsQuiet() const {
+	return quiet_ticks >= QUIET_TICKS;
+}
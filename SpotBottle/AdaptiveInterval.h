@@ -0,0 +1,52 @@
+//Picks the time between samples for /T min max: short while something is
+// happening, backing off toward the maximum while the host is quiet.
+
+#ifndef RESOURCEMONITOR_ADAPTIVEINTERVAL_H
+#define RESOURCEMONITOR_ADAPTIVEINTERVAL_H
+
+#include "Platform.h"
+#include "Collector.h"
+
+using namespace std;
+
+//The CPU% or Disk% that counts as busy on its own
+const double BUSY_UTILIZATION_PCT = 50.0;
+
+//Below this CPU% and Disk%, a new cause or process is noise: the fallback
+// pick between near-idle resources and processes changes every tick.
+const double ACTIVE_UTILIZATION_PCT = 10.0;
+
+//Quiet ticks at the minimum before backing off
+const DWORD QUIET_TICKS = 5;
+
+//Goes to the minimum at once on a saturated resource, high utilization or a
+// new bottleneck cause or process. After QUIET_TICKS without any of those the
+// interval doubles each tick up to the maximum, and per-process collection
+// stops until the next activity.
+class AdaptiveInterval {
+public:
+	AdaptiveInterval();//Constructor
+
+	void SetBounds(unsigned long long min_ns, unsigned long long max_ns);
+
+	//Takes one tick's findings and returns the interval to the next tick.
+	//saturated is a bottleneck found before the fallback picks, PID is the
+	// bottleneck process or -1 if none was collected.
+	unsigned long long Update(bool saturated, double utilization_pct, bottleneck_causes cause, int PID);
+
+	//Interval to the next tick
+	unsigned long long GetInterval() const;
+
+	//True once the host has been quiet long enough to skip the processes.
+	bool IsQuiet() const;
+
+private:
+	unsigned long long min_interval;
+	unsigned long long max_interval;
+	unsigned long long interval;
+	DWORD quiet_ticks;
+	bottleneck_causes last_cause;
+	int last_PID;
+};
+
+#endif
@@ -0,0 +1,50 @@
+#include "AllocationCounter.h"
+
+#ifdef _DEBUG
+
+#include <atomic>
+#include <new>
+#include <stdlib.h>
+
+//Replaces the global operator new and delete to count calls
+static std::atomic<unsigned long long> allocation_count(0);
+
+void* operator new(size_t size) {
+	allocation_count.fetch_add(1, std::memory_order_relaxed);
+	void* memory = malloc((size != 0) ? size : 1);
+	if (memory == 0) throw std::bad_alloc();
+	return memory;
+}
+
+void* operator new[](size_t size) {
+	return operator new(size);
+}
+
+void operator delete(void* memory) noexcept {
+	free(memory);
+}
+
+void operator delete[](void* memory) noexcept {
+	free(memory);
+}
+
+//Sized forms, called instead of the above where the size is known
+void operator delete(void* memory, size_t) noexcept {
+	operator delete(memory);
+}
+
+void operator delete[](void* memory, size_t) noexcept {
+	operator delete[](memory);
+}
+
+unsigned long long GetAllocationCount() {
+	return allocation_count.load(std::memory_order_relaxed);
+}
+
+#else
+
+unsigned long long GetAllocationCount() {
+	return 0;
+}
+
+#endif
@@ -0,0 +1,10 @@
+//Counts heap allocations in debug builds, to check that the sampling loop
+// does not allocate once it has reached a steady state.
+
+#ifndef RESOURCEMONITOR_ALLOCATIONCOUNTER_H
+#define RESOURCEMONITOR_ALLOCATIONCOUNTER_H
+
+//Returns the number of operator new calls so far. Always 0 without _DEBUG.
+unsigned long long GetAllocationCount();
+
+#endif
@@ -0,0 +1,667 @@
+#include "Collector.h"
+#include "SampleRecording.h"
+#ifdef _WIN32
+#include "PdhCollector.h"
+#else
+#include "ProcfsCollector.h"
+#endif
+#include <algorithm>
+
+bool DiskIsSaturated(double await_ms, double queue_depth) {
+	return (await_ms >= SATURATED_AWAIT_MS) && (queue_depth >= SATURATED_QUEUE_DEPTH);
+}
+
+DiskSample::DiskSample() {
+	//Constructor
+	Clear();
+}
+
+void DiskSample::Clear() {
+	busy_pct = 0.0;
+	read_iops = 0.0;
+	write_iops = 0.0;
+	read_bytes = 0;
+	write_bytes = 0;
+	await_ms = 0.0;
+	queue_depth = 0.0;
+}
+
+bool CoreIsSaturated(double core_max_pct, double core_imbalance_pct) {
+	return (core_max_pct >= SATURATED_CORE_PCT) && (core_imbalance_pct >= CORE_IMBALANCE_PCT);
+}
+
+bool LinkIsSaturated(double recv_pct, double sent_pct) {
+	return (recv_pct >= SATURATED_LINK_PCT) || (sent_pct >= SATURATED_LINK_PCT);
+}
+
+InterfaceSample::InterfaceSample() {
+	//Constructor
+	Clear();
+}
+
+void InterfaceSample::Clear() {
+	recv_bytes = 0;
+	sent_bytes = 0;
+	speed = 0;
+	recv_pct = 0.0;
+	sent_pct = 0.0;
+}
+
+PressureSample::PressureSample() {
+	//Constructor
+	available = false;
+	some_pct = 0.0;
+	full_pct = 0.0;
+	some_avg10 = 0.0;
+	full_avg10 = 0.0;
+}
+
+SystemSample::SystemSample() {
+	//Constructor
+	cpu_pct = 0.0;
+	core_max_pct = 0.0;
+	core_imbalance_pct = 0.0;
+	busiest_core = -1;
+	highest_disk_usage = 0.0;
+	disk_await_ms = 0.0;
+	disk_queue_depth = 0.0;
+	recv_bytes = 0;
+	sent_bytes = 0;
+	link_recv_pct = 0.0;
+	link_sent_pct = 0.0;
+	ram_pct = 0.0;
+}
+
+//Slots RankSlots() works through a stage at a time, so each stage is timed
+// once per batch instead of once per process
+const DWORD RANK_BATCH_SIZE = 32;
+
+ThreadSample::ThreadSample() {
+	//Constructor
+	name.reserve(16);//TASK_COMM_LEN
+	TID = 0;
+	cpu = 0.0;
+	rio = 0;
+	wio = 0;
+	faults = 0;
+}
+
+CgroupSample::CgroupSample() {
+	//Constructor
+	cpu = 0.0;
+	rio = 0;
+	wio = 0;
+	memory = 0;
+}
+
+ProcessTimings::ProcessTimings() {
+	//Constructor
+	fetch = 0;
+	join = 0;
+	rates = 0;
+	select = 0;
+}
+
+Collector::Collector() {
+	//Constructor
+	samples_old = &sample_buffers[0];
+	samples_new = &sample_buffers[1];
+	pid_index_old = &pid_indexes[0];
+	pid_index_new = &pid_indexes[1];
+	ranking_cause = none;
+	ranking_joins = false;
+	rank_count = 1;
+	sample_all = false;
+	sample_io = true;
+	sample_names = true;
+	ranked_count = 0;
+	process_sample_time_new = 0;
+	process_sample_time_old = 0;
+	replay = 0;
+	hot_core = -1;
+	thread_count = 0;
+	ranked_thread_count = 0;
+	cgroup_count = 0;
+	ranked_cgroup_count = 0;
+	limiting_PIDs = false;
+	core_count = 0;
+	disk_count = 0;
+	interface_count = 0;
+	ResizeCandidates();
+	names.Reserve(NAME_TABLE_SLACK, NAME_TABLE_SLACK * RESERVED_NAME_LENGTH);
+	commands.Reserve(NAME_TABLE_SLACK, NAME_TABLE_SLACK * RESERVED_COMMAND_LENGTH);
+}
+
+Collector::~Collector() {
+}
+
+void Collector::SetThreadCount(DWORD thread_count) {
+	workers.Start(thread_count);
+	ResizeCandidates();
+}
+
+void Collector::SetRankCount(DWORD new_rank_count) {
+	rank_count = (new_rank_count < 1) ? 1 : new_rank_count;
+	ResizeCandidates();
+}
+
+void Collector::SetSampleAll(bool new_sample_all) {
+	sample_all = new_sample_all;
+}
+
+void Collector::SampleRankedDetail() {
+}
+
+void Collector::CompactNames() {
+	if (sample_all || (replay != 0)) return;
+	DWORD limit = samples_new->count * 2 + NAME_TABLE_SLACK;
+	if (names.GetCount() > limit) names.Compact(samples_new->name_id, samples_new->count);
+	if (commands.GetCount() > limit) commands.Compact(samples_new->command_id, samples_new->count);
+}
+
+void Collector::ResizeCandidates() {
+	//Makes room for rank_count slots in every heap, so ranking does not allocate.
+	worker_candidates.resize(workers.GetWorkerCount());
+	worker_timings.resize(workers.GetWorkerCount());
+	for (size_t n = 0; n < worker_candidates.size(); ++n) {
+		worker_candidates[n].heap.resize(rank_count);
+		worker_candidates[n].count = 0;
+	}
+	merged_candidates.heap.resize(rank_count);
+	merged_candidates.count = 0;
+	ranked.resize(rank_count);
+	ranked_count = 0;
+}
+
+bool Collector::CollectProcesses(bottleneck_causes cause) {
+	//Keeps the previous tick as the old data point and samples a new one.
+	//Returns false if no per-process data could be sampled.
+	ranked_count = 0;
+	ProcessSamples* samples_swap = samples_old;
+	samples_old = samples_new;
+	samples_new = samples_swap;
+	PidIndex* pid_index_swap = pid_index_old;
+	pid_index_old = pid_index_new;
+	pid_index_new = pid_index_swap;
+	unsigned long long fetch_start = GetMonotonicNanoseconds();
+	process_sample_time_old = process_sample_time_new;
+	process_sample_time_new = fetch_start;
+	bool sampled = false;
+	bool raw = true;
+	//Recordings have every counter and name
+	sample_io = sample_all || (replay != 0) || (cause == tio) || (cause == rio) || (cause == wio);
+	sample_names = sample_all || (replay != 0);
+	if (replay != 0) sampled = replay->ReadProcesses(samples_new, pid_index_new, &names, &process_sample_time_new, &raw);
+	else sampled = SampleProcessRaw();
+	timings.fetch = GetMonotonicNanoseconds() - fetch_start;
+	if (!sampled || (samples_new->count == 0)) {
+		samples_new->Clear(0);
+		pid_index_new->Clear(0);
+		return false;
+	}
+
+	//Join with the old sample through the index, O(n) per tick
+	RankProcesses(cause, raw);
+	if (replay == 0) {
+		unsigned long long detail_start = GetMonotonicNanoseconds();
+		SampleRankedDetail();
+		CompactNames();
+		timings.fetch += GetMonotonicNanoseconds() - detail_start;
+	}
+	return true;
+}
+
+unsigned long long Collector::GetProcessSampleTime() {
+	return process_sample_time_new;
+}
+
+void Collector::SetReplay(SampleRecording* recording) {
+	replay = recording;
+	//Only the system-wide values are recorded, not the cores, disks and interfaces
+	core_count = 0;
+	disk_count = 0;
+	interface_count = 0;
+	samples_new->Clear(0);
+	pid_index_new->Clear(0);
+	process_sample_time_new = 0;
+}
+
+void Collector::ForgetSamples() {
+	samples_new->Clear(0);
+	pid_index_new->Clear(0);
+	ranked_count = 0;
+}
+
+DWORD Collector::GetRankedCount() {
+	return ranked_count;
+}
+
+int Collector::GetRankedIndex(DWORD rank) {
+	return ranked[rank];
+}
+
+bool Collector::CollectThreads(bottleneck_causes cause, DWORD slot, DWORD rank_count) {
+	ranked_thread_count = 0;
+	return false;
+}
+
+DWORD Collector::GetRankedThreadCount() {
+	return ranked_thread_count;
+}
+
+const ThreadSample* Collector::GetRankedThread(DWORD rank) {
+	return &threads[ranked_threads[rank]];
+}
+
+ThreadSample* Collector::AddThread() {
+	//Each new entry allocates its name, so grow in steps big enough for most
+	// processes' threads at once
+	if (thread_count == threads.size()) threads.resize((threads.size() < 256) ? 256 : threads.size() * 2);
+	return &threads[thread_count++];
+}
+
+static double GetRankValue(const ThreadSample* thread, bottleneck_causes cause) {
+	if ((cause == cpu) || (cause == core)) return thread->cpu;
+	if (cause == rio) return (double)thread->rio;
+	if (cause == wio) return (double)thread->wio;
+	if (cause == tio) return (double)(thread->rio + thread->wio);
+	if (cause == mem) return (double)thread->faults;
+	return 0.0;
+}
+
+static double GetRankValue(const CgroupSample* cgroup, bottleneck_causes cause) {
+	if ((cause == cpu) || (cause == core)) return cgroup->cpu;
+	if (cause == rio) return (double)cgroup->rio;
+	if (cause == wio) return (double)cgroup->wio;
+	if (cause == tio) return (double)(cgroup->rio + cgroup->wio);
+	if (cause == mem) return (double)cgroup->memory;
+	return 0.0;
+}
+
+template <class T>
+static DWORD RankHighest(const vector<T>& items, DWORD count, bottleneck_causes cause, DWORD rank_count, vector<DWORD>* ranked) {
+	//Selection of the few highest, there are too few items for a heap to pay
+	// off. Leaves out items at 0, ties go to the lower index. Returns the
+	// number ranked.
+	if (ranked->size() < rank_count) ranked->resize(rank_count);
+	DWORD ranked_count = 0;
+	for (DWORD n = 0; n < count; ++n) {
+		double value = GetRankValue(&items[n], cause);
+		if (value <= 0.0) continue;
+		DWORD position = ranked_count;
+		while ((position > 0) && (GetRankValue(&items[(*ranked)[position - 1]], cause) < value)) {
+			if (position < rank_count) (*ranked)[position] = (*ranked)[position - 1];
+			--position;
+		}
+		if (position >= rank_count) continue;
+		(*ranked)[position] = n;
+		if (ranked_count < rank_count) ++ranked_count;
+	}
+	return ranked_count;
+}
+
+void Collector::RankThreads(bottleneck_causes cause, DWORD rank_count) {
+	//Threads are added in TID order, so ties go to the lower TID
+	ranked_thread_count = RankHighest(threads, thread_count, cause, rank_count, &ranked_threads);
+}
+
+bool Collector::CollectCgroups(bottleneck_causes cause, DWORD rank_count) {
+	ranked_cgroup_count = 0;
+	return false;
+}
+
+DWORD Collector::GetRankedCgroupCount() {
+	return ranked_cgroup_count;
+}
+
+const CgroupSample* Collector::GetRankedCgroup(DWORD rank) {
+	return &cgroups[ranked_cgroups[rank]];
+}
+
+void Collector::LimitToCgroup(int rank) {
+	limiting_PIDs = false;
+}
+
+CgroupSample* Collector::AddCgroup() {
+	if (cgroup_count == cgroups.size()) cgroups.resize(cgroups.size() + 1);
+	return &cgroups[cgroup_count++];
+}
+
+void Collector::RankCgroups(bottleneck_causes cause, DWORD rank_count) {
+	ranked_cgroup_count = RankHighest(cgroups, cgroup_count, cause, rank_count, &ranked_cgroups);
+}
+
+DWORD Collector::GetCoreCount() {
+	return core_count;
+}
+
+const double* Collector::GetCorePcts() {
+	return core_pcts.data();
+}
+
+void Collector::SetHotCore(int core) {
+	hot_core = core;
+}
+
+void Collector::SummarizeCores(SystemSample* sample) {
+	//Branch-free reductions over the contiguous array, in four independent
+	// lanes so the compiler can vectorize them and the adds do not wait on
+	// each other. Then one pass finds the first core at the maximum.
+	sample->core_max_pct = 0.0;
+	sample->core_imbalance_pct = 0.0;
+	sample->busiest_core = -1;
+	if (core_count == 0) return;
+	const double* pcts = core_pcts.data();
+	double maximums[4] = { pcts[0], pcts[0], pcts[0], pcts[0] };
+	double sums[4] = { 0.0, 0.0, 0.0, 0.0 };
+	DWORD n = 0;
+	for (; n + 4 <= core_count; n += 4) {
+		for (DWORD lane = 0; lane < 4; ++lane) {
+			double pct = pcts[n + lane];
+			maximums[lane] = (pct > maximums[lane]) ? pct : maximums[lane];
+			sums[lane] += pct;
+		}
+	}
+	for (; n < core_count; ++n) {
+		maximums[0] = (pcts[n] > maximums[0]) ? pcts[n] : maximums[0];
+		sums[0] += pcts[n];
+	}
+	double maximum = maximums[0];
+	for (DWORD lane = 1; lane < 4; ++lane) {
+		if (maximums[lane] > maximum) maximum = maximums[lane];
+	}
+	double mean = (sums[0] + sums[1] + sums[2] + sums[3]) / core_count;
+	DWORD busiest = 0;
+	while ((busiest < core_count) && (pcts[busiest] != maximum)) ++busiest;
+	sample->core_max_pct = maximum;
+	sample->core_imbalance_pct = maximum - mean;
+	sample->busiest_core = (int)busiest;
+}
+
+DWORD Collector::GetDiskCount() {
+	return disk_count;
+}
+
+const DiskSample* Collector::GetDisks() {
+	return disks.data();
+}
+
+DiskSample* Collector::AddDisk() {
+	if (disk_count == disks.size()) disks.resize(disks.size() + 1);
+	return &disks[disk_count++];
+}
+
+void Collector::SummarizeDisks(SystemSample* sample) {
+	//A saturated disk beats any that is not, then the deeper queue wins.
+	sample->disk_await_ms = 0.0;
+	sample->disk_queue_depth = 0.0;
+	int chosen = -1;
+	bool chosen_saturated = false;
+	for (DWORD n = 0; n < disk_count; ++n) {
+		bool saturated = DiskIsSaturated(disks[n].await_ms, disks[n].queue_depth);
+		if ((chosen == -1) || (saturated && !chosen_saturated) ||
+			((saturated == chosen_saturated) && (disks[n].queue_depth > disks[chosen].queue_depth))) {
+			chosen = n;
+			chosen_saturated = saturated;
+		}
+	}
+	if (chosen == -1) return;
+	sample->disk_await_ms = disks[chosen].await_ms;
+	sample->disk_queue_depth = disks[chosen].queue_depth;
+}
+
+DWORD Collector::GetInterfaceCount() {
+	return interface_count;
+}
+
+const InterfaceSample* Collector::GetInterfaces() {
+	return interfaces.data();
+}
+
+void Collector::SetInterfaceFilters(const vector<wstring>& include, const vector<wstring>& exclude) {
+	interface_includes = include;
+	interface_excludes = exclude;
+}
+
+InterfaceSample* Collector::AddInterface() {
+	if (interface_count == interfaces.size()) interfaces.resize(interfaces.size() + 1);
+	return &interfaces[interface_count++];
+}
+
+static bool InterfaceMatches(const wstring& pattern, const wchar_t* name, size_t name_length) {
+	//Exact, or a prefix if the pattern ends in "*"
+	if ((pattern.length() > 0) && (pattern[pattern.length() - 1] == L'*')) {
+		size_t prefix_length = pattern.length() - 1;
+		return (name_length >= prefix_length) && (wcsncmp(pattern.c_str(), name, prefix_length) == 0);
+	}
+	return (pattern.length() == name_length) && (wcsncmp(pattern.c_str(), name, name_length) == 0);
+}
+
+bool Collector::InterfaceIsIncluded(const wchar_t* name, size_t name_length, bool loopback, bool skip_virtual) {
+	for (size_t n = 0; n < interface_excludes.size(); ++n) {
+		if (InterfaceMatches(interface_excludes[n], name, name_length)) return false;
+	}
+	if (interface_includes.size() == 0) return !loopback && !skip_virtual;
+	for (size_t n = 0; n < interface_includes.size(); ++n) {
+		if (InterfaceMatches(interface_includes[n], name, name_length)) return true;
+	}
+	return false;
+}
+
+void Collector::SummarizeInterfaces(SystemSample* sample) {
+	//Totals of the included interfaces, and the use of the fullest link
+	sample->recv_bytes = 0;
+	sample->sent_bytes = 0;
+	sample->link_recv_pct = 0.0;
+	sample->link_sent_pct = 0.0;
+	double highest_pct = 0.0;
+	for (DWORD n = 0; n < interface_count; ++n) {
+		const InterfaceSample* network_interface = &interfaces[n];
+		sample->recv_bytes += network_interface->recv_bytes;
+		sample->sent_bytes += network_interface->sent_bytes;
+		double pct = (network_interface->recv_pct > network_interface->sent_pct) ? network_interface->recv_pct : network_interface->sent_pct;
+		if (pct > highest_pct) {
+			highest_pct = pct;
+			sample->link_recv_pct = network_interface->recv_pct;
+			sample->link_sent_pct = network_interface->sent_pct;
+		}
+	}
+}
+
+int Collector::GetIndexOfHighest() {
+	if (ranked_count == 0) return -1;
+	return ranked[0];
+}
+
+void Collector::RankProcesses(bottleneck_causes cause, bool join) {
+	ranking_cause = cause;
+	ranking_joins = join;
+	for (size_t n = 0; n < worker_candidates.size(); ++n) {
+		worker_candidates[n].count = 0;
+		worker_timings[n].join = 0;
+		worker_timings[n].rates = 0;
+		worker_timings[n].select = 0;
+	}
+	workers.Run(samples_new->count, MIN_PROCESSES_PER_WORKER, RankSlots, this);
+
+	//Merge the workers' candidates
+	unsigned long long merge_start = GetMonotonicNanoseconds();
+	timings.join = 0;
+	timings.rates = 0;
+	timings.select = 0;
+	for (size_t n = 0; n < worker_timings.size(); ++n) {
+		timings.join += worker_timings[n].join;
+		timings.rates += worker_timings[n].rates;
+		timings.select += worker_timings[n].select;
+	}
+	merged_candidates.count = 0;
+	for (size_t n = 0; n < worker_candidates.size(); ++n) {
+		for (DWORD position = 0; position < worker_candidates[n].count; ++position) {
+			PushCandidate(&merged_candidates, worker_candidates[n].heap[position]);
+		}
+	}
+
+	//Popping the heap gives the lowest ranked first, so fill from the back
+	ranked_count = merged_candidates.count;
+	for (DWORD rank = ranked_count; rank > 0; --rank) {
+		ranked[rank - 1] = merged_candidates.heap[0];
+		DWORD last = merged_candidates.heap[--merged_candidates.count];
+		if (merged_candidates.count > 0) SiftDown(&merged_candidates, 0, last);
+	}
+	timings.select += GetMonotonicNanoseconds() - merge_start;
+}
+
+void Collector::PushCandidate(Candidates* candidates, DWORD slot) {
+	//Keeps the rank_count highest slots pushed, O(log rank_count).
+	if (!Outranks(slot, -1)) return;
+	DWORD* heap = candidates->heap.data();
+	if (candidates->count < rank_count) {
+		//Room left, sift the new slot up past higher ranked parents
+		DWORD position = candidates->count++;
+		while (position > 0) {
+			DWORD parent = (position - 1) / 2;
+			if (!Outranks(heap[parent], slot)) break;
+			heap[position] = heap[parent];
+			position = parent;
+		}
+		heap[position] = slot;
+	}
+	else if (Outranks(slot, heap[0])) {
+		//Replace the lowest ranked
+		SiftDown(candidates, 0, slot);
+	}
+}
+
+void Collector::SiftDown(Candidates* candidates, DWORD position, DWORD slot) {
+	//Puts slot at position, moving lower ranked children up past it.
+	DWORD* heap = candidates->heap.data();
+	while (true) {
+		DWORD child = position * 2 + 1;
+		if (child >= candidates->count) break;
+		if ((child + 1 < candidates->count) && Outranks(heap[child], heap[child + 1])) ++child;
+		if (!Outranks(slot, heap[child])) break;
+		heap[position] = heap[child];
+		position = child;
+	}
+	heap[position] = slot;
+}
+
+void Collector::RankSlots(void* context, DWORD worker, DWORD begin, DWORD end) {
+	//Worker function of RankProcesses() for the slots [begin, end).
+	Collector* collector = (Collector*)context;
+	ProcessSamples* samples = collector->samples_new;
+	bottleneck_causes cause = collector->ranking_cause;
+	bool need_cpu = (cause == cpu) || (cause == core);
+	bool need_rio = (cause == rio) || (cause == tio);
+	bool need_wio = (cause == wio) || (cause == tio);
+	bool need_faults = (cause == mem);
+	bool joins = collector->ranking_joins;
+	ProcessSamples* samples_old = collector->samples_old;
+	double elapsed_seconds = (collector->process_sample_time_new - collector->process_sample_time_old) / 1000000000.0;
+	Candidates* candidates = &collector->worker_candidates[worker];
+	WorkerTimings* times = &collector->worker_timings[worker];
+	int old_indexes[RANK_BATCH_SIZE];
+	for (DWORD batch_begin = begin; batch_begin < end; batch_begin += RANK_BATCH_SIZE) {
+		DWORD batch_end = (end - batch_begin > RANK_BATCH_SIZE) ? batch_begin + RANK_BATCH_SIZE : end;
+		unsigned long long join_start = GetMonotonicNanoseconds();
+		if (joins) {
+			//Check if in samples_old, -1 is probably a new process
+			for (DWORD n = batch_begin; n < batch_end; ++n) {
+				old_indexes[n - batch_begin] = collector->pid_index_old->Find(samples->PID[n], samples->start_time[n]);
+			}
+			//The identity is the one read when the process was first seen
+			for (DWORD n = batch_begin; n < batch_end; ++n) {
+				int old_index = old_indexes[n - batch_begin];
+				if (old_index == -1) continue;
+				if (samples->name_id[n] == UNKNOWN_NAME_ID) samples->name_id[n] = samples_old->name_id[old_index];
+				if (samples->command_id[n] == UNKNOWN_NAME_ID) samples->command_id[n] = samples_old->command_id[old_index];
+				if (samples->parent_PID[n] == -1) samples->parent_PID[n] = samples_old->parent_PID[old_index];
+			}
+		}
+		unsigned long long rates_start = GetMonotonicNanoseconds();
+		if (joins) {
+			//Calculate formatted values of the processes found
+			for (DWORD n = batch_begin; n < batch_end; ++n) {
+				int old_index = old_indexes[n - batch_begin];
+				if (old_index == -1) continue;
+				//No I/O rate without I/O totals on both ticks. Totals from
+				// before the last tick would average over however long I/O
+				// went unread, so the first tick of an I/O cause ranks none.
+				bool io_known = (samples_old->raw_io_time[old_index] != 0) && (samples->raw_io_time[n] != 0);
+				collector->CalculateProcess(n, old_index, need_cpu, need_rio && io_known, need_wio && io_known);
+				if (need_rio && need_wio) {
+					samples->tio[n] = samples->wio[n] + samples->rio[n];
+				}
+				//Fault counts are plain totals on every platform
+				if (need_faults && (elapsed_seconds > 0.0) && (samples->raw_faults[n] >= samples_old->raw_faults[old_index])) {
+					samples->faults[n] = (long long)((samples->raw_faults[n] - samples_old->raw_faults[old_index]) / elapsed_seconds);
+				}
+			}
+		}
+		unsigned long long select_start = GetMonotonicNanoseconds();
+		for (DWORD n = batch_begin; n < batch_end; ++n) {
+			//Processes not there to calculate cannot rank
+			if (joins && (old_indexes[n - batch_begin] == -1)) continue;
+			if (collector->limiting_PIDs &&
+				!binary_search(collector->limit_PIDs.begin(), collector->limit_PIDs.end(), samples->PID[n])) continue;
+			collector->PushCandidate(candidates, n);
+		}
+		unsigned long long select_end = GetMonotonicNanoseconds();
+		times->join += rates_start - join_start;
+		times->rates += select_start - rates_start;
+		times->select += select_end - select_start;
+	}
+}
+
+bool Collector::Outranks(DWORD slot, int other_slot) {
+	//Processes with a value of 0 never rank.
+	if ((ranking_cause == cpu) || (ranking_cause == core)) {
+		//For the core cause, only processes last run on the hot core rank
+		const double* column = samples_new->cpu;
+		if (column[slot] <= 0.0) return false;
+		if ((ranking_cause == core) && (hot_core != -1) && (samples_new->processor[slot] != -1) &&
+			(samples_new->processor[slot] != hot_core)) return false;
+		if (other_slot == -1) return true;
+		if (column[slot] != column[other_slot]) return column[slot] > column[other_slot];
+	}
+	else {
+		const long long* column = 0;
+		if (ranking_cause == tio) column = samples_new->tio;
+		else if (ranking_cause == wio) column = samples_new->wio;
+		else if (ranking_cause == rio) column = samples_new->rio;
+		else if (ranking_cause == mem) column = samples_new->faults;
+		else return false;
+		if (column[slot] <= 0) return false;
+		if (other_slot == -1) return true;
+		if (column[slot] != column[other_slot]) return column[slot] > column[other_slot];
+	}
+	return (int)slot < other_slot;
+}
+
+bool Collector::TracksPIDs() {
+	return true;
+}
+
+ProcessSamples* Collector::GetProcesses() {
+	return samples_new;
+}
+
+const NameTable* Collector::GetNames() {
+	return &names;
+}
+
+const NameTable* Collector::GetCommands() {
+	return &commands;
+}
+
+const ProcessTimings* Collector::GetTimings() {
+	return &timings;
+}
+
+Collector* CreateCollector() {
+#ifdef _WIN32
+	return new PdhCollector();
+#else
+	return new ProcfsCollector();
+#endif
+}
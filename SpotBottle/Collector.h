@@ -0,0 +1,433 @@
+//Interface for the platform specific sampling backends.
+//A collector takes one sample per tick and hands the system-wide metrics and
+// per-process values to the bottleneck logic in wmain().
+
+#ifndef RESOURCEMONITOR_COLLECTOR_H
+#define RESOURCEMONITOR_COLLECTOR_H
+
+#include "Platform.h"
+#include "ProcessSamples.h"
+#include "PidIndex.h"
+#include "WorkerPool.h"
+#include <string>
+#include <vector>
+
+using namespace std;
+
+//core is one processor core saturated while the rest are not, like a
+// single-threaded process pinning it. mem is tasks stalled waiting on memory,
+// ranked by major page faults.
+enum bottleneck_causes {none, cpu, wio, rio, tio, core, mem};
+
+//Fewer processes than this per worker are scanned on fewer threads
+const DWORD MIN_PROCESSES_PER_WORKER = 256;
+
+//Name and command line tables are compacted once they hold this many more
+// entries than twice the process count, so each compaction is paid for by
+// at least as many new names.
+const DWORD NAME_TABLE_SLACK = 1024;
+
+//Characters per entry the name and command line tables start with room
+// for. Only ranked processes are named outside /RECORD and /REPLAY, so the
+// room for NAME_TABLE_SLACK entries usually lasts.
+const DWORD RESERVED_NAME_LENGTH = 16;
+const DWORD RESERVED_COMMAND_LENGTH = 64;
+
+class SampleRecording;
+
+//Averages past these mean requests are queueing on a disk, whatever its
+// percent disk time says. Solid state and RAID disks show 100% disk time
+// long before they stop keeping up.
+const double SATURATED_AWAIT_MS = 10.0;
+const double SATURATED_QUEUE_DEPTH = 1.0;
+
+//True if a disk with these averages is a bottleneck.
+bool DiskIsSaturated(double await_ms, double queue_depth);
+
+//One physical disk's activity over the last tick
+struct DiskSample {
+	wstring name;
+	double busy_pct;//Percent of the time with I/O in flight, like % Disk Time
+	double read_iops;
+	double write_iops;
+	unsigned long long read_bytes;//Bytes per second
+	unsigned long long write_bytes;//Bytes per second
+	double await_ms;//Average milliseconds per completed I/O, queueing included
+	double queue_depth;//Average I/Os in flight
+	DiskSample();//Constructor
+	void Clear();//Keeps the name
+};
+
+//A link moving this much of its speed in either direction is a bottleneck.
+const double SATURATED_LINK_PCT = 90.0;
+
+//True if a network interface with these uses of its speed is a bottleneck.
+bool LinkIsSaturated(double recv_pct, double sent_pct);
+
+//One network interface's traffic over the last tick
+struct InterfaceSample {
+	wstring name;
+	unsigned long long recv_bytes;//Bytes per second
+	unsigned long long sent_bytes;//Bytes per second
+	unsigned long long speed;//Link speed in bits per second, 0 if unknown
+	double recv_pct;//Percent of the link speed, 0 if unknown
+	double sent_pct;//Percent of the link speed, 0 if unknown
+	InterfaceSample();//Constructor
+	void Clear();//Keeps the name
+};
+
+//A core this busy while the average is this much lower is a bottleneck the
+// average hides: one core of 64 at 100% is under 2% of the total.
+const double SATURATED_CORE_PCT = 90.0;
+const double CORE_IMBALANCE_PCT = 25.0;
+
+//True if the busiest core is saturated on its own.
+bool CoreIsSaturated(double core_max_pct, double core_imbalance_pct);
+
+//Resources of Linux's Pressure Stall Information, /proc/pressure/*
+enum pressure_resources {pressure_cpu, pressure_io, pressure_memory, PRESSURE_COUNT};
+
+//Tasks stalled this much of the time on a resource make it the bottleneck,
+// before any utilization is looked at.
+const double STALLED_PRESSURE_PCT = 10.0;
+
+//Percent of the time tasks were stalled on one resource. "some" is at least
+// one task stalled, "full" is every non-idle task stalled at once.
+struct PressureSample {
+	bool available;//False without PSI, like on Windows or old kernels
+	double some_pct;//Over the last tick
+	double full_pct;
+	double some_avg10;//The kernel's 10 second averages
+	double full_avg10;
+	PressureSample();//Constructor
+};
+
+//System-wide metrics of one tick
+struct SystemSample {
+	double cpu_pct;//Averaged across all processor cores
+	double core_max_pct;//Of the busiest core
+	double core_imbalance_pct;//Busiest core less the average of the cores
+	int busiest_core;//-1 if the cores are unknown
+	double highest_disk_usage;//Percent disk time of the busiest physical disk
+	double disk_await_ms;//Of the most backed up physical disk, saturated ones first
+	double disk_queue_depth;//Of the same disk
+	unsigned long long recv_bytes;//Bytes per second, summed across the included network interfaces
+	unsigned long long sent_bytes;//Bytes per second, summed across the included network interfaces
+	double link_recv_pct;//Of the interface using the most of its speed
+	double link_sent_pct;//Of the same interface
+	double ram_pct;//Percent physical RAM used
+	PressureSample pressure[PRESSURE_COUNT];
+	SystemSample();//Constructor
+};
+
+//One thread of the bottleneck process over the last tick, for /THREADS
+struct ThreadSample {
+	int TID;
+	wstring name;
+	double cpu;//Percent of one core
+	long long rio;//Read I/O bytes per second
+	long long wio;//Write I/O bytes per second
+	long long faults;//Major page faults per second
+	ThreadSample();//Constructor
+};
+
+//One leaf cgroup, usually a container or a service, over the last tick, for
+// /CGROUPS
+struct CgroupSample {
+	wstring name;//Path under the cgroup2 mount, like /system.slice/nginx.service
+	double cpu;//Percent of one core, summed over the cores like a process's
+	long long rio;//Read I/O bytes per second
+	long long wio;//Write I/O bytes per second
+	unsigned long long memory;//Bytes in use
+	CgroupSample();//Constructor
+};
+
+//Time spent in the stages of the last CollectProcesses(), in nanoseconds.
+//join and rates are summed over the worker threads.
+struct ProcessTimings {
+	unsigned long long fetch;
+	unsigned long long join;
+	unsigned long long rates;
+	unsigned long long select;
+	ProcessTimings();//Constructor
+};
+
+class Collector {
+public:
+	Collector();//Constructor
+	virtual ~Collector();
+
+	//Prepares the counters and takes the first sample.
+	//Returns false if the collector cannot be used.
+	virtual bool Open() = 0;
+
+	//Takes a new sample and fills the system-wide metrics.
+	//Returns false if the sample is unusable and should be retried shortly.
+	virtual bool CollectSystem(SystemSample* sample) = 0;
+
+	//Splits per-process work across thread_count threads, including the caller.
+	virtual void SetThreadCount(DWORD thread_count);
+
+	//Sets how many of the highest processes are ranked each tick, default 1.
+	void SetRankCount(DWORD rank_count);
+
+	//Samples every per-process counter and name each tick, not only what the
+	// cause needs and the ranked processes' names. For /RECORD, which writes
+	// them all and refers to names by id, so the name table is not compacted.
+	void SetSampleAll(bool sample_all);
+
+	//Samples per-process data and calculates the values the cause needs.
+	//Afterwards GetProcesses() returns this tick's processes and
+	// GetRankedIndex() the slots of the ones highest in the cause's value.
+	//Two passes: the cheap one reads only the counters the cause ranks on,
+	// then the ranked processes alone get their names and command lines, the
+	// first time they rank.
+	virtual bool CollectProcesses(bottleneck_causes cause);
+
+	//Slots of the highest processes, highest first. Processes with a value of
+	// 0 are not ranked, so there may be fewer than the rank count.
+	DWORD GetRankedCount();
+	int GetRankedIndex(DWORD rank);
+	int GetIndexOfHighest();//-1 if none
+
+	//True if processes are identified by PID, otherwise only names are known.
+	virtual bool TracksPIDs();
+
+	//This tick's processes and the tables their name and command line ids
+	// refer to.
+	ProcessSamples* GetProcesses();
+	const NameTable* GetNames();
+	const NameTable* GetCommands();
+
+	const ProcessTimings* GetTimings();
+
+	//Monotonic time this tick's per-process counters were read.
+	unsigned long long GetProcessSampleTime();
+
+	//Samples the threads of the process in slot of this tick's processes and
+	// ranks up to rank_count of them highest in the cause's value. Only that
+	// process's threads are read, so the cost does not grow with the system.
+	//Values are differences from the last call for the same process, so a
+	// process new to the top has none until the next tick.
+	//Returns false if threads cannot be sampled, like on Windows or when
+	// replaying.
+	virtual bool CollectThreads(bottleneck_causes cause, DWORD slot, DWORD rank_count);
+	DWORD GetRankedThreadCount();
+	const ThreadSample* GetRankedThread(DWORD rank);
+
+	//Samples the leaf cgroups, where all of a cgroup v2 hierarchy's processes
+	// live, and ranks up to rank_count of them highest in the cause's value.
+	//Totals come from each cgroup's own counters rather than summing its
+	// processes. MEM ranks by the memory in use.
+	//Returns false if there is no cgroup v2 hierarchy, like on Windows or
+	// when replaying.
+	virtual bool CollectCgroups(bottleneck_causes cause, DWORD rank_count);
+	DWORD GetRankedCgroupCount();
+	const CgroupSample* GetRankedCgroup(DWORD rank);
+
+	//Limits the processes ranked by CollectProcesses() to the ones in a
+	// ranked cgroup of the last CollectCgroups(), -1 for any.
+	virtual void LimitToCgroup(int rank);
+
+	//Percent busy of each processor core as of the last CollectSystem(),
+	// indexed by core number
+	DWORD GetCoreCount();
+	const double* GetCorePcts();
+
+	//Sets the core whose processes the core cause ranks, -1 for any.
+	//Processes whose last core is unknown always rank.
+	void SetHotCore(int core);
+
+	//Physical disks as of the last CollectSystem()
+	DWORD GetDiskCount();
+	const DiskSample* GetDisks();
+
+	//Network interfaces counted in the totals, as of the last CollectSystem()
+	DWORD GetInterfaceCount();
+	const InterfaceSample* GetInterfaces();
+
+	//Names of network interfaces to count, and ones not to. A name ending in
+	// "*" matches every name starting with the rest. Without includes every
+	// interface but loopback counts, and virtual ones only if there is no
+	// other, like in a container.
+	void SetInterfaceFilters(const vector<wstring>& include, const vector<wstring>& exclude);
+
+	//Takes per-process samples from a recording instead of sampling them.
+	//Rates and ranking are calculated as usual. Forgets the current samples.
+	void SetReplay(SampleRecording* recording);
+
+	//Forgets the last process, thread and cgroup samples, so rates are not
+	// taken over the time since. The next call of each ranks none and only
+	// primes the one after.
+	virtual void ForgetSamples();
+
+protected:
+	//Fills samples_new with the raw counters and name ids from the latest
+	// sample, adding every process to pid_index_new.
+	//Returns false on failure.
+	virtual bool SampleProcessRaw() = 0;
+
+	//Set by CollectProcesses() for SampleProcessRaw(). I/O totals are only
+	// needed by the I/O causes. SampleProcessRaw() sets raw_io_time of each
+	// process whose totals it read. When left out, raw_io_time stays 0 and the
+	// next tick has no I/O rates, so the tick a cause turns to I/O lists no
+	// process rather than rates over the whole time I/O went unread.
+	bool sample_io;
+	//False to leave the names to SampleRankedDetail(), name ids are then
+	// UNKNOWN_NAME_ID until read.
+	bool sample_names;
+
+	//Second pass over the ranked processes only, filling in the identity the
+	// cheap pass and the join left unknown. Not called when replaying. Does
+	// nothing by default.
+	virtual void SampleRankedDetail();
+
+	//Drops the names and command lines no process in samples_new has once
+	// the tables have grown well past the process count. Not while recording
+	// or replaying, the recording's name ids must stay the same.
+	void CompactNames();
+
+	//Calculates the needed formatted values of a process from two raw samples.
+	virtual void CalculateProcess(
+		DWORD slot_new,
+		DWORD slot_old,
+		bool need_cpu,
+		bool need_rio,
+		bool need_wio) = 0;
+
+	//Joins samples_new with samples_old if join is set, then ranks the processes
+	// highest in the cause's value. Each worker keeps local candidates from its
+	// slots and the candidates are merged, O(P log N) for N ranked processes.
+	void RankProcesses(bottleneck_causes cause, bool join);
+
+	//Per-process samples from this tick and the tick before.
+	//Swapped every tick, so their memory is reused.
+	ProcessSamples* samples_old;
+	ProcessSamples* samples_new;
+	NameTable names;
+	NameTable commands;
+
+	//Slots of the processes in samples_old and samples_new.
+	//Swapped along with the samples.
+	PidIndex* pid_index_old;
+	PidIndex* pid_index_new;
+
+	WorkerPool workers;
+
+	//Set by CollectProcesses() and RankProcesses()
+	ProcessTimings timings;
+
+	//Monotonic times the per-process counters were read, for rates. Set
+	// before SampleProcessRaw() is called, which may set a closer time.
+	unsigned long long process_sample_time_new;
+	unsigned long long process_sample_time_old;
+
+	//0 unless replaying
+	SampleRecording* replay;
+
+	//Filled by CollectSystem(), entries past core_count are unused
+	vector<double> core_pcts;
+	DWORD core_count;
+
+	//Sets the sample's core statistics from core_pcts.
+	void SummarizeCores(SystemSample* sample);
+
+	//Filled by CollectSystem() through AddDisk(). Entries past disk_count
+	// keep their name buffers for the next tick.
+	vector<DiskSample> disks;
+	DWORD disk_count;
+
+	//Returns the next entry of disks to fill in, adding one if needed.
+	DiskSample* AddDisk();
+
+	//Sets the sample's await and queue depth from the most backed up disk.
+	void SummarizeDisks(SystemSample* sample);
+
+	//Filled by CollectSystem() through AddInterface(), like disks
+	vector<InterfaceSample> interfaces;
+	DWORD interface_count;
+	InterfaceSample* AddInterface();
+
+	//True if the interface passes the filters. skip_virtual is set if the
+	// interface has no hardware behind it while another one does, see
+	// SetInterfaceFilters().
+	bool InterfaceIsIncluded(const wchar_t* name, size_t name_length, bool loopback, bool skip_virtual);
+
+	//Sets the sample's totals and link use from interfaces.
+	void SummarizeInterfaces(SystemSample* sample);
+
+	//Filled by CollectThreads() through AddThread(), like disks
+	vector<ThreadSample> threads;
+	DWORD thread_count;
+	ThreadSample* AddThread();
+
+	//Ranks the threads highest in the cause's value, leaving out ones at 0.
+	void RankThreads(bottleneck_causes cause, DWORD rank_count);
+
+	//Filled by CollectCgroups() through AddCgroup() and ranked the same way
+	vector<CgroupSample> cgroups;
+	DWORD cgroup_count;
+	CgroupSample* AddCgroup();
+	void RankCgroups(bottleneck_causes cause, DWORD rank_count);
+
+	//Set by LimitToCgroup(), sorted PIDs of the processes allowed to rank
+	vector<int> limit_PIDs;
+	bool limiting_PIDs;
+
+private:
+	//The highest slots seen so far, kept as a min-heap of rank_count slots
+	// with the lowest ranked at the root. One per worker, padded so workers do
+	// not write to the same cache line.
+	struct Candidates {
+		vector<DWORD> heap;
+		DWORD count;
+		char padding[64];
+	};
+
+	//Time a worker spent in each stage of RankSlots(), padded like Candidates.
+	struct WorkerTimings {
+		unsigned long long join;
+		unsigned long long rates;
+		unsigned long long select;
+		char padding[64];
+	};
+
+	static void RankSlots(void* context, DWORD worker, DWORD begin, DWORD end);
+	//True if the process in slot ranks above the one in other_slot, which may be -1.
+	//Ties go to the lower slot so the result does not depend on the threads.
+	bool Outranks(DWORD slot, int other_slot);
+	void PushCandidate(Candidates* candidates, DWORD slot);
+	void SiftDown(Candidates* candidates, DWORD position, DWORD slot);
+	void ResizeCandidates();
+
+	ProcessSamples sample_buffers[2];
+	PidIndex pid_indexes[2];
+
+	//State of the current RankProcesses()
+	bottleneck_causes ranking_cause;
+	bool ranking_joins;
+	int hot_core;
+	DWORD rank_count;
+	bool sample_all;
+	vector<Candidates> worker_candidates;
+	vector<WorkerTimings> worker_timings;
+	Candidates merged_candidates;
+	vector<DWORD> ranked;//Highest first
+	DWORD ranked_count;
+
+	//Set by RankThreads(), indexes of threads highest first
+	vector<DWORD> ranked_threads;
+	DWORD ranked_thread_count;
+
+	//Set by RankCgroups(), the same way
+	vector<DWORD> ranked_cgroups;
+	DWORD ranked_cgroup_count;
+
+	vector<wstring> interface_includes;
+	vector<wstring> interface_excludes;
+};
+
+//Creates the collector for the current platform. Must be deleted later.
+Collector* CreateCollector();
+
+#endif
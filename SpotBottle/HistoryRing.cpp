@@ -0,0 +1,243 @@
+#include "HistoryRing.h"
+#include "StringHelpers.h"
+#include <iostream>
+#include <atomic>
+#include <string.h>
+#ifndef _WIN32
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
+
+using namespace std;
+
+const char HISTORY_MAGIC[8] = { 'S', 'P', 'O', 'T', 'R', 'I', 'N', 'G' };
+const uint32_t HISTORY_VERSION = 2;
+const uint32_t HISTORY_NAME_CAPACITY = 16384;
+
+HistoryRing::HistoryRing() {
+	//Constructor
+	mapping = 0;
+	mapping_size = 0;
+#ifdef _WIN32
+	file_handle = INVALID_HANDLE_VALUE;
+	mapping_handle = 0;
+#else
+	file_descriptor = -1;
+#endif
+	header = 0;
+	name_entries = 0;
+	records = 0;
+	next_sequence = 1;
+	name_count = 0;
+}
+
+HistoryRing::~HistoryRing() {
+	Close();
+}
+
+bool HistoryRing::Open(const wchar_t* path, DWORD record_capacity, bool read_only) {
+	//Opens the ring file, creating it if it does not exist.
+	Close();
+	if (record_capacity < 1) record_capacity = 1;
+	uint64_t new_size = sizeof(Header) +
+		(uint64_t)HISTORY_NAME_CAPACITY * sizeof(NameEntry) +
+		(uint64_t)record_capacity * sizeof(HistoryRecord);
+	bool created = false;
+	if (!MapFile(path, new_size, read_only, &created)) {
+		wcout << "Could not open history file \"" << path << "\"" << endl;
+		return false;
+	}
+
+	header = (Header*)mapping;
+	if (created) {
+		memset(header, 0, sizeof(Header));
+		memcpy(header->magic, HISTORY_MAGIC, sizeof(HISTORY_MAGIC));
+		header->version = HISTORY_VERSION;
+		header->record_size = sizeof(HistoryRecord);
+		header->record_capacity = record_capacity;
+		header->name_size = sizeof(NameEntry);
+		header->name_capacity = HISTORY_NAME_CAPACITY;
+	}
+
+	//Check an existing file is a ring file of this layout
+	if ((mapping_size < sizeof(Header)) ||
+		(memcmp(header->magic, HISTORY_MAGIC, sizeof(HISTORY_MAGIC)) != 0) ||
+		(header->version != HISTORY_VERSION) ||
+		(header->record_size != sizeof(HistoryRecord)) ||
+		(header->name_size != sizeof(NameEntry)) ||
+		(header->record_capacity == 0) ||
+		(mapping_size < sizeof(Header) +
+			(uint64_t)header->name_capacity * sizeof(NameEntry) +
+			(uint64_t)header->record_capacity * sizeof(HistoryRecord))) {
+		wcout << "\"" << path << "\" is not a history file." << endl;
+		Close();
+		return false;
+	}
+	name_entries = (NameEntry*)(mapping + sizeof(Header));
+	records = (HistoryRecord*)(mapping + sizeof(Header) + (uint64_t)header->name_capacity * sizeof(NameEntry));
+
+	//Continue after the newest record
+	next_sequence = 1;
+	for (DWORD n = 0; n < header->record_capacity; ++n) {
+		if (records[n].sequence >= next_sequence) next_sequence = records[n].sequence + 1;
+	}
+	LoadNames();
+	return true;
+}
+
+void HistoryRing::Close() {
+	UnmapFile();
+	header = 0;
+	name_entries = 0;
+	records = 0;
+	next_sequence = 1;
+	names = NameTable();
+	name_count = 0;
+}
+
+#ifdef _WIN32
+
+bool HistoryRing::MapFile(const wchar_t* path, uint64_t new_size, bool read_only, bool* created) {
+	//Maps the whole file, creating it with new_size bytes if it is empty.
+	file_handle = CreateFileW(path,
+		read_only ? GENERIC_READ : (GENERIC_READ | GENERIC_WRITE),
+		FILE_SHARE_READ | FILE_SHARE_WRITE, 0,
+		read_only ? OPEN_EXISTING : OPEN_ALWAYS,
+		FILE_ATTRIBUTE_NORMAL, 0);
+	if (file_handle == INVALID_HANDLE_VALUE) return false;
+	LARGE_INTEGER existing_size;
+	if (GetFileSizeEx(file_handle, &existing_size) == 0) return false;
+	mapping_size = (uint64_t)existing_size.QuadPart;
+	if (mapping_size == 0) {
+		if (read_only) return false;
+		mapping_size = new_size;
+		*created = true;
+	}
+
+	//Mapping past the end extends the file
+	mapping_handle = CreateFileMappingW(file_handle, 0,
+		read_only ? PAGE_READONLY : PAGE_READWRITE,
+		(DWORD)(mapping_size >> 32), (DWORD)mapping_size, 0);
+	if (mapping_handle == 0) return false;
+	mapping = (char*)MapViewOfFile(mapping_handle, read_only ? FILE_MAP_READ : FILE_MAP_WRITE, 0, 0, (SIZE_T)mapping_size);
+	return mapping != 0;
+}
+
+void HistoryRing::UnmapFile() {
+	if (mapping != 0) UnmapViewOfFile(mapping);
+	if (mapping_handle != 0) CloseHandle(mapping_handle);
+	if (file_handle != INVALID_HANDLE_VALUE) CloseHandle(file_handle);
+	mapping = 0;
+	mapping_size = 0;
+	mapping_handle = 0;
+	file_handle = INVALID_HANDLE_VALUE;
+}
+
+#else
+
+bool HistoryRing::MapFile(const wchar_t* path, uint64_t new_size, bool read_only, bool* created) {
+	//Maps the whole file, creating it with new_size bytes if it is empty.
+	file_descriptor = open(NarrowString(path).c_str(), (read_only ? O_RDONLY : (O_RDWR | O_CREAT)) | O_CLOEXEC, 0644);
+	if (file_descriptor == -1) return false;
+	struct stat file_status;
+	if (fstat(file_descriptor, &file_status) == -1) return false;
+	mapping_size = (uint64_t)file_status.st_size;
+	if (mapping_size == 0) {
+		if (read_only) return false;
+		//Reserve the blocks now, so a full disk fails here instead of faulting
+		// on a later write through the mapping
+		if (posix_fallocate(file_descriptor, 0, (off_t)new_size) != 0) return false;
+		mapping_size = new_size;
+		*created = true;
+	}
+	void* address = mmap(0, (size_t)mapping_size, read_only ? PROT_READ : (PROT_READ | PROT_WRITE), MAP_SHARED, file_descriptor, 0);
+	if (address == MAP_FAILED) return false;
+	mapping = (char*)address;
+	return true;
+}
+
+void HistoryRing::UnmapFile() {
+	if (mapping != 0) munmap(mapping, (size_t)mapping_size);
+	if (file_descriptor != -1) close(file_descriptor);
+	mapping = 0;
+	mapping_size = 0;
+	file_descriptor = -1;
+}
+
+#endif
+
+void HistoryRing::LoadNames() {
+	//Names are added in order, so the table ids match the entries.
+	wchar_t wide_name[32];
+	for (name_count = 0; name_count < header->name_capacity; ++name_count) {
+		const NameEntry* entry = &name_entries[name_count];
+		if ((entry->length == 0) || (entry->length > 31)) break;
+		for (DWORD n = 0; n < entry->length; ++n) wide_name[n] = (wchar_t)entry->text[n];
+		wide_name[entry->length] = 0;
+		names.Intern(wide_name, entry->length);
+	}
+}
+
+uint32_t HistoryRing::AddName(const wchar_t* name, size_t length) {
+	//Returns the name's id, writing it to the table if it is new.
+	//Names are cut to 31 UTF-16 units, characters outside the BMP become '?'.
+	if (length == 0) return NO_NAME_ID;
+	if (length > 31) length = 31;
+	uint16_t units[31];
+	wchar_t wide_name[32];
+	for (size_t n = 0; n < length; ++n) {
+		wchar_t character = name[n];
+		if ((unsigned long)character > 0xFFFF) character = L'?';
+		units[n] = (uint16_t)character;
+		wide_name[n] = character;
+	}
+	wide_name[length] = 0;
+	DWORD name_id = names.Intern(wide_name, length);
+	if (name_id < name_count) return (name_id < header->name_capacity) ? name_id : NO_NAME_ID;
+
+	//New name, a full table leaves it unnamed
+	name_count = name_id + 1;
+	if (name_id >= header->name_capacity) return NO_NAME_ID;
+	NameEntry* entry = &name_entries[name_id];
+	memcpy(entry->text, units, length * sizeof(uint16_t));
+	atomic_signal_fence(memory_order_seq_cst);//Length last, the compiler may not reorder it
+	entry->length = (uint16_t)length;
+	return name_id;
+}
+
+void HistoryRing::Append(HistoryRecord* record, const wchar_t* name, size_t name_length) {
+	//Clears the old record's sequence first, so a crash part way through
+	// leaves a record that reads as invalid rather than a mix of two.
+	record->sequence = next_sequence;
+	record->name_id = AddName(name, name_length);
+	HistoryRecord* slot = &records[(next_sequence - 1) % header->record_capacity];
+	slot->sequence = 0;
+	atomic_signal_fence(memory_order_seq_cst);
+	HistoryRecord unsequenced = *record;
+	unsequenced.sequence = 0;
+	*slot = unsequenced;
+	atomic_signal_fence(memory_order_seq_cst);
+	slot->sequence = next_sequence;
+	++next_sequence;
+}
+
+DWORD HistoryRing::GetRecordCount() {
+	uint64_t written = next_sequence - 1;
+	if (written > header->record_capacity) return header->record_capacity;
+	return (DWORD)written;
+}
+
+const HistoryRecord* HistoryRing::GetRecord(DWORD n) {
+	//Returns the nth oldest record, or 0 if it was left half written.
+	uint64_t sequence = next_sequence - GetRecordCount() + n;
+	const HistoryRecord* record = &records[(sequence - 1) % header->record_capacity];
+	if (record->sequence != sequence) return 0;
+	return record;
+}
+
+const wchar_t* HistoryRing::GetName(uint32_t name_id) {
+	if ((name_id == NO_NAME_ID) || (name_id >= name_count)) return L"";
+	return names.GetName(name_id);
+}
@@ -0,0 +1,105 @@
+//Fixed-size binary history of samples in a memory-mapped ring file.
+
+#ifndef RESOURCEMONITOR_HISTORYRING_H
+#define RESOURCEMONITOR_HISTORYRING_H
+
+#include "Platform.h"
+#include "ProcessSamples.h"
+#include <stdint.h>
+
+//One sample, fixed width so the ring is an array of records.
+//sequence is written last, so a record is only valid once it is set. It
+// counts from 1, 0 marks an empty or half written record.
+struct HistoryRecord {
+	uint64_t sequence;
+	int64_t time;//Milliseconds since 1970-01-01 UTC
+	uint64_t interval_ns;//Measured time since the previous sample
+	double disk_pct;
+	double cpu_pct;
+	double ram_pct;
+	uint64_t recv_bytes;
+	uint64_t sent_bytes;
+	double process_value;//Value of the cause, CPU % summed over cores or bytes
+	uint32_t cause;//bottleneck_causes
+	int32_t PID;
+	uint32_t name_id;//In the ring file's name table, NO_NAME_ID if none
+	uint32_t processor_count;
+};
+
+const uint32_t NO_NAME_ID = 0xFFFFFFFF;
+
+//File layout: a header, a table of names, then the records.
+//The records and names are written through the mapping and the operating
+// system writes them back in the background, so the history survives the
+// program crashing without syncing every sample. Restarting on an existing
+// file continues after its newest record.
+class HistoryRing {
+public:
+	HistoryRing();//Constructor
+	~HistoryRing();
+
+	//Opens the ring file, creating it with room for record_capacity records if
+	// it does not exist. An existing file keeps its own capacity.
+	//read_only opens an existing file for reading only. Returns false on failure.
+	bool Open(const wchar_t* path, DWORD record_capacity, bool read_only);
+	void Close();
+
+	//Adds a record, overwriting the oldest once the ring is full.
+	//Sets record->sequence and record->name_id, adding the name to the table.
+	void Append(HistoryRecord* record, const wchar_t* name, size_t name_length);
+
+	//Records oldest first. GetRecord() returns 0 for a record left half
+	// written by a crash.
+	DWORD GetRecordCount();
+	const HistoryRecord* GetRecord(DWORD n);
+
+	//Null terminated, empty for NO_NAME_ID.
+	const wchar_t* GetName(uint32_t name_id);
+
+private:
+	struct Header {
+		char magic[8];
+		uint32_t version;
+		uint32_t record_size;
+		uint32_t record_capacity;
+		uint32_t name_size;
+		uint32_t name_capacity;
+		uint32_t reserved[9];
+	};
+
+	//Names are stored as UTF-16 so the file reads the same on every platform.
+	//length is written last, 0 marks an unused entry.
+	struct NameEntry {
+		uint16_t length;
+		uint16_t text[31];
+	};
+
+	bool MapFile(const wchar_t* path, uint64_t size, bool read_only, bool* created);
+	void UnmapFile();
+	void LoadNames();
+	uint32_t AddName(const wchar_t* name, size_t length);
+
+	char* mapping;
+	uint64_t mapping_size;
+#ifdef _WIN32
+	HANDLE file_handle;
+	HANDLE mapping_handle;
+#else
+	int file_descriptor;
+#endif
+
+	Header* header;
+	NameEntry* name_entries;
+	HistoryRecord* records;
+	uint64_t next_sequence;
+
+	//Names in the file, ids match the name table's entries
+	NameTable names;
+	DWORD name_count;
+
+	//Not copyable
+	HistoryRing(const HistoryRing&);
+	HistoryRing& operator=(const HistoryRing&);
+};
+
+#endif
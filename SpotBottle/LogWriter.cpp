@@ -0,0 +1,146 @@
+#include "LogWriter.h"
+#include "StringHelpers.h"
+#include <chrono>
+#ifndef _WIN32
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+using namespace std;
+
+//Queue bounds, past either new records are dropped
+const DWORD MAX_QUEUED_RECORDS = 4096;
+const size_t MAX_QUEUED_CHARS = 1024 * 1024;
+
+LogWriter::LogWriter() {
+	//Constructor
+	policy = flush_periodic;
+	flush_interval_ms = 1000;
+	flush_every = 1;
+	dropped_records = 0;
+	queued_records = 0;
+	stopping = false;
+	unflushed_records = 0;
+#ifdef _WIN32
+	sync_handle = INVALID_HANDLE_VALUE;
+#else
+	sync_descriptor = -1;
+#endif
+}
+
+LogWriter::~LogWriter() {
+	Close();
+}
+
+bool LogWriter::Open(const wchar_t* path, flush_policies new_policy, DWORD new_flush_interval_ms, DWORD new_flush_every) {
+	//Opens the file for appending and starts the writer thread.
+	Close();
+#ifdef _WIN32
+	file.open(path, ios::out | ios::app);
+	if (!file.is_open()) return false;
+	//FlushFileBuffers() needs write access
+	sync_handle = CreateFileW(path, GENERIC_WRITE, FILE_SHARE_READ | FILE_SHARE_WRITE, 0, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, 0);
+#else
+	file.open(NarrowString(path).c_str(), ios::out | ios::app);
+	if (!file.is_open()) return false;
+	sync_descriptor = open(NarrowString(path).c_str(), O_WRONLY | O_APPEND | O_CLOEXEC);
+#endif
+	policy = new_policy;
+	flush_interval_ms = (new_flush_interval_ms < 1) ? 1 : new_flush_interval_ms;
+	flush_every = (new_flush_every < 1) ? 1 : new_flush_every;
+
+	//Sized once, so queueing does not allocate
+	queued_text.reserve(MAX_QUEUED_CHARS);
+	batch_text.reserve(MAX_QUEUED_CHARS);
+	stopping = false;
+	writer_thread = thread(&LogWriter::ThreadMain, this);
+	return true;
+}
+
+void LogWriter::Close() {
+	//Writes out the queued records, flushes and stops the writer thread.
+	if (!writer_thread.joinable()) return;
+	{
+		lock_guard<mutex> guard(lock);
+		stopping = true;
+	}
+	wake_condition.notify_one();
+	writer_thread.join();
+	file.close();
+#ifdef _WIN32
+	if (sync_handle != INVALID_HANDLE_VALUE) CloseHandle(sync_handle);
+	sync_handle = INVALID_HANDLE_VALUE;
+#else
+	if (sync_descriptor != -1) close(sync_descriptor);
+	sync_descriptor = -1;
+#endif
+}
+
+bool LogWriter::Write(const wchar_t* text, size_t length) {
+	//Queues a record, dropping it if the queue is full.
+	bool wake_writer = false;
+	{
+		lock_guard<mutex> guard(lock);
+		if ((queued_records >= MAX_QUEUED_RECORDS) || (queued_text.size() + length > MAX_QUEUED_CHARS)) {
+			++dropped_records;
+			return false;
+		}
+		queued_text.insert(queued_text.end(), text, text + length);
+		++queued_records;
+
+		//Wake early when the queue is half full, or enough records need flushing
+		wake_writer = (queued_records >= MAX_QUEUED_RECORDS / 2) ||
+			(queued_text.size() >= MAX_QUEUED_CHARS / 2) ||
+			((policy == flush_every_n) && (unflushed_records + queued_records >= flush_every));
+	}
+	if (wake_writer) wake_condition.notify_one();
+	return true;
+}
+
+unsigned long long LogWriter::GetDroppedCount() {
+	return dropped_records;
+}
+
+void LogWriter::SyncFile() {
+	//The stream is flushed first, only data the OS has can be synced.
+	//fdatasync() skips the times but syncs the size the appends changed.
+#ifdef _WIN32
+	if (sync_handle != INVALID_HANDLE_VALUE) FlushFileBuffers(sync_handle);
+#else
+	if (sync_descriptor != -1) fdatasync(sync_descriptor);
+#endif
+}
+
+void LogWriter::ThreadMain() {
+	//Writes out the queue in batches until stopped.
+	unsigned long long last_flush_time = GetMonotonicNanoseconds();
+	while (true) {
+		bool stop = false;
+		{
+			unique_lock<mutex> guard(lock);
+			if (!stopping) wake_condition.wait_for(guard, chrono::milliseconds(flush_interval_ms));
+			queued_text.swap(batch_text);
+			unflushed_records += queued_records;
+			queued_records = 0;
+			stop = stopping;
+		}
+
+		//The slow part, done without holding the lock
+		if (batch_text.size() > 0) file.write(batch_text.data(), batch_text.size());
+		batch_text.clear();
+
+		unsigned long long now = GetMonotonicNanoseconds();
+		bool flush = stop;
+		if ((policy == flush_every_n) && (unflushed_records >= flush_every)) flush = true;
+		if ((policy == flush_periodic) && (unflushed_records > 0) &&
+			(now - last_flush_time >= flush_interval_ms * 1000000ULL)) flush = true;
+		if (flush) {
+			file.flush();
+			if (policy != flush_none) SyncFile();
+			lock_guard<mutex> guard(lock);
+			unflushed_records = 0;
+			last_flush_time = now;
+		}
+		if (stop) return;
+	}
+}
@@ -0,0 +1,79 @@
+//Writes the /L logfile from a background thread, so a slow disk does not
+// delay sampling.
+
+#ifndef RESOURCEMONITOR_LOGWRITER_H
+#define RESOURCEMONITOR_LOGWRITER_H
+
+#include "Platform.h"
+#include <atomic>
+#include <condition_variable>
+#include <fstream>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+using namespace std;
+
+//When written lines are flushed to the file
+enum flush_policies {flush_none, flush_periodic, flush_every_n};
+
+//Records are queued in a bounded buffer and the writer thread writes all that
+// are queued in one batch, at the flush interval or sooner when the queue
+// fills up. A full queue drops records rather than block the sampler.
+class LogWriter {
+public:
+	LogWriter();//Constructor
+	~LogWriter();
+
+	//Opens the file for appending and starts the writer thread.
+	//flush_periodic flushes every flush_interval_ms, flush_every_n after every
+	// flush_every records and flush_none leaves it to the file's buffer.
+	// A flush writes the lines through to the disk, not just the OS cache.
+	//Returns false if the file cannot be opened.
+	bool Open(const wchar_t* path, flush_policies policy, DWORD flush_interval_ms, DWORD flush_every);
+
+	//Writes out the queued records, flushes and stops the writer thread.
+	void Close();
+
+	//Queues a record of one or more lines. Returns false if it was dropped.
+	bool Write(const wchar_t* text, size_t length);
+
+	//Records dropped because the queue was full.
+	unsigned long long GetDroppedCount();
+
+private:
+	void ThreadMain();
+
+	//Waits for the flushed lines to reach the disk.
+	void SyncFile();
+
+	wofstream file;
+	//Second handle to the file, wofstream does not give its own
+#ifdef _WIN32
+	HANDLE sync_handle;
+#else
+	int sync_descriptor;
+#endif
+	thread writer_thread;
+	flush_policies policy;
+	DWORD flush_interval_ms;
+	DWORD flush_every;
+	atomic<unsigned long long> dropped_records;
+
+	//Guarded by lock. Queued text is swapped with the writer's batch.
+	mutex lock;
+	condition_variable wake_condition;
+	vector<wchar_t> queued_text;
+	DWORD queued_records;
+	DWORD unflushed_records;//Taken by the writer, not yet flushed
+	bool stopping;
+
+	//Only used by the writer thread
+	vector<wchar_t> batch_text;
+
+	//Not copyable
+	LogWriter(const LogWriter&);
+	LogWriter& operator=(const LogWriter&);
+};
+
+#endif
@@ -0,0 +1,95 @@
+#include "LoopStats.h"
+#include <iostream>
+#include <iomanip>
+#include <string.h>
+
+using namespace std;
+
+const wchar_t* STAGE_NAMES[STAGE_COUNT] = {
+	L"Counters", L"Cgroups", L"Fetch", L"Join", L"Rates", L"Select", L"Threads", L"Format", L"Output"
+};
+
+LatencyHistogram::LatencyHistogram() {
+	//Constructor
+	memset(counts, 0, sizeof(counts));
+	count = 0;
+	max = 0;
+}
+
+DWORD LatencyHistogram::GetBucket(unsigned long long value) {
+	//Buckets past the linear ones are 16 per power of two, indexed by the
+	// 4 bits after the highest set bit.
+	if (value < LINEAR_BUCKETS) return (DWORD)value;
+	DWORD highest_bit = 5;
+	while ((value >> (highest_bit + 1)) != 0) ++highest_bit;
+	DWORD sub_bucket = (DWORD)(value >> (highest_bit - 4)) & (SUB_BUCKETS - 1);
+	return LINEAR_BUCKETS + (highest_bit - 5) * SUB_BUCKETS + sub_bucket;
+}
+
+unsigned long long LatencyHistogram::GetBucketTop(DWORD bucket) {
+	if (bucket < LINEAR_BUCKETS) return bucket;
+	DWORD highest_bit = (bucket - LINEAR_BUCKETS) / SUB_BUCKETS + 5;
+	unsigned long long sub_bucket = (bucket - LINEAR_BUCKETS) % SUB_BUCKETS;
+	unsigned long long bottom = (1ULL << highest_bit) | (sub_bucket << (highest_bit - 4));
+	return bottom + (1ULL << (highest_bit - 4)) - 1;
+}
+
+void LatencyHistogram::Record(unsigned long long value) {
+	++counts[GetBucket(value)];
+	++count;
+	if (value > max) max = value;
+}
+
+unsigned long long LatencyHistogram::GetCount() {
+	return count;
+}
+
+unsigned long long LatencyHistogram::GetMax() {
+	return max;
+}
+
+unsigned long long LatencyHistogram::GetPercentile(double percentile) {
+	if (count == 0) return 0;
+	unsigned long long wanted = (unsigned long long)(count * percentile / 100.0 + 0.5);
+	if (wanted < 1) wanted = 1;
+	unsigned long long seen = 0;
+	for (DWORD bucket = 0; bucket < BUCKET_COUNT; ++bucket) {
+		seen += counts[bucket];
+		if (seen >= wanted) {
+			unsigned long long top = GetBucketTop(bucket);
+			return (top < max) ? top : max;
+		}
+	}
+	return max;
+}
+
+LoopStats::LoopStats() {
+	//Constructor
+	start_time = GetMonotonicNanoseconds();
+}
+
+void LoopStats::Record(loop_stages stage, unsigned long long nanoseconds) {
+	stages[stage].Record(nanoseconds);
+}
+
+void LoopStats::Print() {
+	//Microseconds, wide enough for a stage taking minutes
+	wcout << L"Stage         Ticks     p50 us     p99 us     max us" << endl;
+	wcout << fixed << setprecision(1);
+	for (DWORD stage = 0; stage < STAGE_COUNT; ++stage) {
+		wcout << left << setw(10) << STAGE_NAMES[stage] << right
+			<< setw(9) << stages[stage].GetCount()
+			<< setw(11) << stages[stage].GetPercentile(50.0) / 1000.0
+			<< setw(11) << stages[stage].GetPercentile(99.0) / 1000.0
+			<< setw(11) << stages[stage].GetMax() / 1000.0 << endl;
+	}
+
+	//CPU time as a percent of one core over the time running
+	double running_seconds = (GetMonotonicNanoseconds() - start_time) / 1000000000.0;
+	double cpu_seconds = GetOwnCpuNanoseconds() / 1000000000.0;
+	double cpu_pct = (running_seconds > 0.0) ? 100.0 * cpu_seconds / running_seconds : 0.0;
+	wcout << L"CPU time " << setprecision(2) << cpu_seconds << L" s (" << cpu_pct
+		<< L"% of a core), RSS " << GetOwnResidentBytes() / (1024.0 * 1024.0) << L" MB" << endl;
+	wcout.unsetf(ios::floatfield);
+	wcout << setprecision(6);
+}
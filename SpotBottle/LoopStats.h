@@ -0,0 +1,68 @@
+//Latency of each stage of the sampling loop, for /STATS.
+
+#ifndef RESOURCEMONITOR_LOOPSTATS_H
+#define RESOURCEMONITOR_LOOPSTATS_H
+
+#include "Platform.h"
+
+//Stages of one tick, in the order they run
+enum loop_stages {
+	stage_counters,//System-wide counters
+	stage_cgroups,//Leaf cgroup counters, for /CGROUPS
+	stage_fetch,//Raw per-process data
+	stage_join,//Finding each process in the previous tick, summed over threads
+	stage_rates,//Per-process values from the two ticks, summed over threads
+	stage_select,//Ranking the bottleneck processes
+	stage_threads,//Sampling the bottleneck process's threads, for /THREADS
+	stage_format,//Console and log text
+	stage_log,//Console output, queueing the log line, the /RING record and the /DAEMON snapshot
+	STAGE_COUNT
+};
+
+//Counts of values in buckets that grow with the value, so any percentile is
+// known to within 1/16th of it, like an HDR histogram. Fixed size, recording
+// never allocates.
+class LatencyHistogram {
+public:
+	LatencyHistogram();//Constructor
+
+	void Record(unsigned long long value);
+	unsigned long long GetCount();
+	unsigned long long GetMax();
+
+	//Returns the highest value in the bucket holding the percentile, at most
+	// the max. 0 with no values.
+	unsigned long long GetPercentile(double percentile);
+
+private:
+	//Values below 32 have a bucket each, then every power of two is split
+	// into 16 buckets
+	static const DWORD LINEAR_BUCKETS = 32;
+	static const DWORD SUB_BUCKETS = 16;
+	static const DWORD BUCKET_COUNT = LINEAR_BUCKETS + (64 - 5) * SUB_BUCKETS;
+
+	static DWORD GetBucket(unsigned long long value);
+	static unsigned long long GetBucketTop(DWORD bucket);
+
+	unsigned long long counts[BUCKET_COUNT];
+	unsigned long long count;
+	unsigned long long max;
+};
+
+//A histogram of every stage, in nanoseconds per tick.
+class LoopStats {
+public:
+	LoopStats();//Constructor
+
+	void Record(loop_stages stage, unsigned long long nanoseconds);
+
+	//Writes p50/p99/max of every stage, then this program's CPU time and
+	// resident memory.
+	void Print();
+
+private:
+	LatencyHistogram stages[STAGE_COUNT];
+	unsigned long long start_time;//Monotonic
+};
+
+#endif
@@ -0,0 +1,473 @@
+#ifdef _WIN32
+#include <winsock2.h>
+#include <ws2tcpip.h>
+#pragma comment(lib, "ws2_32.lib")
+#endif
+#include "MetricsServer.h"
+#include "StringHelpers.h"
+#include <iostream>
+#include <string.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <wchar.h>
+#ifndef _WIN32
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#endif
+
+using namespace std;
+
+#ifdef _WIN32
+const uintptr_t NO_SOCKET = (uintptr_t)INVALID_SOCKET;
+#else
+const int NO_SOCKET = -1;
+#endif
+
+//Connections with nothing read or sent for this long are closed
+const unsigned long long IDLE_CONNECTION_NS = 10000000000ULL;
+
+//How often the server thread checks for Close() and idle connections
+const DWORD SERVER_WAKE_MS = 250;
+
+MetricsServer::MetricsServer() {
+	//Constructor
+	for (DWORD n = 0; n < PAGE_COUNT; ++n) {
+		pages[n].length = 0;
+		pages[n].senders = 0;
+	}
+	current_page = -1;
+	stopping = false;
+	listen_socket = NO_SOCKET;
+#ifndef _WIN32
+	epoll_fd = -1;
+#endif
+}
+
+MetricsServer::~MetricsServer() {
+	Close();
+}
+
+bool MetricsServer::Open(const wchar_t* address) {
+	Close();
+	if (!Listen(address)) {
+		Close();
+		return false;
+	}
+	stopping = false;
+	server_thread = thread(&MetricsServer::ThreadMain, this);
+	return true;
+}
+
+void MetricsServer::Close() {
+	if (server_thread.joinable()) {
+		stopping = true;
+		server_thread.join();
+	}
+	for (DWORD slot = 0; slot < connections.size(); ++slot) {
+		if (connections[slot].socket != NO_SOCKET) CloseConnection(slot);
+	}
+	connections.clear();
+	free_slots.clear();
+	if (listen_socket != NO_SOCKET) CloseSocket(listen_socket);
+	listen_socket = NO_SOCKET;
+#ifdef _WIN32
+	WSACleanup();
+#else
+	if (epoll_fd != -1) close(epoll_fd);
+	epoll_fd = -1;
+	if (!unix_socket_path.empty()) unlink(unix_socket_path.data());
+#endif
+	unix_socket_path.clear();
+}
+
+static void AppendUtf8(wchar_t character, vector<char>* text, size_t* length) {
+	//Characters outside the BMP come as surrogate pairs on Windows, they are
+	// joined by the caller
+	unsigned long code = (unsigned long)character;
+	char bytes[4];
+	size_t count;
+	if (code < 0x80) {
+		bytes[0] = (char)code;
+		count = 1;
+	}
+	else if (code < 0x800) {
+		bytes[0] = (char)(0xC0 | (code >> 6));
+		bytes[1] = (char)(0x80 | (code & 0x3F));
+		count = 2;
+	}
+	else if (code < 0x10000) {
+		bytes[0] = (char)(0xE0 | (code >> 12));
+		bytes[1] = (char)(0x80 | ((code >> 6) & 0x3F));
+		bytes[2] = (char)(0x80 | (code & 0x3F));
+		count = 3;
+	}
+	else {
+		bytes[0] = (char)(0xF0 | ((code >> 18) & 0x07));
+		bytes[1] = (char)(0x80 | ((code >> 12) & 0x3F));
+		bytes[2] = (char)(0x80 | ((code >> 6) & 0x3F));
+		bytes[3] = (char)(0x80 | (code & 0x3F));
+		count = 4;
+	}
+	if (*length + count > text->size()) text->resize((*length + count) * 2);
+	memcpy(text->data() + *length, bytes, count);
+	*length += count;
+}
+
+void MetricsServer::Publish(const wchar_t* text, size_t length) {
+	//Only the page swap is under the lock, the text is converted outside it.
+	int page = -1;
+	{
+		lock_guard<mutex> guard(page_lock);
+		for (DWORD n = 0; n < PAGE_COUNT; ++n) {
+			if (((int)n != current_page) && (pages[n].senders == 0)) {
+				page = (int)n;
+				break;
+			}
+		}
+	}
+	if (page == -1) return;
+
+	Page* written = &pages[page];
+	written->length = 0;
+	for (size_t n = 0; n < length; ++n) {
+		wchar_t character = text[n];
+		if ((character >= 0xD800) && (character <= 0xDBFF) && (n + 1 < length) && (text[n + 1] >= 0xDC00) && (text[n + 1] <= 0xDFFF)) {
+			character = (wchar_t)(0x10000 + (((unsigned long)character - 0xD800) << 10) + ((unsigned long)text[n + 1] - 0xDC00));
+			++n;
+		}
+		AppendUtf8(character, &written->text, &written->length);
+	}
+
+	lock_guard<mutex> guard(page_lock);
+	current_page = page;
+}
+
+void MetricsServer::ThreadMain() {
+	while (!stopping) {
+		ServeEvents(SERVER_WAKE_MS);
+		CloseIdleConnections(GetMonotonicNanoseconds());
+	}
+}
+
+void MetricsServer::ReadRequest(DWORD slot) {
+	//Reads until the blank line ending the headers. Bodies are not expected,
+	// only the request line is looked at.
+	Connection* connection = &connections[slot];
+	char buffer[1024];
+	while (true) {
+		long bytes = recv(connection->socket, buffer, sizeof(buffer), 0);
+		if (bytes == 0) {
+			CloseConnection(slot);//Closed by the scraper
+			return;
+		}
+		if (bytes < 0) {
+#ifdef _WIN32
+			if (WSAGetLastError() == WSAEWOULDBLOCK) break;
+#else
+			if ((errno == EAGAIN) || (errno == EWOULDBLOCK)) break;
+			if (errno == EINTR) continue;
+#endif
+			CloseConnection(slot);
+			return;
+		}
+		connection->last_active = GetMonotonicNanoseconds();
+		size_t kept = sizeof(connection->request) - connection->request_length;
+		if (kept > (size_t)bytes) kept = (size_t)bytes;
+		memcpy(connection->request + connection->request_length, buffer, kept);
+		connection->request_length += kept;
+		for (long n = 0; n < bytes; ++n) {
+			memmove(connection->last_bytes, connection->last_bytes + 1, 3);
+			connection->last_bytes[3] = buffer[n];
+			if ((memcmp(connection->last_bytes, "\r\n\r\n", 4) == 0) || (memcmp(connection->last_bytes + 2, "\n\n", 2) == 0)) {
+				connection->request_ended = true;
+			}
+		}
+		if (connection->request_ended) break;
+	}
+	if (connection->request_ended) StartResponse(slot);
+}
+
+void MetricsServer::StartResponse(DWORD slot) {
+	//GET of / or /metrics gets the page, anything else a short error.
+	//The page is held until sent, so Publish() never writes over it.
+	Connection* connection = &connections[slot];
+	const char* request = connection->request;
+	size_t request_length = connection->request_length;
+	const char* status = "200 OK";
+	bool is_get = (request_length >= 4) && (memcmp(request, "GET ", 4) == 0);
+	const char* path = request + 4;
+	const char* path_end = is_get ? (const char*)memchr(path, ' ', request_length - 4) : 0;
+	size_t path_length = (path_end != 0) ? path_end - path : 0;
+	if (!is_get) status = "405 Method Not Allowed";
+	else if (!(((path_length == 1) && (path[0] == '/')) || ((path_length == 8) && (memcmp(path, "/metrics", 8) == 0)))) {
+		status = "404 Not Found";
+	}
+
+	connection->page = -1;
+	size_t content_length = 0;
+	if (strcmp(status, "200 OK") == 0) {
+		lock_guard<mutex> guard(page_lock);
+		if (current_page == -1) status = "503 Service Unavailable";//No sample yet
+		else {
+			connection->page = current_page;
+			++pages[current_page].senders;
+			content_length = pages[current_page].length;
+		}
+	}
+	int head_length = snprintf(connection->head, sizeof(connection->head),
+		"HTTP/1.0 %s\r\nContent-Type: text/plain; version=0.0.4; charset=utf-8\r\nContent-Length: %lu\r\nConnection: close\r\n\r\n",
+		status, (unsigned long)content_length);
+	connection->head_length = (head_length > 0) ? (size_t)head_length : 0;
+	connection->sent = 0;
+	connection->responding = true;
+	if (!WatchSocket(slot, true)) {
+		CloseConnection(slot);
+		return;
+	}
+	WriteResponse(slot);
+}
+
+void MetricsServer::WriteResponse(DWORD slot) {
+	//Sends what the socket takes now, the rest when it is writable again.
+	Connection* connection = &connections[slot];
+	const Page* page = (connection->page != -1) ? &pages[connection->page] : 0;
+	size_t total = connection->head_length + ((page != 0) ? page->length : 0);
+	while (connection->sent < total) {
+		const char* data;
+		size_t length;
+		if (connection->sent < connection->head_length) {
+			data = connection->head + connection->sent;
+			length = connection->head_length - connection->sent;
+		}
+		else {
+			data = page->text.data() + (connection->sent - connection->head_length);
+			length = total - connection->sent;
+		}
+#ifdef _WIN32
+		long bytes = send(connection->socket, data, (int)length, 0);
+		if (bytes < 0) {
+			if (WSAGetLastError() == WSAEWOULDBLOCK) return;
+			CloseConnection(slot);
+			return;
+		}
+#else
+		long bytes = send(connection->socket, data, length, MSG_NOSIGNAL);
+		if (bytes < 0) {
+			if ((errno == EAGAIN) || (errno == EWOULDBLOCK)) return;
+			if (errno == EINTR) continue;
+			CloseConnection(slot);
+			return;
+		}
+#endif
+		connection->sent += (size_t)bytes;
+		connection->last_active = GetMonotonicNanoseconds();
+	}
+	CloseConnection(slot);
+}
+
+void MetricsServer::CloseConnection(DWORD slot) {
+	Connection* connection = &connections[slot];
+	if (connection->page != -1) {
+		lock_guard<mutex> guard(page_lock);
+		--pages[connection->page].senders;
+	}
+	CloseSocket(connection->socket);
+	connection->socket = NO_SOCKET;
+	connection->page = -1;
+	free_slots.push_back(slot);
+}
+
+void MetricsServer::CloseIdleConnections(unsigned long long now) {
+	for (DWORD slot = 0; slot < connections.size(); ++slot) {
+		const Connection* connection = &connections[slot];
+		if ((connection->socket != NO_SOCKET) && (now - connection->last_active >= IDLE_CONNECTION_NS)) CloseConnection(slot);
+	}
+}
+
+void MetricsServer::AcceptConnections() {
+	//Takes every waiting connection. Past MAX_CONNECTIONS they are closed
+	// right away rather than left to queue.
+	while (true) {
+#ifdef _WIN32
+		SocketHandle accepted = (SocketHandle)accept((SOCKET)listen_socket, 0, 0);
+		if (accepted == NO_SOCKET) return;
+		u_long non_blocking = 1;
+		ioctlsocket((SOCKET)accepted, FIONBIO, &non_blocking);
+#else
+		SocketHandle accepted = accept4(listen_socket, 0, 0, SOCK_NONBLOCK | SOCK_CLOEXEC);
+		if (accepted == NO_SOCKET) {
+			if (errno == EINTR) continue;
+			return;
+		}
+#endif
+		if (free_slots.empty()) {
+			if (connections.size() >= MAX_CONNECTIONS) {
+				CloseSocket(accepted);
+				continue;
+			}
+			connections.resize(connections.size() + 1);
+			free_slots.push_back((DWORD)connections.size() - 1);
+		}
+		DWORD slot = free_slots.back();
+		free_slots.pop_back();
+		Connection* connection = &connections[slot];
+		connection->socket = accepted;
+		connection->responding = false;
+		connection->request_length = 0;
+		connection->request_ended = false;
+		memset(connection->last_bytes, 0, sizeof(connection->last_bytes));
+		connection->head_length = 0;
+		connection->page = -1;
+		connection->sent = 0;
+		connection->last_active = GetMonotonicNanoseconds();
+		if (!WatchSocket(slot, false)) CloseConnection(slot);
+	}
+}
+
+#ifdef _WIN32
+
+bool MetricsServer::Listen(const wchar_t* address) {
+	//Only TCP, on the loopback address
+	WSADATA winsock_data;
+	if (WSAStartup(MAKEWORD(2, 2), &winsock_data) != 0) return false;
+	wchar_t* port_end = 0;
+	unsigned long port = wcstoul(address, &port_end, 10);
+	if ((port_end == address) || (*port_end != 0) || (port == 0) || (port > 65535)) {
+		wcout << "Unix sockets are not supported on Windows, give a port number." << endl;
+		return false;
+	}
+	SOCKET socket_handle = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+	if (socket_handle == INVALID_SOCKET) return false;
+	listen_socket = (SocketHandle)socket_handle;
+	sockaddr_in socket_address;
+	memset(&socket_address, 0, sizeof(socket_address));
+	socket_address.sin_family = AF_INET;
+	socket_address.sin_port = htons((u_short)port);
+	socket_address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	if (bind(socket_handle, (sockaddr*)&socket_address, sizeof(socket_address)) != 0) return false;
+	if (listen(socket_handle, SOMAXCONN) != 0) return false;
+	u_long non_blocking = 1;
+	return ioctlsocket(socket_handle, FIONBIO, &non_blocking) == 0;
+}
+
+bool MetricsServer::WatchSocket(DWORD slot, bool writing) {
+	//The poll set is rebuilt from the connections every wait
+	return true;
+}
+
+void MetricsServer::CloseSocket(SocketHandle socket) {
+	closesocket((SOCKET)socket);
+}
+
+void MetricsServer::ServeEvents(DWORD timeout_ms) {
+	//WSAPoll over the listener and every open connection
+	polled_slots.clear();
+	for (DWORD slot = 0; slot < connections.size(); ++slot) {
+		if (connections[slot].socket != NO_SOCKET) polled_slots.push_back(slot);
+	}
+	size_t poll_count = polled_slots.size() + 1;
+	if (poll_buffer.size() < poll_count * sizeof(WSAPOLLFD)) poll_buffer.resize(poll_count * sizeof(WSAPOLLFD));
+	WSAPOLLFD* polled = (WSAPOLLFD*)poll_buffer.data();
+	polled[0].fd = (SOCKET)listen_socket;
+	polled[0].events = POLLRDNORM;
+	polled[0].revents = 0;
+	for (size_t n = 0; n < polled_slots.size(); ++n) {
+		const Connection* connection = &connections[polled_slots[n]];
+		polled[n + 1].fd = (SOCKET)connection->socket;
+		polled[n + 1].events = connection->responding ? POLLWRNORM : POLLRDNORM;
+		polled[n + 1].revents = 0;
+	}
+	if (WSAPoll(polled, (ULONG)poll_count, (INT)timeout_ms) <= 0) return;
+	for (size_t n = 0; n < polled_slots.size(); ++n) {
+		DWORD slot = polled_slots[n];
+		if (polled[n + 1].revents == 0) continue;
+		if (connections[slot].socket == NO_SOCKET) continue;
+		if (connections[slot].responding) WriteResponse(slot);
+		else ReadRequest(slot);
+	}
+	if (polled[0].revents != 0) AcceptConnections();
+}
+
+#else
+
+bool MetricsServer::Listen(const wchar_t* address) {
+	//A port number means TCP on the loopback address, anything else a path
+	epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+	if (epoll_fd == -1) return false;
+	wchar_t* port_end = 0;
+	unsigned long port = wcstoul(address, &port_end, 10);
+	if ((port_end != address) && (*port_end == 0)) {
+		if ((port == 0) || (port > 65535)) return false;
+		listen_socket = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+		if (listen_socket == NO_SOCKET) return false;
+		int reuse = 1;
+		setsockopt(listen_socket, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse));
+		sockaddr_in socket_address;
+		memset(&socket_address, 0, sizeof(socket_address));
+		socket_address.sin_family = AF_INET;
+		socket_address.sin_port = htons((uint16_t)port);
+		socket_address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+		if (bind(listen_socket, (sockaddr*)&socket_address, sizeof(socket_address)) != 0) return false;
+	}
+	else {
+		string path = NarrowString(address);
+		sockaddr_un socket_address;
+		memset(&socket_address, 0, sizeof(socket_address));
+		socket_address.sun_family = AF_UNIX;
+		if (path.length() >= sizeof(socket_address.sun_path)) return false;
+		memcpy(socket_address.sun_path, path.c_str(), path.length());
+		listen_socket = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+		if (listen_socket == NO_SOCKET) return false;
+
+		//A socket left by a run that was killed is replaced, other files are not
+		struct stat file_status;
+		if ((stat(path.c_str(), &file_status) == 0) && S_ISSOCK(file_status.st_mode)) unlink(path.c_str());
+		if (bind(listen_socket, (sockaddr*)&socket_address, sizeof(socket_address)) != 0) return false;
+		unix_socket_path.assign(path.c_str(), path.c_str() + path.length() + 1);
+	}
+	if (listen(listen_socket, SOMAXCONN) != 0) return false;
+	epoll_event event;
+	memset(&event, 0, sizeof(event));
+	event.events = EPOLLIN;
+	event.data.u32 = 0xFFFFFFFF;//The listener
+	return epoll_ctl(epoll_fd, EPOLL_CTL_ADD, listen_socket, &event) == 0;
+}
+
+bool MetricsServer::WatchSocket(DWORD slot, bool writing) {
+	//Level triggered, a connection waits for either reading or writing
+	epoll_event event;
+	memset(&event, 0, sizeof(event));
+	event.events = writing ? EPOLLOUT : EPOLLIN;
+	event.data.u32 = slot;
+	return epoll_ctl(epoll_fd, writing ? EPOLL_CTL_MOD : EPOLL_CTL_ADD, connections[slot].socket, &event) == 0;
+}
+
+void MetricsServer::CloseSocket(SocketHandle socket) {
+	//Closing removes it from the epoll set
+	close(socket);
+}
+
+void MetricsServer::ServeEvents(DWORD timeout_ms) {
+	epoll_event events[64];
+	int count = epoll_wait(epoll_fd, events, 64, (int)timeout_ms);
+	for (int n = 0; n < count; ++n) {
+		DWORD slot = events[n].data.u32;
+		if (slot == 0xFFFFFFFF) {
+			AcceptConnections();
+			continue;
+		}
+		//Closed by an earlier event of this wait
+		if ((slot >= connections.size()) || (connections[slot].socket == NO_SOCKET)) continue;
+		if (connections[slot].responding) WriteResponse(slot);
+		else ReadRequest(slot);
+	}
+}
+
+#endif
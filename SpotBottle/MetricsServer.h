@@ -0,0 +1,110 @@
+//Serves the latest tick as Prometheus text for /METRICS, from a background
+// thread so scrapes never wait on sampling or sampling on scrapes.
+
+#ifndef RESOURCEMONITOR_METRICSSERVER_H
+#define RESOURCEMONITOR_METRICSSERVER_H
+
+#include "Platform.h"
+#include <atomic>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+using namespace std;
+
+//One thread waits on every connection at once, with epoll on Linux and
+// WSAPoll on Windows, and answers any number of scrapers without threads of
+// their own. Each request gets the page published last, which is never
+// changed while a connection is sending it: Publish() writes a page no
+// connection holds, then makes it the current one.
+class MetricsServer {
+public:
+	MetricsServer();//Constructor
+	~MetricsServer();
+
+	//Listens on 127.0.0.1 if address is a port number, otherwise on a Unix
+	// socket at that path (Linux only). Starts the server thread.
+	//Returns false if it cannot listen.
+	bool Open(const wchar_t* address);
+
+	//Closes every connection and stops the server thread.
+	void Close();
+
+	//Replaces the page served. Skipped if every spare page is still being
+	// sent, slow scrapers get the page they asked for and the rest the
+	// newest one.
+	void Publish(const wchar_t* text, size_t length);
+
+private:
+#ifdef _WIN32
+	typedef uintptr_t SocketHandle;//SOCKET, without winsock2.h in every file
+#else
+	typedef int SocketHandle;
+#endif
+
+	//A published page as UTF-8
+	struct Page {
+		vector<char> text;
+		size_t length;
+		DWORD senders;//Connections sending it, guarded by page_lock
+	};
+
+	//States of a connection: reading the request, then writing the response.
+	struct Connection {
+		SocketHandle socket;//NO_SOCKET if the slot is free
+		bool responding;
+		char request[1024];//Only the start is kept, enough for the request line
+		size_t request_length;
+		bool request_ended;//A blank line was read
+		char last_bytes[4];//The last 4 bytes read, to find the blank line
+		char head[192];//Status line and headers
+		size_t head_length;
+		int page;//Sent after head, -1 for none
+		size_t sent;//Of head, then of the page
+		unsigned long long last_active;//Monotonic, idle ones are closed
+	};
+
+	void ThreadMain();
+	void AcceptConnections();
+	void ReadRequest(DWORD slot);
+	void StartResponse(DWORD slot);
+	void WriteResponse(DWORD slot);
+	void CloseConnection(DWORD slot);
+	void CloseIdleConnections(unsigned long long now);
+
+	//Platform parts
+	bool Listen(const wchar_t* address);
+	bool WatchSocket(DWORD slot, bool writing);
+	void CloseSocket(SocketHandle socket);
+	//Waits up to timeout_ms and handles what the sockets are ready for
+	void ServeEvents(DWORD timeout_ms);
+
+	static const DWORD PAGE_COUNT = 8;
+	static const DWORD MAX_CONNECTIONS = 1024;
+
+	Page pages[PAGE_COUNT];
+	int current_page;//-1 until the first Publish(), guarded by page_lock
+	mutex page_lock;
+
+	thread server_thread;
+	atomic<bool> stopping;
+	SocketHandle listen_socket;
+	vector<char> unix_socket_path;//Removed on Close(), empty for TCP
+
+	//Only used by the server thread. Slots are reused, so the event data can
+	// name a slot.
+	vector<Connection> connections;
+	vector<DWORD> free_slots;
+#ifdef _WIN32
+	vector<DWORD> polled_slots;//Slot of each polled socket after the listener
+	vector<char> poll_buffer;//WSAPOLLFD array
+#else
+	int epoll_fd;
+#endif
+
+	//Not copyable
+	MetricsServer(const MetricsServer&);
+	MetricsServer& operator=(const MetricsServer&);
+};
+
+#endif
@@ -0,0 +1,1092 @@
+#include "OutputFormat.h"
+#include "RollingStats.h"
+#include <math.h>
+#include <stdio.h>
+#include <string.h>
+#include <wchar.h>
+#include <ctime>
+
+using namespace std;
+
+const double DECIMAL_SCALES[10] = {1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9};
+const unsigned long long DECIMAL_DIVISORS[10] = {1ULL, 10ULL, 100ULL, 1000ULL, 10000ULL,
+	100000ULL, 1000000ULL, 10000000ULL, 100000000ULL, 1000000000ULL};
+
+LineBuffer::LineBuffer() {
+	//Constructor
+	text.resize(1024);
+	text[0] = 0;
+	length = 0;
+}
+
+void LineBuffer::Clear() {
+	//Keeps the buffer for the next tick.
+	length = 0;
+	text[0] = 0;
+}
+
+const wchar_t* LineBuffer::GetText() const {
+	return text.data();
+}
+
+size_t LineBuffer::GetLength() const {
+	return length;
+}
+
+void LineBuffer::Reserve(size_t extra) {
+	//Room for extra characters and the null, doubling so growth is rare.
+	if (length + extra + 1 <= text.size()) return;
+	size_t new_size = text.size() * 2;
+	if (new_size < length + extra + 1) new_size = length + extra + 1;
+	text.resize(new_size);
+}
+
+void LineBuffer::Append(const wchar_t* append_text, size_t append_length) {
+	Reserve(append_length);
+	if (append_length > 0) memcpy(&text[length], append_text, append_length * sizeof(wchar_t));
+	length += append_length;
+	text[length] = 0;
+}
+
+void LineBuffer::Append(const wchar_t* append_text) {
+	Append(append_text, wcslen(append_text));
+}
+
+void LineBuffer::Append(wchar_t character) {
+	Reserve(1);
+	text[length++] = character;
+	text[length] = 0;
+}
+
+void LineBuffer::AppendSpaces(size_t count) {
+	Reserve(count);
+	for (size_t n = 0; n < count; ++n) text[length++] = L' ';
+	text[length] = 0;
+}
+
+void LineBuffer::AppendUnsigned(unsigned long long value) {
+	//Digits are written backwards from the end of a buffer big enough for 2^64
+	wchar_t digits[20];
+	size_t start = 20;
+	do {
+		digits[--start] = (wchar_t)(L'0' + value % 10);
+		value /= 10;
+	} while (value != 0);
+	Append(&digits[start], 20 - start);
+}
+
+void LineBuffer::AppendSigned(long long value) {
+	if (value < 0) {
+		Append(L'-');
+		AppendUnsigned(0ULL - (unsigned long long)value);
+	}
+	else AppendUnsigned((unsigned long long)value);
+}
+
+void LineBuffer::AppendFixed(double value, DWORD decimals, size_t width) {
+	//Rounds in fixed point, which matches swprintf for the percentages and
+	// rates shown. Values too big for 64 bits and NaN are left to swprintf.
+	if (decimals > 9) decimals = 9;
+	double scaled = fabs(value) * DECIMAL_SCALES[decimals];
+	if (!(scaled < 9.0e18)) {
+		wchar_t fallback[512];
+		swprintf(fallback, 512, L"%*.*f", (int)width, (int)decimals, value);
+		Append(fallback);
+		return;
+	}
+	unsigned long long whole = (unsigned long long)scaled;
+	double fraction = scaled - (double)whole;
+	if ((fraction > 0.5) || ((fraction == 0.5) && ((whole & 1) != 0))) ++whole;
+
+	//Backwards again: decimals, the point, the integer part, the sign
+	wchar_t digits[32];
+	size_t start = 32;
+	unsigned long long integer_part = whole / DECIMAL_DIVISORS[decimals];
+	unsigned long long decimal_part = whole % DECIMAL_DIVISORS[decimals];
+	for (DWORD n = 0; n < decimals; ++n) {
+		digits[--start] = (wchar_t)(L'0' + decimal_part % 10);
+		decimal_part /= 10;
+	}
+	if (decimals > 0) digits[--start] = L'.';
+	do {
+		digits[--start] = (wchar_t)(L'0' + integer_part % 10);
+		integer_part /= 10;
+	} while (integer_part != 0);
+	if (signbit(value)) digits[--start] = L'-';
+
+	size_t digit_count = 32 - start;
+	if (width > digit_count) AppendSpaces(width - digit_count);
+	Append(&digits[start], digit_count);
+}
+
+void LineBuffer::AppendJsonString(const wchar_t* append_text, size_t append_length) {
+	Append(L'"');
+	for (size_t n = 0; n < append_length; ++n) {
+		wchar_t character = append_text[n];
+		if (character == L'"') Append(L"\\\"", 2);
+		else if (character == L'\\') Append(L"\\\\", 2);
+		else if (character == L'\n') Append(L"\\n", 2);
+		else if (character == L'\r') Append(L"\\r", 2);
+		else if (character == L'\t') Append(L"\\t", 2);
+		else if (character < 0x20) {
+			const wchar_t hex_digits[] = L"0123456789abcdef";
+			Append(L"\\u00", 4);
+			Append(hex_digits[(character >> 4) & 0xF]);
+			Append(hex_digits[character & 0xF]);
+		}
+		else Append(character);
+	}
+	Append(L'"');
+}
+
+void LineBuffer::AppendCsvField(const wchar_t* append_text, size_t append_length) {
+	bool needs_quotes = false;
+	for (size_t n = 0; n < append_length; ++n) {
+		wchar_t character = append_text[n];
+		if ((character == L',') || (character == L'"') || (character == L'\n') || (character == L'\r')) {
+			needs_quotes = true;
+			break;
+		}
+	}
+	if (!needs_quotes) {
+		Append(append_text, append_length);
+		return;
+	}
+	Append(L'"');
+	for (size_t n = 0; n < append_length; ++n) {
+		if (append_text[n] == L'"') Append(L'"');
+		Append(append_text[n]);
+	}
+	Append(L'"');
+}
+
+const wchar_t* GetCauseName(bottleneck_causes cause) {
+	if (cause == cpu) return L"CPU";
+	if (cause == tio) return L"TIO";
+	if (cause == wio) return L"WIO";
+	if (cause == rio) return L"RIO";
+	if (cause == core) return L"CORE";
+	if (cause == mem) return L"MEM";
+	return L"";
+}
+
+void AppendCauseValue(bottleneck_causes cause, const BottleneckProcess* process, DWORD processor_count, LineBuffer* text) {
+	//CPU% of the whole machine with decimals, of one core for CORE, I/O in
+	// bytes per second
+	if (cause == cpu) text->AppendFixed(process->cpu / processor_count, 2);
+	else if (cause == core) text->AppendFixed(process->cpu, 2);
+	else if (cause == tio) text->AppendSigned(process->tio);
+	else if (cause == wio) text->AppendSigned(process->wio);
+	else if (cause == rio) text->AppendSigned(process->rio);
+	else if (cause == mem) text->AppendSigned(process->faults);
+}
+
+void AppendCauseText(bottleneck_causes cause, const BottleneckProcess* process, DWORD processor_count, bool show_io_value, LineBuffer* text) {
+	//Formats the bottleneck cause with the process's value, like "CPU:45%".
+	//I/O values are only shown when listing the top processes.
+	if (cause == none) return;
+	text->Append(GetCauseName(cause));
+	text->Append(L':');
+	if (cause == cpu) {
+		text->AppendFixed(process->cpu / processor_count, 0);
+		text->Append(L'%');
+	}
+	else if (cause == core) {
+		text->AppendFixed(process->cpu, 0);
+		text->Append(L'%');
+	}
+	else if (show_io_value) AppendCauseValue(cause, process, processor_count, text);
+}
+
+void AppendNameText(const BottleneckProcess* process, LineBuffer* text) {
+	text->Append(process->name.c_str(), process->name.length());
+	if (process->PID != 0) {
+		text->Append(L'_');
+		text->AppendSigned(process->PID);
+	}
+}
+
+void AppendDurationText(unsigned long long nanoseconds, LineBuffer* text) {
+	const unsigned long long second = 1000000000ULL;
+	if ((nanoseconds >= 3600 * second) && (nanoseconds % (3600 * second) == 0)) {
+		text->AppendUnsigned(nanoseconds / (3600 * second));
+		text->Append(L'h');
+	}
+	else if ((nanoseconds >= 60 * second) && (nanoseconds % (60 * second) == 0)) {
+		text->AppendUnsigned(nanoseconds / (60 * second));
+		text->Append(L'm');
+	}
+	else if (nanoseconds % second == 0) {
+		text->AppendUnsigned(nanoseconds / second);
+		text->Append(L's');
+	}
+	else {
+		text->AppendFixed(nanoseconds / (double)second, 3);
+		text->Append(L's');
+	}
+}
+
+void AppendScaledBytes(unsigned long long bytes, LineBuffer* text) {
+	const wchar_t units[] = L"KMGTP";
+	if (bytes < 1024) {
+		text->AppendUnsigned(bytes);
+		text->Append(L'B');
+		return;
+	}
+	double scaled = bytes / 1024.0;
+	DWORD unit = 0;
+	while ((scaled >= 1024.0) && (unit < 4)) {
+		scaled /= 1024.0;
+		++unit;
+	}
+	text->AppendFixed(scaled, 1);
+	text->Append(units[unit]);
+}
+
+void AppendDiskLines(const OutputTick* tick, bool tabs, LineBuffer* text) {
+	//One line per physical disk. Saturated disks are marked, with a "*" at
+	// the start of the smart layout's line and SATURATED at the end of TSV's.
+	for (DWORD n = 0; n < tick->disk_count; ++n) {
+		const DiskSample* disk = &tick->disks[n];
+		bool saturated = DiskIsSaturated(disk->await_ms, disk->queue_depth);
+		if (tabs) {
+			text->Append(L"Disk\t");
+			text->Append(disk->name.c_str(), disk->name.length());
+			text->Append(L'\t');
+			text->AppendFixed(disk->busy_pct, 2);
+			text->Append(L'\t');
+			text->AppendFixed(disk->read_iops, 0);
+			text->Append(L'\t');
+			text->AppendFixed(disk->write_iops, 0);
+			text->Append(L'\t');
+			text->AppendUnsigned(disk->read_bytes);
+			text->Append(L'\t');
+			text->AppendUnsigned(disk->write_bytes);
+			text->Append(L'\t');
+			text->AppendFixed(disk->await_ms, 2);
+			text->Append(L'\t');
+			text->AppendFixed(disk->queue_depth, 2);
+			text->Append(L'\t');
+			if (saturated) text->Append(L"SATURATED");
+			text->Append(L'\n');
+			continue;
+		}
+		text->Append(saturated ? L"* " : L"  ");
+		text->Append(disk->name.c_str(), disk->name.length());
+		text->AppendSpaces((disk->name.length() < 10) ? 10 - disk->name.length() : 1);
+		text->AppendFixed(disk->busy_pct, 0, 4);
+		text->Append(L"%  r ");
+		text->AppendFixed(disk->read_iops, 0);
+		text->Append(L"/s ");
+		AppendScaledBytes(disk->read_bytes, text);
+		text->Append(L"/s  w ");
+		text->AppendFixed(disk->write_iops, 0);
+		text->Append(L"/s ");
+		AppendScaledBytes(disk->write_bytes, text);
+		text->Append(L"/s  await ");
+		text->AppendFixed(disk->await_ms, 2);
+		text->Append(L"ms  queue ");
+		text->AppendFixed(disk->queue_depth, 2);
+		text->Append(L'\n');
+	}
+}
+
+void AppendInterfaceLines(const OutputTick* tick, bool tabs, LineBuffer* text) {
+	//One line per included network interface, marked like the disks.
+	//Link speeds are in bits per second, the traffic in bytes.
+	for (DWORD n = 0; n < tick->interface_count; ++n) {
+		const InterfaceSample* network_interface = &tick->interfaces[n];
+		bool saturated = LinkIsSaturated(network_interface->recv_pct, network_interface->sent_pct);
+		if (tabs) {
+			text->Append(L"Net\t");
+			text->Append(network_interface->name.c_str(), network_interface->name.length());
+			text->Append(L'\t');
+			text->AppendUnsigned(network_interface->recv_bytes);
+			text->Append(L'\t');
+			text->AppendUnsigned(network_interface->sent_bytes);
+			text->Append(L'\t');
+			text->AppendUnsigned(network_interface->speed);
+			text->Append(L'\t');
+			text->AppendFixed(network_interface->recv_pct, 2);
+			text->Append(L'\t');
+			text->AppendFixed(network_interface->sent_pct, 2);
+			text->Append(L'\t');
+			if (saturated) text->Append(L"SATURATED");
+			text->Append(L'\n');
+			continue;
+		}
+		text->Append(saturated ? L"* " : L"  ");
+		text->Append(network_interface->name.c_str(), network_interface->name.length());
+		text->AppendSpaces((network_interface->name.length() < 10) ? 10 - network_interface->name.length() : 1);
+		text->Append(L"down ");
+		AppendScaledBytes(network_interface->recv_bytes, text);
+		text->Append(L"/s  up ");
+		AppendScaledBytes(network_interface->sent_bytes, text);
+		text->Append(L"/s  link ");
+		if (network_interface->speed == 0) {
+			text->Append(L"unknown\n");
+			continue;
+		}
+		text->AppendUnsigned(network_interface->speed / 1000000);
+		text->Append(L"Mb/s  down ");
+		text->AppendFixed(network_interface->recv_pct, 0);
+		text->Append(L"%  up ");
+		text->AppendFixed(network_interface->sent_pct, 0);
+		text->Append(L"%\n");
+	}
+}
+
+void AppendThreadLines(const OutputTick* tick, bool tabs, LineBuffer* text) {
+	//One line per top thread of the bottleneck process. CPU% is of one core,
+	// since a thread runs on one at a time.
+	for (DWORD rank = 0; rank < tick->thread_count; ++rank) {
+		const ThreadSample* thread = &tick->threads[rank];
+		if (tabs) {
+			text->Append(L"Thread\t");
+			text->Append(thread->name.c_str(), thread->name.length());
+			text->Append(L'\t');
+			text->AppendSigned(thread->TID);
+			text->Append(L'\t');
+			text->AppendFixed(thread->cpu, 2);
+			text->Append(L'\t');
+			text->AppendSigned(thread->rio);
+			text->Append(L'\t');
+			text->AppendSigned(thread->wio);
+			text->Append(L'\t');
+			text->AppendSigned(thread->faults);
+			text->Append(L'\n');
+			continue;
+		}
+		text->Append(L"  Thread  ");
+		text->AppendFixed(thread->cpu, 0, 4);
+		text->Append(L"%  r ");
+		AppendScaledBytes((unsigned long long)thread->rio, text);
+		text->Append(L"/s  w ");
+		AppendScaledBytes((unsigned long long)thread->wio, text);
+		text->Append(L"/s  faults ");
+		text->AppendSigned(thread->faults);
+		text->Append(L"/s  ");
+		text->Append(thread->name.c_str(), thread->name.length());
+		text->Append(L'_');
+		text->AppendSigned(thread->TID);
+		text->Append(L'\n');
+	}
+}
+
+void AppendCgroupLines(const OutputTick* tick, bool tabs, LineBuffer* text) {
+	//One line per top cgroup, CPU% of the whole machine like the processes'.
+	for (DWORD rank = 0; rank < tick->cgroup_count; ++rank) {
+		const CgroupSample* cgroup = &tick->cgroups[rank];
+		if (tabs) {
+			text->Append(L"Cgroup\t");
+			text->Append(cgroup->name.c_str(), cgroup->name.length());
+			text->Append(L'\t');
+			text->AppendFixed(cgroup->cpu / tick->processor_count, 2);
+			text->Append(L'\t');
+			text->AppendSigned(cgroup->rio);
+			text->Append(L'\t');
+			text->AppendSigned(cgroup->wio);
+			text->Append(L'\t');
+			text->AppendUnsigned(cgroup->memory);
+			text->Append(L'\n');
+			continue;
+		}
+		text->Append(L"  Cgroup  ");
+		text->AppendFixed(cgroup->cpu / tick->processor_count, 0, 4);
+		text->Append(L"%  r ");
+		AppendScaledBytes((unsigned long long)cgroup->rio, text);
+		text->Append(L"/s  w ");
+		AppendScaledBytes((unsigned long long)cgroup->wio, text);
+		text->Append(L"/s  mem ");
+		AppendScaledBytes(cgroup->memory, text);
+		text->Append(L"  ");
+		text->Append(cgroup->name.c_str(), cgroup->name.length());
+		text->Append(L'\n');
+	}
+}
+
+//Names of the pressure_resources in the layouts
+const wchar_t* PRESSURE_NAMES[PRESSURE_COUNT] = {L"CPU", L"IO", L"MEM"};
+const wchar_t* PRESSURE_KEYS[PRESSURE_COUNT] = {L"cpu", L"io", L"memory"};
+
+void AppendPressureFields(const OutputTick* tick, wchar_t separator, LineBuffer* text) {
+	//The "some" stall percent of each resource, empty where unavailable
+	for (DWORD resource = 0; resource < PRESSURE_COUNT; ++resource) {
+		text->Append(separator);
+		if ((tick->pressure != 0) && tick->pressure[resource].available) text->AppendFixed(tick->pressure[resource].some_pct, 2);
+	}
+}
+
+void AppendPressureLine(const OutputTick* tick, LineBuffer* text) {
+	//One line under the tick in the smart layout, "full" after IO and MEM
+	if (tick->pressure == 0) return;
+	bool started = false;
+	for (DWORD resource = 0; resource < PRESSURE_COUNT; ++resource) {
+		const PressureSample* pressure = &tick->pressure[resource];
+		if (!pressure->available) continue;
+		text->Append(started ? L"  " : L"  Stalled   ");
+		started = true;
+		text->Append(PRESSURE_NAMES[resource]);
+		text->Append(L' ');
+		text->AppendFixed(pressure->some_pct, 1);
+		text->Append(L'%');
+		if (resource != pressure_cpu) {
+			text->Append(L" (full ");
+			text->AppendFixed(pressure->full_pct, 1);
+			text->Append(L"%)");
+		}
+	}
+	if (started) text->Append(L'\n');
+}
+
+//Row names of the summary table, by rolling_metrics
+const wchar_t* METRIC_NAMES[METRIC_COUNT] = {L"Disk%", L"Download", L"Upload", L"CPU%", L"RAM%"};
+
+void AppendSummaryTable(const WindowSummary* summary, bool tabs, LineBuffer* text) {
+	//A title line, then a row of every statistic per value. Percentages have
+	// decimals, bytes per second do not.
+	text->Append(L"Last ");
+	AppendDurationText(summary->length, text);
+	text->Append(L" (");
+	text->AppendUnsigned(summary->sample_count);
+	text->Append(L" samples)\n");
+	const wchar_t* column_names[6] = {L"Min", L"Mean", L"p50", L"p95", L"p99", L"Max"};
+	if (tabs) {
+		for (DWORD column = 0; column < 6; ++column) {
+			text->Append(L'\t');
+			text->Append(column_names[column]);
+		}
+	}
+	else {
+		text->AppendSpaces(9);
+		for (DWORD column = 0; column < 6; ++column) {
+			text->AppendSpaces(11 - wcslen(column_names[column]));
+			text->Append(column_names[column]);
+		}
+	}
+	text->Append(L'\n');
+	for (DWORD metric = 0; metric < METRIC_COUNT; ++metric) {
+		const MetricSummary* values = &summary->metrics[metric];
+		double columns[6] = {values->min, values->mean, values->p50, values->p95, values->p99, values->max};
+		DWORD decimals = ((metric == metric_recv) || (metric == metric_sent)) ? 0 : 2;
+		text->Append(METRIC_NAMES[metric]);
+		if (!tabs) text->AppendSpaces(9 - wcslen(METRIC_NAMES[metric]));
+		for (DWORD column = 0; column < 6; ++column) {
+			if (tabs) text->Append(L'\t');
+			text->AppendFixed(columns[column], decimals, tabs ? 0 : 11);
+		}
+		text->Append(L'\n');
+	}
+}
+
+static void AppendPrometheusLabel(const wchar_t* text, size_t length, LineBuffer* buffer) {
+	//Quoted, with backslash, quote and line feed escaped
+	buffer->Append(L'"');
+	for (size_t n = 0; n < length; ++n) {
+		if (text[n] == L'\\') buffer->Append(L"\\\\", 2);
+		else if (text[n] == L'"') buffer->Append(L"\\\"", 2);
+		else if (text[n] == L'\n') buffer->Append(L"\\n", 2);
+		else buffer->Append(text[n]);
+	}
+	buffer->Append(L'"');
+}
+
+static void AppendPrometheusGauge(const wchar_t* name, const wchar_t* help, double value, DWORD decimals, LineBuffer* text) {
+	text->Append(L"# HELP ");
+	text->Append(name);
+	text->Append(L' ');
+	text->Append(help);
+	text->Append(L"\n# TYPE ");
+	text->Append(name);
+	text->Append(L" gauge\n");
+	text->Append(name);
+	text->Append(L' ');
+	text->AppendFixed(value, decimals);
+	text->Append(L'\n');
+}
+
+void AppendPrometheusText(const OutputTick* tick, LineBuffer* text) {
+	AppendPrometheusGauge(L"spotbottle_disk_busy_percent", L"Percent disk time of the busiest physical disk.", tick->disk_pct, 2, text);
+	AppendPrometheusGauge(L"spotbottle_receive_bytes_per_second", L"Bytes downloaded per second on the counted network interfaces.", (double)tick->recv_bytes, 0, text);
+	AppendPrometheusGauge(L"spotbottle_transmit_bytes_per_second", L"Bytes uploaded per second on the counted network interfaces.", (double)tick->sent_bytes, 0, text);
+	AppendPrometheusGauge(L"spotbottle_cpu_percent", L"Percent processor time of the whole machine.", tick->cpu_pct, 2, text);
+	AppendPrometheusGauge(L"spotbottle_ram_percent", L"Percent physical memory used.", tick->ram_pct, 2, text);
+	AppendPrometheusGauge(L"spotbottle_sample_timestamp_seconds", L"Time of the sample, seconds since 1970.", tick->time / 1000000000.0, 3, text);
+	if (tick->interval_ns != 0) {
+		AppendPrometheusGauge(L"spotbottle_interval_seconds", L"Interval the sample was taken at, chosen by /T min max.", tick->interval_ns / 1000000000.0, 4, text);
+	}
+
+	//Every cause is listed, so queries can tell a change of cause from a gap
+	const bottleneck_causes causes[] = {cpu, core, tio, rio, wio, mem};
+	text->Append(L"# HELP spotbottle_bottleneck 1 for the cause of the bottleneck, 0 for the others.\n"
+		L"# TYPE spotbottle_bottleneck gauge\n");
+	for (DWORD n = 0; n < sizeof(causes) / sizeof(causes[0]); ++n) {
+		text->Append(L"spotbottle_bottleneck{cause=\"");
+		text->Append(GetCauseName(causes[n]));
+		text->Append((tick->cause == causes[n]) ? L"\"} 1\n" : L"\"} 0\n");
+	}
+
+	//Values as in the CSV layout's value column
+	text->Append(L"# HELP spotbottle_top_process Value of the cause for the top processes: CPU% of the machine, "
+		L"CPU% of one core for CORE, bytes per second for I/O, major faults per second for MEM.\n"
+		L"# TYPE spotbottle_top_process gauge\n");
+	if (tick->cause == none) return;
+	for (DWORD rank = 0; rank < tick->process_count; ++rank) {
+		const BottleneckProcess* process = &tick->processes[rank];
+		text->Append(L"spotbottle_top_process{rank=\"");
+		text->AppendUnsigned(rank + 1);
+		text->Append(L"\",cause=\"");
+		text->Append(GetCauseName(tick->cause));
+		text->Append(L"\",process=");
+		AppendPrometheusLabel(process->name.c_str(), process->name.length(), text);
+		text->Append(L",pid=\"");
+		text->AppendSigned(process->PID);
+		text->Append(L"\"} ");
+		AppendCauseValue(tick->cause, process, tick->processor_count, text);
+		text->Append(L'\n');
+	}
+}
+
+OutputEncoder::~OutputEncoder() {
+}
+
+//Widest of the last few values, so columns only shift after a wide value has
+// been gone for a while.
+class WidthHistory {
+public:
+	WidthHistory() {
+		//Constructor
+		pushed = 0;
+	}
+
+	void Push(size_t width) {
+		widths.Push(pushed, (double)width);
+		++pushed;
+		if (pushed > HISTORY_SIZE) widths.Expire(pushed - HISTORY_SIZE);
+	}
+
+	size_t GetLargest() {
+		return (size_t)widths.Get();
+	}
+
+	//Forgets every value but this one
+	void Reset(size_t width) {
+		widths.Clear();
+		Push(width);
+	}
+
+private:
+	static const unsigned long long HISTORY_SIZE = 11;
+	MonotonicQueue widths;
+	unsigned long long pushed;
+};
+
+//Columns aligned for an 80 character console, the default layout.
+class SmartEncoder : public OutputEncoder {
+public:
+	SmartEncoder(bool show_interval) {
+		//Constructor
+		this->show_interval = show_interval;
+	}
+
+	void EncodeHeader(LineBuffer* text) {
+		text->Append(L"Disk%  Download\tUpload\tCPU%   Process\t\tRAM%");
+		if (show_interval) text->Append(L"   Interval");
+		text->Append(L'\n');
+	}
+
+	void EncodeTick(const OutputTick* tick, LineBuffer* text) {
+		//Format the pieces, their widths decide the spacing
+		disk_text.Clear();
+		disk_text.AppendFixed(tick->disk_pct, 2, 5);
+		download_text.Clear();
+		download_text.AppendUnsigned(tick->recv_bytes);
+		upload_text.Clear();
+		upload_text.AppendUnsigned(tick->sent_bytes);
+		cpu_text.Clear();
+		cpu_text.AppendFixed(tick->cpu_pct, 2, 5);
+		ram_text.Clear();
+		ram_text.AppendFixed(tick->ram_pct, 2, 5);
+		if (show_interval) {
+			ram_text.AppendSpaces(2);
+			AppendDurationText(tick->interval_ns, &ram_text);
+		}
+		cause_text.Clear();
+		name_text.Clear();
+		if (tick->process_count > 0) {
+			AppendCauseText(tick->cause, &tick->processes[0], tick->processor_count, tick->show_io_value, &cause_text);
+			AppendNameText(&tick->processes[0], &name_text);
+		}
+
+		//Assume lengths after the pieces
+		size_t after_disk = (disk_text.GetLength() == 6) ? 1 : 2;
+		size_t after_download = (download_text.GetLength() < 8) ? 8 - download_text.GetLength() : 1;
+		size_t after_upload = (upload_text.GetLength() < 8) ? 8 - upload_text.GetLength() : 1;
+		size_t after_cpu = (cpu_text.GetLength() == 6) ? 1 : 2;
+
+		cause_widths.Push(cause_text.GetLength());
+		size_t after_cause = cause_widths.GetLargest() - cause_text.GetLength() + 1;
+		size_t cause_column = disk_text.GetLength() + after_disk + download_text.GetLength() + after_download +
+			upload_text.GetLength() + after_upload + cpu_text.GetLength() + after_cpu;
+
+		name_widths.Push(name_text.GetLength());
+		size_t after_name = name_widths.GetLargest() - name_text.GetLength() + 2;
+		size_t desired_space = cause_column + cause_text.GetLength() + after_cause +
+			name_text.GetLength() + after_name + ram_text.GetLength();
+		if ((desired_space > 79) && (tick->process_count > 0)) {
+			//Output won't fit in command prompt after the return character.
+			//Shorten the process name to compensate, adding a "..." to show
+			// the name was too long.
+			size_t space_needed = desired_space - 79 + 3;
+			const BottleneckProcess* process = &tick->processes[0];
+			size_t kept_length = (process->name.length() > space_needed) ? process->name.length() - space_needed : 0;
+			name_text.Clear();
+			name_text.Append(process->name.c_str(), kept_length);
+			name_text.Append(L"...", 3);
+			if (process->PID != 0) {
+				name_text.Append(L'_');
+				name_text.AppendSigned(process->PID);
+			}
+			name_widths.Reset(name_text.GetLength());
+			after_name = 2;
+		}
+
+		text->Append(disk_text.GetText(), disk_text.GetLength());
+		text->AppendSpaces(after_disk);
+		text->Append(download_text.GetText(), download_text.GetLength());
+		text->AppendSpaces(after_download);
+		text->Append(upload_text.GetText(), upload_text.GetLength());
+		text->AppendSpaces(after_upload);
+		text->Append(cpu_text.GetText(), cpu_text.GetLength());
+		text->AppendSpaces(after_cpu);
+		text->Append(cause_text.GetText(), cause_text.GetLength());
+		text->AppendSpaces(after_cause);
+		text->Append(name_text.GetText(), name_text.GetLength());
+		text->AppendSpaces(after_name);
+		text->Append(ram_text.GetText(), ram_text.GetLength());
+		text->Append(L'\n');
+
+		//The rest of the top processes, one per line under the cause column
+		size_t after_top_cause = after_cause + cause_text.GetLength();
+		for (DWORD rank = 1; rank < tick->process_count; ++rank) {
+			size_t line_start = text->GetLength();
+			text->AppendSpaces(cause_column);
+			AppendCauseText(tick->cause, &tick->processes[rank], tick->processor_count, true, text);
+			size_t top_cause_length = text->GetLength() - line_start - cause_column;
+			text->AppendSpaces((after_top_cause > top_cause_length) ? after_top_cause - top_cause_length : 1);
+			AppendNameText(&tick->processes[rank], text);
+			text->Append(L'\n');
+		}
+		AppendCgroupLines(tick, false, text);
+		AppendThreadLines(tick, false, text);
+		AppendPressureLine(tick, text);
+		AppendDiskLines(tick, false, text);
+		AppendInterfaceLines(tick, false, text);
+	}
+
+	void EncodeSummary(unsigned long long time, const WindowSummary* summary, LineBuffer* text) {
+		AppendSummaryTable(summary, false, text);
+	}
+
+	bool NeedsLogTime() {
+		return true;
+	}
+
+private:
+	//Reused for each tick's pieces
+	LineBuffer disk_text;
+	LineBuffer download_text;
+	LineBuffer upload_text;
+	LineBuffer cpu_text;
+	LineBuffer ram_text;
+	LineBuffer cause_text;
+	LineBuffer name_text;
+
+	WidthHistory cause_widths;
+	WidthHistory name_widths;
+	bool show_interval;
+};
+
+//Tab separated, the /TSV layout
+class TsvEncoder : public OutputEncoder {
+public:
+	TsvEncoder(bool show_pressure, bool show_interval) {
+		//Constructor
+		this->show_pressure = show_pressure;
+		this->show_interval = show_interval;
+	}
+
+	void EncodeHeader(LineBuffer* text) {
+		text->Append(L"Disk%\tDownload\tUpload\tCPU%\tProcess\tRAM%");
+		if (show_pressure) text->Append(L"\tCPUStall%\tIOStall%\tMEMStall%");
+		if (show_interval) text->Append(L"\tInterval");
+		text->Append(L'\n');
+	}
+
+	void EncodeTick(const OutputTick* tick, LineBuffer* text) {
+		text->AppendFixed(tick->disk_pct, 2, 4);
+		text->Append(L'\t');
+		text->AppendUnsigned(tick->recv_bytes);
+		text->Append(L'\t');
+		text->AppendUnsigned(tick->sent_bytes);
+		text->Append(L'\t');
+		text->AppendFixed(tick->cpu_pct, 2, 4);
+		text->Append(L'\t');
+		if (tick->process_count > 0) {
+			AppendCauseText(tick->cause, &tick->processes[0], tick->processor_count, tick->show_io_value, text);
+			text->Append(L'\t');
+			AppendNameText(&tick->processes[0], text);
+		}
+		else text->Append(L'\t');
+		text->Append(L'\t');
+		text->AppendFixed(tick->ram_pct, 2, 4);
+		if (show_pressure) AppendPressureFields(tick, L'\t', text);
+		if (show_interval) {
+			//Seconds
+			text->Append(L'\t');
+			text->AppendFixed(tick->interval_ns / 1000000000.0, 4);
+		}
+		text->Append(L'\n');
+
+		//The rest of the top processes, in the same columns
+		for (DWORD rank = 1; rank < tick->process_count; ++rank) {
+			text->Append(L"\t\t\t\t", 4);
+			AppendCauseText(tick->cause, &tick->processes[rank], tick->processor_count, true, text);
+			text->Append(L'\t');
+			AppendNameText(&tick->processes[rank], text);
+			text->Append(L"\t\n", 2);
+		}
+		AppendCgroupLines(tick, true, text);
+		AppendThreadLines(tick, true, text);
+		AppendDiskLines(tick, true, text);
+		AppendInterfaceLines(tick, true, text);
+	}
+
+	void EncodeSummary(unsigned long long time, const WindowSummary* summary, LineBuffer* text) {
+		AppendSummaryTable(summary, true, text);
+	}
+
+	bool NeedsLogTime() {
+		return true;
+	}
+
+private:
+	bool show_pressure;
+	bool show_interval;
+};
+
+//Comma separated with a time column. The cause's value and the PID get
+// columns of their own, the rest of /TOP are rows with only those filled in.
+class CsvEncoder : public OutputEncoder {
+public:
+	CsvEncoder(bool show_pressure, bool show_interval) {
+		//Constructor
+		this->show_pressure = show_pressure;
+		this->show_interval = show_interval;
+	}
+
+	void EncodeHeader(LineBuffer* text) {
+		text->Append(L"Time,Disk%,Download,Upload,CPU%,Cause,Value,Process,PID,RAM%");
+		if (show_pressure) text->Append(L",CPUStall%,IOStall%,MEMStall%");
+		if (show_interval) text->Append(L",Interval");
+		text->Append(L'\n');
+	}
+
+	void EncodeTick(const OutputTick* tick, LineBuffer* text) {
+		//Local time, like the logfile's
+		time_t rawtime = (time_t)(tick->time / 1000000000ULL);
+		wchar_t time_buffer[64];
+		size_t time_length = wcsftime(time_buffer, 64, L"%F %T", localtime(&rawtime));
+
+		text->Append(time_buffer, time_length);
+		text->Append(L',');
+		text->AppendFixed(tick->disk_pct, 2);
+		text->Append(L',');
+		text->AppendUnsigned(tick->recv_bytes);
+		text->Append(L',');
+		text->AppendUnsigned(tick->sent_bytes);
+		text->Append(L',');
+		text->AppendFixed(tick->cpu_pct, 2);
+		text->Append(L',');
+		if (tick->process_count > 0) AppendProcess(tick, 0, text);
+		else text->Append(L",,,", 3);
+		text->Append(L',');
+		text->AppendFixed(tick->ram_pct, 2);
+		if (show_pressure) AppendPressureFields(tick, L',', text);
+		if (show_interval) {
+			//Seconds
+			text->Append(L',');
+			text->AppendFixed(tick->interval_ns / 1000000000.0, 4);
+		}
+		text->Append(L'\n');
+
+		for (DWORD rank = 1; rank < tick->process_count; ++rank) {
+			text->Append(time_buffer, time_length);
+			text->Append(L",,,,,", 5);
+			AppendProcess(tick, rank, text);
+			text->Append(L',');
+			if (show_pressure) text->Append(L",,,", 3);
+			if (show_interval) text->Append(L',');
+			text->Append(L'\n');
+		}
+	}
+
+	void EncodeSummary(unsigned long long time, const WindowSummary* summary, LineBuffer* text) {
+		//Summaries do not fit the columns
+	}
+
+	bool NeedsLogTime() {
+		return false;
+	}
+
+private:
+	void AppendProcess(const OutputTick* tick, DWORD rank, LineBuffer* text) {
+		//Cause, value, name and PID columns
+		const BottleneckProcess* process = &tick->processes[rank];
+		text->Append(GetCauseName(tick->cause));
+		text->Append(L',');
+		AppendCauseValue(tick->cause, process, tick->processor_count, text);
+		text->Append(L',');
+		text->AppendCsvField(process->name.c_str(), process->name.length());
+		text->Append(L',');
+		text->AppendSigned(process->PID);
+	}
+
+	bool show_pressure;
+	bool show_interval;
+};
+
+//One JSON object per tick per line, with the /TOP processes in an array.
+//Times are milliseconds since 1970-01-01 UTC, CPU% values are of the whole
+// machine and I/O values are bytes per second.
+class JsonEncoder : public OutputEncoder {
+public:
+	void EncodeHeader(LineBuffer* text) {
+		//Every line describes itself
+	}
+
+	void EncodeTick(const OutputTick* tick, LineBuffer* text) {
+		text->Append(L"{\"time\":");
+		text->AppendUnsigned(tick->time / 1000000ULL);
+		text->Append(L",\"disk_pct\":");
+		AppendNumber(tick->disk_pct, text);
+		text->Append(L",\"recv_bytes\":");
+		text->AppendUnsigned(tick->recv_bytes);
+		text->Append(L",\"sent_bytes\":");
+		text->AppendUnsigned(tick->sent_bytes);
+		text->Append(L",\"cpu_pct\":");
+		AppendNumber(tick->cpu_pct, text);
+		text->Append(L",\"core_max_pct\":");
+		if (tick->busiest_core == -1) text->Append(L"null");
+		else AppendNumber(tick->core_max_pct, text);
+		text->Append(L",\"busiest_core\":");
+		if (tick->busiest_core == -1) text->Append(L"null");
+		else text->AppendSigned(tick->busiest_core);
+		text->Append(L",\"ram_pct\":");
+		AppendNumber(tick->ram_pct, text);
+		if (tick->interval_ns != 0) {
+			text->Append(L",\"interval_ms\":");
+			AppendNumber(tick->interval_ns / 1000000.0, text);
+		}
+		if (tick->pressure != 0) {
+			//Resources without PSI are null
+			text->Append(L",\"pressure\":{");
+			for (DWORD resource = 0; resource < PRESSURE_COUNT; ++resource) {
+				const PressureSample* pressure = &tick->pressure[resource];
+				if (resource > 0) text->Append(L',');
+				text->Append(L'"');
+				text->Append(PRESSURE_KEYS[resource]);
+				text->Append(L"\":");
+				if (!pressure->available) {
+					text->Append(L"null");
+					continue;
+				}
+				text->Append(L"{\"some_pct\":");
+				AppendNumber(pressure->some_pct, text);
+				text->Append(L",\"full_pct\":");
+				AppendNumber(pressure->full_pct, text);
+				text->Append(L",\"some_avg10\":");
+				AppendNumber(pressure->some_avg10, text);
+				text->Append(L",\"full_avg10\":");
+				AppendNumber(pressure->full_avg10, text);
+				text->Append(L'}');
+			}
+			text->Append(L'}');
+		}
+		text->Append(L",\"cause\":");
+		if (tick->cause == none) text->Append(L"null");
+		else {
+			text->Append(L'"');
+			text->Append(GetCauseName(tick->cause));
+			text->Append(L'"');
+		}
+		text->Append(L",\"processes\":[");
+		for (DWORD rank = 0; rank < tick->process_count; ++rank) {
+			const BottleneckProcess* process = &tick->processes[rank];
+			if (rank > 0) text->Append(L',');
+			text->Append(L"{\"name\":");
+			text->AppendJsonString(process->name.c_str(), process->name.length());
+			text->Append(L",\"pid\":");
+			text->AppendSigned(process->PID);
+			//Unknown on Windows and when replaying a history
+			text->Append(L",\"ppid\":");
+			if (process->parent_PID == -1) text->Append(L"null");
+			else text->AppendSigned(process->parent_PID);
+			text->Append(L",\"command\":");
+			if (process->command.empty()) text->Append(L"null");
+			else text->AppendJsonString(process->command.c_str(), process->command.length());
+			text->Append(L",\"value\":");
+			if (tick->cause == cpu) AppendNumber(process->cpu / tick->processor_count, text);
+			else if (tick->cause == none) text->Append(L"null");
+			else AppendCauseValue(tick->cause, process, tick->processor_count, text);
+			text->Append(L'}');
+		}
+		text->Append(L']');
+		if (tick->cgroup_count > 0) {
+			//CPU% of the whole machine, I/O in bytes per second
+			text->Append(L",\"cgroups\":[");
+			for (DWORD rank = 0; rank < tick->cgroup_count; ++rank) {
+				const CgroupSample* cgroup = &tick->cgroups[rank];
+				if (rank > 0) text->Append(L',');
+				text->Append(L"{\"name\":");
+				text->AppendJsonString(cgroup->name.c_str(), cgroup->name.length());
+				text->Append(L",\"cpu_pct\":");
+				AppendNumber(cgroup->cpu / tick->processor_count, text);
+				text->Append(L",\"rio\":");
+				text->AppendSigned(cgroup->rio);
+				text->Append(L",\"wio\":");
+				text->AppendSigned(cgroup->wio);
+				text->Append(L",\"memory_bytes\":");
+				text->AppendUnsigned(cgroup->memory);
+				text->Append(L'}');
+			}
+			text->Append(L']');
+		}
+		if (tick->thread_count > 0) {
+			//CPU% of one core, I/O in bytes and faults per second
+			text->Append(L",\"threads\":[");
+			for (DWORD rank = 0; rank < tick->thread_count; ++rank) {
+				const ThreadSample* thread = &tick->threads[rank];
+				if (rank > 0) text->Append(L',');
+				text->Append(L"{\"name\":");
+				text->AppendJsonString(thread->name.c_str(), thread->name.length());
+				text->Append(L",\"tid\":");
+				text->AppendSigned(thread->TID);
+				text->Append(L",\"cpu_pct\":");
+				AppendNumber(thread->cpu, text);
+				text->Append(L",\"rio\":");
+				text->AppendSigned(thread->rio);
+				text->Append(L",\"wio\":");
+				text->AppendSigned(thread->wio);
+				text->Append(L",\"faults\":");
+				text->AppendSigned(thread->faults);
+				text->Append(L'}');
+			}
+			text->Append(L']');
+		}
+		if (tick->disk_count > 0) {
+			text->Append(L",\"disks\":[");
+			for (DWORD n = 0; n < tick->disk_count; ++n) {
+				const DiskSample* disk = &tick->disks[n];
+				if (n > 0) text->Append(L',');
+				text->Append(L"{\"name\":");
+				text->AppendJsonString(disk->name.c_str(), disk->name.length());
+				text->Append(L",\"busy_pct\":");
+				AppendNumber(disk->busy_pct, text);
+				text->Append(L",\"read_iops\":");
+				AppendNumber(disk->read_iops, text);
+				text->Append(L",\"write_iops\":");
+				AppendNumber(disk->write_iops, text);
+				text->Append(L",\"read_bytes\":");
+				text->AppendUnsigned(disk->read_bytes);
+				text->Append(L",\"write_bytes\":");
+				text->AppendUnsigned(disk->write_bytes);
+				text->Append(L",\"await_ms\":");
+				AppendNumber(disk->await_ms, text);
+				text->Append(L",\"queue_depth\":");
+				AppendNumber(disk->queue_depth, text);
+				text->Append(L",\"saturated\":");
+				text->Append(DiskIsSaturated(disk->await_ms, disk->queue_depth) ? L"true" : L"false");
+				text->Append(L'}');
+			}
+			text->Append(L']');
+		}
+		if (tick->interface_count > 0) {
+			//Speeds and percentages are null when the link speed is unknown
+			text->Append(L",\"interfaces\":[");
+			for (DWORD n = 0; n < tick->interface_count; ++n) {
+				const InterfaceSample* network_interface = &tick->interfaces[n];
+				bool known = (network_interface->speed > 0);
+				if (n > 0) text->Append(L',');
+				text->Append(L"{\"name\":");
+				text->AppendJsonString(network_interface->name.c_str(), network_interface->name.length());
+				text->Append(L",\"recv_bytes\":");
+				text->AppendUnsigned(network_interface->recv_bytes);
+				text->Append(L",\"sent_bytes\":");
+				text->AppendUnsigned(network_interface->sent_bytes);
+				text->Append(L",\"speed_bits\":");
+				if (known) text->AppendUnsigned(network_interface->speed);
+				else text->Append(L"null");
+				text->Append(L",\"recv_pct\":");
+				if (known) AppendNumber(network_interface->recv_pct, text);
+				else text->Append(L"null");
+				text->Append(L",\"sent_pct\":");
+				if (known) AppendNumber(network_interface->sent_pct, text);
+				else text->Append(L"null");
+				text->Append(L",\"saturated\":");
+				text->Append(LinkIsSaturated(network_interface->recv_pct, network_interface->sent_pct) ? L"true" : L"false");
+				text->Append(L'}');
+			}
+			text->Append(L']');
+		}
+		text->Append(L"}\n");
+	}
+
+	void EncodeSummary(unsigned long long time, const WindowSummary* summary, LineBuffer* text) {
+		//Told apart from ticks by the window field
+		const wchar_t* metric_keys[METRIC_COUNT] = {L"disk_pct", L"recv_bytes", L"sent_bytes", L"cpu_pct", L"ram_pct"};
+		text->Append(L"{\"time\":");
+		text->AppendUnsigned(time / 1000000ULL);
+		text->Append(L",\"window_ms\":");
+		text->AppendUnsigned(summary->length / 1000000ULL);
+		text->Append(L",\"samples\":");
+		text->AppendUnsigned(summary->sample_count);
+		for (DWORD metric = 0; metric < METRIC_COUNT; ++metric) {
+			const MetricSummary* values = &summary->metrics[metric];
+			text->Append(L",\"");
+			text->Append(metric_keys[metric]);
+			text->Append(L"\":{\"min\":");
+			AppendNumber(values->min, text);
+			text->Append(L",\"mean\":");
+			AppendNumber(values->mean, text);
+			text->Append(L",\"p50\":");
+			AppendNumber(values->p50, text);
+			text->Append(L",\"p95\":");
+			AppendNumber(values->p95, text);
+			text->Append(L",\"p99\":");
+			AppendNumber(values->p99, text);
+			text->Append(L",\"max\":");
+			AppendNumber(values->max, text);
+			text->Append(L'}');
+		}
+		text->Append(L"}\n");
+	}
+
+	bool NeedsLogTime() {
+		return false;
+	}
+
+private:
+	void AppendNumber(double value, LineBuffer* text) {
+		//JSON has no NaN or infinity
+		if (isfinite(value)) text->AppendFixed(value, 2);
+		else text->Append(L"null");
+	}
+};
+
+OutputEncoder* CreateEncoder(output_formats format, bool show_pressure, bool show_interval) {
+	if (format == format_tsv) return new TsvEncoder(show_pressure, show_interval);
+	if (format == format_csv) return new CsvEncoder(show_pressure, show_interval);
+	if (format == format_json) return new JsonEncoder();
+	return new SmartEncoder(show_interval);
+}
@@ -0,0 +1,124 @@
+//Text of the output lines shared by the console, logfile and /DUMP.
+
+#ifndef RESOURCEMONITOR_OUTPUTFORMAT_H
+#define RESOURCEMONITOR_OUTPUTFORMAT_H
+
+#include "Platform.h"
+#include "Collector.h"
+#include "ProcessSamples.h"
+#include "RollingStats.h"
+#include <vector>
+
+using namespace std;
+
+//Layouts selected with /FORMAT
+enum output_formats {format_smart, format_tsv, format_csv, format_json};
+
+//Text built up in one buffer that is kept across ticks, so once it has grown
+// to fit a tick's lines appending never allocates.
+//Numbers are converted by hand rather than with swprintf, which parses its
+// format string on every call.
+class LineBuffer {
+public:
+	LineBuffer();//Constructor
+
+	void Clear();
+	const wchar_t* GetText() const;//Null terminated
+	size_t GetLength() const;
+
+	void Append(const wchar_t* text, size_t length);
+	void Append(const wchar_t* text);
+	void Append(wchar_t character);
+	void AppendSpaces(size_t count);
+	void AppendUnsigned(unsigned long long value);
+	void AppendSigned(long long value);
+
+	//Like swprintf's "%*.*f": decimals after the point, rounded half to even,
+	// padded with spaces on the left to width.
+	void AppendFixed(double value, DWORD decimals, size_t width = 0);
+
+	//Quoted with JSON escapes
+	void AppendJsonString(const wchar_t* text, size_t length);
+
+	//Quoted only if it holds a comma, quote or line break, like RFC 4180
+	void AppendCsvField(const wchar_t* text, size_t length);
+
+private:
+	void Reserve(size_t extra);
+
+	vector<wchar_t> text;
+	size_t length;
+};
+
+//Everything shown for one tick
+struct OutputTick {
+	unsigned long long time;//Nanoseconds since 1970-01-01 UTC
+	double disk_pct;
+	unsigned long long recv_bytes;
+	unsigned long long sent_bytes;
+	double cpu_pct;
+	double core_max_pct;
+	int busiest_core;//-1 if unknown
+	double ram_pct;
+	bottleneck_causes cause;
+	const BottleneckProcess* processes;//The bottleneck, then the rest of /TOP
+	DWORD process_count;//0 if no bottleneck process was found
+	DWORD processor_count;
+	bool show_io_value;//Show I/O values in the text layouts' cause column
+	const DiskSample* disks;//Listed under the tick with /DISKS
+	DWORD disk_count;//0 without /DISKS
+	const InterfaceSample* interfaces;//Listed under the tick with /NETS
+	DWORD interface_count;//0 without /NETS
+	const PressureSample* pressure;//PRESSURE_COUNT of them, 0 without /PSI
+	const ThreadSample* threads;//Of the bottleneck process, highest first
+	DWORD thread_count;//0 without /THREADS
+	const CgroupSample* cgroups;//Highest first
+	DWORD cgroup_count;//0 without /CGROUPS
+	unsigned long long interval_ns;//The /T used for this tick, 0 unless adaptive
+};
+
+//Turns ticks into lines of text. The encoders keep no per-tick allocations,
+// callers pass buffers that are reused.
+class OutputEncoder {
+public:
+	virtual ~OutputEncoder();
+
+	//Appends the column header, written once before the first tick.
+	virtual void EncodeHeader(LineBuffer* text) = 0;
+
+	//Appends the lines of one tick.
+	virtual void EncodeTick(const OutputTick* tick, LineBuffer* text) = 0;
+
+	//Appends the statistics of one /SUMMARY window. time is the tick's.
+	virtual void EncodeSummary(unsigned long long time, const WindowSummary* summary, LineBuffer* text) = 0;
+
+	//True if the lines have no time of their own, so the logfile puts one
+	// at the start of each.
+	virtual bool NeedsLogTime() = 0;
+};
+
+//Returns a new encoder for the format, delete it when done.
+//show_pressure adds the /PSI columns to the header of the column layouts,
+// show_interval an Interval column for /T min max.
+OutputEncoder* CreateEncoder(output_formats format, bool show_pressure = false, bool show_interval = false);
+
+//Appends the tick in the Prometheus text format, for /METRICS: the system
+// values, a gauge per cause set to 1 for the bottleneck's, and the top
+// processes' values labeled with their rank, name and PID.
+void AppendPrometheusText(const OutputTick* tick, LineBuffer* text);
+
+//Appends the bottleneck cause with the process's value, like "CPU:45%".
+//CORE shows the percent of one core, like "CORE:100%".
+//I/O values are only shown if show_io_value is set.
+void AppendCauseText(bottleneck_causes cause, const BottleneckProcess* process, DWORD processor_count, bool show_io_value, LineBuffer* text);
+
+//Appends the process name with its PID, like "firefox_1234".
+void AppendNameText(const BottleneckProcess* process, LineBuffer* text);
+
+//Appends bytes in the largest unit that keeps a whole number, like "4.5M".
+void AppendScaledBytes(unsigned long long bytes, LineBuffer* text);
+
+//Appends a window length in the largest whole unit, like "5m" or "90s".
+void AppendDurationText(unsigned long long nanoseconds, LineBuffer* text);
+
+#endif
@@ -0,0 +1,384 @@
+#ifdef _WIN32
+
+#include "PdhCollector.h"
+#include <iostream>
+#include <PdhMsg.h>
+#include "StringHelpers.h"
+
+using namespace std;
+
+double GetPercentUsedRAM() {
+	//Gets the system physical ram usage percent, returned as a double.
+	MEMORYSTATUSEX data;
+	data.dwLength = sizeof(data);
+	if (GlobalMemoryStatusEx(&data) == 0) {
+		wcout << "GetPercentUsedRAM() GlobalMemoryStatusEx() failed." << endl;
+		return 0.0;
+	}
+	double bytes_in_use = (double)(data.ullTotalPhys - data.ullAvailPhys);
+	return bytes_in_use / ((double)data.ullTotalPhys) * 100;
+}
+
+PdhCollector::PdhCollector() {
+	//Constructor
+	registry_is_set = false;
+	query_handle = 0;
+	cpu_pct_counter = 0;
+	core_pct_counters = 0;
+	disk_pct_counters = 0;
+	for (DWORD counter = 0; counter < DISK_COUNTER_COUNT; ++counter) disk_counters[counter] = 0;
+	for (DWORD counter = 0; counter < NET_COUNTER_COUNT; ++counter) net_counters[counter] = 0;
+	process_elapsed_time_counters = 0;
+	process_cpu_pct_counters = 0;
+	process_write_bytes_counters = 0;
+	process_read_bytes_counters = 0;
+}
+
+PdhCollector::~PdhCollector() {
+	if (query_handle != 0) PdhCloseQuery(query_handle);
+}
+
+bool PdhCollector::Open() {
+	//Check if the registry is set to see PIDs when collecting process data
+	registry_is_set = RegistryIsSetForPIDs();
+	if (!registry_is_set) {
+		//Attempt to set the registry correctly
+		registry_is_set = SetRegistryForPIDs();
+	}
+	if (!registry_is_set) {
+		wcout << "Your system is not configured to monitor processes using their PIDs. You will see missing data. Run once with admin rights to enable more accurate process monitoring. See the usage/help for more details.\n\n";
+	}
+
+	//Open query
+	PDH_STATUS pdh_status = PdhOpenQuery(NULL, 0, &query_handle);
+	if (pdh_status != ERROR_SUCCESS) {
+		wcout << "PdhOpenQuery() error." << endl;
+		query_handle = 0;
+		return false;
+	}
+
+	//Add counters
+	cpu_pct_counter = AddSingleCounter(query_handle,
+									L"\\Processor(_Total)\\% Processor Time");
+	core_pct_counters = AddSingleCounter(query_handle,
+									L"\\Processor(*)\\% Processor Time");
+	disk_pct_counters = AddSingleCounter(query_handle,
+									L"\\PhysicalDisk(*)\\% Disk Time");
+	disk_counters[0] = AddSingleCounter(query_handle,
+									L"\\PhysicalDisk(*)\\Disk Reads/sec");
+	disk_counters[1] = AddSingleCounter(query_handle,
+									L"\\PhysicalDisk(*)\\Disk Writes/sec");
+	disk_counters[2] = AddSingleCounter(query_handle,
+									L"\\PhysicalDisk(*)\\Disk Read Bytes/sec");
+	disk_counters[3] = AddSingleCounter(query_handle,
+									L"\\PhysicalDisk(*)\\Disk Write Bytes/sec");
+	disk_counters[4] = AddSingleCounter(query_handle,
+									L"\\PhysicalDisk(*)\\Avg. Disk sec/Transfer");
+	disk_counters[5] = AddSingleCounter(query_handle,
+									L"\\PhysicalDisk(*)\\Avg. Disk Queue Length");
+	net_counters[0] = AddSingleCounter(query_handle,
+									L"\\Network Interface(*)\\Bytes Received/sec");
+	net_counters[1] = AddSingleCounter(query_handle,
+									L"\\Network Interface(*)\\Bytes Sent/sec");
+	net_counters[2] = AddSingleCounter(query_handle,
+									L"\\Network Interface(*)\\Current Bandwidth");
+	process_elapsed_time_counters = AddSingleCounter(query_handle,
+									L"\\Process(*)\\Elapsed Time");
+	process_cpu_pct_counters = AddSingleCounter(query_handle,
+									L"\\Process(*)\\% Processor Time");
+	process_write_bytes_counters = AddSingleCounter(query_handle,
+									L"\\Process(*)\\IO Write Bytes/sec");
+	process_read_bytes_counters = AddSingleCounter(query_handle,
+									L"\\Process(*)\\IO Read Bytes/sec");
+
+	//Collect first sample
+	if (!CollectQueryData(query_handle)) {
+		wcout << "First sample collection failed." << endl;
+		return false;
+	}
+	return true;
+}
+
+bool PdhCollector::CollectSystem(SystemSample* sample) {
+	CollectQueryData(query_handle);
+
+	////////// CPU % //////////
+	PDH_FMT_COUNTERVALUE cpu_pct;
+	PDH_STATUS pdh_status = PdhGetFormattedCounterValue(cpu_pct_counter, PDH_FMT_DOUBLE, 0, &cpu_pct);
+	if ((pdh_status != ERROR_SUCCESS) || (cpu_pct.CStatus != ERROR_SUCCESS)) {
+		//This will be the first to error if something changes.
+		//	(for example, a disk drive is connected)
+		//The counters will be fine next cycle, so gracefully ignore the error.
+		//cout << "PdhGetFormattedCounterValue() cpu_pct_counter error." << endl;
+		return false;
+	}
+	sample->cpu_pct = cpu_pct.doubleValue;
+	ReadCores();
+	SummarizeCores(sample);
+
+	////////// Disk %s //////////
+	PDH_FMT_COUNTERVALUE_ITEM* disk_pcts = 0;
+	DWORD counter_count = GetCounterArray(disk_pct_counters, PDH_FMT_DOUBLE, &disk_pcts, &counter_buffers[0]);
+	if (counter_count == 0) {
+		//cout << "GetCounterArray() error for disk percent counters." << endl;
+		return false;
+	}
+
+	//Find the maximum disk usage to display
+	sample->highest_disk_usage = ReadDisks(disk_pcts, counter_count);
+	SummarizeDisks(sample);
+
+	////////// Network I/O bytes //////////
+	if (ReadNetworks()) SummarizeInterfaces(sample);
+
+	////////// RAM % //////////
+	sample->ram_pct = GetPercentUsedRAM();
+	return true;
+}
+
+double PdhCollector::ReadDisks(const PDH_FMT_COUNTERVALUE_ITEM* disk_pcts, DWORD disk_pct_count) {
+	//The other per-disk counters list the same instances in the same order.
+	//A value whose instance does not match is left at 0 for the tick.
+	PDH_FMT_COUNTERVALUE_ITEM* values[DISK_COUNTER_COUNT];
+	DWORD value_counts[DISK_COUNTER_COUNT];
+	for (DWORD counter = 0; counter < DISK_COUNTER_COUNT; ++counter) {
+		value_counts[counter] = GetCounterArray(disk_counters[counter], PDH_FMT_DOUBLE, &values[counter], &disk_counter_buffers[counter]);
+	}
+
+	disk_count = 0;
+	double highest_disk_usage = 0.0;
+	for (DWORD diskN = 0; diskN < disk_pct_count; ++diskN) {
+		//Skip the average of all disks
+		const wchar_t* name = disk_pcts[diskN].szName;
+		if (wcscmp(name, L"_Total") == 0) continue;
+		double disk_values[DISK_COUNTER_COUNT];
+		for (DWORD counter = 0; counter < DISK_COUNTER_COUNT; ++counter) {
+			bool matches = (diskN < value_counts[counter]) && (wcscmp(values[counter][diskN].szName, name) == 0);
+			disk_values[counter] = matches ? values[counter][diskN].FmtValue.doubleValue : 0.0;
+		}
+		DiskSample* disk = AddDisk();
+		disk->name.assign(name);
+		disk->busy_pct = disk_pcts[diskN].FmtValue.doubleValue;
+		disk->read_iops = disk_values[0];
+		disk->write_iops = disk_values[1];
+		disk->read_bytes = (unsigned long long)disk_values[2];
+		disk->write_bytes = (unsigned long long)disk_values[3];
+		disk->await_ms = disk_values[4] * 1000.0;
+		disk->queue_depth = disk_values[5];
+		if (disk->busy_pct > highest_disk_usage) highest_disk_usage = disk->busy_pct;
+	}
+	return highest_disk_usage;
+}
+
+void PdhCollector::ReadCores() {
+	//Instances are the core numbers, then "_Total". Processor groups past 64
+	// cores repeat the numbers, so such cores share a slot.
+	PDH_FMT_COUNTERVALUE_ITEM* values = 0;
+	DWORD value_count = GetCounterArray(core_pct_counters, PDH_FMT_DOUBLE, &values, &core_counter_buffer);
+	core_count = 0;
+	for (DWORD coreN = 0; coreN < value_count; ++coreN) {
+		const wchar_t* name = values[coreN].szName;
+		if ((*name < L'0') || (*name > L'9')) continue;
+		DWORD core_number = (DWORD)wcstoul(name, 0, 10);
+		if (core_number >= core_pcts.size()) core_pcts.resize(core_number + 1, 0.0);
+		core_pcts[core_number] = values[coreN].FmtValue.doubleValue;
+		if (core_number + 1 > core_count) core_count = core_number + 1;
+	}
+}
+
+bool PdhCollector::ReadNetworks() {
+	//Like the disks, the counters list the same instances in the same order.
+	//Network Interface has no loopback, and no way to tell virtual adapters
+	// apart, so only the filters given skip interfaces.
+	PDH_FMT_COUNTERVALUE_ITEM* values[NET_COUNTER_COUNT];
+	DWORD value_counts[NET_COUNTER_COUNT];
+	for (DWORD counter = 0; counter < NET_COUNTER_COUNT; ++counter) {
+		value_counts[counter] = GetCounterArray(net_counters[counter], PDH_FMT_LARGE, &values[counter], &net_counter_buffers[counter]);
+	}
+	interface_count = 0;
+	if (value_counts[0] == 0) return false;
+	for (DWORD interfaceN = 0; interfaceN < value_counts[0]; ++interfaceN) {
+		const wchar_t* name = values[0][interfaceN].szName;
+		if (!InterfaceIsIncluded(name, wcslen(name), false, false)) continue;
+		unsigned long long interface_values[NET_COUNTER_COUNT];
+		for (DWORD counter = 0; counter < NET_COUNTER_COUNT; ++counter) {
+			bool matches = (interfaceN < value_counts[counter]) && (wcscmp(values[counter][interfaceN].szName, name) == 0);
+			interface_values[counter] = matches ? (unsigned long long)values[counter][interfaceN].FmtValue.largeValue : 0;
+		}
+		InterfaceSample* network_interface = AddInterface();
+		network_interface->name.assign(name);
+		network_interface->recv_bytes = interface_values[0];
+		network_interface->sent_bytes = interface_values[1];
+		network_interface->speed = interface_values[2];
+		network_interface->recv_pct = (network_interface->speed > 0) ? network_interface->recv_bytes * 8 * 100.0 / network_interface->speed : 0.0;
+		network_interface->sent_pct = (network_interface->speed > 0) ? network_interface->sent_bytes * 8 * 100.0 / network_interface->speed : 0.0;
+	}
+	return true;
+}
+
+bool PdhCollector::TracksPIDs() {
+	return registry_is_set;
+}
+
+void PdhCollector::SetThreadCount(DWORD thread_count) {
+	//PDH samples every process in one call, which leaves little to split, and
+	// PdhCalculateCounterFromRawValue() is not documented as thread safe.
+	Collector::SetThreadCount(1);
+}
+
+bool PdhCollector::CollectProcesses(bottleneck_causes cause) {
+	if (registry_is_set || (replay != 0)) return Collector::CollectProcesses(cause);
+	bool need_cpu = (cause == cpu) || (cause == core);
+	bool need_rio = (cause == rio) || (cause == tio);
+	bool need_wio = (cause == wio) || (cause == tio);
+	unsigned long long fetch_start = GetMonotonicNanoseconds();
+	bool collected = CollectFormattedProcesses(need_cpu, need_rio, need_wio);
+	timings.fetch = GetMonotonicNanoseconds() - fetch_start;
+	if (!collected) return false;
+	RankProcesses(cause, false);
+	CompactNames();
+	return true;
+}
+
+bool PdhCollector::SampleProcessRaw() {
+	//Elapsed Time (and initialize samples_new here too)
+	//The raw value of an elapsed time counter is the process start time.
+	PDH_RAW_COUNTER_ITEM* process_elapsed_times = 0;
+	DWORD process_count = GetCounterArrayRawValues(process_elapsed_time_counters, &process_elapsed_times, &counter_buffers[0]);
+	if (process_count == 0) {
+		wcout << "GetCounterArrayRawValues() error for process elapsed time counters." << endl;
+		return false;
+	}
+	samples_new->Clear(process_count);
+	pid_index_new->Clear(process_count);
+	for (DWORD n = 0; n < process_count; ++n) {
+		size_t name_length = 0;
+		int PID = ParseRawCounterName(process_elapsed_times[n].szName, &name_length);
+		if (PID == 0) continue;//"_Total" and "Idle" are not processes
+		unsigned long long start_time = (unsigned long long)process_elapsed_times[n].RawValue.FirstValue;
+		//A process seen last tick keeps its name, only new ones are interned.
+		// The command line and parent are not read here and stay unknown.
+		int old_slot = pid_index_old->Find(PID, start_time);
+		DWORD name_id = (old_slot == -1) ? names.Intern(process_elapsed_times[n].szName, name_length) : samples_old->name_id[old_slot];
+		DWORD slot = samples_new->Add(PID, start_time, name_id);
+		pid_index_new->Insert(PID, start_time, slot);
+	}
+
+	//CPU, Write I/O and Read I/O
+	//Instances are matched by PID, every array comes from the same sample.
+	//The I/O arrays are skipped unless the cause needs them, see sample_io.
+	CopyRawValuesByPID(process_cpu_pct_counters, samples_new->raw_cpu, L"CPU percent");
+	if (sample_io) {
+		CopyRawValuesByPID(process_write_bytes_counters, samples_new->raw_wio, L"WIO");
+		CopyRawValuesByPID(process_read_bytes_counters, samples_new->raw_rio, L"RIO");
+		for (DWORD slot = 0; slot < samples_new->count; ++slot) samples_new->raw_io_time[slot] = process_sample_time_new;
+	}
+	return true;
+}
+
+void PdhCollector::CopyRawValuesByPID(
+	PDH_HCOUNTER counters,
+	RawCounter* raw_column,
+	const wchar_t* counter_description) {
+	//Copies the raw values of a per-process counter into the matching processes.
+	PDH_RAW_COUNTER_ITEM* raw_values = 0;
+	DWORD process_count = GetCounterArrayRawValues(counters, &raw_values, &counter_buffers[0]);
+	if (process_count == 0) {
+		wcout << "GetCounterArrayRawValues() error for process " << counter_description << " counters." << endl;
+		return;
+	}
+	for (DWORD n = 0; n < process_count; ++n) {
+		DWORD PID = ParsePIDFromRawCounterName(raw_values[n].szName);
+		if (PID != 0) {
+			//Find the process and add the raw data
+			int index = pid_index_new->FindPID(PID);
+			if (index != -1) {
+				memcpy(&raw_column[index], &raw_values[n].RawValue, sizeof(PDH_RAW_COUNTER));
+			}
+		}
+	}
+}
+
+void PdhCollector::CalculateProcess(
+	DWORD slot_new,
+	DWORD slot_old,
+	bool need_cpu,
+	bool need_rio,
+	bool need_wio) {
+	//Lets PDH turn the two raw samples into formatted rates.
+	PDH_FMT_COUNTERVALUE formatted_data;
+	if (need_cpu) {
+		PDH_STATUS ret = PdhCalculateCounterFromRawValue(
+			process_cpu_pct_counters,
+			PDH_FMT_DOUBLE,
+			&samples_new->raw_cpu[slot_new],
+			&samples_old->raw_cpu[slot_old],
+			&formatted_data);
+		if (ret == ERROR_SUCCESS) {
+			samples_new->cpu[slot_new] = formatted_data.doubleValue;
+		}
+	}
+	if (need_wio) {
+		PDH_STATUS ret = PdhCalculateCounterFromRawValue(
+			process_write_bytes_counters,
+			PDH_FMT_LARGE,
+			&samples_new->raw_wio[slot_new],
+			&samples_old->raw_wio[slot_old],
+			&formatted_data);
+		if (ret == ERROR_SUCCESS) {
+			samples_new->wio[slot_new] = formatted_data.largeValue;
+		}
+	}
+	if (need_rio) {
+		PDH_STATUS ret = PdhCalculateCounterFromRawValue(
+			process_read_bytes_counters,
+			PDH_FMT_LARGE,
+			&samples_new->raw_rio[slot_new],
+			&samples_old->raw_rio[slot_old],
+			&formatted_data);
+		if (ret == ERROR_SUCCESS) {
+			samples_new->rio[slot_new] = formatted_data.largeValue;
+		}
+	}
+}
+
+bool PdhCollector::CollectFormattedProcesses(bool need_cpu, bool need_rio, bool need_wio) {
+	//Without PIDs in the instance names raw samples cannot be matched between
+	// ticks, so PDH formats the values and the processes are known by name only.
+	DWORD process_count = 0;
+	PDH_FMT_COUNTERVALUE_ITEM* process_cpu_pcts = 0;
+	PDH_FMT_COUNTERVALUE_ITEM* process_write_bytes = 0;
+	PDH_FMT_COUNTERVALUE_ITEM* process_read_bytes = 0;
+	PDH_FMT_COUNTERVALUE_ITEM* process_names = 0;
+	if (need_cpu) {
+		process_count = GetCounterArray(process_cpu_pct_counters, PDH_FMT_DOUBLE, &process_cpu_pcts, &counter_buffers[0]);
+		process_names = process_cpu_pcts;
+	}
+	if (need_wio) {
+		process_count = GetCounterArray(process_write_bytes_counters, PDH_FMT_LARGE, &process_write_bytes, &counter_buffers[1]);
+		process_names = process_write_bytes;
+	}
+	if (need_rio) {
+		process_count = GetCounterArray(process_read_bytes_counters, PDH_FMT_LARGE, &process_read_bytes, &counter_buffers[2]);
+		process_names = process_read_bytes;
+	}
+
+	//If an error occurs with process counter data, skip the processes
+	samples_new->Clear(process_count);
+	for (DWORD n = 0; n < process_count; ++n) {
+		if (StringsMatch(process_names[n].szName, L"_Total") ||
+			StringsMatch(process_names[n].szName, L"Idle")) {
+			//Ignore collecting values for these
+			continue;
+		}
+		DWORD name_id = names.Intern(process_names[n].szName, wcslen(process_names[n].szName));
+		DWORD slot = samples_new->Add(0, 0, name_id);
+		if (process_cpu_pcts != 0) samples_new->cpu[slot] = process_cpu_pcts[n].FmtValue.doubleValue;
+		if (process_write_bytes != 0) samples_new->wio[slot] = process_write_bytes[n].FmtValue.largeValue;
+		if (process_read_bytes != 0) samples_new->rio[slot] = process_read_bytes[n].FmtValue.largeValue;
+		samples_new->tio[slot] = samples_new->wio[slot] + samples_new->rio[slot];
+	}
+	return process_count != 0;
+}
+
+#endif
@@ -0,0 +1,75 @@
+//Windows collector using the PDH Counters library.
+
+#ifndef RESOURCEMONITOR_PDHCOLLECTOR_H
+#define RESOURCEMONITOR_PDHCOLLECTOR_H
+
+#include "Collector.h"
+#include "PdhHelperFunctions.h"
+
+class PdhCollector : public Collector {
+public:
+	PdhCollector();//Constructor
+	~PdhCollector();
+	bool Open();
+	bool CollectSystem(SystemSample* sample);
+	void SetThreadCount(DWORD thread_count);
+	bool CollectProcesses(bottleneck_causes cause);
+	bool TracksPIDs();
+
+protected:
+	bool SampleProcessRaw();
+	void CalculateProcess(
+		DWORD slot_new,
+		DWORD slot_old,
+		bool need_cpu,
+		bool need_rio,
+		bool need_wio);
+
+private:
+	//Fills the collector's core percentages from the per-core counters.
+	void ReadCores();
+
+	//Per-disk counters read along with % Disk Time, in DiskSample order
+	static const DWORD DISK_COUNTER_COUNT = 6;
+
+	//Fills the collector's disks from the % Disk Time array and the other
+	// per-disk counters. Returns the highest percent disk time.
+	double ReadDisks(const PDH_FMT_COUNTERVALUE_ITEM* disk_pcts, DWORD disk_pct_count);
+
+	//Per-interface counters: Bytes Received/sec, Bytes Sent/sec, Current Bandwidth
+	static const DWORD NET_COUNTER_COUNT = 3;
+
+	//Fills the collector's interfaces with the included ones.
+	bool ReadNetworks();
+
+	//Fills samples_new from formatted counters, names only without PIDs.
+	bool CollectFormattedProcesses(bool need_cpu, bool need_rio, bool need_wio);
+	//Copies the raw values of a per-process counter into the matching processes.
+	void CopyRawValuesByPID(
+		PDH_HCOUNTER counters,
+		RawCounter* raw_column,
+		const wchar_t* counter_description);
+
+	bool registry_is_set;
+	PDH_HQUERY query_handle;
+	PDH_HCOUNTER cpu_pct_counter;
+	PDH_HCOUNTER core_pct_counters;
+	PDH_HCOUNTER disk_pct_counters;
+	PDH_HCOUNTER disk_counters[DISK_COUNTER_COUNT];
+	PDH_HCOUNTER net_counters[NET_COUNTER_COUNT];
+	PDH_HCOUNTER process_elapsed_time_counters;
+	PDH_HCOUNTER process_cpu_pct_counters;
+	PDH_HCOUNTER process_write_bytes_counters;
+	PDH_HCOUNTER process_read_bytes_counters;
+
+	//Reused for every counter array
+	vector<char> counter_buffers[3];
+	vector<char> core_counter_buffer;
+	vector<char> disk_counter_buffers[DISK_COUNTER_COUNT];
+	vector<char> net_counter_buffers[NET_COUNTER_COUNT];
+};
+
+//Gets the system physical ram usage percent, returned as a double.
+double GetPercentUsedRAM();
+
+#endif
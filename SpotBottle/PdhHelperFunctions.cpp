@@ -1,3 +1,5 @@
+#ifdef _WIN32
+
 #include "PdhHelperFunctions.h"
 #include <iostream>
 #include <string>
@@ -30,53 +32,55 @@ bool CollectQueryData(PDH_HQUERY query_handle) {
 	return true;
 }
 
-DWORD GetCounterArray(PDH_HCOUNTER counters, DWORD format, PDH_FMT_COUNTERVALUE_ITEM** values_out) {
-	//Allocates memory to save an array of counter data, size is returned.
-	//Counter data saved to values_out. This must be deallocated later.
+DWORD GetCounterArray(PDH_HCOUNTER counters, DWORD format, PDH_FMT_COUNTERVALUE_ITEM** values_out, vector<char>* buffer) {
+	//Saves an array of counter data into buffer, growing it if needed, size is returned.
+	//values_out points into buffer, so it is valid until the buffer is reused.
 	//Returns 0 if an error.
-	DWORD buffer_size = 0;
+	DWORD buffer_size = (DWORD)buffer->size();
 	DWORD counter_count = 0;
-	PDH_STATUS pdh_status = PdhGetFormattedCounterArray(counters, format, &buffer_size, &counter_count, 0);
-	if (pdh_status != PDH_MORE_DATA) {
-		wcout << "GetCounterArray() expected PDH_MORE_DATA." << endl;
-		return 0;
+	PDH_STATUS pdh_status = PdhGetFormattedCounterArray(counters, format, &buffer_size, &counter_count,
+		(buffer->size() != 0) ? (PDH_FMT_COUNTERVALUE_ITEM*)buffer->data() : 0);
+	if (pdh_status == PDH_MORE_DATA) {
+		//Leave headroom for new instances
+		buffer->resize(buffer_size + buffer_size / 4);
+		buffer_size = (DWORD)buffer->size();
+		pdh_status = PdhGetFormattedCounterArray(counters, format, &buffer_size, &counter_count, (PDH_FMT_COUNTERVALUE_ITEM*)buffer->data());
 	}
-	*values_out = (PDH_FMT_COUNTERVALUE_ITEM*) new char[buffer_size];
-	pdh_status = PdhGetFormattedCounterArray(counters, format, &buffer_size, &counter_count, *values_out);
 	if (pdh_status != ERROR_SUCCESS) {
 		//wcout << "GetCounterArray() error code " << std::hex << (unsigned int)pdh_status << endl;
-		delete[] * values_out;
 		return 0;
 	}
+	*values_out = (PDH_FMT_COUNTERVALUE_ITEM*)buffer->data();
 	return counter_count;
 }
 
-DWORD GetCounterArrayRawValues(PDH_HCOUNTER counters, PDH_RAW_COUNTER_ITEM** values_out) {
-	//Allocates memory to save an array of counter data, size is returned.
-	//Counter data saved to values_out. This must be deallocated later.
+DWORD GetCounterArrayRawValues(PDH_HCOUNTER counters, PDH_RAW_COUNTER_ITEM** values_out, vector<char>* buffer) {
+	//Saves an array of raw counter data into buffer, growing it if needed, size is returned.
+	//values_out points into buffer, so it is valid until the buffer is reused.
 	//Returns 0 if an error.
-	DWORD buffer_size = 0;
+	DWORD buffer_size = (DWORD)buffer->size();
 	DWORD counter_count = 0;
-	PDH_STATUS pdh_status = PdhGetRawCounterArray(counters, &buffer_size, &counter_count, 0);
-	if (pdh_status != PDH_MORE_DATA) {
-		wcout << "PdhGetRawCounterArray() expected PDH_MORE_DATA." << endl;
-		return 0;
+	PDH_STATUS pdh_status = PdhGetRawCounterArray(counters, &buffer_size, &counter_count,
+		(buffer->size() != 0) ? (PDH_RAW_COUNTER_ITEM*)buffer->data() : 0);
+	if (pdh_status == PDH_MORE_DATA) {
+		//Leave headroom for new instances
+		buffer->resize(buffer_size + buffer_size / 4);
+		buffer_size = (DWORD)buffer->size();
+		pdh_status = PdhGetRawCounterArray(counters, &buffer_size, &counter_count, (PDH_RAW_COUNTER_ITEM*)buffer->data());
 	}
-	*values_out = (PDH_RAW_COUNTER_ITEM*) new char[buffer_size];
-	pdh_status = PdhGetRawCounterArray(counters, &buffer_size, &counter_count, *values_out);
 	if (pdh_status != ERROR_SUCCESS) {
 		//wcout << "PdhGetRawCounterArray() error code " << std::hex << (unsigned int)pdh_status << endl;
-		delete[] * values_out;
 		return 0;
 	}
+	*values_out = (PDH_RAW_COUNTER_ITEM*)buffer->data();
 	return counter_count;
 }
 
-unsigned long long SumCounterArray(PDH_HCOUNTER counters) {
+unsigned long long SumCounterArray(PDH_HCOUNTER counters, vector<char>* buffer) {
 	//Gets an array of counter data (unsigned long long) and returns their sum.
 	//Intended for adding bytes over all network interfaces for IO counters.
 	PDH_FMT_COUNTERVALUE_ITEM* values = 0;
-	DWORD values_count = GetCounterArray(counters, PDH_FMT_LARGE, &values);
+	DWORD values_count = GetCounterArray(counters, PDH_FMT_LARGE, &values, buffer);
 	if (values_count == 0) {
 		wcout << "SumCounterArray() error." << endl;
 		return 0;
@@ -87,113 +91,38 @@ unsigned long long SumCounterArray(PDH_HCOUNTER counters) {
 	for (DWORD entry = 0; entry < values_count; ++entry) {
 		total += values[entry].FmtValue.largeValue;
 	}
-	delete[] values;
 	return total;
 }
 
-DWORD FindIndexOfProcessWithHighestDouble(PDH_FMT_COUNTERVALUE_ITEM* processes, DWORD process_count) {
-	//Returns the index of the given array, treating the data as double, or -1 on failure.
-	double highest = 0.0;
-	DWORD index_of_highest = -1;
-	for (DWORD n = 0; n < process_count; ++n) {
-		if (processes[n].FmtValue.doubleValue > highest) {
-			if (StringsMatch(processes[n].szName, L"_Total") ||
-				StringsMatch(processes[n].szName, L"Idle")) {
-				//Ignore collecting values for these
-			}
-			else {
-				highest = processes[n].FmtValue.doubleValue;
-				index_of_highest = n;
-			}
-		}
-	}
-	return index_of_highest;
-}
-
-DWORD FindIndexOfProcessWithHighestLongLong(PDH_FMT_COUNTERVALUE_ITEM* processes, DWORD process_count) {
-	//Returns the index of the given array, treating the data as long long, or -1 on failure.
-	long long highest = 0ULL;
-	DWORD index_of_highest = -1;
-	for (DWORD n = 0; n < process_count; ++n) {
-		if (processes[n].FmtValue.largeValue > highest) {
-			if (StringsMatch(processes[n].szName, L"_Total") ||
-				StringsMatch(processes[n].szName, L"Idle")) {
-				//Ignore collecting values for these
-			}
-			else {
-				highest = processes[n].FmtValue.largeValue;
-				index_of_highest = n;
-			}
-		}
-	}
-	return index_of_highest;
-}
-
-int FindPIDInProcessRawArray(ProcessRaw* process_raw_array, int array_length, int PID) {
-	//Searches an array of ProcessRaw objects for the given PID.
-	//Returns -1 on failure.
-	for (int i = 0; i < array_length; ++i) {
-		if (process_raw_array[i].PID == PID) return i;
-	}
-	return -1;
-}
-
-ProcessRaw::ProcessRaw() {
-	//Constructor
-	PID = 0;
-	name.assign(L"");
-	cpu = 0;
-	wio = 0;
-	rio = 0;
-	tio = 0;
-}
-
-void ProcessRaw::Copy(ProcessRaw* source) {
-	//Safely copy the data from another ProcessRaw object.
-	PID = source->PID;
-	name.assign(source->name);
-	memcpy(&raw_cpu, &source->raw_cpu, sizeof(PDH_RAW_COUNTER));
-	memcpy(&raw_wio, &source->raw_wio, sizeof(PDH_RAW_COUNTER));
-	memcpy(&raw_rio, &source->raw_rio, sizeof(PDH_RAW_COUNTER));
-	cpu = source->cpu;
-	wio = source->wio;
-	rio = source->rio;
-	tio = source->tio;
-}
-
-void ProcessRaw::ParseRawCounterName(wchar_t* szName) {
-	//Calculates the ProcessRaw object's PID and name from a raw counter name.
+int ParseRawCounterName(const wchar_t* szName, size_t* name_length) {
+	//Returns the PID of the raw counter szName and the length of the name before it.
 	//Expecting names like: processname_0000, where the numbers after the underscore is the PID
-	wstring name = szName;//wstring version for the functions
-	size_t underscore_pos = name.rfind('_');
+	//Returns 0 with the whole length for "_Total", "Idle" or names without a PID.
+	//Does not allocate, this runs for every process every tick.
+	*name_length = wcslen(szName);
+	const wchar_t* underscore = wcsrchr(szName, L'_');
 	if (StringsMatch(szName, L"_Total") ||
 		StringsMatch(szName, L"Idle") ||
-		(underscore_pos == std::string::npos)) {
-		this->name.assign(szName);
-		this->PID = 0;
-		return;
+		(underscore == 0)) {
+		return 0;
 	}
-	this->name = name.substr(0, underscore_pos);
-	wstring PID = name.substr(underscore_pos + 1, name.length() - underscore_pos);
-	this->PID = stoi(PID);
+	int PID = 0;
+	for (const wchar_t* digit = underscore + 1; *digit != 0; ++digit) {
+		if ((*digit < L'0') || (*digit > L'9')) return 0;
+		PID = PID * 10 + (*digit - L'0');
+	}
+	*name_length = underscore - szName;
+	return PID;
 }
 
-DWORD ParsePIDFromRawCounterName(wchar_t* szName) {
+DWORD ParsePIDFromRawCounterName(const wchar_t* szName) {
 	//Returns the PID of the raw counter szName as a DWORD, 0 on failure.
 	//Failure includes processes named "_Total" or "Idle".
-	wstring name = szName;//wstring version for the functions
-	size_t underscore_pos = name.rfind('_');
-	if (StringsMatch(szName, L"_Total") ||
-		StringsMatch(szName, L"Idle") ||
-		(underscore_pos == std::string::npos)) {
-		//Ignore collecting values for these
-		return 0;
-	}
-	wstring PID = name.substr(underscore_pos + 1, name.length() - underscore_pos);
-	return stoi(PID);
+	size_t name_length = 0;
+	return (DWORD)ParseRawCounterName(szName, &name_length);
 }
 
-wstring ParseNameFromRawCounterName(wchar_t* szName) {
+wstring ParseNameFromRawCounterName(const wchar_t* szName) {
 	//Returns the name of the raw counter szName, removing the PID, or L"" on failure.
 	//Failure includes processes named "_Total" or "Idle".
 	wstring name = szName;//wstring version for the functions
@@ -284,3 +213,5 @@ bool SetRegistryForPIDs() {
 	RegCloseKey(key);
 	return set_value;
 }
+
+#endif
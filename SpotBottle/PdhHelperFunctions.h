@@ -6,47 +6,30 @@
 #include <Pdh.h>//Link pdh.lib
 #pragma comment(lib, "pdh.lib")
 #include <string>
+#include <vector>
 
 using namespace std;
 
 //Functions for adding counters and collecting the data.
+//Arrays are read into a caller's buffer that only grows, so repeated calls
+// do not allocate once the buffer is large enough.
 PDH_HCOUNTER AddSingleCounter(PDH_HQUERY query_handle, LPCWSTR query_str);
 bool CollectQueryData(PDH_HQUERY query_handle);
 DWORD GetCounterArray(
 	PDH_HCOUNTER counters, 
 	DWORD format, 
-	PDH_FMT_COUNTERVALUE_ITEM** values_out);
+	PDH_FMT_COUNTERVALUE_ITEM** values_out,
+	vector<char>* buffer);
 DWORD GetCounterArrayRawValues(
 	PDH_HCOUNTER counters, 
-	PDH_RAW_COUNTER_ITEM** values_out);
-unsigned long long SumCounterArray(PDH_HCOUNTER counters);
-DWORD FindIndexOfProcessWithHighestDouble(
-	PDH_FMT_COUNTERVALUE_ITEM* processes,
-	DWORD process_count);
-DWORD FindIndexOfProcessWithHighestLongLong(
-	PDH_FMT_COUNTERVALUE_ITEM* processes, 
-	DWORD process_count);
-
-//Struct to store raw and formatted per-process information
-struct ProcessRaw {
-	int PID;
-	wstring name;
-	PDH_RAW_COUNTER raw_cpu;//CPU %
-	PDH_RAW_COUNTER raw_wio;//Write I/O bytes
-	PDH_RAW_COUNTER raw_rio;//Read I/O bytes
-	double cpu;
-	long long wio;
-	long long rio;
-	long long tio;//Total rio + wio
-	ProcessRaw();//Constructor
-	void Copy(ProcessRaw* source);
-	void ParseRawCounterName(wchar_t* szName);
-};
-
-//Used with ProcessRaw
-DWORD ParsePIDFromRawCounterName(wchar_t* szName);
-wstring ParseNameFromRawCounterName(wchar_t* szName);
-int FindPIDInProcessRawArray(ProcessRaw* process_raw_array, int array_length, int PID);
+	PDH_RAW_COUNTER_ITEM** values_out,
+	vector<char>* buffer);
+unsigned long long SumCounterArray(PDH_HCOUNTER counters, vector<char>* buffer);
+
+//Used for parsing PDH process instance names
+int ParseRawCounterName(const wchar_t* szName, size_t* name_length);
+DWORD ParsePIDFromRawCounterName(const wchar_t* szName);
+wstring ParseNameFromRawCounterName(const wchar_t* szName);
 
 //Checks or sets the registry setting for PDH to output PIDs with process names.
 // By default, PDH will output names with no PID. This can be set to output
@@ -0,0 +1,85 @@
+#include "PidIndex.h"
+
+PidIndex::PidIndex() {
+	//Constructor
+	entries = 0;
+	capacity = 0;
+	shift = 32;
+	generation = 0;
+}
+
+PidIndex::~PidIndex() {
+	delete[] entries;
+}
+
+DWORD PidIndex::Hash(int PID) const {
+	//Fibonacci hashing spreads the mostly sequential PIDs across the table.
+	return (DWORD)(((unsigned int)PID * 2654435769u) >> shift);
+}
+
+void PidIndex::Clear(DWORD count) {
+	//Forgets all entries and makes room for at least count entries.
+	//The table is kept at most half full so probe sequences stay short.
+	//Sized for a few more than count when it grows, so a count hovering
+	// around a power of two does not reallocate.
+	DWORD needed = 16;
+	while (needed < count * 2) needed *= 2;
+	if (needed > capacity) {
+		while (needed < (count + count / 4 + 64) * 2) needed *= 2;
+		delete[] entries;
+		entries = new Entry[needed];
+		capacity = needed;
+		shift = 32;
+		for (DWORD size = capacity; size > 1; size /= 2) --shift;
+		for (DWORD n = 0; n < capacity; ++n) entries[n].generation = 0;
+		generation = 0;
+	}
+
+	//Entries of older generations count as empty
+	++generation;
+	if (generation == 0) {
+		//Wrapped around, old entries could look current again
+		for (DWORD n = 0; n < capacity; ++n) entries[n].generation = 0;
+		generation = 1;
+	}
+}
+
+void PidIndex::Insert(int PID, unsigned long long start_time, DWORD slot) {
+	//Linear probing to the first empty entry.
+	//Clear() must have made room for every entry inserted.
+	DWORD mask = capacity - 1;
+	DWORD position = Hash(PID);
+	while (entries[position].generation == generation) {
+		position = (position + 1) & mask;
+	}
+	entries[position].PID = PID;
+	entries[position].slot = slot;
+	entries[position].start_time = start_time;
+	entries[position].generation = generation;
+}
+
+int PidIndex::Find(int PID, unsigned long long start_time) const {
+	//Returns the slot of the process, or -1 if not found.
+	if (capacity == 0) return -1;
+	DWORD mask = capacity - 1;
+	DWORD position = Hash(PID);
+	while (entries[position].generation == generation) {
+		if ((entries[position].PID == PID) && (entries[position].start_time == start_time)) {
+			return (int)entries[position].slot;
+		}
+		position = (position + 1) & mask;
+	}
+	return -1;
+}
+
+int PidIndex::FindPID(int PID) const {
+	//Returns the slot of the first process with the PID, or -1 if not found.
+	if (capacity == 0) return -1;
+	DWORD mask = capacity - 1;
+	DWORD position = Hash(PID);
+	while (entries[position].generation == generation) {
+		if (entries[position].PID == PID) return (int)entries[position].slot;
+		position = (position + 1) & mask;
+	}
+	return -1;
+}
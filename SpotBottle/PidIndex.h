@@ -0,0 +1,48 @@
+//Open-addressing hash index from a process to its slot in a sample array.
+
+#ifndef RESOURCEMONITOR_PIDINDEX_H
+#define RESOURCEMONITOR_PIDINDEX_H
+
+#include "Platform.h"
+
+//Processes are keyed on PID plus start time, so a reused PID is not mistaken
+// for the process that had it before. Lookups by PID alone are possible for
+// joining counters taken within the same sample, where PIDs are unique.
+//Clear() is O(1): entries from older generations count as empty, so the table
+// memory is allocated once and reused every tick.
+class PidIndex {
+public:
+	PidIndex();//Constructor
+	~PidIndex();
+
+	//Forgets all entries and makes room for at least count entries.
+	void Clear(DWORD count);
+
+	//Adds a process. Each PID and start time must only be added once per Clear().
+	void Insert(int PID, unsigned long long start_time, DWORD slot);
+
+	//Return the slot of the process, or -1 if not found.
+	int Find(int PID, unsigned long long start_time) const;
+	int FindPID(int PID) const;
+
+private:
+	struct Entry {
+		int PID;
+		DWORD slot;
+		unsigned long long start_time;
+		DWORD generation;
+	};
+
+	DWORD Hash(int PID) const;
+
+	Entry* entries;
+	DWORD capacity;//Always a power of two
+	DWORD shift;//32 - log2(capacity), for the multiplicative hash
+	DWORD generation;
+
+	//Not copyable
+	PidIndex(const PidIndex&);
+	PidIndex& operator=(const PidIndex&);
+};
+
+#endif
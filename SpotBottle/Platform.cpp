@@ -0,0 +1,117 @@
+#include "Platform.h"
+
+#ifdef _WIN32
+
+#include <psapi.h>
+
+DWORD GetProcessorCount() {
+	SYSTEM_INFO sys_info;
+	GetSystemInfo(&sys_info);
+	return sys_info.dwNumberOfProcessors;
+}
+
+unsigned long long GetMonotonicNanoseconds() {
+	LARGE_INTEGER frequency;
+	LARGE_INTEGER counter;
+	QueryPerformanceFrequency(&frequency);
+	QueryPerformanceCounter(&counter);
+	//Split to avoid overflowing the multiplication
+	unsigned long long seconds = counter.QuadPart / frequency.QuadPart;
+	unsigned long long remainder = counter.QuadPart % frequency.QuadPart;
+	return seconds * 1000000000ULL + remainder * 1000000000ULL / frequency.QuadPart;
+}
+
+unsigned long long GetUnixTimeNanoseconds() {
+	//FILETIME counts 100 nanosecond intervals since 1601-01-01 UTC.
+	//The precise version is needed to align sub-millisecond ticks.
+	FILETIME now;
+	GetSystemTimePreciseAsFileTime(&now);
+	ULARGE_INTEGER intervals;
+	intervals.LowPart = now.dwLowDateTime;
+	intervals.HighPart = now.dwHighDateTime;
+	return (intervals.QuadPart - 116444736000000000ULL) * 100ULL;
+}
+
+unsigned long long GetOwnCpuNanoseconds() {
+	//FILETIME durations are in 100 nanosecond intervals.
+	FILETIME creation_time, exit_time, kernel_time, user_time;
+	if (GetProcessTimes(GetCurrentProcess(), &creation_time, &exit_time, &kernel_time, &user_time) == 0) return 0;
+	ULARGE_INTEGER kernel_intervals, user_intervals;
+	kernel_intervals.LowPart = kernel_time.dwLowDateTime;
+	kernel_intervals.HighPart = kernel_time.dwHighDateTime;
+	user_intervals.LowPart = user_time.dwLowDateTime;
+	user_intervals.HighPart = user_time.dwHighDateTime;
+	return (kernel_intervals.QuadPart + user_intervals.QuadPart) * 100ULL;
+}
+
+unsigned long long GetOwnResidentBytes() {
+	PROCESS_MEMORY_COUNTERS counters;
+	if (GetProcessMemoryInfo(GetCurrentProcess(), &counters, sizeof(counters)) == 0) return 0;
+	return counters.WorkingSetSize;
+}
+
+#else
+
+#include <time.h>
+#include <errno.h>
+#include <unistd.h>
+#include <stdio.h>
+#include <sys/resource.h>
+
+void Sleep(DWORD milliseconds) {
+	//Sleeps for the full time, resuming if interrupted by a signal.
+	struct timespec remaining;
+	remaining.tv_sec = milliseconds / 1000;
+	remaining.tv_nsec = (long)(milliseconds % 1000) * 1000000L;
+	while (nanosleep(&remaining, &remaining) == -1 && errno == EINTR) {}
+}
+
+int wcscpy_s(wchar_t* destination, size_t destination_size, const wchar_t* source) {
+	//Copies source into destination, failing if it does not fit.
+	size_t length = wcslen(source);
+	if (length + 1 > destination_size) {
+		if (destination_size > 0) destination[0] = 0;
+		return EINVAL;
+	}
+	wmemcpy(destination, source, length + 1);
+	return 0;
+}
+
+DWORD GetProcessorCount() {
+	long count = sysconf(_SC_NPROCESSORS_ONLN);
+	if (count < 1) return 1;
+	return (DWORD)count;
+}
+
+unsigned long long GetMonotonicNanoseconds() {
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (unsigned long long)now.tv_sec * 1000000000ULL + now.tv_nsec;
+}
+
+unsigned long long GetUnixTimeNanoseconds() {
+	struct timespec now;
+	clock_gettime(CLOCK_REALTIME, &now);
+	return (unsigned long long)now.tv_sec * 1000000000ULL + now.tv_nsec;
+}
+
+unsigned long long GetOwnCpuNanoseconds() {
+	struct rusage usage;
+	if (getrusage(RUSAGE_SELF, &usage) == -1) return 0;
+	return ((unsigned long long)usage.ru_utime.tv_sec + usage.ru_stime.tv_sec) * 1000000000ULL +
+		((unsigned long long)usage.ru_utime.tv_usec + usage.ru_stime.tv_usec) * 1000ULL;
+}
+
+unsigned long long GetOwnResidentBytes() {
+	//The second field of statm is the resident set in pages.
+	FILE* statm = fopen("/proc/self/statm", "r");
+	if (statm == 0) return 0;
+	unsigned long long size_pages = 0;
+	unsigned long long resident_pages = 0;
+	int fields = fscanf(statm, "%llu %llu", &size_pages, &resident_pages);
+	fclose(statm);
+	if (fields != 2) return 0;
+	return resident_pages * (unsigned long long)sysconf(_SC_PAGESIZE);
+}
+
+#endif
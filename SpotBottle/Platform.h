@@ -0,0 +1,34 @@
+//Portability shims so the same sampling loop builds on Windows and Linux.
+
+#ifndef RESOURCEMONITOR_PLATFORM_H
+#define RESOURCEMONITOR_PLATFORM_H
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <stdint.h>
+#include <stddef.h>
+#include <wchar.h>
+
+//Windows types and functions used by the shared code
+typedef uint32_t DWORD;
+void Sleep(DWORD milliseconds);
+int wcscpy_s(wchar_t* destination, size_t destination_size, const wchar_t* source);
+#endif
+
+//Returns the number of logical processors.
+DWORD GetProcessorCount();
+
+//Returns a monotonic timestamp in nanoseconds, only useful for differences.
+unsigned long long GetMonotonicNanoseconds();
+
+//Returns the wall clock time in nanoseconds since 1970-01-01 UTC.
+unsigned long long GetUnixTimeNanoseconds();
+
+//Returns the user and kernel CPU time this process has used, in nanoseconds.
+unsigned long long GetOwnCpuNanoseconds();
+
+//Returns the physical memory this process is using, in bytes.
+unsigned long long GetOwnResidentBytes();
+
+#endif
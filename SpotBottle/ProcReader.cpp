@@ -0,0 +1,313 @@
+#ifndef _WIN32
+
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE//memrchr()
+#endif
+#include "ProcReader.h"
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/resource.h>
+
+using namespace std;
+
+long ReadWholeFile(const char* path, vector<char>* buffer) {
+	//Reads a whole file into buffer, growing it if needed, and null terminates it.
+	//Returns the number of bytes read, or -1 on failure.
+	int fd = open(path, O_RDONLY | O_CLOEXEC);
+	if (fd == -1) return -1;
+	long length = PreadWholeFile(fd, buffer);
+	close(fd);
+	return length;
+}
+
+long PreadWholeFile(int fd, vector<char>* buffer) {
+	//Reads a whole file from the start into buffer, growing it if needed, and
+	// null terminates it. Returns the number of bytes read, or -1 on failure.
+	//procfs fills the whole buffer when there is more to read, so a short read
+	// is the end of the file and saves a second system call.
+	if (buffer->size() < 4096) buffer->resize(4096);
+	size_t length = 0;
+	while (true) {
+		size_t space = buffer->size() - length - 1;
+		ssize_t ret = pread(fd, buffer->data() + length, space, length);
+		if (ret < 0) return -1;
+		length += ret;
+		if ((size_t)ret < space) break;
+		buffer->resize(buffer->size() * 2);
+	}
+	(*buffer)[length] = 0;
+	return (long)length;
+}
+
+ProcFile::ProcFile() {
+	//Constructor
+	fd = -1;
+	path[0] = 0;
+}
+
+ProcFile::~ProcFile() {
+	if (fd != -1) close(fd);
+}
+
+bool ProcFile::Open(const char* file_path) {
+	snprintf(path, sizeof(path), "%s", file_path);
+	return Reopen();
+}
+
+bool ProcFile::Reopen() {
+	if (fd != -1) close(fd);
+	fd = open(path, O_RDONLY | O_CLOEXEC);
+	return fd != -1;
+}
+
+long ProcFile::Read(vector<char>* buffer) {
+	//Same as ReadWholeFile(), reopening the file once if the read fails.
+	if (fd != -1) {
+		long length = PreadWholeFile(fd, buffer);
+		if (length >= 0) return length;
+	}
+	if (!Reopen()) return -1;
+	return PreadWholeFile(fd, buffer);
+}
+
+static bool ScanField(const char** text, const char* end, unsigned long long* value) {
+	//ScanUnsigned(), failing if there is no number or it does not end in a
+	// space or newline. A number cut off by the end of the text is truncated.
+	const char* start = *text;
+	*value = ScanUnsigned(text, end);
+	if ((*text == start) || ((unsigned int)(unsigned char)(*text)[-1] - '0' > 9)) return false;
+	return (*text < end) && ((**text == ' ') || (**text == '\n'));
+}
+
+bool ParseProcStat(const char* text, size_t length, ProcStat* stat) {
+	//Format: "pid (name) state ppid ..." where majflt is the 12th field, utime
+	// and stime the 14th and 15th, starttime the 22nd and processor the 39th.
+	//Returns false if the text is malformed or truncated.
+	const char* end = text + length;
+	const char* name_open = (const char*)memchr(text, '(', length);
+	const char* name_close = (const char*)memrchr(text, ')', length);
+	if ((name_open == 0) || (name_close == 0) || (name_close < name_open)) return false;
+	stat->name = name_open + 1;
+	stat->name_length = name_close - name_open - 1;
+
+	//") S " then the numeric fields
+	const char* field = name_close + 2;
+	if ((field >= end) || (name_close[1] != ' ')) return false;
+	stat->state = *field;
+
+	unsigned long long value = 0;
+	field = SkipFields(field, end, 1);//4: ppid
+	const char* position = field;
+	if (!ScanField(&position, end, &value)) return false;
+	stat->ppid = (int)value;
+
+	field = SkipFields(field, end, 8);//12: majflt
+	position = field;
+	if (!ScanField(&position, end, &stat->major_faults)) return false;
+
+	field = SkipFields(field, end, 2);//14: utime
+	position = field;
+	if (!ScanField(&position, end, &stat->utime)) return false;
+	if (!ScanField(&position, end, &stat->stime)) return false;
+
+	field = SkipFields(field, end, 8);//22: starttime
+	position = field;
+	if (!ScanField(&position, end, &stat->start_time)) return false;
+
+	field = SkipFields(field, end, 17);//39: processor, missing on old kernels
+	position = field;
+	stat->processor = ScanField(&position, end, &value) ? (int)value : -1;
+	return true;
+}
+
+bool ParseProcIo(const char* text, size_t length, ProcIo* io) {
+	//Format: one "name: value" per line. rchar and wchar are required.
+	//Returns false if the text is malformed or truncated.
+	const char* end = text + length;
+	bool found_rchar = false;
+	bool found_wchar = false;
+	io->read_bytes = 0;
+	io->write_bytes = 0;
+	const char* line = text;
+	while (line < end) {
+		const char* line_end = NextLine(line, end);
+		const char* colon = (const char*)memchr(line, ':', line_end - line);
+		if (colon != 0) {
+			size_t name_length = colon - line;
+			const char* position = colon + 1;
+			unsigned long long value = 0;
+			if (ScanField(&position, line_end, &value)) {
+				if ((name_length == 5) && (memcmp(line, "rchar", 5) == 0)) {
+					io->rchar = value;
+					found_rchar = true;
+				}
+				else if ((name_length == 5) && (memcmp(line, "wchar", 5) == 0)) {
+					io->wchar = value;
+					found_wchar = true;
+				}
+				else if ((name_length == 10) && (memcmp(line, "read_bytes", 10) == 0)) {
+					io->read_bytes = value;
+				}
+				else if ((name_length == 11) && (memcmp(line, "write_bytes", 11) == 0)) {
+					io->write_bytes = value;
+				}
+			}
+		}
+		line = line_end;
+	}
+	return found_rchar && found_wchar;
+}
+
+ProcReader::ProcReader() {
+	//Constructor
+	pid_index_old = &pid_indexes[0];
+	pid_index_new = &pid_indexes[1];
+	buffers.resize(1);
+	descriptors_exhausted = false;
+	descriptors_released = false;
+
+	//Two descriptors per process, raise the soft limit as far as allowed
+	struct rlimit limit;
+	if ((getrlimit(RLIMIT_NOFILE, &limit) == 0) && (limit.rlim_cur < limit.rlim_max)) {
+		limit.rlim_cur = limit.rlim_max;
+		setrlimit(RLIMIT_NOFILE, &limit);
+	}
+}
+
+ProcReader::~ProcReader() {
+	for (size_t n = 0; n < entries_old.size(); ++n) CloseEntry(&entries_old[n]);
+	for (size_t n = 0; n < entries_new.size(); ++n) CloseEntry(&entries_new[n]);
+}
+
+void ProcReader::SetWorkerCount(DWORD worker_count) {
+	buffers.resize((worker_count < 1) ? 1 : worker_count);
+}
+
+void ProcReader::BeginTick(DWORD process_count) {
+	//Last tick's entries become the old ones to take descriptors from
+	entries_old.swap(entries_new);
+	//assign() would allocate exactly process_count, leave headroom instead
+	if (entries_new.capacity() < process_count) entries_new.reserve(process_count + process_count / 4 + 64);
+	Entry empty_entry;
+	empty_entry.PID = 0;
+	empty_entry.stat_fd = -1;
+	empty_entry.io_fd = -1;
+	entries_new.assign(process_count, empty_entry);
+	PidIndex* pid_index_swap = pid_index_old;
+	pid_index_old = pid_index_new;
+	pid_index_new = pid_index_swap;
+}
+
+void ProcReader::EndTick() {
+	//Processes not read this tick have exited
+	for (size_t n = 0; n < entries_old.size(); ++n) CloseEntry(&entries_old[n]);
+	entries_old.clear();
+
+	//Descriptors ran out during the tick, stop keeping any open
+	if (descriptors_exhausted && !descriptors_released) {
+		for (size_t n = 0; n < entries_new.size(); ++n) CloseEntry(&entries_new[n]);
+		descriptors_released = true;
+	}
+
+	//Index this tick's processes for the next tick
+	pid_index_new->Clear((DWORD)entries_new.size());
+	for (size_t n = 0; n < entries_new.size(); ++n) {
+		if (entries_new[n].PID != 0) pid_index_new->Insert(entries_new[n].PID, 0, (DWORD)n);
+	}
+}
+
+void ProcReader::CloseEntry(Entry* entry) {
+	if (entry->stat_fd >= 0) close(entry->stat_fd);
+	if (entry->io_fd >= 0) close(entry->io_fd);
+	entry->stat_fd = -1;
+	entry->io_fd = -1;
+}
+
+int ProcReader::OpenProcessFile(int PID, const char* file) {
+	//Opens /proc/PID/file. Returns -1 on failure with errno set.
+	//Running out of descriptors switches to opening the files every tick. The
+	// process is skipped this tick, other workers may be using the descriptors.
+	char path[64];
+	snprintf(path, sizeof(path), "/proc/%d/%s", PID, file);
+	int fd = open(path, O_RDONLY | O_CLOEXEC);
+	if ((fd == -1) && ((errno == EMFILE) || (errno == ENFILE))) descriptors_exhausted = true;
+	return fd;
+}
+
+long ProcReader::ReadProcessFile(int* fd, int PID, const char* file, vector<char>* buffer) {
+	//Reads a per-process file through its kept descriptor, opening it if needed.
+	//Returns the number of bytes read, or -1 on failure with errno set.
+	if (*fd < 0) {
+		*fd = OpenProcessFile(PID, file);
+		if (*fd == -1) return -1;
+	}
+	long length = PreadWholeFile(*fd, buffer);
+	if (descriptors_exhausted) {
+		int saved_errno = errno;
+		close(*fd);
+		*fd = -1;
+		errno = saved_errno;
+	}
+	return length;
+}
+
+bool ProcReader::ReadProcess(DWORD worker, DWORD slot, int PID, bool read_io, ProcStat* stat, ProcIo* io, bool* io_read) {
+	//Take the descriptors kept from last tick
+	Entry entry;
+	entry.PID = PID;
+	entry.stat_fd = -1;
+	entry.io_fd = -1;
+	int slot_old = pid_index_old->FindPID(PID);
+	if (slot_old != -1) {
+		entry.stat_fd = entries_old[slot_old].stat_fd;
+		entry.io_fd = entries_old[slot_old].io_fd;
+		entries_old[slot_old].stat_fd = -1;
+		entries_old[slot_old].io_fd = -1;
+	}
+	vector<char>* stat_buffer = &buffers[worker].stat_buffer;
+	vector<char>* io_buffer = &buffers[worker].io_buffer;
+
+	//A kept descriptor of an exited process fails to read, even when the PID
+	// has been reused since. Then reopen both files for the new process.
+	long length = -1;
+	if (entry.stat_fd >= 0) {
+		length = ReadProcessFile(&entry.stat_fd, PID, "stat", stat_buffer);
+		if (length <= 0) CloseEntry(&entry);
+	}
+	if (entry.stat_fd < 0) {
+		length = ReadProcessFile(&entry.stat_fd, PID, "stat", stat_buffer);
+	}
+	if ((length <= 0) || !ParseProcStat(stat_buffer->data(), length, stat)) {
+		CloseEntry(&entry);
+		return false;
+	}
+
+	//I/O, not readable for other users' processes without root
+	memset(io, 0, sizeof(ProcIo));
+	*io_read = false;
+	if (read_io && (entry.io_fd != -2)) {
+		length = ReadProcessFile(&entry.io_fd, PID, "io", io_buffer);
+		if (length < 0) {
+			//A kept descriptor is checked again on every read, it can start
+			// failing once the process execs a setuid program
+			int read_errno = errno;
+			if (entry.io_fd >= 0) close(entry.io_fd);
+			if ((read_errno == EACCES) || (read_errno == EPERM)) entry.io_fd = -2;//Do not retry every tick
+			else entry.io_fd = -1;
+		}
+		else if (ParseProcIo(io_buffer->data(), length, io)) {
+			*io_read = true;
+		}
+		else {
+			memset(io, 0, sizeof(ProcIo));
+		}
+	}
+
+	entries_new[slot] = entry;
+	return true;
+}
+
+#endif
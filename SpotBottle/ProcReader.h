@@ -0,0 +1,162 @@
+//Reading and parsing of /proc files for the procfs collector.
+//Files are kept open across ticks and re-read with pread(), and the parsers
+// work in place on the read buffer without copying or allocating.
+
+#ifndef RESOURCEMONITOR_PROCREADER_H
+#define RESOURCEMONITOR_PROCREADER_H
+
+#ifndef _WIN32
+
+#include "Platform.h"
+#include "PidIndex.h"
+#include <string.h>
+#include <atomic>
+#include <vector>
+
+using namespace std;
+
+//Skips spaces and tabs, then parses an unsigned decimal number.
+//Never reads at or past end. Advances text past the number.
+inline unsigned long long ScanUnsigned(const char** text, const char* end) {
+	const char* position = *text;
+	while ((position < end) && ((*position == ' ') || (*position == '\t'))) ++position;
+	unsigned long long value = 0;
+	while (position < end) {
+		unsigned int digit = (unsigned int)(unsigned char)*position - '0';
+		if (digit > 9) break;
+		value = value * 10 + digit;
+		++position;
+	}
+	*text = position;
+	return value;
+}
+
+//Returns the start of the field count fields after the one text is in.
+//Fields are separated by spaces. Returns end if the text runs out.
+inline const char* SkipFields(const char* text, const char* end, int count) {
+	for (int n = 0; n < count; ++n) {
+		while ((text < end) && (*text != ' ') && (*text != '\n')) ++text;
+		while ((text < end) && (*text == ' ')) ++text;
+	}
+	return text;
+}
+
+//Returns the start of the line after text, or end.
+inline const char* NextLine(const char* text, const char* end) {
+	const char* newline = (const char*)memchr(text, '\n', end - text);
+	return (newline == 0) ? end : newline + 1;
+}
+
+//Reads a whole file into buffer, growing it if needed, and null terminates it.
+//Returns the number of bytes read, or -1 on failure.
+long ReadWholeFile(const char* path, vector<char>* buffer);
+long PreadWholeFile(int fd, vector<char>* buffer);
+
+//A /proc file opened once and re-read from the start every tick.
+class ProcFile {
+public:
+	ProcFile();//Constructor
+	~ProcFile();
+	bool Open(const char* path);
+	//Same as ReadWholeFile(), reopening the file once if the read fails.
+	long Read(vector<char>* buffer);
+
+private:
+	bool Reopen();
+
+	int fd;
+	char path[64];
+
+	//Not copyable
+	ProcFile(const ProcFile&);
+	ProcFile& operator=(const ProcFile&);
+};
+
+//Fields of /proc/[pid]/stat. name points into the parsed buffer.
+struct ProcStat {
+	const char* name;
+	size_t name_length;
+	char state;
+	int ppid;
+	unsigned long long major_faults;//Page faults that read from disk
+	unsigned long long utime;//Clock ticks
+	unsigned long long stime;//Clock ticks
+	unsigned long long start_time;//Clock ticks after boot
+	int processor;//CPU last run on
+};
+
+//Fields of /proc/[pid]/io
+struct ProcIo {
+	unsigned long long rchar;
+	unsigned long long wchar;
+	unsigned long long read_bytes;
+	unsigned long long write_bytes;
+};
+
+//Return false if the text is malformed or truncated, leaving the output partial.
+//Every number read must end in a space or newline, so one cut short is not
+// taken for a smaller value. Nothing at or past length is read.
+//The name in /proc/[pid]/stat may contain spaces and parentheses, so it ends
+// at the last ')'.
+bool ParseProcStat(const char* text, size_t length, ProcStat* stat);
+bool ParseProcIo(const char* text, size_t length, ProcIo* io);
+
+//Keeps /proc/[pid]/stat and /proc/[pid]/io open for every process between
+// ticks. Call BeginTick(), ReadProcess() for each PID, then EndTick(), which
+// closes the files of processes that were not read, ie. have exited.
+//ReadProcess() may be called from several workers at once, as long as each
+// uses its own worker number and the slots differ.
+class ProcReader {
+public:
+	ProcReader();//Constructor
+	~ProcReader();
+
+	//Makes a read buffer for each of worker_count workers.
+	void SetWorkerCount(DWORD worker_count);
+
+	//The processes of the tick will be read into slots [0, process_count).
+	void BeginTick(DWORD process_count);
+
+	//Reads and parses the files of a process. io is zeroed and io_read set
+	// false if /proc/[pid]/io was not read and parsed, which needs root for
+	// other users' processes, or if read_io is not set.
+	//stat->name is valid until the worker's next call. Returns false if the
+	// process exited.
+	bool ReadProcess(DWORD worker, DWORD slot, int PID, bool read_io, ProcStat* stat, ProcIo* io, bool* io_read);
+
+	void EndTick();
+
+private:
+	struct Entry {
+		int PID;
+		int stat_fd;
+		int io_fd;//-1 if not open, -2 if not readable
+	};
+
+	//Per worker
+	struct ReadBuffers {
+		vector<char> stat_buffer;
+		vector<char> io_buffer;
+	};
+
+	//Opens or reads a per-process file. Return -1 on failure.
+	int OpenProcessFile(int PID, const char* file);
+	long ReadProcessFile(int* fd, int PID, const char* file, vector<char>* buffer);
+	void CloseEntry(Entry* entry);
+
+	//Entries of the processes read last tick and this tick, swapped every tick.
+	//Entries of processes that were not read have a PID of 0.
+	vector<Entry> entries_old;
+	vector<Entry> entries_new;
+	PidIndex pid_indexes[2];
+	PidIndex* pid_index_old;
+	PidIndex* pid_index_new;
+
+	vector<ReadBuffers> buffers;
+	atomic<bool> descriptors_exhausted;//Falls back to opening the files every tick
+	bool descriptors_released;
+};
+
+#endif
+
+#endif
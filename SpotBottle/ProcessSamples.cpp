@@ -0,0 +1,257 @@
+#include "ProcessSamples.h"
+#include <string.h>
+
+using namespace std;
+
+ProcessSamples::ProcessSamples() {
+	//Constructor
+	count = 0;
+	capacity = 0;
+	PID = 0;
+	start_time = 0;
+	name_id = 0;
+	command_id = 0;
+	parent_PID = 0;
+	raw_cpu = 0;
+	raw_wio = 0;
+	raw_rio = 0;
+	raw_io_time = 0;
+	processor = 0;
+	raw_faults = 0;
+	cpu = 0;
+	wio = 0;
+	rio = 0;
+	tio = 0;
+	faults = 0;
+}
+
+ProcessSamples::~ProcessSamples() {
+	Free();
+}
+
+void ProcessSamples::Free() {
+	delete[] PID;
+	delete[] start_time;
+	delete[] name_id;
+	delete[] command_id;
+	delete[] parent_PID;
+	delete[] raw_cpu;
+	delete[] raw_wio;
+	delete[] raw_rio;
+	delete[] raw_io_time;
+	delete[] processor;
+	delete[] raw_faults;
+	delete[] cpu;
+	delete[] wio;
+	delete[] rio;
+	delete[] tio;
+	delete[] faults;
+	capacity = 0;
+}
+
+void ProcessSamples::Clear(DWORD new_capacity) {
+	//Empties the samples and makes room for at least new_capacity processes.
+	count = 0;
+	if (new_capacity <= capacity) return;
+
+	//Leave headroom so a few new processes do not reallocate next tick
+	new_capacity += new_capacity / 4 + 64;
+	Free();
+	PID = new int[new_capacity];
+	start_time = new unsigned long long[new_capacity];
+	name_id = new DWORD[new_capacity];
+	command_id = new DWORD[new_capacity];
+	parent_PID = new int[new_capacity];
+	raw_cpu = new RawCounter[new_capacity];
+	raw_wio = new RawCounter[new_capacity];
+	raw_rio = new RawCounter[new_capacity];
+	raw_io_time = new unsigned long long[new_capacity];
+	processor = new int[new_capacity];
+	raw_faults = new unsigned long long[new_capacity];
+	cpu = new double[new_capacity];
+	wio = new long long[new_capacity];
+	rio = new long long[new_capacity];
+	tio = new long long[new_capacity];
+	faults = new long long[new_capacity];
+	capacity = new_capacity;
+}
+
+DWORD ProcessSamples::Add(int new_PID, unsigned long long new_start_time, DWORD new_name_id) {
+	//Adds a process with zeroed values and returns its slot.
+	DWORD slot = count++;
+	PID[slot] = new_PID;
+	start_time[slot] = new_start_time;
+	name_id[slot] = new_name_id;
+	command_id[slot] = UNKNOWN_NAME_ID;
+	parent_PID[slot] = -1;
+	memset(&raw_cpu[slot], 0, sizeof(RawCounter));
+	memset(&raw_wio[slot], 0, sizeof(RawCounter));
+	memset(&raw_rio[slot], 0, sizeof(RawCounter));
+	raw_io_time[slot] = 0;
+	processor[slot] = -1;
+	raw_faults[slot] = 0;
+	cpu[slot] = 0;
+	wio[slot] = 0;
+	rio[slot] = 0;
+	tio[slot] = 0;
+	faults[slot] = 0;
+	return slot;
+}
+
+template <typename Char> static DWORD HashName(const Char* name, size_t length) {
+	//FNV-1a over the character values.
+	DWORD hash = 2166136261u;
+	for (size_t n = 0; n < length; ++n) {
+		hash ^= (DWORD)name[n];
+		hash *= 16777619u;
+	}
+	return hash;
+}
+
+NameTable::NameTable() {
+	//Constructor
+	hash_table.assign(256, 0);
+}
+
+template <typename Char> DWORD NameTable::InternRange(const Char* name, size_t length) {
+	//Linear probing from the hash of the name.
+	DWORD mask = (DWORD)hash_table.size() - 1;
+	DWORD position = HashName(name, length) & mask;
+	while (hash_table[position] != 0) {
+		DWORD name_id = hash_table[position] - 1;
+		if (lengths[name_id] == length) {
+			const wchar_t* existing = &text[offsets[name_id]];
+			size_t n = 0;
+			while ((n < length) && (existing[n] == (wchar_t)name[n])) ++n;
+			if (n == length) return name_id;
+		}
+		position = (position + 1) & mask;
+	}
+
+	//New name
+	DWORD name_id = (DWORD)offsets.size();
+	offsets.push_back((DWORD)text.size());
+	lengths.push_back((DWORD)length);
+	for (size_t n = 0; n < length; ++n) text.push_back((wchar_t)name[n]);
+	text.push_back(0);
+	hash_table[position] = name_id + 1;
+
+	//Keep the table at most half full
+	if (offsets.size() * 2 > hash_table.size()) Grow();
+	return name_id;
+}
+
+DWORD NameTable::Intern(const wchar_t* name, size_t length) {
+	return InternRange(name, length);
+}
+
+DWORD NameTable::Intern(const char* name, size_t length) {
+	//Bytes are widened as they are, process names are nearly always ASCII.
+	return InternRange((const unsigned char*)name, length);
+}
+
+void NameTable::Grow() {
+	//Doubles the hash table and reinserts every id.
+	hash_table.assign(hash_table.size() * 2, 0);
+	Rehash();
+}
+
+void NameTable::Rehash() {
+	//Inserts every id into the emptied hash table.
+	DWORD mask = (DWORD)hash_table.size() - 1;
+	for (DWORD name_id = 0; name_id < (DWORD)offsets.size(); ++name_id) {
+		DWORD position = HashName(&text[offsets[name_id]], lengths[name_id]) & mask;
+		while (hash_table[position] != 0) position = (position + 1) & mask;
+		hash_table[position] = name_id + 1;
+	}
+}
+
+const wchar_t* NameTable::GetName(DWORD name_id) const {
+	if (name_id == UNKNOWN_NAME_ID) return L"";
+	return &text[offsets[name_id]];
+}
+
+size_t NameTable::GetLength(DWORD name_id) const {
+	if (name_id == UNKNOWN_NAME_ID) return 0;
+	return lengths[name_id];
+}
+
+DWORD NameTable::GetCount() const {
+	return (DWORD)offsets.size();
+}
+
+void NameTable::Reserve(DWORD name_count, size_t text_length) {
+	//Each name needs its null too. Compact() marks names in new_ids.
+	offsets.reserve(name_count);
+	lengths.reserve(name_count);
+	new_ids.reserve(name_count);
+	text.reserve(text_length + name_count);
+	if (name_count * 2 > hash_table.size()) {
+		DWORD size = (DWORD)hash_table.size();
+		while (size < name_count * 2) size *= 2;
+		hash_table.assign(size, 0);
+		Rehash();
+	}
+}
+
+void NameTable::Compact(DWORD* ids, DWORD count) {
+	//Kept names keep their order, so each moves down in text or stays.
+	DWORD name_count = (DWORD)offsets.size();
+	new_ids.assign(name_count, UNKNOWN_NAME_ID);
+	for (DWORD n = 0; n < count; ++n) {
+		if (ids[n] != UNKNOWN_NAME_ID) new_ids[ids[n]] = 0;
+	}
+	DWORD kept_count = 0;
+	size_t text_length = 0;
+	for (DWORD name_id = 0; name_id < name_count; ++name_id) {
+		if (new_ids[name_id] == UNKNOWN_NAME_ID) continue;
+		size_t size = lengths[name_id] + 1;
+		memmove(&text[text_length], &text[offsets[name_id]], size * sizeof(wchar_t));
+		offsets[kept_count] = (DWORD)text_length;
+		lengths[kept_count] = lengths[name_id];
+		new_ids[name_id] = kept_count++;
+		text_length += size;
+	}
+	//Shrinking keeps the capacity for the names to come
+	text.resize(text_length);
+	offsets.resize(kept_count);
+	lengths.resize(kept_count);
+	hash_table.assign(hash_table.size(), 0);
+	Rehash();
+	for (DWORD n = 0; n < count; ++n) {
+		if (ids[n] != UNKNOWN_NAME_ID) ids[n] = new_ids[ids[n]];
+	}
+}
+
+BottleneckProcess::BottleneckProcess() {
+	//Constructor
+	name.reserve(64);//Most names, and every procfs one
+	command.reserve(MAX_COMMAND_LENGTH);
+	Clear();
+}
+
+void BottleneckProcess::Clear() {
+	//Keeps the name's buffer for the next tick.
+	PID = 0;
+	name.clear();
+	cpu = 0;
+	wio = 0;
+	rio = 0;
+	tio = 0;
+	faults = 0;
+	parent_PID = -1;
+	command.clear();
+}
+
+void BottleneckProcess::Copy(const ProcessSamples* samples, DWORD slot, const NameTable* names, const NameTable* commands) {
+	//Copies one process out of the samples.
+	PID = samples->PID[slot];
+	name.assign(names->GetName(samples->name_id[slot]), names->GetLength(samples->name_id[slot]));
+	command.assign(commands->GetName(samples->command_id[slot]), commands->GetLength(samples->command_id[slot]));
+	parent_PID = samples->parent_PID[slot];
+	cpu = samples->cpu[slot];
+	wio = samples->wio[slot];
+	rio = samples->rio[slot];
+	tio = samples->tio[slot];
+	faults = samples->faults[slot];
+}
@@ -0,0 +1,137 @@
+//Per-process sample storage shared by every collector.
+
+#ifndef RESOURCEMONITOR_PROCESSSAMPLES_H
+#define RESOURCEMONITOR_PROCESSSAMPLES_H
+
+#include "Platform.h"
+#include <string>
+#include <vector>
+
+using namespace std;
+
+//Raw counter type of the collector in use. PDH needs the whole raw counter
+// to calculate rates, procfs counters are plain running totals.
+#ifdef _WIN32
+#include <Pdh.h>
+typedef PDH_RAW_COUNTER RawCounter;
+#else
+typedef unsigned long long RawCounter;
+#endif
+
+//Name or command line id of a process not read yet. NameTable gives it as
+// an empty name.
+const DWORD UNKNOWN_NAME_ID = 0xFFFFFFFF;
+
+//Command lines are cut to this many characters
+const DWORD MAX_COMMAND_LENGTH = 512;
+
+//One tick of per-process samples, stored as a structure of arrays.
+//The arrays only grow, so once the largest process count has been seen a
+// tick does not allocate. Collectors keep two and swap them every tick.
+class ProcessSamples {
+public:
+	ProcessSamples();//Constructor
+	~ProcessSamples();
+
+	//Empties the samples and makes room for at least capacity processes.
+	void Clear(DWORD capacity);
+
+	//Adds a process with zeroed values and an unknown command line and
+	// parent, and returns its slot. Clear() must have made room for it.
+	DWORD Add(int PID, unsigned long long start_time, DWORD name_id);
+
+	DWORD count;
+	int* PID;
+	unsigned long long* start_time;//Tells apart processes reusing a PID
+	DWORD* name_id;//See NameTable
+
+	//Identity, read once per process: collectors fill it in for processes
+	// new to the tick, the join carries it over from the last tick for the
+	// rest, and it goes with the process when it exits.
+	DWORD* command_id;//Of the collector's command line table
+	int* parent_PID;//-1 if unknown
+
+	RawCounter* raw_cpu;//CPU %
+	RawCounter* raw_wio;//Write I/O bytes
+	RawCounter* raw_rio;//Read I/O bytes
+	unsigned long long* raw_io_time;//Monotonic time raw_wio and raw_rio were read, 0 if not this tick
+	int* processor;//Core last run on, -1 if unknown
+	unsigned long long* raw_faults;//Major page faults, 0 where not collected
+	double* cpu;
+	long long* wio;
+	long long* rio;
+	long long* tio;//Total rio + wio
+	long long* faults;//Major page faults per second
+
+private:
+	void Free();
+
+	DWORD capacity;
+
+	//Not copyable
+	ProcessSamples(const ProcessSamples&);
+	ProcessSamples& operator=(const ProcessSamples&);
+};
+
+//Interned process names. Each distinct name is stored once and known by a
+// small integer id, so samples carry ids instead of strings.
+//Names of exited processes stay until Compact() drops them, so a host
+// starting processes with ever new command lines does not grow it forever.
+class NameTable {
+public:
+	NameTable();//Constructor
+
+	//Return the id of the name, adding it if it is new.
+	//PDH names are wide, procfs process names are bytes widened one to one.
+	//Command lines are decoded before they are interned.
+	DWORD Intern(const wchar_t* name, size_t length);
+	DWORD Intern(const char* name, size_t length);
+
+	//Null terminated. Only valid until the next Intern() call.
+	//UNKNOWN_NAME_ID gives an empty name.
+	const wchar_t* GetName(DWORD name_id) const;
+	size_t GetLength(DWORD name_id) const;
+
+	//Ids are given out in order, from 0 to the count - 1.
+	DWORD GetCount() const;
+
+	//Makes room for name_count names of text_length characters in all, so
+	// interning them does not allocate.
+	void Reserve(DWORD name_count, size_t text_length);
+
+	//Drops every name not in ids and renumbers the rest in order, rewriting
+	// ids to match. UNKNOWN_NAME_ID is left as it is. Ids held anywhere else
+	// become invalid. Does not allocate once the table has stopped growing.
+	void Compact(DWORD* ids, DWORD count);
+
+private:
+	template <typename Char> DWORD InternRange(const Char* name, size_t length);
+	void Grow();
+	void Rehash();
+
+	vector<wchar_t> text;//Every name, null terminated
+	vector<DWORD> offsets;//Start of each name in text, by id
+	vector<DWORD> lengths;//By id
+	vector<DWORD> hash_table;//id + 1, 0 if empty. Open addressing.
+	vector<DWORD> new_ids;//Used by Compact(), by old id
+};
+
+//The process picked as the bottleneck, copied out of the samples for output.
+//Keep one across ticks so the name buffers are reused, the command line's is
+// made big enough for any up front.
+struct BottleneckProcess {
+	int PID;
+	wstring name;
+	double cpu;
+	long long wio;
+	long long rio;
+	long long tio;
+	long long faults;
+	int parent_PID;//-1 if unknown
+	wstring command;//Empty if unknown
+	BottleneckProcess();//Constructor
+	void Clear();
+	void Copy(const ProcessSamples* samples, DWORD slot, const NameTable* names, const NameTable* commands);
+};
+
+#endif
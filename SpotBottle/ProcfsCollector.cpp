@@ -0,0 +1,863 @@
+#ifndef _WIN32
+
+#include "ProcfsCollector.h"
+#include "StringHelpers.h"
+#include <algorithm>
+#include <iostream>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <wchar.h>
+#include <dirent.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+
+using namespace std;
+
+ProcfsCollector::ProcfsCollector() {
+	//Constructor
+	last_sample_time = 0;
+	cpu_busy = 0;
+	cpu_total = 0;
+	clock_ticks_per_second = (double)sysconf(_SC_CLK_TCK);
+	if (clock_ticks_per_second <= 0) clock_ticks_per_second = 100.0;
+	proc_dir_fd = -1;
+	thread_PID = 0;
+	thread_start_time = 0;
+	thread_sample_time = 0;
+	cgroup_root_checked = false;
+	cgroup_scan_time = 0;
+	cgroup_sample_time = 0;
+	memset(pressure_totals, 0, sizeof(pressure_totals));
+	for (DWORD resource = 0; resource < PRESSURE_COUNT; ++resource) pressure_opened[resource] = false;
+	dirent_buffer.resize(32768);
+	thread_states_old.reserve(256);
+	thread_states_new.reserve(256);
+}
+
+ProcfsCollector::~ProcfsCollector() {
+	if (proc_dir_fd != -1) close(proc_dir_fd);
+}
+
+bool ProcfsCollector::Open() {
+	//Keep the system-wide files open, they are re-read every tick
+	stat_file.Open("/proc/stat");
+	diskstats_file.Open("/proc/diskstats");
+	net_dev_file.Open("/proc/net/dev");
+	meminfo_file.Open("/proc/meminfo");
+	pressure_opened[pressure_cpu] = pressure_files[pressure_cpu].Open("/proc/pressure/cpu");
+	pressure_opened[pressure_io] = pressure_files[pressure_io].Open("/proc/pressure/io");
+	pressure_opened[pressure_memory] = pressure_files[pressure_memory].Open("/proc/pressure/memory");
+
+	//Collect first sample, the totals are only useful as differences.
+	if (!ReadCpuTimes(&cpu_busy, &cpu_total)) {
+		wcout << "Could not read /proc/stat." << endl;
+		return false;
+	}
+	ReadDisks(0.0);
+	last_sample_time = GetMonotonicNanoseconds();
+	ReadNetworks(0.0, last_sample_time);
+	PressureSample pressure[PRESSURE_COUNT];
+	ReadPressure(0.0, pressure);
+	proc_dir_fd = open("/proc", O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+	if (proc_dir_fd == -1) {
+		wcout << "Could not open /proc." << endl;
+		return false;
+	}
+	return true;
+}
+
+void ProcfsCollector::SetThreadCount(DWORD thread_count) {
+	Collector::SetThreadCount(thread_count);
+	process_reader.SetWorkerCount(workers.GetWorkerCount());
+}
+
+bool ProcfsCollector::CollectSystem(SystemSample* sample) {
+	unsigned long long now = GetMonotonicNanoseconds();
+	double elapsed_ms = (now - last_sample_time) / 1000000.0;
+	if (elapsed_ms <= 0.0) return false;
+	last_sample_time = now;
+
+	////////// CPU % //////////
+	unsigned long long busy = 0;
+	unsigned long long total = 0;
+	if (!ReadCpuTimes(&busy, &total)) return false;
+	SummarizeCores(sample);
+	if ((total > cpu_total) && (busy >= cpu_busy)) {
+		sample->cpu_pct = (double)(busy - cpu_busy) / (double)(total - cpu_total) * 100.0;
+	}
+	else {
+		sample->cpu_pct = 0.0;
+	}
+	cpu_busy = busy;
+	cpu_total = total;
+
+	////////// Disk %s //////////
+	sample->highest_disk_usage = ReadDisks(elapsed_ms);
+	SummarizeDisks(sample);
+
+	////////// Network I/O bytes //////////
+	if (ReadNetworks(elapsed_ms, now)) SummarizeInterfaces(sample);
+
+	////////// RAM % //////////
+	sample->ram_pct = ReadPercentUsedRAM();
+
+	////////// Stall % //////////
+	ReadPressure(elapsed_ms, sample->pressure);
+	return true;
+}
+
+bool ProcfsCollector::ReadCpuTimes(unsigned long long* busy, unsigned long long* total) {
+	//First line of /proc/stat: cpu user nice system idle iowait irq softirq steal ...
+	//Then a cpuN line of the same fields per online core.
+	long length = stat_file.Read(&read_buffer);
+	if (length <= 4) return false;
+	const char* line = read_buffer.data();
+	const char* end = line + length;
+	if (strncmp(line, "cpu ", 4) != 0) return false;
+	core_count = 0;
+	while ((line < end) && (strncmp(line, "cpu", 3) == 0)) {
+		const char* line_end = NextLine(line, end);
+		const char* text = line + 3;
+		bool is_core = (*text >= '0') && (*text <= '9');
+		DWORD core_number = is_core ? (DWORD)ScanUnsigned(&text, line_end) : 0;
+		unsigned long long fields[8] = { 0 };
+		for (int n = 0; n < 8; ++n) fields[n] = ScanUnsigned(&text, line_end);
+		unsigned long long line_total = 0;
+		for (int n = 0; n < 8; ++n) line_total += fields[n];
+		//Idle and I/O wait time are not busy
+		unsigned long long line_busy = line_total - fields[3] - fields[4];
+		if (!is_core) {
+			*busy = line_busy;
+			*total = line_total;
+		}
+		else {
+			//Offline cores have no line, so they stay at 0 until they return
+			if (core_number >= core_pcts.size()) {
+				core_pcts.resize(core_number + 1, 0.0);
+				core_busy.resize(core_number + 1, 0);
+				core_total.resize(core_number + 1, 0);
+			}
+			if ((line_total > core_total[core_number]) && (line_busy >= core_busy[core_number])) {
+				core_pcts[core_number] = (double)(line_busy - core_busy[core_number]) / (double)(line_total - core_total[core_number]) * 100.0;
+			}
+			else core_pcts[core_number] = 0.0;
+			core_busy[core_number] = line_busy;
+			core_total[core_number] = line_total;
+			if (core_number + 1 > core_count) core_count = core_number + 1;
+		}
+		line = line_end;
+	}
+	return true;
+}
+
+double ProcfsCollector::ReadDisks(double elapsed_ms) {
+	//Lines of /proc/diskstats: major minor name, then the I/O statistics.
+	//Statistics are differences over the elapsed time, like iostat's:
+	// reads and writes completed, sectors, milliseconds spent on them, and the
+	// milliseconds spent doing I/O (10th) and weighted by the I/Os in flight
+	// (11th). Their differences over the elapsed milliseconds are the percent
+	// disk time and the average queue depth.
+	long length = diskstats_file.Read(&read_buffer);
+	disk_count = 0;
+	if (length <= 0) return 0.0;
+	double highest_disk_usage = 0.0;
+	const char* line = read_buffer.data();
+	const char* end = line + length;
+	while (line < end) {
+		const char* line_end = NextLine(line, end);
+		const char* text = line;
+		while ((text < line_end) && (*text == ' ')) ++text;
+		const char* name_start = SkipFields(text, line_end, 2);//major minor name
+		const char* name_end = name_start;
+		while ((name_end < line_end) && (*name_end != ' ') && (*name_end != '\n')) ++name_end;
+		text = name_end;
+		unsigned long long fields[11] = { 0 };
+		for (int field = 0; field < 11; ++field) fields[field] = ScanUnsigned(&text, line_end);
+
+		//Find the disk, adding it if it is new
+		size_t name_length = name_end - name_start;
+		DiskState* disk = 0;
+		for (size_t n = 0; n < disk_states.size(); ++n) {
+			if ((disk_states[n].name.length() == name_length) && (disk_states[n].name.compare(0, name_length, name_start, name_length) == 0)) {
+				disk = &disk_states[n];
+				break;
+			}
+		}
+		bool is_new = (disk == 0);
+		if (is_new) {
+			//Only whole physical disks have a device link, like Windows' PhysicalDisk
+			DiskState new_disk;
+			new_disk.name.assign(name_start, name_length);
+			new_disk.wide_name = WidenString(new_disk.name.c_str());
+			string device_path = "/sys/block/" + new_disk.name + "/device";
+			new_disk.physical = (access(device_path.c_str(), F_OK) == 0);
+			disk_states.push_back(new_disk);
+			disk = &disk_states.back();
+		}
+		if (disk->physical) {
+			DiskSample* sample = AddDisk();
+			sample->name.assign(disk->wide_name);
+			if (!is_new && (elapsed_ms > 0.0) && (fields[9] >= disk->io_ticks)) {
+				double per_second = 1000.0 / elapsed_ms;
+				//Counters wrap on 32-bit kernels, a wrapped one reads as 0 for a tick
+				unsigned long long reads = (fields[0] >= disk->reads) ? fields[0] - disk->reads : 0;
+				unsigned long long writes = (fields[4] >= disk->writes) ? fields[4] - disk->writes : 0;
+				unsigned long long read_sectors = (fields[2] >= disk->read_sectors) ? fields[2] - disk->read_sectors : 0;
+				unsigned long long write_sectors = (fields[6] >= disk->write_sectors) ? fields[6] - disk->write_sectors : 0;
+				unsigned long long read_ms = (fields[3] >= disk->read_ms) ? fields[3] - disk->read_ms : 0;
+				unsigned long long write_ms = (fields[7] >= disk->write_ms) ? fields[7] - disk->write_ms : 0;
+				unsigned long long queue_ms = (fields[10] >= disk->time_in_queue) ? fields[10] - disk->time_in_queue : 0;
+				sample->busy_pct = (fields[9] - disk->io_ticks) / elapsed_ms * 100.0;
+				sample->read_iops = reads * per_second;
+				sample->write_iops = writes * per_second;
+				sample->read_bytes = (unsigned long long)(read_sectors * 512 * per_second);
+				sample->write_bytes = (unsigned long long)(write_sectors * 512 * per_second);
+				sample->await_ms = ((reads + writes) > 0) ? (double)(read_ms + write_ms) / (reads + writes) : 0.0;
+				sample->queue_depth = queue_ms / elapsed_ms;
+				if (sample->busy_pct > highest_disk_usage) highest_disk_usage = sample->busy_pct;
+			}
+			else sample->Clear();
+		}
+		disk->reads = fields[0];
+		disk->read_sectors = fields[2];
+		disk->read_ms = fields[3];
+		disk->writes = fields[4];
+		disk->write_sectors = fields[6];
+		disk->write_ms = fields[7];
+		disk->io_ticks = fields[9];
+		disk->time_in_queue = fields[10];
+		line = line_end;
+	}
+	return highest_disk_usage;
+}
+
+bool ProcfsCollector::ReadNetworks(double elapsed_ms, unsigned long long now) {
+	//Lines of /proc/net/dev after two header lines: name: 8 receive fields, 8 transmit fields
+	//Loopback and virtual interfaces are skipped by default, their traffic is
+	// counted again on the physical interface it leaves through.
+	long length = net_dev_file.Read(&read_buffer);
+	interface_count = 0;
+	if (length <= 0) return false;
+	for (size_t n = 0; n < net_states.size(); ++n) net_states[n].seen = false;
+	const char* line = read_buffer.data();
+	const char* end = line + length;
+	while (line < end) {
+		const char* line_end = NextLine(line, end);
+		const char* colon = (const char*)memchr(line, ':', line_end - line);
+		if (colon != 0) {
+			const char* name = line;
+			while (*name == ' ') ++name;
+			size_t name_length = colon - name;
+			const char* text = colon + 1;
+			unsigned long long fields[9] = { 0 };
+			for (int n = 0; n < 9; ++n) fields[n] = ScanUnsigned(&text, line_end);
+
+			//Find the interface, adding it if it is new
+			NetState* state = 0;
+			for (size_t n = 0; n < net_states.size(); ++n) {
+				if ((net_states[n].name.length() == name_length) && (net_states[n].name.compare(0, name_length, name, name_length) == 0)) {
+					state = &net_states[n];
+					break;
+				}
+			}
+			if (state == 0) {
+				NetState new_state;
+				new_state.name.assign(name, name_length);
+				new_state.wide_name = WidenString(new_state.name.c_str());
+				new_state.loopback = (new_state.name == "lo");
+				string device_path = "/sys/class/net/" + new_state.name + "/device";
+				new_state.physical = (access(device_path.c_str(), F_OK) == 0);
+				new_state.speed_path = "/sys/class/net/" + new_state.name + "/speed";
+				new_state.recv = fields[0];
+				new_state.sent = fields[8];
+				new_state.speed = ReadLinkSpeed(&new_state);
+				new_state.speed_time = now;
+				net_states.push_back(new_state);
+				state = &net_states.back();
+			}
+			else if (now - state->speed_time >= 10000000000ULL) {
+				//Speeds change when links renegotiate, but rarely
+				state->speed = ReadLinkSpeed(state);
+				state->speed_time = now;
+			}
+			state->seen = true;
+
+			//Counters going back mean the interface was recreated, 0 for a tick
+			unsigned long long recv = (fields[0] >= state->recv) ? fields[0] - state->recv : 0;
+			unsigned long long sent = (fields[8] >= state->sent) ? fields[8] - state->sent : 0;
+			state->recv_bytes = (elapsed_ms > 0.0) ? (unsigned long long)(recv * 1000.0 / elapsed_ms) : 0;
+			state->sent_bytes = (elapsed_ms > 0.0) ? (unsigned long long)(sent * 1000.0 / elapsed_ms) : 0;
+			state->recv = fields[0];
+			state->sent = fields[8];
+		}
+		line = line_end;
+	}
+
+	//Keep the included interfaces. Virtual ones are skipped only if a
+	// physical one is counted, a container may have nothing but a veth.
+	bool has_physical = false;
+	for (size_t n = 0; n < net_states.size(); ++n) {
+		const NetState* state = &net_states[n];
+		if (state->seen && state->physical && InterfaceIsIncluded(state->wide_name.c_str(), state->wide_name.length(), state->loopback, false)) {
+			has_physical = true;
+		}
+	}
+	for (size_t n = 0; n < net_states.size(); ++n) {
+		const NetState* state = &net_states[n];
+		if (!state->seen) continue;
+		bool skip_virtual = has_physical && !state->physical;
+		if (!InterfaceIsIncluded(state->wide_name.c_str(), state->wide_name.length(), state->loopback, skip_virtual)) continue;
+		InterfaceSample* sample = AddInterface();
+		sample->name.assign(state->wide_name);
+		sample->recv_bytes = state->recv_bytes;
+		sample->sent_bytes = state->sent_bytes;
+		sample->speed = state->speed;
+		sample->recv_pct = (state->speed > 0) ? state->recv_bytes * 8 * 100.0 / state->speed : 0.0;
+		sample->sent_pct = (state->speed > 0) ? state->sent_bytes * 8 * 100.0 / state->speed : 0.0;
+	}
+	return true;
+}
+
+unsigned long long ProcfsCollector::ReadLinkSpeed(const NetState* state) {
+	//Mb/s, or -1 and read errors for links that are down or have no speed,
+	// like wireless and virtual ones
+	long length = ReadWholeFile(state->speed_path.c_str(), &speed_buffer);
+	if (length <= 0) return 0;
+	const char* text = speed_buffer.data();
+	if (*text == '-') return 0;
+	return ScanUnsigned(&text, text + length) * 1000000ULL;
+}
+
+double ProcfsCollector::ReadPercentUsedRAM() {
+	//Used RAM is what is not available, matching GlobalMemoryStatusEx() on Windows.
+	long length = meminfo_file.Read(&read_buffer);
+	if (length <= 0) return 0.0;
+	const char* end = read_buffer.data() + length;
+	unsigned long long total = 0;
+	unsigned long long available = 0;
+	const char* text = strstr(read_buffer.data(), "MemTotal:");
+	if (text != 0) {
+		text += 9;
+		total = ScanUnsigned(&text, end);
+	}
+	text = strstr(read_buffer.data(), "MemAvailable:");
+	if (text != 0) {
+		text += 13;
+		available = ScanUnsigned(&text, end);
+	}
+	if ((total == 0) || (available > total)) return 0.0;
+	return (double)(total - available) / (double)total * 100;
+}
+
+void ProcfsCollector::ReadPressure(double elapsed_ms, PressureSample* pressure) {
+	//Each file has a "some" line and, except cpu on kernels before 5.13, a
+	// "full" line: some avg10=0.00 avg60=0.00 avg300=0.00 total=12345
+	for (DWORD resource = 0; resource < PRESSURE_COUNT; ++resource) {
+		PressureSample* resource_pressure = &pressure[resource];
+		long length = pressure_opened[resource] ? pressure_files[resource].Read(&read_buffer) : -1;
+		resource_pressure->available = (length > 0);
+		resource_pressure->some_pct = 0.0;
+		resource_pressure->full_pct = 0.0;
+		resource_pressure->some_avg10 = 0.0;
+		resource_pressure->full_avg10 = 0.0;
+		if (length <= 0) continue;
+		const char* line = read_buffer.data();
+		const char* end = line + length;
+		while (line < end) {
+			const char* line_end = NextLine(line, end);
+			bool full = (strncmp(line, "full ", 5) == 0);
+			const char* avg10 = strstr(line, "avg10=");
+			const char* total_text = strstr(line, "total=");
+			if ((avg10 != 0) && (total_text != 0) && (avg10 < line_end) && (total_text < line_end)) {
+				double average = strtod(avg10 + 6, 0);
+				total_text += 6;
+				unsigned long long total = ScanUnsigned(&total_text, line_end);
+				unsigned long long* last_total = &pressure_totals[resource][full ? 1 : 0];
+				double pct = 0.0;
+				if ((elapsed_ms > 0.0) && (total >= *last_total)) pct = (total - *last_total) / 1000.0 / elapsed_ms * 100.0;
+				if (pct > 100.0) pct = 100.0;
+				*last_total = total;
+				if (full) {
+					resource_pressure->full_pct = pct;
+					resource_pressure->full_avg10 = average;
+				}
+				else {
+					resource_pressure->some_pct = pct;
+					resource_pressure->some_avg10 = average;
+				}
+			}
+			line = line_end;
+		}
+	}
+}
+
+bool ProcfsCollector::ListPIDs() {
+	//Lists the numeric entries of /proc into PIDs.
+	//Uses getdents64 on a descriptor kept open, opendir() would allocate every tick.
+	PIDs.clear();
+	if (lseek(proc_dir_fd, 0, SEEK_SET) == -1) return false;
+	while (true) {
+		long bytes = syscall(SYS_getdents64, proc_dir_fd, dirent_buffer.data(), dirent_buffer.size());
+		if (bytes < 0) return false;
+		if (bytes == 0) break;
+		long offset = 0;
+		while (offset < bytes) {
+			//struct linux_dirent64: ino, off, reclen, type, name
+			const char* entry = dirent_buffer.data() + offset;
+			unsigned short record_length;
+			memcpy(&record_length, entry + 16, sizeof(record_length));
+			const char* name = entry + 19;
+			if ((*name >= '0') && (*name <= '9')) {
+				const char* text = name;
+				PIDs.push_back((int)ScanUnsigned(&text, name + 20));
+			}
+			offset += record_length;
+		}
+	}
+	//Headroom, so a few more processes next tick do not reallocate
+	if (PIDs.capacity() < PIDs.size() + 64) PIDs.reserve(PIDs.size() + PIDs.size() / 4 + 64);
+	return true;
+}
+
+bool ProcfsCollector::SampleProcessRaw() {
+	//List the PIDs first so the samples can make room once
+	if (!ListPIDs()) {
+		wcout << "Could not list /proc." << endl;
+		return false;
+	}
+	if (PIDs.size() == 0) return false;
+
+	process_sample_time_new = GetMonotonicNanoseconds();
+
+	//Reading the files is most of the work, so it is split across the workers
+	DWORD process_count = (DWORD)PIDs.size();
+	records.resize(process_count);
+	process_reader.BeginTick(process_count);
+	workers.Run(process_count, MIN_PROCESSES_PER_WORKER, ReadProcesses, this);
+	process_reader.EndTick();
+
+	samples_new->Clear(process_count);
+	pid_index_new->Clear(process_count);
+	slot_records.resize(process_count);
+	for (DWORD n = 0; n < process_count; ++n) {
+		const ProcessRecord* record = &records[n];
+		if (!record->exists) continue;//Process exited
+		//Interning is the one part not split across the workers, so names are
+		// left to the join and SampleRankedDetail() unless all are needed
+		DWORD name_id = sample_names ? names.Intern(record->name, record->name_length) : UNKNOWN_NAME_ID;
+		DWORD slot = samples_new->Add(PIDs[n], record->start_time, name_id);
+		slot_records[slot] = n;
+		samples_new->parent_PID[slot] = record->parent_PID;
+		pid_index_new->Insert(PIDs[n], record->start_time, slot);
+		samples_new->raw_cpu[slot] = record->raw_cpu;
+		samples_new->raw_rio[slot] = record->raw_rio;
+		samples_new->raw_wio[slot] = record->raw_wio;
+		if (record->io_read) samples_new->raw_io_time[slot] = process_sample_time_new;
+		samples_new->processor[slot] = record->processor;
+		samples_new->raw_faults[slot] = record->raw_faults;
+	}
+	return true;
+}
+
+void ProcfsCollector::ReadProcesses(void* context, DWORD worker, DWORD begin, DWORD end) {
+	ProcfsCollector* collector = (ProcfsCollector*)context;
+	for (DWORD n = begin; n < end; ++n) {
+		ProcessRecord* record = &collector->records[n];
+		ProcStat stat;
+		ProcIo io;
+		record->exists = collector->process_reader.ReadProcess(worker, n, collector->PIDs[n], collector->sample_io, &stat, &io, &record->io_read);
+		if (!record->exists) continue;
+
+		size_t name_length = stat.name_length;
+		if (name_length > sizeof(record->name)) name_length = sizeof(record->name);
+		memcpy(record->name, stat.name, name_length);
+		record->name_length = (unsigned char)name_length;
+		record->start_time = stat.start_time;
+		record->raw_cpu = stat.utime + stat.stime;
+		record->processor = stat.processor;
+		record->raw_faults = stat.major_faults;
+		record->parent_PID = stat.ppid;
+
+		//rchar and wchar count all read and write calls, like Windows'
+		// IO Read/Write Bytes.
+		record->raw_rio = io.rchar;
+		record->raw_wio = io.wchar;
+	}
+}
+
+void ProcfsCollector::SampleRankedDetail() {
+	//Names come from the stat records, which last until the next tick. The
+	// command line is the one extra read, once per process.
+	for (DWORD rank = 0; rank < GetRankedCount(); ++rank) {
+		DWORD slot = (DWORD)GetRankedIndex(rank);
+		if (samples_new->name_id[slot] == UNKNOWN_NAME_ID) {
+			const ProcessRecord* record = &records[slot_records[slot]];
+			samples_new->name_id[slot] = names.Intern(record->name, record->name_length);
+		}
+		if (samples_new->command_id[slot] == UNKNOWN_NAME_ID) {
+			samples_new->command_id[slot] = ReadCommandLine(samples_new->PID[slot]);
+		}
+	}
+}
+
+DWORD ProcfsCollector::ReadCommandLine(int PID) {
+	//Arguments are null terminated, long ones are cut
+	char path[32];
+	char text[MAX_COMMAND_LENGTH];
+	snprintf(path, sizeof(path), "/proc/%d/cmdline", PID);
+	ssize_t length = 0;
+	int fd = open(path, O_RDONLY | O_CLOEXEC);
+	if (fd != -1) {
+		length = read(fd, text, sizeof(text));
+		close(fd);
+		if (length < 0) length = 0;
+	}
+	bool cut = (length == (ssize_t)sizeof(text));
+	while ((length > 0) && (text[length - 1] == 0)) --length;
+	for (ssize_t n = 0; n < length; ++n) {
+		if (text[n] == 0) text[n] = ' ';
+	}
+
+	//Decoded with the locale like WidenString(), without allocating. A
+	// character cut off by the length limit is dropped, other bytes that
+	// cannot be converted are copied as they are.
+	wchar_t wide_text[MAX_COMMAND_LENGTH];
+	size_t wide_length = 0;
+	mbstate_t state;
+	memset(&state, 0, sizeof(state));
+	ssize_t position = 0;
+	while (position < length) {
+		size_t used = mbrtowc(&wide_text[wide_length], text + position, (size_t)(length - position), &state);
+		if ((used == (size_t)-2) && cut) break;
+		if ((used == (size_t)-1) || (used == (size_t)-2)) {
+			wide_text[wide_length] = (unsigned char)text[position];
+			memset(&state, 0, sizeof(state));
+			used = 1;
+		}
+		++wide_length;
+		position += (ssize_t)used;
+	}
+	return commands.Intern(wide_text, wide_length);
+}
+
+bool ProcfsCollector::ThreadIsBefore(const ThreadState& first, const ThreadState& second) {
+	return first.TID < second.TID;
+}
+
+bool ProcfsCollector::ReadThreads(int PID) {
+	//Lists /proc/[pid]/task like ListPIDs(), then reads each thread's stat
+	// and io. The files are opened per read, only one process is scanned.
+	thread_states_new.clear();
+	char path[96];
+	snprintf(path, sizeof(path), "/proc/%d/task", PID);
+	int task_dir_fd = open(path, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+	if (task_dir_fd == -1) return false;
+	while (true) {
+		long bytes = syscall(SYS_getdents64, task_dir_fd, dirent_buffer.data(), dirent_buffer.size());
+		if (bytes <= 0) break;
+		long offset = 0;
+		while (offset < bytes) {
+			const char* entry = dirent_buffer.data() + offset;
+			unsigned short record_length;
+			memcpy(&record_length, entry + 16, sizeof(record_length));
+			const char* name = entry + 19;
+			offset += record_length;
+			if ((*name < '0') || (*name > '9')) continue;
+			const char* text = name;
+			int TID = (int)ScanUnsigned(&text, name + 20);
+
+			snprintf(path, sizeof(path), "/proc/%d/task/%d/stat", PID, TID);
+			ProcStat stat;
+			long length = ReadWholeFile(path, &read_buffer);
+			if ((length <= 0) || !ParseProcStat(read_buffer.data(), length, &stat)) continue;//Thread exited
+			ThreadState state;
+			state.TID = TID;
+			state.name_length = (unsigned char)((stat.name_length < sizeof(state.name)) ? stat.name_length : sizeof(state.name));
+			memcpy(state.name, stat.name, state.name_length);
+			state.raw_cpu = stat.utime + stat.stime;
+			state.raw_faults = stat.major_faults;
+
+			//I/O, not readable for other users' processes without root
+			snprintf(path, sizeof(path), "/proc/%d/task/%d/io", PID, TID);
+			ProcIo io;
+			memset(&io, 0, sizeof(io));
+			length = ReadWholeFile(path, &read_buffer);
+			if ((length > 0) && !ParseProcIo(read_buffer.data(), length, &io)) memset(&io, 0, sizeof(io));
+			state.raw_rio = io.rchar;
+			state.raw_wio = io.wchar;
+			thread_states_new.push_back(state);
+		}
+	}
+	close(task_dir_fd);
+	sort(thread_states_new.begin(), thread_states_new.end(), ThreadIsBefore);
+	return thread_states_new.size() > 0;
+}
+
+bool ProcfsCollector::CollectThreads(bottleneck_causes cause, DWORD slot, DWORD rank_count) {
+	//Both lists are sorted by TID, so they are joined in one pass.
+	thread_count = 0;
+	RankThreads(cause, rank_count);//None until this tick's are read
+	if (replay != 0) return false;
+	int PID = samples_new->PID[slot];
+	unsigned long long start_time = samples_new->start_time[slot];
+	unsigned long long now = GetMonotonicNanoseconds();
+	bool same_process = (PID == thread_PID) && (start_time == thread_start_time);
+	double elapsed_seconds = (now - thread_sample_time) / 1000000000.0;
+	thread_states_old.swap(thread_states_new);
+	bool read = ReadThreads(PID);
+	thread_PID = PID;
+	thread_start_time = start_time;
+	thread_sample_time = now;
+	if (!read) return false;
+	if (!same_process || (elapsed_seconds <= 0.0)) return true;
+
+	size_t old_index = 0;
+	for (size_t n = 0; n < thread_states_new.size(); ++n) {
+		const ThreadState* state = &thread_states_new[n];
+		while ((old_index < thread_states_old.size()) && (thread_states_old[old_index].TID < state->TID)) ++old_index;
+		if ((old_index == thread_states_old.size()) || (thread_states_old[old_index].TID != state->TID)) continue;//New thread
+		const ThreadState* old_state = &thread_states_old[old_index];
+		ThreadSample* thread = AddThread();
+		thread->TID = state->TID;
+		thread->name.resize(state->name_length);
+		for (DWORD character = 0; character < state->name_length; ++character) {
+			thread->name[character] = (wchar_t)(unsigned char)state->name[character];
+		}
+		thread->cpu = (state->raw_cpu >= old_state->raw_cpu) ? (state->raw_cpu - old_state->raw_cpu) / clock_ticks_per_second / elapsed_seconds * 100.0 : 0.0;
+		thread->rio = (state->raw_rio >= old_state->raw_rio) ? (long long)((state->raw_rio - old_state->raw_rio) / elapsed_seconds) : 0;
+		thread->wio = (state->raw_wio >= old_state->raw_wio) ? (long long)((state->raw_wio - old_state->raw_wio) / elapsed_seconds) : 0;
+		thread->faults = (state->raw_faults >= old_state->raw_faults) ? (long long)((state->raw_faults - old_state->raw_faults) / elapsed_seconds) : 0;
+	}
+	RankThreads(cause, rank_count);
+	return true;
+}
+
+bool ProcfsCollector::CgroupIsBefore(const CgroupState& first, const CgroupState& second) {
+	return first.path < second.path;
+}
+
+void ProcfsCollector::FindCgroupRoot() {
+	//Lines of /proc/self/mounts: device mount_point type options 0 0
+	//On hybrid systems cgroup2 is mounted beside v1, often at /sys/fs/cgroup/unified.
+	cgroup_root_checked = true;
+	cgroup_root.clear();
+	long length = ReadWholeFile("/proc/self/mounts", &read_buffer);
+	if (length <= 0) return;
+	const char* line = read_buffer.data();
+	const char* end = line + length;
+	while (line < end) {
+		const char* line_end = NextLine(line, end);
+		const char* mount_point = SkipFields(line, line_end, 1);
+		const char* type = SkipFields(mount_point, line_end, 1);
+		if ((line_end - type > 8) && (memcmp(type, "cgroup2 ", 8) == 0)) {
+			const char* mount_end = (const char*)memchr(mount_point, ' ', line_end - mount_point);
+			cgroup_root.assign(mount_point, mount_end - mount_point);
+			return;
+		}
+		line = line_end;
+	}
+}
+
+void ProcfsCollector::ScanCgroups() {
+	//Processes only live in leaves, cgroup v2 keeps them out of cgroups with
+	// children, so the leaves split the system without counting twice.
+	for (size_t n = 0; n < cgroup_states.size(); ++n) cgroup_states[n].seen = false;
+	size_t known_count = cgroup_states.size();
+	vector<string> pending(1, cgroup_root);
+	while (!pending.empty()) {
+		string path;
+		path.swap(pending.back());
+		pending.pop_back();
+		int dir_fd = open(path.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+		if (dir_fd == -1) continue;//Removed since listed
+		bool has_children = false;
+		while (true) {
+			long bytes = syscall(SYS_getdents64, dir_fd, dirent_buffer.data(), dirent_buffer.size());
+			if (bytes <= 0) break;
+			long offset = 0;
+			while (offset < bytes) {
+				const char* entry = dirent_buffer.data() + offset;
+				unsigned short record_length;
+				memcpy(&record_length, entry + 16, sizeof(record_length));
+				const char* name = entry + 19;
+				offset += record_length;
+				if ((entry[18] != DT_DIR) || (strcmp(name, ".") == 0) || (strcmp(name, "..") == 0)) continue;
+				has_children = true;
+				pending.push_back(path + "/" + name);
+			}
+		}
+		close(dir_fd);
+		if (has_children || (path == cgroup_root)) continue;
+
+		//A leaf, found before or new
+		CgroupState key;
+		key.path.swap(path);
+		vector<CgroupState>::iterator known = lower_bound(cgroup_states.begin(), cgroup_states.begin() + known_count, key, CgroupIsBefore);
+		if ((known != cgroup_states.begin() + known_count) && (known->path == key.path)) {
+			known->seen = true;
+			continue;
+		}
+		key.wide_name = WidenString(key.path.c_str() + cgroup_root.length());
+		key.seen = true;
+		key.counted = false;
+		key.usage_usec = 0;
+		key.read_bytes = 0;
+		key.write_bytes = 0;
+		cgroup_states.push_back(key);
+	}
+
+	//Drop the removed ones and sort the new ones in
+	size_t kept = 0;
+	for (size_t n = 0; n < cgroup_states.size(); ++n) {
+		if (!cgroup_states[n].seen) continue;
+		if (kept != n) swap(cgroup_states[kept], cgroup_states[n]);
+		++kept;
+	}
+	cgroup_states.resize(kept);
+	sort(cgroup_states.begin(), cgroup_states.end(), CgroupIsBefore);
+}
+
+bool ProcfsCollector::ReadCgroup(const CgroupState* state, unsigned long long* usage_usec,
+	unsigned long long* read_bytes, unsigned long long* write_bytes, unsigned long long* memory) {
+	//cpu.stat is always there, io.stat and memory.current only if their
+	// controllers are enabled for the cgroup.
+	char path[4200];
+	snprintf(path, sizeof(path), "%s/cpu.stat", state->path.c_str());
+	long length = ReadWholeFile(path, &read_buffer);
+	if (length <= 0) return false;
+	const char* line = read_buffer.data();
+	const char* end = line + length;
+	*usage_usec = 0;
+	for (; line < end; line = NextLine(line, end)) {
+		if ((end - line > 11) && (memcmp(line, "usage_usec ", 11) == 0)) {
+			const char* text = line + 11;
+			*usage_usec = ScanUnsigned(&text, end);
+			break;
+		}
+	}
+
+	//Lines of io.stat: major:minor rbytes=N wbytes=N rios=N wios=N ...
+	*read_bytes = 0;
+	*write_bytes = 0;
+	snprintf(path, sizeof(path), "%s/io.stat", state->path.c_str());
+	length = ReadWholeFile(path, &read_buffer);
+	line = read_buffer.data();
+	end = line + ((length > 0) ? length : 0);
+	while (line < end) {
+		const char* line_end = NextLine(line, end);
+		for (const char* field = SkipFields(line, line_end, 1); field < line_end; field = SkipFields(field, line_end, 1)) {
+			const char* text = field + 7;
+			if ((line_end - field > 7) && (memcmp(field, "rbytes=", 7) == 0)) *read_bytes += ScanUnsigned(&text, line_end);
+			else if ((line_end - field > 7) && (memcmp(field, "wbytes=", 7) == 0)) *write_bytes += ScanUnsigned(&text, line_end);
+		}
+		line = line_end;
+	}
+
+	*memory = 0;
+	snprintf(path, sizeof(path), "%s/memory.current", state->path.c_str());
+	length = ReadWholeFile(path, &read_buffer);
+	if (length > 0) {
+		const char* text = read_buffer.data();
+		*memory = ScanUnsigned(&text, text + length);
+	}
+	return true;
+}
+
+bool ProcfsCollector::CollectCgroups(bottleneck_causes cause, DWORD rank_count) {
+	//Rates are differences from the last call, like the threads'
+	cgroup_count = 0;
+	cgroup_sample_states.clear();
+	RankCgroups(cause, rank_count);//None until this tick's are read
+	if (replay != 0) return false;
+	if (!cgroup_root_checked) FindCgroupRoot();
+	if (cgroup_root.empty()) return false;
+	unsigned long long now = GetMonotonicNanoseconds();
+	if ((cgroup_scan_time == 0) || (now - cgroup_scan_time >= 10000000000ULL)) {
+		//Containers come and go, but not every tick
+		ScanCgroups();
+		cgroup_scan_time = now;
+	}
+	double elapsed_seconds = (now - cgroup_sample_time) / 1000000000.0;
+	cgroup_sample_time = now;
+	for (size_t n = 0; n < cgroup_states.size(); ++n) {
+		CgroupState* state = &cgroup_states[n];
+		unsigned long long usage_usec;
+		unsigned long long read_bytes;
+		unsigned long long write_bytes;
+		unsigned long long memory;
+		if (!ReadCgroup(state, &usage_usec, &read_bytes, &write_bytes, &memory)) {
+			state->counted = false;//Removed, or recreated before the next scan
+			continue;
+		}
+		if (state->counted && (elapsed_seconds > 0.0)) {
+			CgroupSample* cgroup = AddCgroup();
+			cgroup_sample_states.push_back((DWORD)n);
+			cgroup->name.assign(state->wide_name);
+			cgroup->cpu = (usage_usec >= state->usage_usec) ? (usage_usec - state->usage_usec) / 10000.0 / elapsed_seconds : 0.0;
+			cgroup->rio = (read_bytes >= state->read_bytes) ? (long long)((read_bytes - state->read_bytes) / elapsed_seconds) : 0;
+			cgroup->wio = (write_bytes >= state->write_bytes) ? (long long)((write_bytes - state->write_bytes) / elapsed_seconds) : 0;
+			cgroup->memory = memory;
+		}
+		state->counted = true;
+		state->usage_usec = usage_usec;
+		state->read_bytes = read_bytes;
+		state->write_bytes = write_bytes;
+	}
+	RankCgroups(cause, rank_count);
+	return true;
+}
+
+void ProcfsCollector::ForgetSamples() {
+	//Totals are kept per cgroup, the threads' only for one process
+	Collector::ForgetSamples();
+	thread_PID = 0;
+	thread_start_time = 0;
+	for (size_t n = 0; n < cgroup_states.size(); ++n) cgroup_states[n].counted = false;
+}
+
+void ProcfsCollector::LimitToCgroup(int rank) {
+	//cgroup.procs lists the PIDs in no particular order
+	limiting_PIDs = false;
+	if ((rank < 0) || ((DWORD)rank >= GetRankedCgroupCount())) return;
+	const CgroupState* state = &cgroup_states[cgroup_sample_states[GetRankedCgroup(rank) - cgroups.data()]];
+	char path[4200];
+	snprintf(path, sizeof(path), "%s/cgroup.procs", state->path.c_str());
+	long length = ReadWholeFile(path, &read_buffer);
+	if (length < 0) return;
+	limit_PIDs.clear();
+	const char* text = read_buffer.data();
+	const char* end = text + length;
+	while (text < end) {
+		limit_PIDs.push_back((int)ScanUnsigned(&text, end));
+		text = NextLine(text, end);
+	}
+	sort(limit_PIDs.begin(), limit_PIDs.end());
+	limiting_PIDs = true;
+}
+
+void ProcfsCollector::CalculateProcess(
+	DWORD slot_new,
+	DWORD slot_old,
+	bool need_cpu,
+	bool need_rio,
+	bool need_wio) {
+	//Rates are the difference of the running totals over the elapsed time.
+	//CPU % is summed over cores like PDH's Process % Processor Time.
+	double elapsed_seconds = (process_sample_time_new - process_sample_time_old) / 1000000000.0;
+	if (elapsed_seconds <= 0.0) return;
+	if (need_cpu && (samples_new->raw_cpu[slot_new] >= samples_old->raw_cpu[slot_old])) {
+		double cpu_seconds = (samples_new->raw_cpu[slot_new] - samples_old->raw_cpu[slot_old]) / clock_ticks_per_second;
+		samples_new->cpu[slot_new] = cpu_seconds / elapsed_seconds * 100.0;
+	}
+
+	if (need_wio && (samples_new->raw_wio[slot_new] >= samples_old->raw_wio[slot_old])) {
+		samples_new->wio[slot_new] = (long long)((samples_new->raw_wio[slot_new] - samples_old->raw_wio[slot_old]) / elapsed_seconds);
+	}
+	if (need_rio && (samples_new->raw_rio[slot_new] >= samples_old->raw_rio[slot_old])) {
+		samples_new->rio[slot_new] = (long long)((samples_new->raw_rio[slot_new] - samples_old->raw_rio[slot_old]) / elapsed_seconds);
+	}
+}
+
+#endif
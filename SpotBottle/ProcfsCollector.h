@@ -0,0 +1,190 @@
+//Linux collector reading the /proc filesystem directly.
+
+#ifndef RESOURCEMONITOR_PROCFSCOLLECTOR_H
+#define RESOURCEMONITOR_PROCFSCOLLECTOR_H
+
+#include "Collector.h"
+#include "ProcReader.h"
+#include <string>
+#include <vector>
+
+using namespace std;
+
+class ProcfsCollector : public Collector {
+public:
+	ProcfsCollector();//Constructor
+	~ProcfsCollector();
+	bool Open();
+	bool CollectSystem(SystemSample* sample);
+	void SetThreadCount(DWORD thread_count);
+	bool CollectThreads(bottleneck_causes cause, DWORD slot, DWORD rank_count);
+	bool CollectCgroups(bottleneck_causes cause, DWORD rank_count);
+	void LimitToCgroup(int rank);
+	void ForgetSamples();
+
+protected:
+	bool SampleProcessRaw();
+	void SampleRankedDetail();
+	void CalculateProcess(
+		DWORD slot_new,
+		DWORD slot_old,
+		bool need_cpu,
+		bool need_rio,
+		bool need_wio);
+
+private:
+	//Running totals of one /proc/diskstats device
+	struct DiskState {
+		string name;
+		wstring wide_name;
+		bool physical;//Partitions, loop and device-mapper devices are skipped
+		unsigned long long reads;//Completed
+		unsigned long long read_sectors;//512 bytes each
+		unsigned long long read_ms;//Summed over the reads, queueing included
+		unsigned long long writes;
+		unsigned long long write_sectors;
+		unsigned long long write_ms;
+		unsigned long long io_ticks;//Milliseconds spent doing I/O
+		unsigned long long time_in_queue;//Milliseconds weighted by the I/Os in flight
+	};
+
+	//Running totals of one /proc/net/dev interface
+	struct NetState {
+		string name;
+		wstring wide_name;
+		string speed_path;//Built once, read every few seconds
+		bool loopback;
+		bool physical;//Has a device link, bridges, tunnels and veths do not
+		bool seen;//Listed in the last read
+		unsigned long long recv;
+		unsigned long long sent;
+		unsigned long long recv_bytes;//Per second over the last tick
+		unsigned long long sent_bytes;
+		unsigned long long speed;//Bits per second, 0 if unknown
+		unsigned long long speed_time;//When speed was read, monotonic
+	};
+
+	//A process as read by a worker. Added to the samples afterwards, on one
+	// thread, because interning names is not thread safe.
+	struct ProcessRecord {
+		bool exists;
+		unsigned char name_length;
+		char name[32];//Names are at most 15 bytes, see TASK_COMM_LEN
+		unsigned long long start_time;
+		unsigned long long raw_cpu;
+		unsigned long long raw_rio;
+		unsigned long long raw_wio;
+		unsigned long long raw_faults;
+		int processor;
+		int parent_PID;
+		bool io_read;//False if raw_rio and raw_wio were not read
+	};
+
+	//Running totals of one thread of the /THREADS process
+	struct ThreadState {
+		int TID;
+		unsigned char name_length;
+		char name[16];//TASK_COMM_LEN
+		unsigned long long raw_cpu;
+		unsigned long long raw_rio;
+		unsigned long long raw_wio;
+		unsigned long long raw_faults;
+	};
+
+	//Running totals of one leaf cgroup
+	struct CgroupState {
+		string path;//Under the cgroup2 mount
+		wstring wide_name;//Relative to the mount
+		bool seen;//Found by the last scan
+		bool counted;//Totals read at least once
+		unsigned long long usage_usec;//CPU time
+		unsigned long long read_bytes;//Summed over the devices
+		unsigned long long write_bytes;
+	};
+
+	static bool CgroupIsBefore(const CgroupState& first, const CgroupState& second);
+
+	//Sets cgroup_root from /proc/self/mounts, empty without cgroup v2.
+	void FindCgroupRoot();
+	//Walks the hierarchy for its leaves, keeping the totals of ones already
+	// known. The walk allocates, so it is only redone every few seconds.
+	void ScanCgroups();
+	//Reads a cgroup's current totals. Returns false if it is gone.
+	bool ReadCgroup(const CgroupState* state, unsigned long long* usage_usec,
+		unsigned long long* read_bytes, unsigned long long* write_bytes, unsigned long long* memory);
+
+	static bool ThreadIsBefore(const ThreadState& first, const ThreadState& second);
+
+	//Reads the threads of a process from /proc/[pid]/task into
+	// thread_states_new, sorted by TID. Returns false if it is gone.
+	bool ReadThreads(int PID);
+
+	//Worker function reading the processes PIDs[begin] to PIDs[end - 1].
+	static void ReadProcesses(void* context, DWORD worker, DWORD begin, DWORD end);
+
+	//Each reads the running totals from its /proc file. Return false on failure.
+	//Percentages are calculated against the previous totals.
+	//Also fills the collector's core percentages from the cpuN lines.
+	bool ReadCpuTimes(unsigned long long* busy, unsigned long long* total);
+	//Also fills the collector's disks, returns the highest percent disk time.
+	double ReadDisks(double elapsed_ms);
+	//Fills the collector's interfaces with the included ones.
+	bool ReadNetworks(double elapsed_ms, unsigned long long now);
+	//Link speed of a /sys/class/net interface in bits per second, 0 if unknown.
+	unsigned long long ReadLinkSpeed(const NetState* state);
+	double ReadPercentUsedRAM();
+	//Fills the sample's pressure from /proc/pressure, stall times are
+	// differences of the running totals over the elapsed time.
+	void ReadPressure(double elapsed_ms, PressureSample* pressure);
+	bool ListPIDs();
+	//Interns the start of /proc/[pid]/cmdline with the arguments separated by
+	// spaces. Kernel threads have an empty one.
+	DWORD ReadCommandLine(int PID);
+
+	//Previous system-wide totals
+	unsigned long long last_sample_time;
+	unsigned long long cpu_busy;
+	unsigned long long cpu_total;
+	vector<unsigned long long> core_busy;//By core number
+	vector<unsigned long long> core_total;
+	vector<DiskState> disk_states;
+	vector<NetState> net_states;
+	unsigned long long pressure_totals[PRESSURE_COUNT][2];//Microseconds, some and full
+
+	double clock_ticks_per_second;
+
+	//Kept open between ticks
+	ProcFile stat_file;
+	ProcFile diskstats_file;
+	ProcFile net_dev_file;
+	ProcFile meminfo_file;
+	ProcFile pressure_files[PRESSURE_COUNT];
+	bool pressure_opened[PRESSURE_COUNT];//Missing without PSI, not retried
+	ProcReader process_reader;
+	int proc_dir_fd;
+
+	//Reused between reads
+	vector<char> dirent_buffer;
+	vector<char> read_buffer;
+	vector<char> speed_buffer;
+	vector<int> PIDs;
+	vector<ProcessRecord> records;
+	vector<DWORD> slot_records;//Index in records of each slot, for SampleRankedDetail()
+
+	//Threads of the last /THREADS process, kept to diff against
+	vector<ThreadState> thread_states_old;
+	vector<ThreadState> thread_states_new;
+	int thread_PID;
+	unsigned long long thread_start_time;
+	unsigned long long thread_sample_time;
+
+	//Leaf cgroups for /CGROUPS, sorted by path
+	bool cgroup_root_checked;
+	string cgroup_root;
+	vector<CgroupState> cgroup_states;
+	vector<DWORD> cgroup_sample_states;//Index in cgroup_states of each of cgroups
+	unsigned long long cgroup_scan_time;
+	unsigned long long cgroup_sample_time;
+};
+
+#endif
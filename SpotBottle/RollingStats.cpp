@@ -0,0 +1,179 @@
+#include "RollingStats.h"
+#include <algorithm>
+#include <string.h>
+
+using namespace std;
+
+MonotonicQueue::MonotonicQueue(bool keep_largest) {
+	//Constructor
+	this->keep_largest = keep_largest;
+	entries.resize(16);
+	first = 0;
+	count = 0;
+}
+
+void MonotonicQueue::Clear() {
+	first = 0;
+	count = 0;
+}
+
+void MonotonicQueue::Push(unsigned long long key, double value) {
+	//Drops the values from the back that the new value beats
+	size_t mask = entries.size() - 1;
+	while (count > 0) {
+		double last = entries[(first + count - 1) & mask].value;
+		if (keep_largest ? (last > value) : (last < value)) break;
+		--count;
+	}
+	if (count == entries.size()) {
+		//Unrolls the ring into one twice the size
+		vector<Entry> grown(entries.size() * 2);
+		for (size_t n = 0; n < count; ++n) grown[n] = entries[(first + n) & mask];
+		entries.swap(grown);
+		first = 0;
+		mask = entries.size() - 1;
+	}
+	Entry* entry = &entries[(first + count) & mask];
+	entry->key = key;
+	entry->value = value;
+	++count;
+}
+
+void MonotonicQueue::Expire(unsigned long long oldest_key) {
+	size_t mask = entries.size() - 1;
+	while ((count > 0) && (entries[first].key < oldest_key)) {
+		first = (first + 1) & mask;
+		--count;
+	}
+}
+
+double MonotonicQueue::Get() const {
+	if (count == 0) return 0.0;
+	return entries[first].value;
+}
+
+bool MonotonicQueue::IsEmpty() const {
+	return count == 0;
+}
+
+RollingStats::Window::Window() {
+	//Constructor
+	length = 0;
+	start = 0;
+	for (DWORD metric = 0; metric < METRIC_COUNT; ++metric) {
+		sums[metric] = 0.0;
+		minimums[metric] = MonotonicQueue(false);
+	}
+}
+
+RollingStats::RollingStats() {
+	//Constructor
+	window_count = 0;
+	samples.resize(64);
+	oldest = 0;
+	next = 0;
+}
+
+void RollingStats::SetWindows(const unsigned long long* lengths, DWORD count) {
+	if (count > MAX_WINDOWS) count = MAX_WINDOWS;
+	window_count = count;
+	oldest = 0;
+	next = 0;
+	for (DWORD window = 0; window < window_count; ++window) {
+		windows[window] = Window();
+		windows[window].length = lengths[window];
+	}
+}
+
+DWORD RollingStats::GetWindowCount() {
+	return window_count;
+}
+
+RollingStats::Sample* RollingStats::GetSample(unsigned long long sequence) {
+	return &samples[sequence & (samples.size() - 1)];
+}
+
+void RollingStats::Add(unsigned long long time, const double values[METRIC_COUNT]) {
+	if (next - oldest == samples.size()) {
+		//Unrolls the ring into one twice the size, keeping sequence numbers
+		// at the same positions modulo the new size
+		vector<Sample> grown(samples.size() * 2);
+		size_t grown_mask = grown.size() - 1;
+		for (unsigned long long sequence = oldest; sequence < next; ++sequence) {
+			grown[sequence & grown_mask] = *GetSample(sequence);
+		}
+		samples.swap(grown);
+	}
+	unsigned long long sequence = next++;
+	Sample* sample = GetSample(sequence);
+	sample->time = time;
+	memcpy(sample->values, values, sizeof(sample->values));
+
+	unsigned long long longest_start = sequence;
+	for (DWORD n = 0; n < window_count; ++n) {
+		Window* window = &windows[n];
+		for (DWORD metric = 0; metric < METRIC_COUNT; ++metric) {
+			window->sums[metric] += values[metric];
+			window->minimums[metric].Push(sequence, values[metric]);
+			window->maximums[metric].Push(sequence, values[metric]);
+		}
+
+		//Samples as old as the window's length have left it
+		while ((window->start < sequence) && (GetSample(window->start)->time + window->length <= time)) {
+			const Sample* leaving = GetSample(window->start);
+			for (DWORD metric = 0; metric < METRIC_COUNT; ++metric) window->sums[metric] -= leaving->values[metric];
+			++window->start;
+		}
+		for (DWORD metric = 0; metric < METRIC_COUNT; ++metric) {
+			window->minimums[metric].Expire(window->start);
+			window->maximums[metric].Expire(window->start);
+		}
+		if (window->start < longest_start) longest_start = window->start;
+	}
+	oldest = longest_start;
+}
+
+double RollingStats::GetMin(DWORD window, rolling_metrics metric) {
+	return windows[window].minimums[metric].Get();
+}
+
+double RollingStats::GetMax(DWORD window, rolling_metrics metric) {
+	return windows[window].maximums[metric].Get();
+}
+
+double RollingStats::GetMean(DWORD window, rolling_metrics metric) {
+	unsigned long long sample_count = next - windows[window].start;
+	if (sample_count == 0) return 0.0;
+	return windows[window].sums[metric] / sample_count;
+}
+
+void RollingStats::Summarize(DWORD window, WindowSummary* summary) {
+	Window* summarized = &windows[window];
+	DWORD sample_count = (DWORD)(next - summarized->start);
+	summary->length = summarized->length;
+	summary->sample_count = sample_count;
+	if (sorted.size() < sample_count) sorted.resize(sample_count);
+	for (DWORD metric = 0; metric < METRIC_COUNT; ++metric) {
+		MetricSummary* metric_summary = &summary->metrics[metric];
+		memset(metric_summary, 0, sizeof(*metric_summary));
+		if (sample_count == 0) continue;
+
+		//The sum is redone exactly while copying, so adding and subtracting
+		// never drifts for long
+		double sum = 0.0;
+		for (DWORD n = 0; n < sample_count; ++n) {
+			sorted[n] = GetSample(summarized->start + n)->values[metric];
+			sum += sorted[n];
+		}
+		summarized->sums[metric] = sum;
+		sort(sorted.begin(), sorted.begin() + sample_count);
+
+		//Nearest rank
+		metric_summary->min = summarized->minimums[metric].Get();
+		metric_summary->mean = sum / sample_count;
+		metric_summary->p50 = sorted[(sample_count * 50 + 99) / 100 - 1];
+		metric_summary->p95 = sorted[(sample_count * 95 + 99) / 100 - 1];
+		metric_summary->p99 = sorted[(sample_count * 99 + 99) / 100 - 1];
+		metric_summary->max = summarized->maximums[metric].Get();
+	}
+}
@@ -0,0 +1,121 @@
+//Statistics of the system-wide values over sliding windows of time, for
+// /SUMMARY.
+
+#ifndef RESOURCEMONITOR_ROLLINGSTATS_H
+#define RESOURCEMONITOR_ROLLINGSTATS_H
+
+#include "Platform.h"
+#include <vector>
+
+using namespace std;
+
+//Largest or smallest value of a sliding window, O(1) amortized per value.
+//Values are kept in decreasing (increasing) order, a new value removes the
+// ones it beats, since they can never be the answer again. Keys only grow,
+// values with keys below the window's start are removed from the front.
+class MonotonicQueue {
+public:
+	MonotonicQueue(bool keep_largest = true);//Constructor
+
+	void Clear();
+	void Push(unsigned long long key, double value);
+
+	//Removes values with keys below oldest_key
+	void Expire(unsigned long long oldest_key);
+
+	//0 if empty
+	double Get() const;
+	bool IsEmpty() const;
+
+private:
+	struct Entry {
+		unsigned long long key;
+		double value;
+	};
+
+	bool keep_largest;
+
+	//Ring of entries, the size is a power of two and only grows
+	vector<Entry> entries;
+	size_t first;
+	size_t count;
+};
+
+//The values tracked, in output column order
+enum rolling_metrics {metric_disk, metric_recv, metric_sent, metric_cpu, metric_ram, METRIC_COUNT};
+
+struct MetricSummary {
+	double min;
+	double mean;
+	double p50;
+	double p95;
+	double p99;
+	double max;
+};
+
+struct WindowSummary {
+	unsigned long long length;//Nanoseconds
+	DWORD sample_count;
+	MetricSummary metrics[METRIC_COUNT];
+};
+
+//Samples of the longest window are kept in one ring. Each window has running
+// sums and min/max queues of its own, so its mean, min and max are O(1) to
+// read after every tick.
+//Percentiles are exact, sorted from the window's samples when summarized.
+// Streaming estimates like P^2 cannot forget the samples leaving a sliding
+// window, and the samples are kept anyway.
+class RollingStats {
+public:
+	RollingStats();//Constructor
+
+	//Lengths in nanoseconds, at most MAX_WINDOWS. Clears the samples.
+	void SetWindows(const unsigned long long* lengths, DWORD count);
+	DWORD GetWindowCount();
+
+	//Adds a tick's values. time is in nanoseconds and should not go back.
+	void Add(unsigned long long time, const double values[METRIC_COUNT]);
+
+	double GetMin(DWORD window, rolling_metrics metric);
+	double GetMax(DWORD window, rolling_metrics metric);
+	double GetMean(DWORD window, rolling_metrics metric);
+
+	//Fills in every statistic of a window.
+	void Summarize(DWORD window, WindowSummary* summary);
+
+	static const DWORD MAX_WINDOWS = 8;
+
+private:
+	struct Sample {
+		unsigned long long time;
+		double values[METRIC_COUNT];
+	};
+
+	struct Window {
+		unsigned long long length;
+		unsigned long long start;//Sequence number of the oldest sample
+		double sums[METRIC_COUNT];
+		MonotonicQueue minimums[METRIC_COUNT];
+		MonotonicQueue maximums[METRIC_COUNT];
+		Window();//Constructor
+	};
+
+	Sample* GetSample(unsigned long long sequence);
+
+	Window windows[MAX_WINDOWS];
+	DWORD window_count;
+
+	//Ring of samples by sequence number, the size is a power of two
+	vector<Sample> samples;
+	unsigned long long oldest;//Sequence number of the oldest kept sample
+	unsigned long long next;//Sequence number of the next sample
+
+	//Reused to sort a window's values
+	vector<double> sorted;
+
+	//Not copyable
+	RollingStats(const RollingStats&);
+	RollingStats& operator=(const RollingStats&);
+};
+
+#endif
@@ -0,0 +1,259 @@
+#include "SampleRecording.h"
+#include "StringHelpers.h"
+#include <iostream>
+#include <string.h>
+
+using namespace std;
+
+const char RECORDING_MAGIC[8] = { 'S', 'P', 'O', 'T', 'R', 'E', 'C', 'D' };
+const uint32_t RECORDING_VERSION = 5;
+#ifdef _WIN32
+const uint32_t RECORDING_PLATFORM = 1;
+#else
+const uint32_t RECORDING_PLATFORM = 2;
+#endif
+
+//Tick flags
+const uint32_t TICK_HAS_PROCESSES = 1;
+const uint32_t TICK_RAW = 2;
+
+//Longest name read back, longer ones mean the file is damaged
+const uint32_t MAX_NAME_LENGTH = 4096;
+
+SampleRecording::SampleRecording() {
+	//Constructor
+	file = 0;
+	memset(&header, 0, sizeof(header));
+	memset(&tick, 0, sizeof(tick));
+	names_written = 0;
+	tick_pending = false;
+}
+
+SampleRecording::~SampleRecording() {
+	Close();
+}
+
+bool SampleRecording::Create(const wchar_t* path, DWORD processor_count) {
+	Close();
+#ifdef _WIN32
+	file = _wfopen(path, L"wb");
+#else
+	file = fopen(NarrowString(path).c_str(), "wb");
+#endif
+	if (file == 0) return false;
+	memset(&header, 0, sizeof(header));
+	memcpy(header.magic, RECORDING_MAGIC, sizeof(RECORDING_MAGIC));
+	header.version = RECORDING_VERSION;
+	header.platform = RECORDING_PLATFORM;
+	header.process_size = sizeof(Process);
+	header.processor_count = processor_count;
+	names_written = 0;
+	if (fwrite(&header, sizeof(header), 1, file) != 1) {
+		Close();
+		return false;
+	}
+	return true;
+}
+
+bool SampleRecording::Open(const wchar_t* path) {
+	Close();
+#ifdef _WIN32
+	file = _wfopen(path, L"rb");
+#else
+	file = fopen(NarrowString(path).c_str(), "rb");
+#endif
+	if (file == 0) return false;
+	if ((fread(&header, sizeof(header), 1, file) != 1) ||
+		(memcmp(header.magic, RECORDING_MAGIC, sizeof(RECORDING_MAGIC)) != 0) ||
+		(header.version != RECORDING_VERSION)) {
+		wcout << "\"" << path << "\" is not a recording." << endl;
+		Close();
+		return false;
+	}
+	if ((header.platform != RECORDING_PLATFORM) || (header.process_size != sizeof(Process))) {
+		wcout << "\"" << path << "\" was recorded on another platform." << endl;
+		Close();
+		return false;
+	}
+	tick_pending = false;
+	recorded_names = NameTable();
+	name_ids.clear();
+	return true;
+}
+
+void SampleRecording::Close() {
+	if (file != 0) fclose(file);
+	file = 0;
+}
+
+DWORD SampleRecording::GetProcessorCount() {
+	return (header.processor_count > 0) ? header.processor_count : 1;
+}
+
+bool SampleRecording::WriteTick(unsigned long long time, const SystemSample* sample, const ProcessSamples* samples,
+	const NameTable* names, unsigned long long process_sample_time, bool raw) {
+	//Written with one call per part, then flushed so a crash loses at most a tick.
+	memset(&tick, 0, sizeof(tick));
+	tick.flags = (samples->count > 0) ? TICK_HAS_PROCESSES : 0;
+	if (raw) tick.flags |= TICK_RAW;
+	tick.process_count = samples->count;
+	tick.name_count = names->GetCount() - names_written;
+	tick.time = time;
+	tick.process_sample_time = process_sample_time;
+	tick.cpu_pct = sample->cpu_pct;
+	tick.core_max_pct = sample->core_max_pct;
+	tick.core_imbalance_pct = sample->core_imbalance_pct;
+	tick.busiest_core = sample->busiest_core;
+	for (DWORD resource = 0; resource < PRESSURE_COUNT; ++resource) {
+		const PressureSample* pressure = &sample->pressure[resource];
+		if (pressure->available) tick.pressure_flags |= 1 << resource;
+		tick.pressure[resource][0] = pressure->some_pct;
+		tick.pressure[resource][1] = pressure->full_pct;
+		tick.pressure[resource][2] = pressure->some_avg10;
+		tick.pressure[resource][3] = pressure->full_avg10;
+	}
+	tick.highest_disk_usage = sample->highest_disk_usage;
+	tick.disk_await_ms = sample->disk_await_ms;
+	tick.disk_queue_depth = sample->disk_queue_depth;
+	tick.ram_pct = sample->ram_pct;
+	tick.recv_bytes = sample->recv_bytes;
+	tick.sent_bytes = sample->sent_bytes;
+	tick.link_recv_pct = sample->link_recv_pct;
+	tick.link_sent_pct = sample->link_sent_pct;
+	if (fwrite(&tick, sizeof(tick), 1, file) != 1) return false;
+
+	//New names, as a length and the characters
+	for (; names_written < names->GetCount(); ++names_written) {
+		uint32_t length = (uint32_t)names->GetLength(names_written);
+		if (fwrite(&length, sizeof(length), 1, file) != 1) return false;
+		if ((length > 0) && (fwrite(names->GetName(names_written), sizeof(wchar_t), length, file) != length)) return false;
+	}
+
+	//Processes, the buffer only grows
+	if (process_buffer.size() < samples->count) process_buffer.resize(samples->count);
+	for (DWORD n = 0; n < samples->count; ++n) {
+		Process* process = &process_buffer[n];
+		memset(process, 0, sizeof(*process));
+		process->PID = samples->PID[n];
+		process->name_id = samples->name_id[n];
+		process->start_time = samples->start_time[n];
+		process->processor = samples->processor[n];
+		process->raw_faults = samples->raw_faults[n];
+		if (raw) {
+			process->raw_cpu = samples->raw_cpu[n];
+			process->raw_wio = samples->raw_wio[n];
+			process->raw_rio = samples->raw_rio[n];
+		}
+		else {
+			process->cpu = samples->cpu[n];
+			process->wio = samples->wio[n];
+			process->rio = samples->rio[n];
+			process->tio = samples->tio[n];
+			process->faults = samples->faults[n];
+		}
+	}
+	if ((samples->count > 0) && (fwrite(process_buffer.data(), sizeof(Process), samples->count, file) != samples->count)) return false;
+	return fflush(file) == 0;
+}
+
+bool SampleRecording::ReadNames() {
+	//Names are recorded once each, so interning them in order keeps the ids.
+	for (uint32_t n = 0; n < tick.name_count; ++n) {
+		uint32_t length = 0;
+		if ((fread(&length, sizeof(length), 1, file) != 1) || (length > MAX_NAME_LENGTH)) return false;
+		if (name_buffer.size() < length + 1) name_buffer.resize(length + 1);
+		if ((length > 0) && (fread(name_buffer.data(), sizeof(wchar_t), length, file) != length)) return false;
+		name_buffer[length] = 0;
+		recorded_names.Intern(name_buffer.data(), length);
+	}
+	return true;
+}
+
+bool SampleRecording::ReadSystem(SystemSample* sample, unsigned long long* time) {
+	//Skips the processes of a tick that were not read.
+	if (tick_pending) {
+		if (!ReadNames()) return false;
+		if (fseek(file, (long)(tick.process_count * sizeof(Process)), SEEK_CUR) != 0) return false;
+		tick_pending = false;
+	}
+	if (fread(&tick, sizeof(tick), 1, file) != 1) return false;
+	tick_pending = true;
+	sample->cpu_pct = tick.cpu_pct;
+	sample->core_max_pct = tick.core_max_pct;
+	sample->core_imbalance_pct = tick.core_imbalance_pct;
+	sample->busiest_core = tick.busiest_core;
+	for (DWORD resource = 0; resource < PRESSURE_COUNT; ++resource) {
+		PressureSample* pressure = &sample->pressure[resource];
+		pressure->available = (tick.pressure_flags & (1 << resource)) != 0;
+		pressure->some_pct = tick.pressure[resource][0];
+		pressure->full_pct = tick.pressure[resource][1];
+		pressure->some_avg10 = tick.pressure[resource][2];
+		pressure->full_avg10 = tick.pressure[resource][3];
+	}
+	sample->highest_disk_usage = tick.highest_disk_usage;
+	sample->disk_await_ms = tick.disk_await_ms;
+	sample->disk_queue_depth = tick.disk_queue_depth;
+	sample->ram_pct = tick.ram_pct;
+	sample->recv_bytes = tick.recv_bytes;
+	sample->sent_bytes = tick.sent_bytes;
+	sample->link_recv_pct = tick.link_recv_pct;
+	sample->link_sent_pct = tick.link_sent_pct;
+	*time = tick.time;
+	return true;
+}
+
+static bool IsZeroCounter(const RawCounter& counter) {
+	RawCounter zero;
+	memset(&zero, 0, sizeof(zero));
+	return memcmp(&counter, &zero, sizeof(zero)) == 0;
+}
+
+bool SampleRecording::ReadProcesses(ProcessSamples* samples, PidIndex* pid_index, NameTable* names,
+	unsigned long long* process_sample_time, bool* raw) {
+	//Fills the samples the way the collector's SampleProcessRaw() would have.
+	samples->Clear(0);
+	pid_index->Clear(0);
+	if (!tick_pending) return false;
+	tick_pending = false;
+	*process_sample_time = tick.process_sample_time;
+	*raw = (tick.flags & TICK_RAW) != 0;
+	if (!ReadNames()) {
+		wcout << "The recording is damaged." << endl;
+		return false;
+	}
+	for (DWORD name_id = (DWORD)name_ids.size(); name_id < recorded_names.GetCount(); ++name_id) {
+		name_ids.push_back(names->Intern(recorded_names.GetName(name_id), recorded_names.GetLength(name_id)));
+	}
+	if (process_buffer.size() < tick.process_count) process_buffer.resize(tick.process_count);
+	if ((tick.process_count > 0) && (fread(process_buffer.data(), sizeof(Process), tick.process_count, file) != tick.process_count)) {
+		wcout << "The recording is damaged." << endl;
+		return false;
+	}
+	if ((tick.flags & TICK_HAS_PROCESSES) == 0) return false;
+
+	samples->Clear(tick.process_count);
+	pid_index->Clear(tick.process_count);
+	for (DWORD n = 0; n < tick.process_count; ++n) {
+		const Process* process = &process_buffer[n];
+		DWORD name_id = (process->name_id < name_ids.size()) ? name_ids[process->name_id] : names->Intern(L"", 0);
+		DWORD slot = samples->Add(process->PID, process->start_time, name_id);
+		samples->processor[slot] = process->processor;
+		samples->raw_faults[slot] = process->raw_faults;
+		if (*raw) {
+			samples->raw_cpu[slot] = process->raw_cpu;
+			samples->raw_wio[slot] = process->raw_wio;
+			samples->raw_rio[slot] = process->raw_rio;
+			//Totals that could not be read were recorded as 0
+			if (!IsZeroCounter(process->raw_rio) || !IsZeroCounter(process->raw_wio)) samples->raw_io_time[slot] = *process_sample_time;
+			pid_index->Insert(process->PID, process->start_time, slot);
+		}
+		else {
+			samples->cpu[slot] = process->cpu;
+			samples->wio[slot] = process->wio;
+			samples->rio[slot] = process->rio;
+			samples->tio[slot] = process->tio;
+			samples->faults[slot] = process->faults;
+		}
+	}
+	return true;
+}
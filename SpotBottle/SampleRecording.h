@@ -0,0 +1,122 @@
+//Raw samples of every tick saved by /RECORD and read back by /REPLAY.
+
+#ifndef RESOURCEMONITOR_SAMPLERECORDING_H
+#define RESOURCEMONITOR_SAMPLERECORDING_H
+
+#include "Platform.h"
+#include "Collector.h"
+#include "PidIndex.h"
+#include "ProcessSamples.h"
+#include <stdint.h>
+#include <stdio.h>
+#include <vector>
+
+using namespace std;
+
+//File layout: a header, then per tick the system-wide sample, the names
+// first seen that tick and the processes.
+//Processes keep the collector's raw counters, so a replay calculates rates
+// the same way the live program did. Raw counters differ between Windows and
+// Linux, so a recording only replays on the platform it was made on.
+class SampleRecording {
+public:
+	SampleRecording();//Constructor
+	~SampleRecording();
+
+	//Creates a new recording. Returns false on failure.
+	bool Create(const wchar_t* path, DWORD processor_count);
+
+	//Opens a recording for replay. Returns false on failure.
+	bool Open(const wchar_t* path);
+	void Close();
+
+	//Processor count of the host that made the recording.
+	DWORD GetProcessorCount();
+
+	//Saves a tick: the system-wide sample, then this tick's processes. raw is
+	// false if the collector only has formatted values, see TracksPIDs().
+	//time is nanoseconds since 1970-01-01 UTC. Returns false on failure.
+	bool WriteTick(unsigned long long time, const SystemSample* sample, const ProcessSamples* samples,
+		const NameTable* names, unsigned long long process_sample_time, bool raw);
+
+	//Reads the next tick's system-wide sample. Returns false at the end.
+	bool ReadSystem(SystemSample* sample, unsigned long long* time);
+
+	//Reads the processes of the tick ReadSystem() returned, interning their
+	// names in names. Returns false if the tick has none.
+	bool ReadProcesses(ProcessSamples* samples, PidIndex* pid_index, NameTable* names,
+		unsigned long long* process_sample_time, bool* raw);
+
+private:
+	struct Header {
+		char magic[8];
+		uint32_t version;
+		uint32_t platform;
+		uint32_t process_size;
+		uint32_t processor_count;
+		uint32_t reserved[4];
+	};
+
+	struct Tick {
+		uint32_t flags;
+		uint32_t process_count;
+		uint32_t name_count;//Names first seen this tick
+		uint32_t reserved;
+		uint64_t time;
+		uint64_t process_sample_time;//Monotonic, only differences matter
+		double cpu_pct;
+		double highest_disk_usage;
+		double disk_await_ms;
+		double disk_queue_depth;
+		double ram_pct;
+		uint64_t recv_bytes;
+		uint64_t sent_bytes;
+		double link_recv_pct;
+		double link_sent_pct;
+		double core_max_pct;
+		double core_imbalance_pct;
+		int32_t busiest_core;
+		uint32_t pressure_flags;//Bit per available pressure_resources
+		double pressure[PRESSURE_COUNT][4];//some_pct, full_pct, some_avg10, full_avg10
+	};
+
+	//Raw counters for ticks that join, formatted values for ones that do not
+	struct Process {
+		int32_t PID;
+		uint32_t name_id;
+		uint64_t start_time;
+		int32_t processor;
+		uint32_t reserved;
+		RawCounter raw_cpu;
+		RawCounter raw_wio;
+		RawCounter raw_rio;
+		double cpu;
+		int64_t wio;
+		int64_t rio;
+		int64_t tio;
+		uint64_t raw_faults;
+		int64_t faults;
+	};
+
+	bool ReadNames();
+
+	FILE* file;
+	Header header;
+
+	//Writing, names with lower ids were saved already
+	DWORD names_written;
+
+	//Reading
+	Tick tick;
+	bool tick_pending;//ReadProcesses() has not read the tick's names and processes
+	NameTable recorded_names;//Ids match the recording's
+	vector<DWORD> name_ids;//Recorded id to the id in the caller's table
+	vector<wchar_t> name_buffer;
+	vector<Process> process_buffer;
+
+	//Not copyable
+	SampleRecording(const SampleRecording&);
+	SampleRecording& operator=(const SampleRecording&);
+};
+
+#endif
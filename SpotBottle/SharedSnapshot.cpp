@@ -0,0 +1,196 @@
+#include "SharedSnapshot.h"
+#include <string.h>
+#include <stddef.h>
+#ifndef _WIN32
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#endif
+
+using namespace std;
+
+const char SNAPSHOT_MAGIC[8] = { 'S', 'P', 'O', 'T', 'S', 'H', 'M', ' ' };
+const uint32_t SNAPSHOT_VERSION = 1;
+#ifdef _WIN32
+const wchar_t SNAPSHOT_SEGMENT_NAME[] = L"Local\\SpotBottle";
+#else
+const char SNAPSHOT_SEGMENT_NAME[] = "/SpotBottle";
+#endif
+
+//Bytes of a snapshot up to and including its processes
+static size_t GetSnapshotSize(uint32_t process_count) {
+	if (process_count > SNAPSHOT_MAX_PROCESSES) process_count = SNAPSHOT_MAX_PROCESSES;
+	return offsetof(Snapshot, processes) + process_count * sizeof(SnapshotProcess);
+}
+
+SharedSnapshot::SharedSnapshot() {
+	//Constructor
+	mapping = 0;
+	header = 0;
+	snapshot = 0;
+	owner = false;
+#ifdef _WIN32
+	mapping_handle = 0;
+#else
+	file_descriptor = -1;
+#endif
+}
+
+SharedSnapshot::~SharedSnapshot() {
+	Close();
+}
+
+bool SharedSnapshot::Create() {
+	Close();
+	if (!MapSegment(true)) return false;
+	header = (Header*)mapping;
+	snapshot = (Snapshot*)(mapping + sizeof(Header));
+
+	//A segment left by a daemon that died is taken over
+	if ((memcmp(header->magic, SNAPSHOT_MAGIC, sizeof(SNAPSHOT_MAGIC)) == 0) &&
+		header->publishing.load() && ProcessIsAlive(header->owner_PID)) {
+		UnmapSegment();
+		return false;
+	}
+	memset(snapshot, 0, sizeof(Snapshot));
+	header->version = SNAPSHOT_VERSION;
+	header->snapshot_size = sizeof(Snapshot);
+#ifdef _WIN32
+	header->owner_PID = GetCurrentProcessId();
+#else
+	header->owner_PID = (uint32_t)getpid();
+#endif
+	header->sequence.store(header->sequence.load() & ~1ULL);
+	header->publishing.store(1);
+	memcpy(header->magic, SNAPSHOT_MAGIC, sizeof(SNAPSHOT_MAGIC));
+	owner = true;
+	return true;
+}
+
+bool SharedSnapshot::Attach() {
+	Close();
+	if (!MapSegment(false)) return false;
+	header = (Header*)mapping;
+	snapshot = (Snapshot*)(mapping + sizeof(Header));
+	if ((memcmp(header->magic, SNAPSHOT_MAGIC, sizeof(SNAPSHOT_MAGIC)) != 0) ||
+		(header->version != SNAPSHOT_VERSION) ||
+		(header->snapshot_size != sizeof(Snapshot))) {
+		UnmapSegment();
+		return false;
+	}
+	return true;
+}
+
+void SharedSnapshot::Close() {
+	if ((header != 0) && owner) header->publishing.store(0);
+	UnmapSegment();
+}
+
+void SharedSnapshot::Publish(const Snapshot* new_snapshot) {
+	//The fence keeps the snapshot's stores after the odd sequence number
+	uint64_t sequence = header->sequence.load(memory_order_relaxed);
+	header->sequence.store(sequence + 1, memory_order_relaxed);
+	atomic_thread_fence(memory_order_release);
+	memcpy(snapshot, new_snapshot, GetSnapshotSize(new_snapshot->process_count));
+	header->sequence.store(sequence + 2, memory_order_release);
+}
+
+bool SharedSnapshot::ReadNew(Snapshot* copy, uint64_t* sequence) {
+	//Retries until a copy was made with no write in between. The writer only
+	// holds the sequence odd for a copy of a few kilobytes.
+	while (true) {
+		uint64_t before = header->sequence.load(memory_order_acquire);
+		if (before == *sequence) return false;
+		if ((before & 1) != 0) continue;
+		memcpy(copy, snapshot, offsetof(Snapshot, processes));
+		uint32_t process_count = copy->process_count;
+		if (process_count > SNAPSHOT_MAX_PROCESSES) process_count = SNAPSHOT_MAX_PROCESSES;
+		memcpy(copy->processes, snapshot->processes, process_count * sizeof(SnapshotProcess));
+		atomic_thread_fence(memory_order_acquire);
+		if (header->sequence.load(memory_order_relaxed) != before) continue;
+		copy->process_count = process_count;
+		*sequence = before;
+		return true;
+	}
+}
+
+bool SharedSnapshot::IsPublishing() {
+	return (header != 0) && header->publishing.load() && ProcessIsAlive(header->owner_PID);
+}
+
+#ifdef _WIN32
+
+bool SharedSnapshot::MapSegment(bool create) {
+	//Backed by the paging file, it goes away with the last handle to it
+	size_t size = sizeof(Header) + sizeof(Snapshot);
+	if (create) {
+		mapping_handle = CreateFileMappingW(INVALID_HANDLE_VALUE, 0, PAGE_READWRITE, 0, (DWORD)size, SNAPSHOT_SEGMENT_NAME);
+	}
+	else mapping_handle = OpenFileMappingW(FILE_MAP_READ, FALSE, SNAPSHOT_SEGMENT_NAME);
+	if (mapping_handle == 0) return false;
+	mapping = (char*)MapViewOfFile(mapping_handle, create ? FILE_MAP_WRITE : FILE_MAP_READ, 0, 0, size);
+	if (mapping == 0) {
+		UnmapSegment();
+		return false;
+	}
+	return true;
+}
+
+void SharedSnapshot::UnmapSegment() {
+	if (mapping != 0) UnmapViewOfFile(mapping);
+	if (mapping_handle != 0) CloseHandle(mapping_handle);
+	mapping = 0;
+	mapping_handle = 0;
+	header = 0;
+	snapshot = 0;
+	owner = false;
+}
+
+bool SharedSnapshot::ProcessIsAlive(uint32_t PID) {
+	HANDLE process = OpenProcess(SYNCHRONIZE, FALSE, PID);
+	if (process == 0) return GetLastError() == ERROR_ACCESS_DENIED;
+	bool alive = WaitForSingleObject(process, 0) == WAIT_TIMEOUT;
+	CloseHandle(process);
+	return alive;
+}
+
+#else
+
+bool SharedSnapshot::MapSegment(bool create) {
+	//A POSIX shared memory object, under /dev/shm on Linux
+	size_t size = sizeof(Header) + sizeof(Snapshot);
+	file_descriptor = shm_open(SNAPSHOT_SEGMENT_NAME, create ? (O_RDWR | O_CREAT) : O_RDONLY, 0644);
+	if (file_descriptor == -1) return false;
+	if (create && (ftruncate(file_descriptor, (off_t)size) == -1)) {
+		UnmapSegment();
+		return false;
+	}
+	void* address = mmap(0, size, create ? (PROT_READ | PROT_WRITE) : PROT_READ, MAP_SHARED, file_descriptor, 0);
+	if (address == MAP_FAILED) {
+		UnmapSegment();
+		return false;
+	}
+	mapping = (char*)address;
+	return true;
+}
+
+void SharedSnapshot::UnmapSegment() {
+	//Attached viewers keep their mapping and see publishing stop
+	if (owner) shm_unlink(SNAPSHOT_SEGMENT_NAME);
+	if (mapping != 0) munmap(mapping, sizeof(Header) + sizeof(Snapshot));
+	if (file_descriptor != -1) close(file_descriptor);
+	mapping = 0;
+	file_descriptor = -1;
+	header = 0;
+	snapshot = 0;
+	owner = false;
+}
+
+bool SharedSnapshot::ProcessIsAlive(uint32_t PID) {
+	//Signal 0 only checks the process exists
+	return (kill((pid_t)PID, 0) == 0) || (errno == EPERM);
+}
+
+#endif
@@ -0,0 +1,112 @@
+//Each tick's results published in named shared memory by /DAEMON, so /ATTACH
+// viewers can show them without collecting anything themselves.
+
+#ifndef RESOURCEMONITOR_SHAREDSNAPSHOT_H
+#define RESOURCEMONITOR_SHAREDSNAPSHOT_H
+
+#include "Platform.h"
+#include "Collector.h"
+#include <atomic>
+#include <stdint.h>
+
+using namespace std;
+
+//The most processes /TOP lists
+const DWORD SNAPSHOT_MAX_PROCESSES = 100;
+
+//One of the tick's top processes. Names are cut to 63 UTF-16 units like the
+// history's, characters outside the BMP become '?'.
+struct SnapshotProcess {
+	int32_t PID;
+	uint32_t name_length;
+	double cpu;//Percent of one core, summed over the cores
+	int64_t wio;//Bytes per second
+	int64_t rio;
+	int64_t tio;
+	int64_t faults;//Major page faults per second
+	uint16_t name[63];
+	uint16_t reserved;
+};
+
+//One tick, fixed width so readers need no allocation. Only the first
+// process_count processes are copied in or out.
+struct Snapshot {
+	uint64_t time;//Nanoseconds since 1970-01-01 UTC
+	uint64_t interval_ns;//The daemon's /T
+	double disk_pct;
+	double cpu_pct;
+	double core_max_pct;
+	double ram_pct;
+	uint64_t recv_bytes;//Bytes per second
+	uint64_t sent_bytes;
+	int32_t busiest_core;//-1 if unknown
+	uint32_t cause;//bottleneck_causes
+	uint32_t processor_count;
+	uint32_t process_count;
+	uint32_t pressure_flags;//Bit per pressure_resources with PSI
+	uint32_t reserved;
+	double pressure[PRESSURE_COUNT][4];//some_pct, full_pct, some_avg10, full_avg10
+	SnapshotProcess processes[SNAPSHOT_MAX_PROCESSES];
+};
+
+//A segment holding the newest snapshot behind a seqlock: the one writer makes
+// the sequence odd, copies the snapshot in and makes it even again. Readers
+// copy it out and retry if the sequence was odd or changed meanwhile, so they
+// never block the writer and any number of them cost it nothing.
+class SharedSnapshot {
+public:
+	SharedSnapshot();//Constructor
+	~SharedSnapshot();
+
+	//Creates the segment to publish in. Fails if another daemon is still
+	// publishing in it.
+	bool Create();
+
+	//Opens the segment of a running daemon read only.
+	bool Attach();
+
+	//Stops publishing, the segment is removed once the daemon closes it.
+	void Close();
+
+	//Writes a new snapshot, readers see all of it or none of it.
+	void Publish(const Snapshot* snapshot);
+
+	//Copies the newest snapshot if its sequence is not *sequence, then sets
+	// *sequence. Returns false if there is nothing new.
+	bool ReadNew(Snapshot* snapshot, uint64_t* sequence);
+
+	//False once the daemon has stopped or died.
+	bool IsPublishing();
+
+private:
+	struct Header {
+		char magic[8];
+		uint32_t version;
+		uint32_t snapshot_size;
+		atomic<uint32_t> publishing;
+		uint32_t owner_PID;//Of the daemon, to tell a dead one from a live one
+		atomic<uint64_t> sequence;//Odd while the snapshot is being written
+	};
+
+	bool MapSegment(bool create);
+	void UnmapSegment();
+
+	//True if the process is still running
+	static bool ProcessIsAlive(uint32_t PID);
+
+	char* mapping;
+	Header* header;
+	Snapshot* snapshot;
+	bool owner;
+#ifdef _WIN32
+	HANDLE mapping_handle;
+#else
+	int file_descriptor;
+#endif
+
+	//Not copyable
+	SharedSnapshot(const SharedSnapshot&);
+	SharedSnapshot& operator=(const SharedSnapshot&);
+};
+
+#endif
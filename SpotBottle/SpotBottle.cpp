@@ -3,17 +3,31 @@
 // Command line resource monitor for spotting bottlenecks. 
 // Displays CPU, network, disk, RAM, and process bottleneck information.
 
-#include <windows.h>
+#include "Platform.h"
 #include <iostream>
 #include <fstream>
 #include <string>
-#include <queue>
+#include <vector>
 #include <ctime>
-#include <Pdh.h>//Link pdh.lib
-#pragma comment(lib, "pdh.lib")
-#include <PdhMsg.h>
+#include <cstring>
+#include <clocale>
+#ifndef _WIN32
+#include <signal.h>
+#include <pthread.h>
+#endif
 
-#include "PdhHelperFunctions.h"
+#include "Collector.h"
+#include "HistoryRing.h"
+#include "LogWriter.h"
+#include "TickScheduler.h"
+#include "LoopStats.h"
+#include "OutputFormat.h"
+#include "RollingStats.h"
+#include "SampleRecording.h"
+#include "SharedSnapshot.h"
+#include "MetricsServer.h"
+#include "AdaptiveInterval.h"
+#include "AllocationCounter.h"
 #include "StringHelpers.h"
 
 
@@ -21,31 +35,155 @@
 using namespace std;
 
 const wchar_t USAGE_TEXT[] =
-L"SPOTBOTTLE [/T seconds] [/L logfile] /TSV /H\n\n"
+L"SPOTBOTTLE [/T seconds [max]] /CATCHUP [/L logfile] [/FLUSH policy]\n"
+"           [/FLUSHT seconds] [/RING file] [/RINGSIZE records] [/RECORD file]\n"
+"           [/J threads] [/TOP n] [/THREADS n] [/CGROUPS n] /INCGROUP\n"
+"           [/FORMAT layout] /TSV /DISKS /NETS /PSI [/NETINCLUDE list]\n"
+"           [/NETEXCLUDE list] /SUMMARY [/SUMMARYT seconds] [/WINDOWS list]\n"
+"           /STATS [/STATST seconds] /DAEMON [/METRICS address] /H\n"
+"SPOTBOTTLE /ATTACH [/TOP n] [/FORMAT layout] /PSI\n"
+"SPOTBOTTLE /REPLAY file [/L logfile] [/RING file] [/TOP n] [/FORMAT layout]\n"
+"           /SUMMARY [/SUMMARYT seconds] [/WINDOWS list]\n"
+"SPOTBOTTLE /DUMP file [/FORMAT layout]\n\n"
 " /T\tIndicates the time delay between data collection is given, in seconds.\n"
-"    \tDefaults to 1 second. May be a decimal.\n\n"
+"    \tDefaults to 1 second. May be a decimal, down to 0.0001.\n"
+"    \tSamples are taken on multiples of the time by the clock, e.g. on\n"
+"    \tthe second, however long collecting takes. A sample running more\n"
+"    \tthan the whole time late skips the ones missed.\n"
+"    \tWith a max, the time adapts between the two: the first while a\n"
+"    \tresource is saturated or busy or the bottleneck changes, doubling\n"
+"    \ttoward the max while the host stays quiet, when processes are not\n"
+"    \tcollected. Each line then shows the time it was sampled at.\n\n"
+" /CATCHUP Takes samples missed by running late back to back instead of\n"
+"    \tskipping them, up to 10 at a time.\n\n"
 " /L\tIndicates an output logfile name is given.\n"
-"    \tWarning: No write buffer is used. Use a large [/T seconds].\n\n"
-" /TSV\tTab Separated Values. Disables smart formatting for tabs instead.\n\n"
+"    \tLines are written in batches by a background thread. If the disk\n"
+"    \tfalls behind, lines are dropped and the count is displayed.\n\n"
+" /FLUSH\tIndicates when the logfile is flushed is given: NONE, PERIODIC, or a\n"
+"    \tnumber of lines to flush after. Defaults to PERIODIC.\n"
+"    \tA flush waits for the lines to reach the disk, so they survive a\n"
+"    \tcrash or power loss. NONE leaves them to the OS.\n\n"
+" /FLUSHT Indicates the time between logfile writes is given, in seconds.\n"
+"    \tDefaults to 1 second. May be a decimal.\n\n"
+" /RING\tIndicates a binary history file name is given.\n"
+"    \tSamples are kept in a fixed-size ring of records in the file, the\n"
+"    \toldest overwritten first. Cheap enough for short [/T seconds].\n\n"
+" /RINGSIZE Indicates the number of records a new /RING file holds is given.\n"
+"    \tDefaults to 86400. An existing file keeps its size.\n\n"
+" /RECORD Indicates a file to record the raw samples of every tick in is given.\n"
+"    \tThe per-process counters are kept, so the bottlenecks found in each\n"
+"    \ttick can be reproduced later with /REPLAY.\n\n"
+" /REPLAY Indicates a /RECORD file to replay is given. Its ticks go through\n"
+"    \tthe same calculations as when recorded, as fast as possible, then\n"
+"    \tthe program exits. Only replays on the operating system it was\n"
+"    \trecorded on.\n\n"
+" /DUMP\tWrites the samples in a /RING file as tab separated values, in\n"
+"    \tthe layout of a /TSV logfile, or of /FORMAT if given, then exits.\n\n"
+" /J\tIndicates the number of threads collecting per-process data is given.\n"
+"    \tDefaults to a quarter of the processor cores, at most 16. Threads are\n"
+"    \tonly used with hundreds of processes per thread.\n\n"
+" /TOP\tIndicates the number of bottleneck processes to list is given.\n"
+"    \tThe highest processes of the bottleneck cause are listed below each\n"
+"    \tline with their values, I/O in bytes per second. Defaults to 1.\n\n"
+" /THREADS Indicates the number of threads of the bottleneck process to list\n"
+"    \tis given. Only that process's threads are read, from /proc on\n"
+"    \tLinux, and listed below it highest in the cause's value with their\n"
+"    \tCPU% of one core, I/O bytes and major faults per second, names and\n"
+"    \tTIDs. Values start on the second sample of the same process. Left\n"
+"    \tout with /FORMAT CSV and on Windows.\n\n"
+" /CGROUPS Indicates the number of cgroups to list is given. The leaf\n"
+"    \tcgroups of the cgroup v2 hierarchy, usually containers and services,\n"
+"    \tare listed below each line highest in the cause's value with their\n"
+"    \tCPU%, I/O bytes per second, memory in use and path. Read from the\n"
+"    \tcgroups' own counters, not summed from their processes. Left out\n"
+"    \twith /FORMAT CSV and on Windows.\n\n"
+" /INCGROUP Only ranks the processes in the top cgroup, finding the\n"
+"    \tbottleneck process inside the bottleneck container. Lists 1 cgroup\n"
+"    \tunless /CGROUPS is given.\n\n"
+" /FORMAT Indicates the layout of the output lines is given: SMART, TSV,\n"
+"    \tCSV or JSON. Defaults to SMART, columns aligned for the console.\n"
+"    \tCSV adds a time and columns for the cause's value and the PID, the\n"
+"    \trest of the top processes are rows with only those filled in.\n"
+"    \tJSON writes one object per sample, with the time in milliseconds\n"
+"    \tsince 1970 and the top processes in an array, with their parent PID\n"
+"    \tand command line on Linux.\n\n"
+" /TSV\tTab Separated Values. Disables smart formatting for tabs instead.\n"
+"    \tSame as /FORMAT TSV.\n\n"
+" /DISKS\tLists every physical disk under each line: percent disk time, reads\n"
+"    \tand writes per second with their bytes, the average milliseconds\n"
+"    \tper I/O (await) and I/Os in flight (queue). Disks with an await of\n"
+"    \t10 ms or more and a queue of 1 or more are saturated, marked with\n"
+"    \ta \"*\", and make TIO the cause. Left out with /FORMAT CSV.\n\n"
+" /NETS\tLists every counted network interface under each line: bytes\n"
+"    \tdownloaded and uploaded per second, the link speed, and the percent\n"
+"    \tof it used each way. Links 90% used or more are saturated, marked\n"
+"    \twith a \"*\", and make RIO or WIO the cause. Speeds are read from\n"
+"    \t/sys/class/net on Linux, unknown for wireless and virtual links.\n"
+"    \tLeft out with /FORMAT CSV.\n\n"
+" /PSI\tAdds the percent of the time tasks stalled waiting on the CPU, I/O\n"
+"    \tand memory, from Linux's Pressure Stall Information. Columns in the\n"
+"    \tTSV and CSV layouts, a line under each sample in the smart layout,\n"
+"    \tand a pressure object in JSON. With or without /PSI, a resource\n"
+"    \tstalled 10% of the time or more is the bottleneck cause, the\n"
+"    \tlongest stalled first.\n\n"
+" /NETINCLUDE Indicates the network interfaces to count are given, like\n"
+"    \teth0,wlan*. A \"*\" at the end matches any name starting with the\n"
+"    \trest. Defaults to every interface but loopback, skipping virtual\n"
+"    \tones like bridges and veths unless there is no other.\n\n"
+" /NETEXCLUDE Indicates network interfaces not to count are given, like\n"
+"    \tdocker*,tun0.\n\n"
+" /SUMMARY Displays the min, mean, p50, p95, p99 and max of disk%, download,\n"
+"    \tupload, CPU% and RAM% over the last 1, 5 and 15 minutes, every\n"
+"    \tminute. Written to the logfile too, except with /FORMAT CSV.\n\n"
+" /SUMMARYT Indicates the time between summaries is given, in seconds.\n"
+"    \tDefaults to 60.\n\n"
+" /WINDOWS Indicates the summary windows are given, like 1m,5m,15m.\n"
+"    \tLengths are in s, m or h, seconds without a unit. Up to 8.\n\n"
+" /STATS\tDisplays how long each stage of sampling takes, p50/p99/max in\n"
+"    \tmicroseconds, and this program's CPU time and memory. Displayed\n"
+"    \tperiodically and on exit with Ctrl+C.\n\n"
+" /STATST Indicates the time between /STATS displays is given, in seconds.\n"
+"    \tDefaults to 60 seconds.\n\n"
+" /DAEMON Publishes each sample's system values, cause and top processes in\n"
+"    \tshared memory for /ATTACH, besides the usual output. One daemon runs\n"
+"    \tper user session on Windows and per host on Linux.\n\n"
+" /ATTACH Displays the samples of a running /DAEMON without collecting\n"
+"    \tanything, so any number of viewers cost the same as one. Lists up to\n"
+"    \tthe daemon's /TOP processes, with /PSI only if the host has it.\n"
+"    \tExits when the daemon does.\n\n"
+" /METRICS Serves the last sample as Prometheus text over HTTP, on 127.0.0.1\n"
+"    \tif the address is a port number, else on a Unix socket at that path\n"
+"    \t(Linux only). Scrapes are answered from a background thread and\n"
+"    \tnever trigger collection.\n\n"
 " /H\tDisplays this usage/help text.\n\n\n"
 "Data Collected:\n\n"
 " Disk%\tPercent Disk Read/Write Time for the physical disk most in use.\n"
 "      \tInternally calculated for all physical disks and then the highest is\n"
 "      \tdisplayed to catch a disk-related bottleneck.\n"
 "      \tHard disk drives are often the cause of a slow computer.\n\n"
-" Download Bytes downloaded, summed across all network interfaces.\n\n"
-" Upload\tBytes uploaded, summed across all network interfaces.\n\n"
+" Download Bytes downloaded, summed across the counted network interfaces.\n\n"
+" Upload\tBytes uploaded, summed across the counted network interfaces.\n\n"
 " CPU%\tPercent Processor Usage Time, averaged across all processor cores.\n\n"
 " RAM%\tPercent Physical RAM used.\n\n\n"
 "Bottleneck Cause Key:\n\n"
 " CPU:\tIndicates CPU bottleneck.\n"
 "     \tDisplays the estimated percent CPU time the process used.\n\n"
+" CORE:\tIndicates one processor core is saturated while the rest are not,\n"
+"     \tlike a single-threaded process pinning it, which the average hides.\n"
+"     \tDisplays the percent of one core used by the busiest process that\n"
+"     \tlast ran on it. The core is only known on Linux.\n\n"
+" MEM:\tIndicates tasks are stalled waiting on memory, see /PSI.\n"
+"     \tUsed as an estimation, the process with the most major page faults.\n"
+"     \tDisplays them per second when listing the top processes.\n\n"
 " RIO:\tIndicates Read-bytes I/O bottleneck.\n"
-"     \tUsed as an estimation to determine per-process download bytes.\n\n"
+"     \tUsed as an estimation to determine per-process download bytes.\n"
+"     \tChosen when a link is saturated downloading, see /NETS.\n\n"
 " WIO:\tIndicates Write-bytes I/O bottleneck.\n"
-"     \tUsed as an estimation to determine per-process upload bytes.\n\n"
+"     \tUsed as an estimation to determine per-process upload bytes.\n"
+"     \tChosen when a link is saturated uploading, see /NETS.\n\n"
 " TIO:\tIndicates Total-bytes I/O bottleneck.\n"
-"     \tUsed as an estimation to determine per-process percent disk usage.\n\n\n"
+"     \tUsed as an estimation to determine per-process percent disk usage.\n"
+"     \tChosen when a disk is saturated, see /DISKS.\n\n\n"
 "Data Collection Note:\n\n"
 "\tThis program uses the Windows Performance Counters API, which by \n"
 "\tdefault does not track process IDs (PIDs) along with process names. \n"
@@ -62,53 +200,310 @@ L"SPOTBOTTLE [/T seconds] [/L logfile] /TSV /H\n\n"
 
 const wchar_t WELCOME_HEADER[] = L"Spotbottle v2.0, Kristofer Christakos, 2017";
 
-double GetPercentUsedRAM() {
-	//Gets the system physical ram usage percent, returned as a double.
-	MEMORYSTATUSEX data;
-	data.dwLength = sizeof(data);
-	if (GlobalMemoryStatusEx(&data) == 0) {
-		wcout << "GetPercentUsedRAM() GlobalMemoryStatusEx() failed." << endl;
-		return 0.0;
+bool ParseWindows(const wchar_t* text, unsigned long long* lengths, DWORD* count) {
+	//Reads a comma separated list of lengths like "1m,5m,15m" into nanoseconds.
+	//A number without a unit is seconds. Returns false if any is malformed.
+	*count = 0;
+	const wchar_t* position = text;
+	while (*position != 0) {
+		if (*count == RollingStats::MAX_WINDOWS) return false;
+		wchar_t* unit = 0;
+		double length = wcstod(position, &unit);
+		if ((unit == position) || !(length > 0.0)) return false;
+		double unit_seconds = 1.0;
+		if ((*unit == L's') || (*unit == L'S')) ++unit;
+		else if ((*unit == L'm') || (*unit == L'M')) {
+			unit_seconds = 60.0;
+			++unit;
+		}
+		else if ((*unit == L'h') || (*unit == L'H')) {
+			unit_seconds = 3600.0;
+			++unit;
+		}
+		double length_seconds = length * unit_seconds;
+		if (length_seconds > 7 * 86400.0) return false;
+		lengths[(*count)++] = (unsigned long long)(length_seconds * 1000000000.0 + 0.5);
+		if (*unit == L',') ++unit;
+		else if (*unit != 0) return false;
+		position = unit;
+	}
+	return *count > 0;
+}
+
+void ParseNameList(const wchar_t* text, vector<wstring>* names) {
+	//Splits a comma separated list like "eth0,wlan*", skipping empty names.
+	const wchar_t* position = text;
+	while (*position != 0) {
+		const wchar_t* comma = wcschr(position, L',');
+		size_t length = (comma != 0) ? comma - position : wcslen(position);
+		if (length > 0) names->push_back(wstring(position, length));
+		position += length;
+		if (*position == L',') ++position;
 	}
-	double bytes_in_use = (double)(data.ullTotalPhys - data.ullAvailPhys);
-	return bytes_in_use / ((double)data.ullTotalPhys) * 100;
 }
 
-DWORD GetProcessorCount() {
-	SYSTEM_INFO sys_info;
-	GetSystemInfo(&sys_info);
-	return sys_info.dwNumberOfProcessors;
+void AppendLogLines(const LineBuffer* text, unsigned long long time, LineBuffer* log_text) {
+	//Puts the local time at the start of each line, for layouts without a
+	// time column.
+	time_t rawtime = (time_t)(time / 1000000000ULL);
+	wchar_t time_buffer[256];
+	size_t time_length = wcsftime(time_buffer, 256, L"%F %T\t", localtime(&rawtime));
+	const wchar_t* line = text->GetText();
+	const wchar_t* text_end = line + text->GetLength();
+	while (line < text_end) {
+		const wchar_t* line_end = wmemchr(line, L'\n', text_end - line);
+		line_end = (line_end != 0) ? line_end + 1 : text_end;
+		log_text->Append(time_buffer, time_length);
+		log_text->Append(line, line_end - line);
+		line = line_end;
+	}
 }
 
-enum bottleneck_causes {none, cpu, wio, rio, tio};
+int DumpHistory(const wchar_t* history_filename, output_formats format) {
+	//Writes the samples of a history file in the layout of a logfile.
+	HistoryRing history;
+	if (!history.Open(history_filename, 0, true)) return EXIT_FAILURE;
+	OutputEncoder* encoder = CreateEncoder(format);
+	LineBuffer text;
+	LineBuffer timed_text;
+	encoder->EncodeHeader(&text);
+	wcout << text.GetText();
+	BottleneckProcess process;
+	for (DWORD n = 0; n < history.GetRecordCount(); ++n) {
+		const HistoryRecord* record = history.GetRecord(n);
+		if (record == 0) continue;//Half written when the program stopped
 
-size_t GetLargestValueInQueue(queue <size_t>* size_queue) {
-	queue <size_t> temp;
-	size_t max_value = 0;
+		process.PID = record->PID;
+		process.name = history.GetName(record->name_id);
+		process.cpu = record->process_value;
+		process.wio = (long long)record->process_value;
+		process.rio = (long long)record->process_value;
+		process.tio = (long long)record->process_value;
+		process.faults = (long long)record->process_value;
 
-	//Store values in temp while finding the largest
-	while (size_queue->size() > 0) {
-		size_t check_value = size_queue->front();
-		size_queue->pop();
-		temp.push(check_value);
-		if (check_value > max_value) max_value = check_value;
+		OutputTick output;
+		output.time = (unsigned long long)record->time * 1000000ULL;
+		output.disk_pct = record->disk_pct;
+		output.recv_bytes = record->recv_bytes;
+		output.sent_bytes = record->sent_bytes;
+		output.cpu_pct = record->cpu_pct;
+		output.core_max_pct = 0.0;
+		output.busiest_core = -1;
+		output.ram_pct = record->ram_pct;
+		output.cause = (bottleneck_causes)record->cause;
+		output.processes = &process;
+		output.process_count = (process.name.length() != 0) ? 1 : 0;
+		output.processor_count = (record->processor_count > 0) ? record->processor_count : 1;
+		output.show_io_value = false;
+		output.disks = 0;
+		output.disk_count = 0;
+		output.interfaces = 0;
+		output.interface_count = 0;
+		output.pressure = 0;
+		output.threads = 0;
+		output.thread_count = 0;
+		output.cgroups = 0;
+		output.cgroup_count = 0;
+		output.interval_ns = 0;
+
+		text.Clear();
+		encoder->EncodeTick(&output, &text);
+		if (encoder->NeedsLogTime()) {
+			timed_text.Clear();
+			AppendLogLines(&text, output.time, &timed_text);
+			wcout.write(timed_text.GetText(), timed_text.GetLength());
+		}
+		else wcout.write(text.GetText(), text.GetLength());
 	}
+	wcout << flush;
+	delete encoder;
+	return EXIT_SUCCESS;
+}
 
-	//Loop again to restore the loop
-	while (temp.size() > 0) {
-		size_queue->push(temp.front());
-		temp.pop();
+void FillSnapshot(const OutputTick* output, unsigned long long interval_ns, const PressureSample* pressure, Snapshot* snapshot) {
+	//Copies what viewers show into the fixed-width snapshot.
+	snapshot->time = output->time;
+	snapshot->interval_ns = interval_ns;
+	snapshot->disk_pct = output->disk_pct;
+	snapshot->cpu_pct = output->cpu_pct;
+	snapshot->core_max_pct = output->core_max_pct;
+	snapshot->ram_pct = output->ram_pct;
+	snapshot->recv_bytes = output->recv_bytes;
+	snapshot->sent_bytes = output->sent_bytes;
+	snapshot->busiest_core = output->busiest_core;
+	snapshot->cause = output->cause;
+	snapshot->processor_count = output->processor_count;
+	snapshot->pressure_flags = 0;
+	for (DWORD resource = 0; resource < PRESSURE_COUNT; ++resource) {
+		if (pressure[resource].available) snapshot->pressure_flags |= 1 << resource;
+		snapshot->pressure[resource][0] = pressure[resource].some_pct;
+		snapshot->pressure[resource][1] = pressure[resource].full_pct;
+		snapshot->pressure[resource][2] = pressure[resource].some_avg10;
+		snapshot->pressure[resource][3] = pressure[resource].full_avg10;
+	}
+	snapshot->process_count = (output->process_count < SNAPSHOT_MAX_PROCESSES) ? output->process_count : SNAPSHOT_MAX_PROCESSES;
+	for (DWORD rank = 0; rank < snapshot->process_count; ++rank) {
+		const BottleneckProcess* process = &output->processes[rank];
+		SnapshotProcess* shared_process = &snapshot->processes[rank];
+		shared_process->PID = process->PID;
+		shared_process->cpu = process->cpu;
+		shared_process->wio = process->wio;
+		shared_process->rio = process->rio;
+		shared_process->tio = process->tio;
+		shared_process->faults = process->faults;
+		size_t length = (process->name.length() < 63) ? process->name.length() : 63;
+		for (size_t n = 0; n < length; ++n) {
+			wchar_t character = process->name[n];
+			shared_process->name[n] = ((unsigned long)character > 0xFFFF) ? (uint16_t)L'?' : (uint16_t)character;
+		}
+		shared_process->name_length = (uint32_t)length;
 	}
-	
-	return max_value;
 }
 
+int AttachToDaemon(output_formats format, DWORD top_count, bool show_pressure) {
+	//Formats the daemon's snapshots like the sampling loop formats its ticks.
+	SharedSnapshot shared;
+	if (!shared.Attach() || !shared.IsPublishing()) {
+		wcout << "No /DAEMON is running." << endl;
+		return EXIT_FAILURE;
+	}
+	OutputEncoder* encoder = CreateEncoder(format, show_pressure);
+	LineBuffer text;
+	if ((format == format_smart) || (format == format_tsv)) {
+		text.Append(WELCOME_HEADER);
+		text.Append(L'\n');
+	}
+	encoder->EncodeHeader(&text);
+	wcout << text.GetText() << flush;
+
+	Snapshot* snapshot = new Snapshot;
+	vector<BottleneckProcess> processes(top_count);
+	PressureSample pressure[PRESSURE_COUNT];
+	uint64_t sequence = 0;
+	DWORD poll_ms = 10;
+	while (shared.IsPublishing()) {
+		//Checking for a new snapshot is one load, so polling is cheap
+		if (!shared.ReadNew(snapshot, &sequence)) {
+			Sleep(poll_ms);
+			continue;
+		}
+		poll_ms = (DWORD)(snapshot->interval_ns / 20000000ULL);
+		if (poll_ms < 1) poll_ms = 1;
+		if (poll_ms > 50) poll_ms = 50;
+
+		DWORD process_count = (snapshot->process_count < top_count) ? snapshot->process_count : top_count;
+		for (DWORD rank = 0; rank < process_count; ++rank) {
+			const SnapshotProcess* shared_process = &snapshot->processes[rank];
+			BottleneckProcess* process = &processes[rank];
+			process->PID = shared_process->PID;
+			process->name.resize(shared_process->name_length);
+			for (DWORD n = 0; n < shared_process->name_length; ++n) process->name[n] = (wchar_t)shared_process->name[n];
+			process->cpu = shared_process->cpu;
+			process->wio = shared_process->wio;
+			process->rio = shared_process->rio;
+			process->tio = shared_process->tio;
+			process->faults = shared_process->faults;
+		}
+		for (DWORD resource = 0; resource < PRESSURE_COUNT; ++resource) {
+			pressure[resource].available = (snapshot->pressure_flags & (1 << resource)) != 0;
+			pressure[resource].some_pct = snapshot->pressure[resource][0];
+			pressure[resource].full_pct = snapshot->pressure[resource][1];
+			pressure[resource].some_avg10 = snapshot->pressure[resource][2];
+			pressure[resource].full_avg10 = snapshot->pressure[resource][3];
+		}
+
+		OutputTick output;
+		output.time = snapshot->time;
+		output.disk_pct = snapshot->disk_pct;
+		output.recv_bytes = snapshot->recv_bytes;
+		output.sent_bytes = snapshot->sent_bytes;
+		output.cpu_pct = snapshot->cpu_pct;
+		output.core_max_pct = snapshot->core_max_pct;
+		output.busiest_core = snapshot->busiest_core;
+		output.ram_pct = snapshot->ram_pct;
+		output.cause = (bottleneck_causes)snapshot->cause;
+		output.processes = processes.data();
+		output.process_count = process_count;
+		output.processor_count = (snapshot->processor_count > 0) ? snapshot->processor_count : 1;
+		output.show_io_value = top_count > 1;
+		output.disks = 0;
+		output.disk_count = 0;
+		output.interfaces = 0;
+		output.interface_count = 0;
+		output.pressure = show_pressure ? pressure : 0;
+		output.threads = 0;
+		output.thread_count = 0;
+		output.cgroups = 0;
+		output.cgroup_count = 0;
+		output.interval_ns = 0;
+
+		text.Clear();
+		encoder->EncodeTick(&output, &text);
+		wcout.write(text.GetText(), text.GetLength());
+		wcout << flush;
+	}
+	wcout << "The /DAEMON stopped." << endl;
+	delete snapshot;
+	delete encoder;
+	return EXIT_SUCCESS;
+}
+
+//The sampling loop's scheduler, stopped on Ctrl+C so the loop can end cleanly
+TickScheduler* running_scheduler = 0;
+
+#ifdef _WIN32
+BOOL WINAPI HandleConsoleControl(DWORD control_type) {
+	//Runs on its own thread, the loop stops after its current tick.
+	if (running_scheduler == 0) return FALSE;
+	running_scheduler->Stop();
+	return TRUE;
+}
+#else
+pthread_t main_thread;
+
+void HandleStopSignal(int signal_number) {
+	//Any thread may get the signal, the main thread's sleep is what needs
+	// interrupting.
+	if (running_scheduler != 0) running_scheduler->Stop();
+	if (!pthread_equal(pthread_self(), main_thread)) pthread_kill(main_thread, signal_number);
+}
+#endif
+
 int wmain(int argc, wchar_t* argv[])
 {
 	//Argument vars to be assigned during argument parsing
 	wchar_t* logging_filename = 0;
-	int master_sleep_time = 1000;
-	bool smart_formatting = true;
+	flush_policies flush_policy = flush_periodic;
+	DWORD flush_every = 1;
+	DWORD flush_interval_ms = 1000;
+	wchar_t* history_filename = 0;
+	DWORD history_records = 86400;
+	wchar_t* dump_filename = 0;
+	wchar_t* record_filename = 0;
+	wchar_t* replay_filename = 0;
+	unsigned long long interval_ns = 1000000000ULL;
+	unsigned long long max_interval_ns = 0;//0 without a max for /T
+	bool catch_up = false;
+	bool show_stats = false;
+	DWORD stats_interval_seconds = 60;
+	bool show_disks = false;
+	bool show_interfaces = false;
+	bool show_pressure = false;
+	vector<wstring> interface_includes;
+	vector<wstring> interface_excludes;
+	bool show_summary = false;
+	DWORD summary_interval_seconds = 60;
+	unsigned long long summary_windows[RollingStats::MAX_WINDOWS] = {60000000000ULL, 300000000000ULL, 900000000000ULL};
+	DWORD summary_window_count = 3;
+	DWORD thread_count = 0;//0 picks from the processor count
+	DWORD top_count = 1;
+	DWORD top_thread_count = 0;//0 without /THREADS
+	bool publish = false;
+	bool attach = false;
+	wchar_t* metrics_address = 0;
+	DWORD top_cgroup_count = 0;//0 without /CGROUPS
+	bool in_cgroup = false;
+	output_formats output_format = format_smart;
 
 	//Argument parsing
 	for (int argn = 1; argn < argc; ++argn) {
@@ -134,21 +529,286 @@ int wmain(int argc, wchar_t* argv[])
 				wstring sleep_time_string;
 				sleep_time_string.assign(argv[argn]);
 				double sleep_time_seconds = stod(argv[argn]);
-				if (sleep_time_seconds < 0.001) {
-					wcout << "Time must be at least 0.001 seconds." << endl;
+				if (sleep_time_seconds < 0.0001) {
+					wcout << "Time must be at least 0.0001 seconds." << endl;
 					return EXIT_FAILURE;
 				}
 				if (sleep_time_seconds > 2147483) {
 					wcout << "Time must be less than or equal to 2,147,483 seconds." << endl;
 					return EXIT_FAILURE;
 				}
-				master_sleep_time = (int) 1000 * sleep_time_seconds;//Generates a compiler warning, but I did the safety checks above. 
+				interval_ns = (unsigned long long)(sleep_time_seconds * 1000000000.0 + 0.5);
+
+				//An optional max time makes it adaptive
+				if ((argn + 1 < argc) && (argv[argn + 1][0] != L'/') && (argv[argn + 1][0] != L'-')) {
+					++argn;
+					double max_seconds = stod(argv[argn]);
+					if ((max_seconds < sleep_time_seconds) || (max_seconds > 2147483)) {
+						wcout << "Max time must be from the time to 2,147,483 seconds." << endl;
+						return EXIT_FAILURE;
+					}
+					max_interval_ns = (unsigned long long)(max_seconds * 1000000000.0 + 0.5);
+				}
 			}
 			else {
 				wcout << "Did not specify a time." << endl;
 				return EXIT_FAILURE;
 			}
 		}
+		else if (StringsMatch(argv[argn], L"/CATCHUP")) {
+			catch_up = true;
+		}
+		else if (StringsMatch(argv[argn], L"/J")) {
+			//Thread count input
+			++argn;
+			if (argn < argc) {
+				int threads = stoi(argv[argn]);
+				if ((threads < 1) || (threads > 256)) {
+					wcout << "Threads must be from 1 to 256." << endl;
+					return EXIT_FAILURE;
+				}
+				thread_count = threads;
+			}
+			else {
+				wcout << "Did not specify a thread count." << endl;
+				return EXIT_FAILURE;
+			}
+		}
+		else if (StringsMatch(argv[argn], L"/CGROUPS")) {
+			//Number of cgroups to list
+			++argn;
+			if (argn < argc) {
+				int count = stoi(argv[argn]);
+				if ((count < 1) || (count > 100)) {
+					wcout << "Cgroup count must be from 1 to 100." << endl;
+					return EXIT_FAILURE;
+				}
+				top_cgroup_count = count;
+			}
+			else {
+				wcout << "Did not specify a cgroup count." << endl;
+				return EXIT_FAILURE;
+			}
+		}
+		else if (StringsMatch(argv[argn], L"/INCGROUP")) {
+			in_cgroup = true;
+		}
+		else if (StringsMatch(argv[argn], L"/THREADS")) {
+			//Number of the bottleneck process's threads to list
+			++argn;
+			if (argn < argc) {
+				int count = stoi(argv[argn]);
+				if ((count < 1) || (count > 100)) {
+					wcout << "Thread count must be from 1 to 100." << endl;
+					return EXIT_FAILURE;
+				}
+				top_thread_count = count;
+			}
+			else {
+				wcout << "Did not specify a thread count." << endl;
+				return EXIT_FAILURE;
+			}
+		}
+		else if (StringsMatch(argv[argn], L"/TOP")) {
+			//Number of processes to list
+			++argn;
+			if (argn < argc) {
+				int count = stoi(argv[argn]);
+				if ((count < 1) || (count > 100)) {
+					wcout << "Top count must be from 1 to 100." << endl;
+					return EXIT_FAILURE;
+				}
+				top_count = count;
+			}
+			else {
+				wcout << "Did not specify a top count." << endl;
+				return EXIT_FAILURE;
+			}
+		}
+		else if (StringsMatch(argv[argn], L"/FLUSH")) {
+			//Logfile flush policy input
+			++argn;
+			if (argn < argc) {
+				ConvertCStringToUpper(argv[argn]);
+				if (StringsMatch(argv[argn], L"NONE")) flush_policy = flush_none;
+				else if (StringsMatch(argv[argn], L"PERIODIC")) flush_policy = flush_periodic;
+				else {
+					int lines = stoi(argv[argn]);
+					if (lines < 1) {
+						wcout << "Flush line count must be at least 1." << endl;
+						return EXIT_FAILURE;
+					}
+					flush_policy = flush_every_n;
+					flush_every = lines;
+				}
+			}
+			else {
+				wcout << "Did not specify a flush policy." << endl;
+				return EXIT_FAILURE;
+			}
+		}
+		else if (StringsMatch(argv[argn], L"/FLUSHT")) {
+			//Logfile write interval input
+			++argn;
+			if (argn < argc) {
+				double flush_seconds = stod(argv[argn]);
+				if ((flush_seconds < 0.001) || (flush_seconds > 3600)) {
+					wcout << "Flush time must be from 0.001 to 3600 seconds." << endl;
+					return EXIT_FAILURE;
+				}
+				flush_interval_ms = (DWORD)(flush_seconds * 1000);
+			}
+			else {
+				wcout << "Did not specify a flush time." << endl;
+				return EXIT_FAILURE;
+			}
+		}
+		else if (StringsMatch(argv[argn], L"/DAEMON")) {
+			publish = true;
+		}
+		else if (StringsMatch(argv[argn], L"/ATTACH")) {
+			attach = true;
+		}
+		else if (StringsMatch(argv[argn], L"/METRICS")) {
+			//Port or Unix socket path to serve Prometheus text on
+			++argn;
+			if (argn < argc) metrics_address = argv[argn];
+			else {
+				wcout << "Did not specify a metrics address." << endl;
+				return EXIT_FAILURE;
+			}
+		}
+		else if (StringsMatch(argv[argn], L"/STATS")) {
+			show_stats = true;
+		}
+		else if (StringsMatch(argv[argn], L"/STATST")) {
+			//Stats display interval input
+			++argn;
+			if (argn < argc) {
+				int stats_seconds = stoi(argv[argn]);
+				if ((stats_seconds < 1) || (stats_seconds > 86400)) {
+					wcout << "Stats time must be from 1 to 86400 seconds." << endl;
+					return EXIT_FAILURE;
+				}
+				stats_interval_seconds = stats_seconds;
+			}
+			else {
+				wcout << "Did not specify a stats time." << endl;
+				return EXIT_FAILURE;
+			}
+		}
+		else if (StringsMatch(argv[argn], L"/DISKS")) {
+			show_disks = true;
+		}
+		else if (StringsMatch(argv[argn], L"/NETS")) {
+			show_interfaces = true;
+		}
+		else if (StringsMatch(argv[argn], L"/PSI")) {
+			show_pressure = true;
+		}
+		else if (StringsMatch(argv[argn], L"/NETINCLUDE")) {
+			//Network interface names to count
+			++argn;
+			if (argn < argc) ParseNameList(argv[argn], &interface_includes);
+			else {
+				wcout << "Did not specify network interfaces to include." << endl;
+				return EXIT_FAILURE;
+			}
+		}
+		else if (StringsMatch(argv[argn], L"/NETEXCLUDE")) {
+			//Network interface names not to count
+			++argn;
+			if (argn < argc) ParseNameList(argv[argn], &interface_excludes);
+			else {
+				wcout << "Did not specify network interfaces to exclude." << endl;
+				return EXIT_FAILURE;
+			}
+		}
+		else if (StringsMatch(argv[argn], L"/SUMMARY")) {
+			show_summary = true;
+		}
+		else if (StringsMatch(argv[argn], L"/SUMMARYT")) {
+			//Summary display interval input
+			++argn;
+			if (argn < argc) {
+				int summary_seconds = stoi(argv[argn]);
+				if ((summary_seconds < 1) || (summary_seconds > 86400)) {
+					wcout << "Summary time must be from 1 to 86400 seconds." << endl;
+					return EXIT_FAILURE;
+				}
+				summary_interval_seconds = summary_seconds;
+			}
+			else {
+				wcout << "Did not specify a summary time." << endl;
+				return EXIT_FAILURE;
+			}
+		}
+		else if (StringsMatch(argv[argn], L"/WINDOWS")) {
+			//Summary window lengths input
+			++argn;
+			if (argn < argc) {
+				if (!ParseWindows(argv[argn], summary_windows, &summary_window_count)) {
+					wcout << "Windows must be up to 8 lengths like 1m,5m,15m, each at most 7 days." << endl;
+					return EXIT_FAILURE;
+				}
+			}
+			else {
+				wcout << "Did not specify summary windows." << endl;
+				return EXIT_FAILURE;
+			}
+		}
+		else if (StringsMatch(argv[argn], L"/RING")) {
+			//History file, read filename next
+			++argn;
+			if (argn < argc) history_filename = argv[argn];
+			else {
+				wcout << "Did not specify history filename." << endl;
+				return EXIT_FAILURE;
+			}
+		}
+		else if (StringsMatch(argv[argn], L"/RINGSIZE")) {
+			//History record count input
+			++argn;
+			if (argn < argc) {
+				long long records = stoll(argv[argn]);
+				if ((records < 1) || (records > 100000000)) {
+					wcout << "Ring size must be from 1 to 100,000,000 records." << endl;
+					return EXIT_FAILURE;
+				}
+				history_records = (DWORD)records;
+			}
+			else {
+				wcout << "Did not specify a ring size." << endl;
+				return EXIT_FAILURE;
+			}
+		}
+		else if (StringsMatch(argv[argn], L"/RECORD")) {
+			//Recording file, read filename next
+			++argn;
+			if (argn < argc) record_filename = argv[argn];
+			else {
+				wcout << "Did not specify recording filename." << endl;
+				return EXIT_FAILURE;
+			}
+		}
+		else if (StringsMatch(argv[argn], L"/REPLAY")) {
+			//Recording file to replay, read filename next
+			++argn;
+			if (argn < argc) replay_filename = argv[argn];
+			else {
+				wcout << "Did not specify recording filename." << endl;
+				return EXIT_FAILURE;
+			}
+		}
+		else if (StringsMatch(argv[argn], L"/DUMP")) {
+			//Decode a history file and exit
+			++argn;
+			if (argn < argc) dump_filename = argv[argn];
+			else {
+				wcout << "Did not specify history filename." << endl;
+				return EXIT_FAILURE;
+			}
+		}
 		else if (StringsMatch(argv[argn], L"/L")) {
 			//Logging, read filename next
 			++argn;
@@ -162,7 +822,26 @@ int wmain(int argc, wchar_t* argv[])
 		}
 		else if (StringsMatch(argv[argn], L"/TSV")) {
 			//No Smart Formatting
-			smart_formatting = false;
+			output_format = format_tsv;
+		}
+		else if (StringsMatch(argv[argn], L"/FORMAT")) {
+			//Output layout input
+			++argn;
+			if (argn < argc) {
+				ConvertCStringToUpper(argv[argn]);
+				if (StringsMatch(argv[argn], L"SMART")) output_format = format_smart;
+				else if (StringsMatch(argv[argn], L"TSV")) output_format = format_tsv;
+				else if (StringsMatch(argv[argn], L"CSV")) output_format = format_csv;
+				else if (StringsMatch(argv[argn], L"JSON")) output_format = format_json;
+				else {
+					wcout << "Format must be SMART, TSV, CSV or JSON." << endl;
+					return EXIT_FAILURE;
+				}
+			}
+			else {
+				wcout << "Did not specify a format." << endl;
+				return EXIT_FAILURE;
+			}
 		}
 		else if (StringsMatch(argv[argn], L"/H") ||
 				 StringsMatch(argv[argn], L"/HELP") ||
@@ -180,560 +859,517 @@ int wmain(int argc, wchar_t* argv[])
 		}
 	}
 
-	//Check if the registry is set to see PIDs when collecting process data
-	bool registry_is_set = RegistryIsSetForPIDs();
-	if (!registry_is_set) {
-		//Attempt to set the registry correctly
-		registry_is_set = SetRegistryForPIDs();
+	//Dumping a history file does not sample
+	if (dump_filename != 0) return DumpHistory(dump_filename, (output_format == format_smart) ? format_tsv : output_format);
+
+	//Viewers only read what the daemon publishes
+	if (attach) return AttachToDaemon(output_format, top_count, show_pressure);
+	if ((record_filename != 0) && (replay_filename != 0)) {
+		wcout << "Cannot record while replaying." << endl;
+		return EXIT_FAILURE;
 	}
-	if (!registry_is_set) {
-		wcout << "Your system is not configured to monitor processes using their PIDs. You will see missing data. Run once with admin rights to enable more accurate process monitoring. See the usage/help for more details.\n\n";
+
+	//Replays take their times from the recording
+	if (replay_filename != 0) max_interval_ns = 0;
+
+	//Open the collector for this platform
+	Collector* collector = CreateCollector();
+	collector->SetInterfaceFilters(interface_includes, interface_excludes);
+	if (!collector->Open()) {
+		delete collector;
+		return EXIT_FAILURE;
 	}
 
 	//Open logging file if specified
-	wofstream logfile;
+	LogWriter logfile;
 	if (logging_filename != 0) {
-		logfile.open(logging_filename, ios::out | ios::app);
-		if (!logfile.is_open()) {
+		if (!logfile.Open(logging_filename, flush_policy, flush_interval_ms, flush_every)) {
 			wcout << "Error opening logfile \"" << logging_filename << "\"" << endl;
 			wcout << WELCOME_HEADER << endl << endl;
 			wcout << USAGE_TEXT;
+			delete collector;
 			return EXIT_FAILURE;
 		}
 	}
 
+	//Open history file if specified
+	HistoryRing history;
+	if ((history_filename != 0) && !history.Open(history_filename, history_records, false)) {
+		delete collector;
+		return EXIT_FAILURE;
+	}
+
 	//Get number of processor cores
 	DWORD processor_count = GetProcessorCount();
 
-	//Welcome message
-	wcout << WELCOME_HEADER << endl;
-	if (smart_formatting) wcout << L"Disk%  Download\tUpload\tCPU%   Process\t\tRAM%" << endl;
-	else				  wcout << L"Disk%\tDownload\tUpload\tCPU%\tProcess\tRAM%" << endl;
-	if (logging_filename != 0) {
-		logfile << WELCOME_HEADER << endl;
-		if (smart_formatting) logfile << L"Disk%  Download\tUpload\tCPU%   Process\t\tRAM%" << endl;
-		else logfile << L"Disk%\tDownload\tUpload\tCPU%\tProcess\tRAM%" << endl;
+	//Reading /proc stops scaling long before the core count on large hosts
+	if (thread_count == 0) {
+		thread_count = processor_count / 4;
+		if (thread_count < 1) thread_count = 1;
+		if (thread_count > 16) thread_count = 16;
 	}
+	collector->SetThreadCount(thread_count);
+	collector->SetRankCount(top_count);
+	//Recordings keep every process's counters and name
+	collector->SetSampleAll(record_filename != 0);
 
-	//Open query
-	PDH_HQUERY query_handle;
-	PDH_STATUS pdh_status = PdhOpenQuery(NULL, 0, &query_handle);
-	if (pdh_status != ERROR_SUCCESS) {
-		wcout << "PdhOpenQuery() error." << endl;
-		return EXIT_FAILURE;
+	//Open the recording to write or replay
+	SampleRecording recording;
+	if (record_filename != 0) {
+		if (!recording.Create(record_filename, processor_count)) {
+			wcout << "Error opening recording \"" << record_filename << "\"" << endl;
+			delete collector;
+			return EXIT_FAILURE;
+		}
+	}
+	if (replay_filename != 0) {
+		if (!recording.Open(replay_filename)) {
+			wcout << "Error opening recording \"" << replay_filename << "\"" << endl;
+			delete collector;
+			return EXIT_FAILURE;
+		}
+		//The recorded host's CPU% is per its own cores
+		processor_count = recording.GetProcessorCount();
+		collector->SetReplay(&recording);
 	}
 
-	//Add counters
-	PDH_HCOUNTER cpu_pct_counter = AddSingleCounter(query_handle, 
-									L"\\Processor(_Total)\\% Processor Time");
-	PDH_HCOUNTER disk_pct_counters = AddSingleCounter(query_handle, 
-									L"\\PhysicalDisk(*)\\% Disk Time");
-	PDH_HCOUNTER bytes_sent_counters = AddSingleCounter(query_handle, 
-									L"\\Network Interface(*)\\Bytes Sent/sec");
-	PDH_HCOUNTER bytes_recv_counters = AddSingleCounter(query_handle, 
-									L"\\Network Interface(*)\\Bytes Received/sec");
-	PDH_HCOUNTER process_cpu_pct_counters = AddSingleCounter(query_handle, 
-									L"\\Process(*)\\% Processor Time");
-	PDH_HCOUNTER process_write_bytes_counters = AddSingleCounter(query_handle, 
-									L"\\Process(*)\\IO Write Bytes/sec");
-	PDH_HCOUNTER process_read_bytes_counters = AddSingleCounter(query_handle, 
-									L"\\Process(*)\\IO Read Bytes/sec");
-	
-	//Collect first sample
-	if (!CollectQueryData(query_handle)) {
-		wcout << "First sample collection failed." << endl;
+	//Open the shared memory to publish in
+	SharedSnapshot shared;
+	Snapshot* snapshot = 0;
+	if (publish) {
+		if (!shared.Create()) {
+			wcout << "Error publishing in shared memory, is another /DAEMON running?" << endl;
+			delete collector;
+			return EXIT_FAILURE;
+		}
+		snapshot = new Snapshot;
+		memset(snapshot, 0, sizeof(Snapshot));
+	}
+
+	//Start serving metrics, scrapes get the last tick's
+	MetricsServer metrics;
+	LineBuffer metrics_text;
+	if ((metrics_address != 0) && !metrics.Open(metrics_address)) {
+		wcout << "Error serving metrics on \"" << metrics_address << "\"" << endl;
+		delete snapshot;
+		delete collector;
 		return EXIT_FAILURE;
 	}
 
-	//Pointers for keeping track of processes
-	ProcessRaw* process_raw_old = 0;
-	ProcessRaw* process_raw_new = 0;
-	DWORD process_raw_old_length = 0;
-	DWORD process_raw_new_length = 0;
+	//Welcome message
+	OutputEncoder* encoder = CreateEncoder(output_format, show_pressure, max_interval_ns != 0);
+	LineBuffer output_text;
+	//CSV and JSON are left for programs to read, without it
+	if ((output_format == format_smart) || (output_format == format_tsv)) {
+		output_text.Append(WELCOME_HEADER);
+		output_text.Append(L'\n');
+	}
+	encoder->EncodeHeader(&output_text);
+	wcout << output_text.GetText() << flush;
+	if ((logging_filename != 0) && (output_text.GetLength() > 0)) {
+		logfile.Write(output_text.GetText(), output_text.GetLength());
+	}
 
-	//Formatting queues
-	const unsigned int MAX_QUEUE_SIZE = 10;
-	queue <size_t> bottleneck_name_length_queue;
-	queue <size_t> bottleneck_cause_length_queue;
+	//Each tick's logfile lines, queued as one record
+	LineBuffer log_text;
+	unsigned long long reported_log_drops = 0;
 
-	int sleep_time = 1000;
-	while (true) {
-		Sleep(sleep_time);
-		if (sleep_time != master_sleep_time) {
-			sleep_time = master_sleep_time;
-		}
-		CollectQueryData(query_handle);
-
-		////////// CPU % //////////
-		PDH_FMT_COUNTERVALUE cpu_pct;
-		pdh_status = PdhGetFormattedCounterValue(cpu_pct_counter, PDH_FMT_DOUBLE, 0, &cpu_pct);
-		if ((pdh_status != ERROR_SUCCESS) || (cpu_pct.CStatus != ERROR_SUCCESS)) {
-			//This will be the first to error if something changes.
-			//	(for example, a disk drive is connected)
-			//The counters will be fine next cycle, so gracefully ignore the error.
-			//cout << "PdhGetFormattedCounterValue() cpu_pct_counter error." << endl;
-			sleep_time = 1;
-			continue;
-		}
-		//Use cpu_pct.doubleValue
+	//Kept across ticks so the name buffers are reused, the bottleneck then
+	// the rest of /TOP
+	vector<BottleneckProcess> top_processes(top_count);
+	DWORD top_process_count = 0;
 
-		////////// Disk %s //////////
-		PDH_FMT_COUNTERVALUE_ITEM* disk_pcts = 0;
-		DWORD counter_count = GetCounterArray(disk_pct_counters, PDH_FMT_DOUBLE, &disk_pcts);
-		if (counter_count == 0) {
-			//cout << "GetCounterArray() error for disk percent counters." << endl;
-			sleep_time = 1;
-			continue;
-		}
-		
-		//Find the maximum disk usage to display, that will be the bottleneck I care about
-		//Skip the first disk, it is an average of all disks
-		double highest_disk_usage = 0.0;
-		for (DWORD diskN = 1; diskN < counter_count; ++diskN) {
-			if (disk_pcts[diskN].FmtValue.doubleValue > highest_disk_usage) {
-				highest_disk_usage = disk_pcts[diskN].FmtValue.doubleValue;
-			}
-		}
-		delete[] disk_pcts;
-		//Use highest_disk_usage
-
-		////////// Network I/O bytes //////////
-		unsigned long long sent_bytes = SumCounterArray(bytes_sent_counters);
-		unsigned long long recv_bytes = SumCounterArray(bytes_recv_counters);
-		
-		////////// RAM % //////////
-		double ram_pct = GetPercentUsedRAM();
-
-		////////// Save High-Performance Per-Process Data //////////
-		if (registry_is_set) {
-			//CPU (and initialize process_raw_new here too)
-			PDH_RAW_COUNTER_ITEM* process_cpu_pcts = 0;
-			process_raw_new_length = GetCounterArrayRawValues(process_cpu_pct_counters, &process_cpu_pcts);
-			if (process_raw_new_length == 0) {
-				wcout << "GetCounterArrayRawValues() error for process cpu percent counters." << endl;
-			}
-			else {
-				process_raw_new = new ProcessRaw[process_raw_new_length];
-				for (DWORD n = 0; n < process_raw_new_length; ++n) {
-					process_raw_new[n].ParseRawCounterName(process_cpu_pcts[n].szName);
-					memcpy(&process_raw_new[n].raw_cpu, &process_cpu_pcts[n].RawValue, sizeof(PDH_RAW_COUNTER));
-				}
-			}
-			delete[] process_cpu_pcts;
+	//The bottleneck process's top threads, kept the same way
+	vector<ThreadSample> top_threads(top_thread_count);
+	DWORD top_threads_found = 0;
 
-			//Write I/O
-			if (process_raw_new_length != 0) {
-				PDH_RAW_COUNTER_ITEM* process_wio = 0;
-				DWORD process_count = GetCounterArrayRawValues(process_write_bytes_counters, &process_wio);
-				if (process_count == 0) {
-					wcout << "GetCounterArrayRawValues() error for process WIO counters." << endl;
-				}
-				else {
-					for (DWORD n = 0; n < process_count; ++n) {
-						DWORD PID = ParsePIDFromRawCounterName(process_wio[n].szName);
-						if (PID != 0) {
-							//Find the process and add the raw data
-							int index = FindPIDInProcessRawArray(process_raw_new, process_raw_new_length, PID);
-							if (index != -1) {
-								memcpy(&process_raw_new[n].raw_wio, &process_wio[n].RawValue, sizeof(PDH_RAW_COUNTER));
-							}
-						}
-					}
-					delete[] process_wio;
-				}
-			}
+	//The top cgroups, kept the same way
+	if (in_cgroup && (top_cgroup_count == 0)) top_cgroup_count = 1;
+	vector<CgroupSample> top_cgroups(top_cgroup_count);
+	DWORD top_cgroups_found = 0;
 
-			//Read I/O
-			if (process_raw_new_length != 0) {
-				PDH_RAW_COUNTER_ITEM* process_rio = 0;
-				DWORD process_count = GetCounterArrayRawValues(process_read_bytes_counters, &process_rio);
-				if (process_count == 0) {
-					wcout << "GetCounterArrayRawValues() error for process RIO counters." << endl;
-				}
-				else {
-					for (DWORD n = 0; n < process_count; ++n) {
-						DWORD PID = ParsePIDFromRawCounterName(process_rio[n].szName);
-						if (PID != 0) {
-							//Find the process and add the raw data
-							int index = FindPIDInProcessRawArray(process_raw_new, process_raw_new_length, PID);
-							if (index != -1) {
-								memcpy(&process_raw_new[n].raw_rio, &process_rio[n].RawValue, sizeof(PDH_RAW_COUNTER));
-							}
-						}
-					}
-					delete[] process_rio;
-				}
+	//Ctrl+C ends the loop after the current tick
+	TickScheduler scheduler;
+	running_scheduler = &scheduler;
+#ifdef _WIN32
+	SetConsoleCtrlHandler(HandleConsoleControl, TRUE);
+#else
+	main_thread = pthread_self();
+	struct sigaction stop_action;
+	memset(&stop_action, 0, sizeof(stop_action));
+	stop_action.sa_handler = HandleStopSignal;
+	stop_action.sa_flags = SA_RESTART;
+	sigemptyset(&stop_action.sa_mask);
+	sigaction(SIGINT, &stop_action, 0);
+	sigaction(SIGTERM, &stop_action, 0);
+#endif
+
+	LoopStats stats;
+
+	RollingStats rolling;
+	rolling.SetWindows(summary_windows, summary_window_count);
+	LineBuffer summary_text;
+	unsigned long long summary_interval_ns = summary_interval_seconds * 1000000000ULL;
+	unsigned long long next_summary_time = 0;//Unix time, set on the first tick
+	unsigned long long stats_interval_ns = stats_interval_seconds * 1000000000ULL;
+	unsigned long long next_stats_time = GetMonotonicNanoseconds() + stats_interval_ns;
+
+	unsigned long long reported_skipped_ticks = 0;
+	unsigned long long tick_time = 0;//Nanoseconds since 1970-01-01 UTC
+	unsigned long long replayed_tick_time = 0;
+	AdaptiveInterval adaptive;
+	if (max_interval_ns != 0) adaptive.SetBounds(interval_ns, max_interval_ns);
+	scheduler.Start(interval_ns, catch_up);
+	while (true) {
+		//Collectors measure their own elapsed time for rates, this is recorded
+		unsigned long long actual_interval_ns = 0;
+		if (replay_filename == 0) actual_interval_ns = scheduler.WaitForNextTick();
+		if (scheduler.IsStopped()) break;
+		if (scheduler.GetSkippedCount() != reported_skipped_ticks) {
+			reported_skipped_ticks = scheduler.GetSkippedCount();
+			wcout << L"Sampling is behind, " << reported_skipped_ticks << L" samples skipped." << endl;
+		}
+#ifdef _DEBUG
+		unsigned long long allocations_before_sampling = GetAllocationCount();
+#endif
+		unsigned long long counters_start = GetMonotonicNanoseconds();
+		SystemSample sample;
+		if (replay_filename != 0) {
+			//Replays do not wait for ticks, the recording has their times
+			if (!recording.ReadSystem(&sample, &tick_time)) break;
+			if (replayed_tick_time != 0) actual_interval_ns = tick_time - replayed_tick_time;
+			replayed_tick_time = tick_time;
+		}
+		else {
+			if (!collector->CollectSystem(&sample)) {
+				//The counters will be fine next cycle, so gracefully ignore the error.
+				scheduler.RetryAfter(1000000ULL);
+				continue;
 			}
+			tick_time = GetUnixTimeNanoseconds();
 		}
+		if (show_stats) stats.Record(stage_counters, GetMonotonicNanoseconds() - counters_start);
+		double highest_disk_usage = sample.highest_disk_usage;
+		unsigned long long sent_bytes = sample.sent_bytes;
+		unsigned long long recv_bytes = sample.recv_bytes;
+		double ram_pct = sample.ram_pct;
 
 		////////// Determine which bottleneck to care about //////////
-		ProcessRaw bottleneck;
+		top_process_count = 0;
+		top_threads_found = 0;
+		top_cgroups_found = 0;
 		bottleneck_causes bottleneck_cause = none;
-		bool need_process_cpu = false;
-		bool need_process_rio = false;
-		bool need_process_wio = false;
-		if (cpu_pct.doubleValue >= 90.0) {
+		bool saturated = true;//False for the fallback picks
+
+		//Stall times say directly what tasks are waiting on, so the resource
+		// stalled the longest wins over any guess from utilization
+		int stalled_resource = -1;
+		for (DWORD resource = 0; resource < PRESSURE_COUNT; ++resource) {
+			const PressureSample* pressure = &sample.pressure[resource];
+			if (!pressure->available || (pressure->some_pct < STALLED_PRESSURE_PCT)) continue;
+			if ((stalled_resource == -1) || (pressure->some_pct > sample.pressure[stalled_resource].some_pct)) {
+				stalled_resource = resource;
+			}
+		}
+		if (stalled_resource == pressure_cpu) {
+			bottleneck_cause = CoreIsSaturated(sample.core_max_pct, sample.core_imbalance_pct) ? core : cpu;
+		}
+		else if (stalled_resource == pressure_io) {
+			bottleneck_cause = tio;
+		}
+		else if (stalled_resource == pressure_memory) {
+			//Find process with the most major page faults
+			bottleneck_cause = mem;
+		}
+		else if (sample.cpu_pct >= 90.0) {
 			//Find process with highest processor usage
 			bottleneck_cause = cpu;
-			need_process_cpu = true;
+		}
+		else if (CoreIsSaturated(sample.core_max_pct, sample.core_imbalance_pct)) {
+			//One core is full while the average looks idle, find the process
+			// with the highest processor usage on that core
+			bottleneck_cause = core;
 		}
 		else {
 			//Not a CPU bottleneck so IO is more interesting now
-			if (highest_disk_usage >= 20.0) {
+			//Percent disk time reaches 100% on fast disks that keep up, so
+			// the disk is only the bottleneck if requests wait in its queue
+			if (DiskIsSaturated(sample.disk_await_ms, sample.disk_queue_depth)) {
 				bottleneck_cause = tio;
-				need_process_rio = true;
-				need_process_wio = true;
 			}
-			else if (recv_bytes > sent_bytes) {
-				bottleneck_cause = rio;
-				need_process_rio = true;
-			}
-			else if (sent_bytes < recv_bytes) {
-				bottleneck_cause = wio;
-				need_process_wio = true;
+			//Likewise a network interface only when its link is nearly full.
+			//Per-process network bytes are not collected, so the processes
+			// reading or writing the most stand in for the direction that is full.
+			else if (LinkIsSaturated(sample.link_recv_pct, sample.link_sent_pct)) {
+				bottleneck_cause = (sample.link_recv_pct >= sample.link_sent_pct) ? rio : wio;
 			}
 			else {
-				//Nothing is happening, pick something anyways
-				if (cpu_pct.doubleValue > highest_disk_usage) {
+				//Nothing is saturated, pick something anyways
+				saturated = false;
+				if (sample.cpu_pct > highest_disk_usage) {
 					bottleneck_cause = cpu;
-					need_process_cpu = true;
 				}
 				else if (highest_disk_usage > 1.00) {
 					bottleneck_cause = tio;
-					need_process_rio = true;
-					need_process_wio = true;
 				}
 				else if (recv_bytes > sent_bytes) {
 					bottleneck_cause = rio;
-					need_process_rio = true;
 				}
-				else if (sent_bytes < recv_bytes) {
+				else if (sent_bytes > recv_bytes) {
 					bottleneck_cause = wio;
-					need_process_wio = true;
 				}
 				else {
 					bottleneck_cause = cpu;
-					need_process_cpu = true;
 				}
 			}
 		}
 
-		///////// If registry is not set, save the needed formatted data //////////
-		DWORD process_count = 0;
-		PDH_FMT_COUNTERVALUE_ITEM* process_cpu_pcts = 0;
-		PDH_FMT_COUNTERVALUE_ITEM* process_write_bytes = 0;
-		PDH_FMT_COUNTERVALUE_ITEM* process_read_bytes = 0;
-		PDH_FMT_COUNTERVALUE_ITEM* process_total_bytes = 0;
-		if (registry_is_set == false) {
-			//Allocates memory to the above pointers. Will need to deallocate later.
-			if (need_process_cpu) {
-				process_count = GetCounterArray(process_cpu_pct_counters, PDH_FMT_DOUBLE, &process_cpu_pcts);
-			}
-			if (need_process_wio) {
-				process_count = GetCounterArray(process_write_bytes_counters, PDH_FMT_LARGE, &process_write_bytes);
-			}
-			if (need_process_rio) {
-				process_count = GetCounterArray(process_read_bytes_counters, PDH_FMT_LARGE, &process_read_bytes);
-			}
-			if ((bottleneck_cause == tio) && (process_count > 0)) {
-				process_total_bytes = new PDH_FMT_COUNTERVALUE_ITEM[process_count];
-				memcpy(process_total_bytes, process_read_bytes, process_count * sizeof(PDH_FMT_COUNTERVALUE_ITEM));
-				for (DWORD n = 0; n < process_count; ++n) {
-					process_total_bytes[n].FmtValue.largeValue += process_write_bytes[n].FmtValue.largeValue;
-				}
-			}
-		}
+		////////// Collect per-process data and determine the bottleneck process //////////
+		//  If an error occurs with process counter data, skip outputting
+		//  the bottleneck process and output the resource stats anyways.
+		//A quiet host is not worth the processes, /T min max skips them until
+		// something happens. Recordings need every tick's.
+		bool collect_processes = (max_interval_ns == 0) || !adaptive.IsQuiet() || (record_filename != 0);
 
-		////////// If registry is set, calculate the needed formatted data //////////
-		if (registry_is_set) {
-			for (DWORD n = 0; n < process_raw_new_length; ++n) {
-				//Check if in process_raw_old, and calculate formmated values if so
-				int old_index = FindPIDInProcessRawArray(process_raw_old, process_raw_old_length, process_raw_new[n].PID);
-				if (old_index == -1) {
-					//Process is not there to calculate, probably a new process
-					continue;
-				}
-				PDH_FMT_COUNTERVALUE formatted_data;
-				if (need_process_cpu) {
-					PDH_STATUS ret = PdhCalculateCounterFromRawValue(
-						process_cpu_pct_counters, 
-						PDH_FMT_DOUBLE, 
-						&process_raw_new[n].raw_cpu, 
-						&process_raw_old[n].raw_cpu, 
-						&formatted_data);
-					if (ret == ERROR_SUCCESS) {
-						process_raw_new[n].cpu = formatted_data.doubleValue;
-					}
-				}
-				if (need_process_wio) {
-					PDH_STATUS ret = PdhCalculateCounterFromRawValue(
-						process_write_bytes_counters, 
-						PDH_FMT_LARGE, 
-						&process_raw_new[n].raw_wio, 
-						&process_raw_old[n].raw_wio, 
-						&formatted_data);
-					if (ret == ERROR_SUCCESS) {
-						process_raw_new[n].wio = formatted_data.largeValue;
-					}
-				}
-				if (need_process_rio) {
-					PDH_STATUS ret = PdhCalculateCounterFromRawValue(
-						process_read_bytes_counters, 
-						PDH_FMT_LARGE, 
-						&process_raw_new[n].raw_rio, 
-						&process_raw_old[n].raw_rio, 
-						&formatted_data);
-					if (ret == ERROR_SUCCESS) {
-						process_raw_new[n].rio = formatted_data.largeValue;
-					}
-				}
-				if (bottleneck_cause == tio) {
-					process_raw_new[n].tio = process_raw_new[n].wio + process_raw_new[n].rio;
+		//Rank the cgroups first, so /INCGROUP can keep the processes to the top one
+#ifdef _DEBUG
+		unsigned long long allocations_before_cgroups = GetAllocationCount();
+#endif
+		if (collect_processes && (top_cgroup_count > 0)) {
+			unsigned long long cgroups_start = GetMonotonicNanoseconds();
+			if (collector->CollectCgroups(bottleneck_cause, top_cgroup_count)) {
+				for (; top_cgroups_found < collector->GetRankedCgroupCount(); ++top_cgroups_found) {
+					top_cgroups[top_cgroups_found] = *collector->GetRankedCgroup(top_cgroups_found);
 				}
 			}
+			if (in_cgroup) collector->LimitToCgroup((top_cgroups_found > 0) ? 0 : -1);
+			if (show_stats) stats.Record(stage_cgroups, GetMonotonicNanoseconds() - cgroups_start);
 		}
+#ifdef _DEBUG
+		unsigned long long cgroup_allocations = GetAllocationCount() - allocations_before_cgroups;
+#endif
 
-		////////// Determine the bottleneck process, if registry is not set //////////
-		//  If an error occurs with process counter data, skip outputting
-		//  the bottleneck process and output the resource stats anyways.
-		if ((registry_is_set == false) && (process_count != 0)) {
-			DWORD index_of_highest = -1;
-			if (bottleneck_cause == cpu) {
-				index_of_highest = FindIndexOfProcessWithHighestDouble(process_cpu_pcts, process_count);
-				if (index_of_highest != -1) {
-					bottleneck.name.assign(process_cpu_pcts[index_of_highest].szName);
-				}
-				/*else {
-					//There was an error and all values were probably set to 0
-					//Error likely caused by number of processes changing
-				}*/
-			}
-			else if (bottleneck_cause == tio) {
-				//Find process with highest total IO
-				index_of_highest = FindIndexOfProcessWithHighestLongLong(process_total_bytes, process_count);
-				if (index_of_highest != -1) {
-					bottleneck.name.assign(process_total_bytes[index_of_highest].szName);
-				}
+		collector->SetHotCore(sample.busiest_core);
+		if (collect_processes && collector->CollectProcesses(bottleneck_cause)) {
+			//Add the process as the bottleneck, then the rest of /TOP
+			while ((top_process_count < collector->GetRankedCount()) && (top_process_count < top_count)) {
+				top_processes[top_process_count].Copy(collector->GetProcesses(),
+					collector->GetRankedIndex(top_process_count), collector->GetNames(), collector->GetCommands());
+				++top_process_count;
 			}
-			else if (bottleneck_cause == rio) {
-				//Find process with highest read IO
-				index_of_highest = FindIndexOfProcessWithHighestLongLong(process_read_bytes, process_count);
-				if (index_of_highest != -1) {
-					bottleneck.name.assign(process_read_bytes[index_of_highest].szName);
-				}
-			}
-			else if (bottleneck_cause == wio) {
-				//Find process with highest write IO
-				index_of_highest = FindIndexOfProcessWithHighestLongLong(process_write_bytes, process_count);
-				if (index_of_highest != -1) {
-					bottleneck.name.assign(process_write_bytes[index_of_highest].szName);
-				}
+			if ((top_process_count > 0) && (top_processes[0].name.length() == 0)) top_process_count = 0;
+			if (show_stats) {
+				const ProcessTimings* timings = collector->GetTimings();
+				stats.Record(stage_fetch, timings->fetch);
+				stats.Record(stage_join, timings->join);
+				stats.Record(stage_rates, timings->rates);
+				stats.Record(stage_select, timings->select);
 			}
 		}
 
-		////////// Determine the bottleneck process, if registry is set //////////
-		if (registry_is_set) {
-			DWORD index_of_highest = -1;
-			if (bottleneck_cause == cpu) {
-				double highest_value = 0.0;
-				for (DWORD n = 0; n < process_raw_new_length; ++n) {
-					if ((process_raw_new[n].PID != 0) && (process_raw_new[n].cpu > highest_value)) {
-						highest_value = process_raw_new[n].cpu;
-						index_of_highest = n;
-					}
-				}
-			}
-			else if (bottleneck_cause == tio) {
-				long long highest_value = 0;
-				for (DWORD n = 0; n < process_raw_new_length; ++n) {
-					if ((process_raw_new[n].PID != 0) && (process_raw_new[n].tio > highest_value)) {
-						highest_value = process_raw_new[n].tio;
-						index_of_highest = n;
-					}
+		//Drill into the bottleneck process's threads, only the winner's
+		if ((top_thread_count > 0) && (top_process_count > 0)) {
+			unsigned long long threads_start = GetMonotonicNanoseconds();
+			if (collector->CollectThreads(bottleneck_cause, collector->GetRankedIndex(0), top_thread_count)) {
+				for (; top_threads_found < collector->GetRankedThreadCount(); ++top_threads_found) {
+					top_threads[top_threads_found] = *collector->GetRankedThread(top_threads_found);
 				}
 			}
-			else if (bottleneck_cause == wio) {
-				long long highest_value = 0;
-				for (DWORD n = 0; n < process_raw_new_length; ++n) {
-					if ((process_raw_new[n].PID != 0) && (process_raw_new[n].wio > highest_value)) {
-						highest_value = process_raw_new[n].wio;
-						index_of_highest = n;
-					}
-				}
+			if (show_stats) stats.Record(stage_threads, GetMonotonicNanoseconds() - threads_start);
+		}
+
+		if (record_filename != 0) {
+			if (!recording.WriteTick(tick_time, &sample, collector->GetProcesses(), collector->GetNames(),
+				collector->GetProcessSampleTime(), collector->TracksPIDs())) {
+				wcout << L"Error writing recording \"" << record_filename << L"\", stopped recording." << endl;
+				recording.Close();
+				record_filename = 0;
 			}
-			else if (bottleneck_cause == rio) {
-				long long highest_value = 0;
-				for (DWORD n = 0; n < process_raw_new_length; ++n) {
-					if ((process_raw_new[n].PID != 0) && (process_raw_new[n].rio > highest_value)) {
-						highest_value = process_raw_new[n].rio;
-						index_of_highest = n;
-					}
+		}
+
+		//Picks the time to the next tick, lines show the one this tick came after
+		unsigned long long tick_interval_ns = 0;
+		if (max_interval_ns != 0) {
+			tick_interval_ns = adaptive.GetInterval();
+			double utilization_pct = (sample.cpu_pct > highest_disk_usage) ? sample.cpu_pct : highest_disk_usage;
+			int bottleneck_PID = (top_process_count > 0) ? top_processes[0].PID : -1;
+			unsigned long long next_interval_ns = adaptive.Update(saturated, utilization_pct, bottleneck_cause, bottleneck_PID);
+			if (next_interval_ns != tick_interval_ns) scheduler.SetInterval(next_interval_ns);
+
+			//Waking from a quiet stretch, the last samples are from before it
+			// and would water down whatever woke it. Sample afresh now, so the
+			// next tick's rates are over one interval.
+			if (!collect_processes && !adaptive.IsQuiet()) {
+				collector->ForgetSamples();
+				if (top_cgroup_count > 0) {
+					bool cgroups_ranked = collector->CollectCgroups(bottleneck_cause, top_cgroup_count);
+					if (in_cgroup) collector->LimitToCgroup((cgroups_ranked && (collector->GetRankedCgroupCount() > 0)) ? 0 : -1);
 				}
+				collector->CollectProcesses(bottleneck_cause);
 			}
+		}
 
-			//Add the process as the bottleneck
-			if (index_of_highest != -1) {
-				bottleneck.Copy(&process_raw_new[index_of_highest]);
+#ifdef _DEBUG
+		//Once the buffers have grown to fit, sampling should not allocate. The
+		// cgroup hierarchy walk does, it is told apart.
+		unsigned long long sampling_allocations = GetAllocationCount() - allocations_before_sampling - cgroup_allocations;
+		if (sampling_allocations != 0) {
+			wcout << L"Debug: " << sampling_allocations << L" heap allocations while sampling." << endl;
+		}
+		if (cgroup_allocations != 0) {
+			wcout << L"Debug: " << cgroup_allocations << L" heap allocations in the cgroup rescan, which runs every 10 seconds." << endl;
+		}
+#endif
+
+		////////// Rolling statistics //////////
+		bool summary_due = false;
+		if (show_summary) {
+			double values[METRIC_COUNT] = {highest_disk_usage, (double)recv_bytes, (double)sent_bytes, sample.cpu_pct, ram_pct};
+			rolling.Add(tick_time, values);
+			if (next_summary_time == 0) next_summary_time = tick_time + summary_interval_ns;
+			else if (tick_time >= next_summary_time) {
+				summary_text.Clear();
+				for (DWORD window = 0; window < rolling.GetWindowCount(); ++window) {
+					WindowSummary summary;
+					rolling.Summarize(window, &summary);
+					encoder->EncodeSummary(tick_time, &summary, &summary_text);
+				}
+				summary_due = true;
+				next_summary_time = tick_time + summary_interval_ns;
 			}
 		}
 
-		//Cleanup if needed
-		delete[] process_cpu_pcts;
-		delete[] process_write_bytes;
-		delete[] process_read_bytes;
-		delete[] process_total_bytes;
+		////////// Format Output //////////
+#ifdef _DEBUG
+		unsigned long long allocations_before_formatting = GetAllocationCount();
+#endif
+		unsigned long long format_start = GetMonotonicNanoseconds();
+		OutputTick output;
+		output.time = tick_time;
+		output.disk_pct = highest_disk_usage;
+		output.recv_bytes = recv_bytes;
+		output.sent_bytes = sent_bytes;
+		output.cpu_pct = sample.cpu_pct;
+		output.core_max_pct = sample.core_max_pct;
+		output.busiest_core = sample.busiest_core;
+		output.ram_pct = ram_pct;
+		output.cause = bottleneck_cause;
+		output.processes = top_processes.data();
+		output.process_count = top_process_count;
+		output.processor_count = processor_count;
+		output.show_io_value = top_count > 1;
+		output.disks = collector->GetDisks();
+		output.disk_count = show_disks ? collector->GetDiskCount() : 0;
+		output.interfaces = collector->GetInterfaces();
+		output.interface_count = show_interfaces ? collector->GetInterfaceCount() : 0;
+		output.pressure = show_pressure ? sample.pressure : 0;
+		output.threads = top_threads.data();
+		output.thread_count = top_threads_found;
+		output.cgroups = top_cgroups.data();
+		output.cgroup_count = top_cgroups_found;
+		output.interval_ns = tick_interval_ns;
+		output_text.Clear();
+		encoder->EncodeTick(&output, &output_text);
 
-		//Set the new process data to be the old data point next loop
-		delete[] process_raw_old;
-		process_raw_old = process_raw_new;
-		process_raw_old_length = process_raw_new_length;
-		process_raw_new = 0;
-		process_raw_new_length = 0;
+		if (summary_due) output_text.Append(summary_text.GetText(), summary_text.GetLength());
 
-		////////// Format Output //////////
-		wstring bottleneck_cause_text = L"";
-		if (bottleneck.name.length() != 0) {
-			const size_t number_text_length = 128;
-			wchar_t number_text[number_text_length];
-			if (bottleneck_cause == cpu) {
-				bottleneck_cause_text = L"CPU:";
-				swprintf(number_text, number_text_length, L"%1.0f%%", bottleneck.cpu/processor_count);
-				bottleneck_cause_text.append(number_text);
-			}
-			else if (bottleneck_cause == tio) {
-				bottleneck_cause_text = L"TIO:";
-				//swprintf(number_text, number_text_length, L"%u%", bottleneck.tio);
-				//bottleneck_cause_text.append(number_text);
-			}
-			else if (bottleneck_cause == wio) {
-				bottleneck_cause_text = L"WIO:";
-				//swprintf(number_text, number_text_length, L"%u%", bottleneck.wio);
-				//bottleneck_cause_text.append(number_text);
-			}
-			else if (bottleneck_cause == rio) {
-				bottleneck_cause_text = L"RIO:";
-				//swprintf(number_text, number_text_length, L"%u%", bottleneck.rio);
-				//bottleneck_cause_text.append(number_text);
-			}
-		}
-		const size_t text_buffer_size = 1024;
-		wchar_t text_buffer[text_buffer_size];
-		if (smart_formatting) {
-			//Assume 80 char width, try to format within 80 chars
-			
-			//Temp variables
-			const size_t str_size = 32;
-			wchar_t disk_str[str_size];
-			wchar_t DL_str[str_size];
-			wchar_t UL_str[str_size];
-			wchar_t CPU_str[str_size];
-			wchar_t RAM_str[str_size];
-
-			//Format the pieces
-			swprintf(disk_str, str_size, L"%5.2f", highest_disk_usage);
-			swprintf(DL_str, str_size, L"%u", (unsigned int)recv_bytes);
-			swprintf(UL_str, str_size, L"%u", (unsigned int)sent_bytes);
-			swprintf(CPU_str, str_size, L"%5.2f", cpu_pct.doubleValue);
-			swprintf(RAM_str, str_size, L"%5.2f", ram_pct);
-
-			//Assume lengths after the pieces
-			size_t after_disk = 2;
-			if (wcslen(disk_str) == 6) after_disk = 1;
-			
-			size_t after_DL;
-			if (wcslen(DL_str) < 8) after_DL = 8 - wcslen(DL_str);
-			else after_DL = 1;
-
-			size_t after_UL;
-			if (wcslen(DL_str) < 8) after_UL = 8 - wcslen(UL_str);
-			else after_UL = 1;
-
-			size_t after_CPU = 2;
-			if (wcslen(CPU_str) == 6) after_CPU = 1;
-
-			if (bottleneck_cause_length_queue.size() > MAX_QUEUE_SIZE) bottleneck_cause_length_queue.pop();
-			bottleneck_cause_length_queue.push(bottleneck_cause_text.length());
-			size_t after_cause = GetLargestValueInQueue(&bottleneck_cause_length_queue) - bottleneck_cause_text.length() + 1;
-
-			wstring bottleneck_name_text = bottleneck.name;
-			if (bottleneck.PID != 0) {
-				bottleneck_name_text.append(L"_");
-				bottleneck_name_text.append(to_wstring(bottleneck.PID));
-			}
-			if (bottleneck_name_length_queue.size() > MAX_QUEUE_SIZE) bottleneck_name_length_queue.pop();
-			bottleneck_name_length_queue.push(bottleneck_name_text.length());
-			size_t after_name = GetLargestValueInQueue(&bottleneck_name_length_queue) - bottleneck_name_text.length() + 2;
-			size_t text_chars_needed = 
-				wcslen(disk_str) +
-				wcslen(DL_str) +
-				wcslen(UL_str) +
-				wcslen(CPU_str) +
-				bottleneck_cause_text.length() +
-				bottleneck_name_text.length() +
-				wcslen(RAM_str);
-			size_t desired_space = text_chars_needed + after_disk + after_DL + after_UL + after_CPU + after_cause + after_name;
-			if (desired_space > 79) {
-				//wcout << "!!!!!!!!!!!desired_space=" << desired_space << endl;
-				//Output won't fit in command prompt after the return character.
-				//Adjust the process name to compensate.
-				size_t space_needed = desired_space - 79;
-				space_needed += 3;//For adding a "..." to show the name was too long
-
-				//Recalculate bottleneck_name_text
-				bottleneck_name_text = bottleneck.name.substr(0, bottleneck.name.length() - space_needed);
-				bottleneck_name_text.append(L"..._");
-				bottleneck_name_text.append(to_wstring(bottleneck.PID));
-
-				//Clear the formatting queue
-				while (bottleneck_name_length_queue.size() > 0) bottleneck_name_length_queue.pop();
-				bottleneck_name_length_queue.push(bottleneck_name_text.length());
-				after_name = 2;
-			}
-
-			//Create the final output string string
-			swprintf(text_buffer, text_buffer_size, L"%s%*s%s%*s%s%*s%s%*s%s%*s%s%*s%s\n",
-				disk_str, (int)after_disk, L"", 
-				DL_str, (int)after_DL, L"",
-				UL_str, (int)after_UL, L"",
-				CPU_str, (int)after_CPU, L"",
-				bottleneck_cause_text.c_str(), (int)after_cause, L"",
-				bottleneck_name_text.c_str(), (int)after_name, L"",
-				RAM_str);
+		//Layouts without a time column get one at the start of each logfile line
+		bool log_time = (logging_filename != 0) && encoder->NeedsLogTime();
+		if (log_time) {
+			log_text.Clear();
+			AppendLogLines(&output_text, tick_time, &log_text);
 		}
-		else {
-			//No smart formatting, simple tabular output
-			wstring bottleneck_name_text = bottleneck.name;
-			if (bottleneck.PID != 0) {
-				bottleneck_name_text.append(L"_");
-				bottleneck_name_text.append(to_wstring(bottleneck.PID));
-			}
-			swprintf(text_buffer, text_buffer_size, L"%4.2f\t%u\t%u\t%4.2f\t%s\t%s\t%4.2f\n",
-				highest_disk_usage,
-				(unsigned int)recv_bytes,
-				(unsigned int)sent_bytes,
-				cpu_pct.doubleValue,
-				bottleneck_cause_text.c_str(),
-				bottleneck_name_text.c_str(),
-				ram_pct);
-			//Old line: swprintf(text_buffer, text_buffer_size, L"%5.2f  %u\t%u\t%5.2f  %s %s\t%5.2f\n",
-		}
-		wcout << text_buffer;
+
+		unsigned long long output_start = GetMonotonicNanoseconds();
+		if (show_stats) stats.Record(stage_format, output_start - format_start);
+#ifdef _DEBUG
+		//Formatting reuses its buffers the same way
+		unsigned long long formatting_allocations = GetAllocationCount() - allocations_before_formatting;
+		if (formatting_allocations != 0) {
+			wcout << L"Debug: " << formatting_allocations << L" heap allocations while formatting." << endl;
+		}
+#endif
+
+		wcout.write(output_text.GetText(), output_text.GetLength());
+		wcout << flush;
 		if (logging_filename != 0) {
-			//First write the time
-			time_t rawtime = time(0);
-				//struct tm realtime;
-				//_localtime32_s(&rawtime, &realtime);
-			wchar_t time_buffer[256];
-			wcsftime(time_buffer, 256, L"%F %T\t", localtime(&rawtime));
-			logfile << time_buffer;
+			//The writer thread writes and flushes it, a slow disk drops lines instead of delaying the next sample
+			if (log_time) logfile.Write(log_text.GetText(), log_text.GetLength());
+			else logfile.Write(output_text.GetText(), output_text.GetLength());
+			if (logfile.GetDroppedCount() != reported_log_drops) {
+				reported_log_drops = logfile.GetDroppedCount();
+				wcout << L"Logfile is behind, " << reported_log_drops << L" lines dropped." << endl;
+			}
+		}
+
+		//The history is written through a mapping, no flush is needed
+		if (history_filename != 0) {
+			HistoryRecord record;
+			memset(&record, 0, sizeof(record));
+			record.time = (int64_t)(tick_time / 1000000ULL);
+			record.interval_ns = actual_interval_ns;
+			record.disk_pct = highest_disk_usage;
+			record.cpu_pct = sample.cpu_pct;
+			record.ram_pct = ram_pct;
+			record.recv_bytes = recv_bytes;
+			record.sent_bytes = sent_bytes;
+			record.processor_count = processor_count;
+			//The cause is kept even when no process was found for it
+			record.cause = bottleneck_cause;
+			const BottleneckProcess* bottleneck = &top_processes[0];
+			if (top_process_count > 0) {
+				record.PID = bottleneck->PID;
+				if ((bottleneck_cause == cpu) || (bottleneck_cause == core)) record.process_value = bottleneck->cpu;
+				else if (bottleneck_cause == tio) record.process_value = (double)bottleneck->tio;
+				else if (bottleneck_cause == wio) record.process_value = (double)bottleneck->wio;
+				else if (bottleneck_cause == rio) record.process_value = (double)bottleneck->rio;
+				else if (bottleneck_cause == mem) record.process_value = (double)bottleneck->faults;
+				history.Append(&record, bottleneck->name.c_str(), bottleneck->name.length());
+			}
+			else history.Append(&record, L"", 0);
+		}
 
-			//Then write the output line
-			logfile << text_buffer;
+		if (publish) {
+			FillSnapshot(&output, (max_interval_ns != 0) ? adaptive.GetInterval() : interval_ns, sample.pressure, snapshot);
+			shared.Publish(snapshot);
+		}
 
-			//Flush file before computer crashes
-			logfile.flush();
+		if (metrics_address != 0) {
+			metrics_text.Clear();
+			AppendPrometheusText(&output, &metrics_text);
+			metrics.Publish(metrics_text.GetText(), metrics_text.GetLength());
+		}
+
+		if (show_stats) {
+			unsigned long long output_end = GetMonotonicNanoseconds();
+			stats.Record(stage_log, output_end - output_start);
+			if (output_end >= next_stats_time) {
+				stats.Print();
+				next_stats_time = output_end + stats_interval_ns;
+			}
 		}
 	}
 
+	if (show_stats) stats.Print();
+	running_scheduler = 0;
+	metrics.Close();
+	shared.Close();
+	delete snapshot;
+	delete encoder;
+	delete collector;
     return EXIT_SUCCESS;
 }
+
+#ifndef _WIN32
+int main(int argc, char* argv[]) {
+	//Widens the arguments so wmain() is shared with Windows.
+	setlocale(LC_ALL, "");
+	vector<wstring> wide_arguments(argc);
+	vector<wchar_t*> wide_argv(argc + 1, (wchar_t*)0);
+	for (int argn = 0; argn < argc; ++argn) {
+		wide_arguments[argn] = WidenString(argv[argn]);
+		wide_argv[argn] = &wide_arguments[argn][0];
+	}
+	return wmain(argc, wide_argv.data());
+}
+#endif
@@ -6,7 +6,9 @@
 #include <string>
 
 void ConvertCStringToUpper(wchar_t* input);
-bool StringsMatch(wchar_t* input1, wchar_t* input2);
+bool StringsMatch(const wchar_t* input1, const wchar_t* input2);
 bool StringsMatch(std::wstring input1, std::wstring input2);
+std::wstring WidenString(const char* input);
+std::string NarrowString(const wchar_t* input);
 
 #endif
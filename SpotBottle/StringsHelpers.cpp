@@ -1,5 +1,8 @@
 #include "StringHelpers.h"
 #include <locale>
+#include <wchar.h>
+#include <stdlib.h>
+#include <vector>
 
 void ConvertCStringToUpper(wchar_t* input) {
 	//Replaces all lowercase characters in a null terminated wchar_t array with uppercase characters, dependent on the locale.
@@ -10,7 +13,7 @@ void ConvertCStringToUpper(wchar_t* input) {
 	}
 }
 
-bool StringsMatch(wchar_t* input1, wchar_t* input2) {
+bool StringsMatch(const wchar_t* input1, const wchar_t* input2) {
 	//Returns true if two wchar_t strings compare the same, else false.
 	if (wcscmp(input1, input2) == 0) return true;
 	return false;
@@ -21,3 +24,34 @@ bool StringsMatch(std::wstring input1, std::wstring input2) {
 	if (input1.compare(input2) == 0) return true;
 	return false;
 }
+
+std::wstring WidenString(const char* input) {
+	//Converts a multibyte string to a wstring using the current locale.
+	//Bytes that cannot be converted are copied as they are.
+	size_t length = mbstowcs(0, input, 0);
+	if (length == (size_t)-1) {
+		std::wstring copy;
+		while (*input != 0) copy.push_back((unsigned char)*input++);
+		return copy;
+	}
+	std::vector<wchar_t> buffer(length + 1);
+	mbstowcs(buffer.data(), input, length + 1);
+	return std::wstring(buffer.data(), length);
+}
+
+std::string NarrowString(const wchar_t* input) {
+	//Converts a wide string to a multibyte string using the current locale.
+	//Characters that cannot be converted are replaced with '?'.
+	size_t length = wcstombs(0, input, 0);
+	if (length == (size_t)-1) {
+		std::string copy;
+		while (*input != 0) {
+			copy.push_back((*input < 128) ? (char)*input : '?');
+			++input;
+		}
+		return copy;
+	}
+	std::vector<char> buffer(length + 1);
+	wcstombs(buffer.data(), input, length + 1);
+	return std::string(buffer.data(), length);
+}
@@ -0,0 +1,159 @@
+#include "TickScheduler.h"
+#ifndef _WIN32
+#include <time.h>
+#include <errno.h>
+#include <sys/prctl.h>
+#endif
+
+using namespace std;
+
+//Missed ticks run back to back with catch_up, past this many the rest are
+// skipped so a long stall does not turn into a burst of samples.
+const unsigned long long MAX_CATCH_UP_TICKS = 10;
+
+#ifdef _WIN32
+#ifndef CREATE_WAITABLE_TIMER_HIGH_RESOLUTION
+#define CREATE_WAITABLE_TIMER_HIGH_RESOLUTION 0x00000002
+#endif
+#endif
+
+TickScheduler::TickScheduler() {
+	//Constructor
+	interval = 1000000000ULL;
+	catch_up = false;
+	next_tick = 0;
+	last_tick_time = 0;
+	retry_time = 0;
+	skipped_ticks = 0;
+	stopping = false;
+#ifdef _WIN32
+	stop_event = CreateEventW(0, TRUE, FALSE, 0);
+	//High resolution timers need Windows 10 1803, older versions get the
+	// regular timer
+	timer = CreateWaitableTimerExW(0, 0, CREATE_WAITABLE_TIMER_HIGH_RESOLUTION, TIMER_ALL_ACCESS);
+	if (timer == 0) timer = CreateWaitableTimerExW(0, 0, 0, TIMER_ALL_ACCESS);
+#else
+	original_slack = 0;
+#endif
+}
+
+TickScheduler::~TickScheduler() {
+#ifdef _WIN32
+	if (timer != 0) CloseHandle(timer);
+	if (stop_event != 0) CloseHandle(stop_event);
+#endif
+}
+
+void TickScheduler::Start(unsigned long long interval_ns, bool new_catch_up) {
+	//Starts ticking on the next wall clock multiple of interval_ns.
+	catch_up = new_catch_up;
+	last_tick_time = GetMonotonicNanoseconds();
+	retry_time = 0;
+	skipped_ticks = 0;
+	SetInterval(interval_ns);
+}
+
+void TickScheduler::SetInterval(unsigned long long interval_ns) {
+	//The ticks of the old interval are dropped, none count as skipped
+	interval = (interval_ns < 1) ? 1 : interval_ns;
+	next_tick = GetUnixTimeNanoseconds() / interval + 1;
+#ifndef _WIN32
+	//The default 50 microsecond timer slack would swamp short intervals.
+	// Longer ones get it back, it lets the kernel batch wakeups.
+	if ((interval < 1000000ULL) && (original_slack == 0)) {
+		int slack = prctl(PR_GET_TIMERSLACK, 0UL, 0UL, 0UL, 0UL);
+		if ((slack > 1) && (prctl(PR_SET_TIMERSLACK, 1UL, 0UL, 0UL, 0UL) == 0)) original_slack = (unsigned long)slack;
+	}
+	else if ((interval >= 1000000ULL) && (original_slack != 0)) {
+		prctl(PR_SET_TIMERSLACK, original_slack, 0UL, 0UL, 0UL);
+		original_slack = 0;
+	}
+#endif
+}
+
+unsigned long long TickScheduler::WaitForNextTick() {
+	//Sleeps until the next tick and returns the time since the last one.
+	if (stopping) return 0;
+	if (retry_time != 0) {
+		SleepUntil(retry_time);
+		retry_time = 0;
+	}
+	else {
+		//Both clocks are read together, the wall clock places the tick and
+		// the monotonic clock is slept on, so a clock step cannot stretch a sleep
+		unsigned long long wall_now = GetUnixTimeNanoseconds();
+		unsigned long long monotonic_now = GetMonotonicNanoseconds();
+		unsigned long long current_tick = wall_now / interval;
+		if (current_tick >= next_tick + 1) {
+			//At least one whole tick was missed
+			unsigned long long missed = current_tick - next_tick;
+			if (!catch_up || (missed > MAX_CATCH_UP_TICKS)) {
+				skipped_ticks += missed;
+				next_tick = current_tick;
+			}
+		}
+		else if (next_tick > current_tick + 1) {
+			//The wall clock was set back, start again from now
+			next_tick = current_tick + 1;
+		}
+		unsigned long long tick_time = next_tick * interval;
+		if (tick_time > wall_now) SleepUntil(monotonic_now + (tick_time - wall_now));
+		++next_tick;
+	}
+	unsigned long long now = GetMonotonicNanoseconds();
+	unsigned long long actual_interval = now - last_tick_time;
+	last_tick_time = now;
+	return actual_interval;
+}
+
+void TickScheduler::RetryAfter(unsigned long long delay_ns) {
+	retry_time = GetMonotonicNanoseconds() + delay_ns;
+}
+
+unsigned long long TickScheduler::GetSkippedCount() {
+	return skipped_ticks;
+}
+
+void TickScheduler::Stop() {
+	stopping = true;
+#ifdef _WIN32
+	if (stop_event != 0) SetEvent(stop_event);
+#endif
+}
+
+bool TickScheduler::IsStopped() {
+	return stopping;
+}
+
+#ifdef _WIN32
+
+void TickScheduler::SleepUntil(unsigned long long monotonic_deadline) {
+	//Waitable timers take a relative time in 100 nanosecond units.
+	unsigned long long now = GetMonotonicNanoseconds();
+	if (monotonic_deadline <= now) return;
+	unsigned long long remaining = monotonic_deadline - now;
+	DWORD remaining_ms = (DWORD)((remaining + 999999ULL) / 1000000ULL);
+	LARGE_INTEGER due_time;
+	due_time.QuadPart = -(LONGLONG)((remaining + 99ULL) / 100ULL);
+	if ((timer == 0) || (SetWaitableTimer(timer, &due_time, 0, 0, 0, FALSE) == 0)) {
+		//Millisecond resolution, still woken by Stop()
+		if (stop_event != 0) WaitForSingleObject(stop_event, remaining_ms);
+		else Sleep(remaining_ms);
+		return;
+	}
+	HANDLE handles[2] = { timer, stop_event };
+	WaitForMultipleObjects((stop_event != 0) ? 2 : 1, handles, FALSE, INFINITE);
+}
+
+#else
+
+void TickScheduler::SleepUntil(unsigned long long monotonic_deadline) {
+	//An absolute deadline, so a signal interrupting the sleep cannot lengthen it.
+	//Stop() is called from a signal handler, which interrupts the sleep.
+	struct timespec deadline;
+	deadline.tv_sec = (time_t)(monotonic_deadline / 1000000000ULL);
+	deadline.tv_nsec = (long)(monotonic_deadline % 1000000000ULL);
+	while ((clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &deadline, 0) == EINTR) && !stopping) {}
+}
+
+#endif
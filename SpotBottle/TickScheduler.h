@@ -0,0 +1,65 @@
+//Wakes the sampling loop on absolute deadlines, so the period does not grow
+// by the time spent collecting and printing.
+
+#ifndef RESOURCEMONITOR_TICKSCHEDULER_H
+#define RESOURCEMONITOR_TICKSCHEDULER_H
+
+#include "Platform.h"
+#include <atomic>
+
+using namespace std;
+
+//Ticks fall on wall clock multiples of the interval, e.g. on the second for
+// /T 1, and are waited for on the monotonic clock. A tick that is missed
+// entirely is either skipped or run late, back to back with the next.
+class TickScheduler {
+public:
+	TickScheduler();//Constructor
+	~TickScheduler();
+
+	//Starts ticking every interval_ns, the first tick being the next multiple
+	// of it. catch_up runs missed ticks instead of skipping them.
+	void Start(unsigned long long interval_ns, bool catch_up);
+
+	//Ticks every interval_ns from the next multiple of it, for /T min max.
+	void SetInterval(unsigned long long interval_ns);
+
+	//Sleeps until the next tick. Returns the measured time since the last
+	// tick returned, in nanoseconds.
+	unsigned long long WaitForNextTick();
+
+	//Makes the next WaitForNextTick() return after delay_ns, without waiting
+	// for the next tick. Used to retry a failed sample.
+	void RetryAfter(unsigned long long delay_ns);
+
+	//Ticks skipped because the loop fell a whole interval behind.
+	unsigned long long GetSkippedCount();
+
+	//Wakes WaitForNextTick() and makes it return at once from then on.
+	//Safe to call from a signal handler or another thread.
+	void Stop();
+	bool IsStopped();
+
+private:
+	void SleepUntil(unsigned long long monotonic_deadline);
+
+	unsigned long long interval;
+	bool catch_up;
+	unsigned long long next_tick;//Wall clock time is next_tick * interval
+	unsigned long long last_tick_time;//Monotonic
+	unsigned long long retry_time;//Monotonic, 0 if no retry is pending
+	unsigned long long skipped_ticks;
+	atomic<bool> stopping;
+#ifdef _WIN32
+	HANDLE timer;
+	HANDLE stop_event;
+#else
+	unsigned long original_slack;//Timer slack to restore, 0 if not lowered
+#endif
+
+	//Not copyable
+	TickScheduler(const TickScheduler&);
+	TickScheduler& operator=(const TickScheduler&);
+};
+
+#endif
@@ -0,0 +1,156 @@
+#include "WorkerPool.h"
+
+using namespace std;
+
+//Items taken from a share at a time. Small enough to balance, large enough
+// that the share's lock is rarely contended.
+const DWORD CHUNK_SIZE = 32;
+
+WorkerPool::WorkerPool() {
+	//Constructor
+	shares = new Share[1];
+	shares[0].begin = 0;
+	shares[0].end = 0;
+	worker_count = 1;
+	generation = 0;
+	active_workers = 1;
+	running_threads = 0;
+	stopping = false;
+	function = 0;
+	context = 0;
+}
+
+WorkerPool::~WorkerPool() {
+	Stop();
+	delete[] shares;
+}
+
+void WorkerPool::Start(DWORD new_worker_count) {
+	//Stops any running threads and starts new_worker_count - 1 new ones.
+	Stop();
+	if (new_worker_count < 1) new_worker_count = 1;
+	delete[] shares;
+	shares = new Share[new_worker_count];
+	for (DWORD n = 0; n < new_worker_count; ++n) {
+		shares[n].begin = 0;
+		shares[n].end = 0;
+	}
+	worker_count = new_worker_count;
+	generation = 0;
+	stopping = false;
+	for (DWORD worker = 1; worker < worker_count; ++worker) {
+		threads.push_back(thread(&WorkerPool::ThreadMain, this, worker));
+	}
+}
+
+void WorkerPool::Stop() {
+	{
+		lock_guard<mutex> guard(lock);
+		stopping = true;
+	}
+	start_condition.notify_all();
+	for (size_t n = 0; n < threads.size(); ++n) threads[n].join();
+	threads.clear();
+}
+
+DWORD WorkerPool::GetWorkerCount() {
+	return worker_count;
+}
+
+void WorkerPool::Run(DWORD item_count, DWORD min_items_per_worker, WorkerFunction new_function, void* new_context) {
+	//Calls function over the items [0, item_count) and returns when all are done.
+	DWORD workers = worker_count;
+	if (min_items_per_worker > 0) {
+		DWORD useful_workers = item_count / min_items_per_worker;
+		if (useful_workers < workers) workers = useful_workers;
+	}
+	if (workers <= 1) {
+		if (item_count > 0) new_function(new_context, 0, 0, item_count);
+		return;
+	}
+
+	//Even shares, the last worker takes the remainder
+	DWORD share_size = item_count / workers;
+	for (DWORD worker = 0; worker < workers; ++worker) {
+		lock_guard<mutex> guard(shares[worker].lock);
+		shares[worker].begin = worker * share_size;
+		shares[worker].end = (worker == workers - 1) ? item_count : (worker + 1) * share_size;
+	}
+
+	{
+		lock_guard<mutex> guard(lock);
+		function = new_function;
+		context = new_context;
+		active_workers = workers;
+		running_threads = workers - 1;
+		++generation;
+	}
+	start_condition.notify_all();
+
+	RunWorker(0);
+
+	unique_lock<mutex> guard(lock);
+	while (running_threads != 0) done_condition.wait(guard);
+}
+
+void WorkerPool::ThreadMain(DWORD worker) {
+	//Waits for jobs until the pool stops.
+	unsigned long long seen_generation = 0;
+	while (true) {
+		unique_lock<mutex> guard(lock);
+		while (!stopping && (generation == seen_generation)) start_condition.wait(guard);
+		if (stopping) return;
+		seen_generation = generation;
+		if (worker >= active_workers) continue;//Not needed for this job
+		guard.unlock();
+
+		RunWorker(worker);
+
+		guard.lock();
+		--running_threads;
+		if (running_threads == 0) done_condition.notify_one();
+	}
+}
+
+void WorkerPool::RunWorker(DWORD worker) {
+	//Works through its own share, then steals until no work is left.
+	DWORD begin = 0;
+	DWORD end = 0;
+	while (TakeChunk(worker, &begin, &end) || (Steal(worker) && TakeChunk(worker, &begin, &end))) {
+		function(context, worker, begin, end);
+	}
+}
+
+bool WorkerPool::TakeChunk(DWORD worker, DWORD* begin, DWORD* end) {
+	//Takes up to CHUNK_SIZE items from the front of the worker's share.
+	lock_guard<mutex> guard(shares[worker].lock);
+	if (shares[worker].begin >= shares[worker].end) return false;
+	*begin = shares[worker].begin;
+	*end = *begin + CHUNK_SIZE;
+	if (*end > shares[worker].end) *end = shares[worker].end;
+	shares[worker].begin = *end;
+	return true;
+}
+
+bool WorkerPool::Steal(DWORD worker) {
+	//Moves the back half of another worker's share into this worker's share.
+	//Returns false if every share is empty.
+	for (DWORD n = 1; n < active_workers; ++n) {
+		DWORD victim = (worker + n) % active_workers;
+		DWORD begin;
+		DWORD end;
+		{
+			lock_guard<mutex> guard(shares[victim].lock);
+			if (shares[victim].begin >= shares[victim].end) continue;
+			DWORD stolen = (shares[victim].end - shares[victim].begin + 1) / 2;
+			end = shares[victim].end;
+			begin = end - stolen;
+			shares[victim].end = begin;
+		}
+		lock_guard<mutex> guard(shares[worker].lock);
+		shares[worker].begin = begin;
+		shares[worker].end = end;
+		return true;
+	}
+	return false;
+}
@@ -0,0 +1,71 @@
+//Small pool of threads for splitting per-process work across cores.
+
+#ifndef RESOURCEMONITOR_WORKERPOOL_H
+#define RESOURCEMONITOR_WORKERPOOL_H
+
+#include "Platform.h"
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+using namespace std;
+
+//Processes the items [begin, end). worker is 0 to GetWorkerCount() - 1, so
+// per-worker state can be kept in arrays without locking.
+typedef void (*WorkerFunction)(void* context, DWORD worker, DWORD begin, DWORD end);
+
+//Each worker starts with an even share of the items and takes them from the
+// front in small chunks. A worker that runs out steals the back half of
+// another worker's remaining share, so slow items do not hold up the tick.
+//The calling thread is worker 0, so a pool of one worker starts no threads.
+class WorkerPool {
+public:
+	WorkerPool();//Constructor
+	~WorkerPool();
+
+	//Stops any running threads and starts worker_count - 1 new ones.
+	void Start(DWORD worker_count);
+	DWORD GetWorkerCount();
+
+	//Calls function over the items [0, item_count) and returns when all are done.
+	//Only as many workers as have min_items_per_worker items each take part,
+	// small jobs are cheaper on one thread than waking the others.
+	void Run(DWORD item_count, DWORD min_items_per_worker, WorkerFunction function, void* context);
+
+private:
+	//A worker's remaining share, [begin, end)
+	struct Share {
+		mutex lock;
+		DWORD begin;
+		DWORD end;
+		char padding[64];//Keep shares on separate cache lines
+	};
+
+	void Stop();
+	void ThreadMain(DWORD worker);
+	void RunWorker(DWORD worker);
+	bool TakeChunk(DWORD worker, DWORD* begin, DWORD* end);
+	bool Steal(DWORD worker);
+
+	vector<thread> threads;
+	Share* shares;
+	DWORD worker_count;
+
+	//Current job, guarded by lock
+	mutex lock;
+	condition_variable start_condition;
+	condition_variable done_condition;
+	unsigned long long generation;//Bumped for every job
+	DWORD active_workers;
+	DWORD running_threads;
+	bool stopping;
+	WorkerFunction function;
+	void* context;
+
+	//Not copyable
+	WorkerPool(const WorkerPool&);
+	WorkerPool& operator=(const WorkerPool&);
+};
+
+#endif
@@ -0,0 +1,501 @@
+//Benchmark of SpotBottle's per-tick pipeline on synthetic process tables.
+//Runs each stage over tables of 100 to 100,000 processes and writes the
+// per-tick times as JSON, so results can be compared between releases.
+
+#include "Platform.h"
+#include "Collector.h"
+#include "LoopStats.h"
+#include "OutputFormat.h"
+#include "ProcessSamples.h"
+#include "StringHelpers.h"
+#ifdef _WIN32
+#include "PdhHelperFunctions.h"
+#else
+#include "ProcReader.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#endif
+#include <iostream>
+#include <string>
+#include <vector>
+#include <cstdlib>
+#include <cstring>
+
+using namespace std;
+
+const wchar_t USAGE_TEXT[] =
+L"SPOTBOTTLEBENCH [/TICKS n] [/MAX processes] [/J threads] [/TOP n] /NOTREE\n\n"
+" /TICKS\tIndicates the most ticks timed per table size is given.\n"
+"    \tDefaults to 50, fewer are run for the large tables.\n\n"
+" /MAX\tIndicates the largest table size to run is given. Defaults to 100000.\n\n"
+" /J\tIndicates the number of threads ranking processes is given.\n"
+"    \tDefaults to 1.\n\n"
+" /TOP\tIndicates the number of processes ranked and formatted is given.\n"
+"    \tDefaults to 10.\n\n"
+" /NOTREE Skips reading a /proc-style tree of files, which is slow to\n"
+"    \tcreate for the large tables.\n\n"
+"Writes JSON to the console: per stage and table size, the count of ticks\n"
+"and the mean, p50, p99 and max nanoseconds per tick.\n";
+
+const DWORD TABLE_SIZES[] = { 100, 1000, 10000, 100000 };
+
+//Ticks are cut for large tables so each size runs about as long
+const unsigned long long PROCESSES_PER_SIZE = 2000000;
+
+//Processes replaced by new ones every tick, in 1/1000ths
+const DWORD CHURN_PER_MILLE = 10;
+
+const char* PROCESS_NAMES[] = {
+	"systemd", "kworker/0:1", "bash", "sshd", "chrome", "firefox", "java",
+	"postgres", "nginx", "python3", "node", "containerd-shim", "dockerd",
+	"svchost", "explorer", "Code - Insiders", "rsyslogd", "cron", "ksoftirqd/3"
+};
+const DWORD PROCESS_NAME_COUNT = sizeof(PROCESS_NAMES) / sizeof(PROCESS_NAMES[0]);
+
+//xorshift64, the tables are the same every run
+unsigned long long random_state = 0x9E3779B97F4A7C15ULL;
+unsigned long long NextRandom() {
+	random_state ^= random_state << 13;
+	random_state ^= random_state >> 7;
+	random_state ^= random_state << 17;
+	return random_state;
+}
+
+//A synthetic process, its counters advance every tick
+struct SyntheticProcess {
+	int PID;
+	unsigned long long start_time;
+	string name;
+	unsigned long long cpu_ticks;
+	unsigned long long read_bytes;
+	unsigned long long write_bytes;
+};
+
+class SyntheticTable {
+public:
+	explicit SyntheticTable(DWORD process_count) {
+		//Constructor
+		next_PID = 1;
+		tick = 0;
+		processes.resize(process_count);
+		for (DWORD n = 0; n < process_count; ++n) Replace(n);
+	}
+
+	//Advances the counters and replaces a few processes with new ones.
+	void Advance() {
+		++tick;
+		for (size_t n = 0; n < processes.size(); ++n) {
+			if (NextRandom() % 1000 < CHURN_PER_MILLE) {
+				Replace((DWORD)n);
+				continue;
+			}
+			//Most processes are idle, like on a real host
+			unsigned long long busy = NextRandom() % 100;
+			if (busy < 90) continue;
+			processes[n].cpu_ticks += busy - 89;
+			processes[n].read_bytes += NextRandom() % 65536;
+			processes[n].write_bytes += NextRandom() % 16384;
+		}
+	}
+
+	vector<SyntheticProcess> processes;
+
+private:
+	void Replace(DWORD n) {
+		SyntheticProcess* process = &processes[n];
+		process->PID = next_PID++;
+		process->start_time = tick;
+		process->name = PROCESS_NAMES[NextRandom() % PROCESS_NAME_COUNT];
+		//Some names get a number, so there are many distinct names
+		if (NextRandom() % 4 == 0) process->name.append(to_string(NextRandom() % 1000));
+		process->cpu_ticks = NextRandom() % 100000;
+		process->read_bytes = NextRandom() % 100000000;
+		process->write_bytes = NextRandom() % 10000000;
+	}
+
+	int next_PID;
+	unsigned long long tick;
+};
+
+#ifdef _WIN32
+void SetRawCounter(RawCounter* counter, unsigned long long value) {
+	memset(counter, 0, sizeof(*counter));
+	counter->FirstValue = (LONGLONG)value;
+}
+unsigned long long GetRawCounter(const RawCounter& counter) {
+	return (unsigned long long)counter.FirstValue;
+}
+#else
+void SetRawCounter(RawCounter* counter, unsigned long long value) {
+	*counter = value;
+}
+unsigned long long GetRawCounter(const RawCounter& counter) {
+	return counter;
+}
+#endif
+
+//Feeds a synthetic table through the real join and ranking, one second apart.
+class SyntheticCollector : public Collector {
+public:
+	explicit SyntheticCollector(SyntheticTable* new_table) {
+		//Constructor
+		table = new_table;
+	}
+	virtual bool Open() {
+		return true;
+	}
+	virtual bool CollectSystem(SystemSample* sample) {
+		return true;
+	}
+
+protected:
+	virtual bool SampleProcessRaw() {
+		DWORD process_count = (DWORD)table->processes.size();
+		samples_new->Clear(process_count);
+		pid_index_new->Clear(process_count);
+		for (DWORD n = 0; n < process_count; ++n) {
+			const SyntheticProcess* process = &table->processes[n];
+			DWORD name_id = names.Intern(process->name.c_str(), process->name.length());
+			DWORD slot = samples_new->Add(process->PID, process->start_time, name_id);
+			SetRawCounter(&samples_new->raw_cpu[slot], process->cpu_ticks);
+			SetRawCounter(&samples_new->raw_rio[slot], process->read_bytes);
+			SetRawCounter(&samples_new->raw_wio[slot], process->write_bytes);
+			pid_index_new->Insert(process->PID, process->start_time, slot);
+		}
+		return true;
+	}
+
+	virtual void CalculateProcess(DWORD slot_new, DWORD slot_old, bool need_cpu, bool need_rio, bool need_wio) {
+		//Counters are a second apart, CPU in 100 ticks per second
+		unsigned long long cpu_new = GetRawCounter(samples_new->raw_cpu[slot_new]);
+		unsigned long long cpu_old = GetRawCounter(samples_old->raw_cpu[slot_old]);
+		unsigned long long wio_new = GetRawCounter(samples_new->raw_wio[slot_new]);
+		unsigned long long wio_old = GetRawCounter(samples_old->raw_wio[slot_old]);
+		unsigned long long rio_new = GetRawCounter(samples_new->raw_rio[slot_new]);
+		unsigned long long rio_old = GetRawCounter(samples_old->raw_rio[slot_old]);
+		if (need_cpu && (cpu_new >= cpu_old)) samples_new->cpu[slot_new] = (double)(cpu_new - cpu_old);
+		if (need_wio && (wio_new >= wio_old)) samples_new->wio[slot_new] = (long long)(wio_new - wio_old);
+		if (need_rio && (rio_new >= rio_old)) samples_new->rio[slot_new] = (long long)(rio_new - rio_old);
+	}
+
+private:
+	SyntheticTable* table;
+};
+
+//Results of one stage at one table size
+struct StageResult {
+	const char* stage;
+	DWORD process_count;
+	LatencyHistogram ticks;
+	unsigned long long total;
+	StageResult(const char* new_stage, DWORD new_process_count) {
+		//Constructor
+		stage = new_stage;
+		process_count = new_process_count;
+		total = 0;
+	}
+	void Record(unsigned long long nanoseconds) {
+		ticks.Record(nanoseconds);
+		total += nanoseconds;
+	}
+};
+
+#ifdef _WIN32
+
+void BenchmarkParse(SyntheticTable* table, DWORD tick_count, StageResult* result) {
+	//Instance names like PDH returns them with PID tracking, "name_1234".
+	vector<wstring> instance_names(table->processes.size());
+	for (size_t n = 0; n < table->processes.size(); ++n) {
+		const SyntheticProcess* process = &table->processes[n];
+		instance_names[n] = WidenString(process->name.c_str()) + L"_" + to_wstring(process->PID);
+	}
+	NameTable names;
+	unsigned long long PID_sum = 0;
+	for (DWORD tick = 0; tick < tick_count; ++tick) {
+		unsigned long long start = GetMonotonicNanoseconds();
+		for (size_t n = 0; n < instance_names.size(); ++n) {
+			size_t name_length = 0;
+			PID_sum += ParseRawCounterName(instance_names[n].c_str(), &name_length);
+			names.Intern(instance_names[n].c_str(), name_length);
+		}
+		result->Record(GetMonotonicNanoseconds() - start);
+	}
+	if (PID_sum == 0) wcout << L"";//Keeps the parsing from being optimized away
+}
+
+#else
+
+void FormatStatText(const SyntheticProcess* process, char* text, size_t text_size) {
+	//A /proc/[pid]/stat line with all 52 fields.
+	snprintf(text, text_size,
+		"%d (%s) S 1 %d %d 0 -1 4194560 %llu 0 12 0 %llu %llu 0 0 20 0 1 0 %llu "
+		"171016192 2331 18446744073709551615 1 1 0 0 0 0 0 4096 0 0 0 0 17 %d 0 0 0 0 0 "
+		"0 0 0 0 0 0 0 0\n",
+		process->PID, process->name.c_str(), process->PID, process->PID,
+		process->cpu_ticks * 7, process->cpu_ticks * 2 / 3, process->cpu_ticks / 3,
+		process->start_time, process->PID % 8);
+}
+
+void FormatIoText(const SyntheticProcess* process, char* text, size_t text_size) {
+	snprintf(text, text_size,
+		"rchar: %llu\nwchar: %llu\nsyscr: %llu\nsyscw: %llu\n"
+		"read_bytes: %llu\nwrite_bytes: %llu\ncancelled_write_bytes: 0\n",
+		process->read_bytes * 3, process->write_bytes * 2,
+		process->read_bytes / 512, process->write_bytes / 512,
+		process->read_bytes, process->write_bytes);
+}
+
+void BenchmarkParse(SyntheticTable* table, DWORD tick_count, StageResult* result) {
+	//Parses stat and io texts in memory, like ProcfsCollector after its reads.
+	vector<string> stat_texts(table->processes.size());
+	vector<string> io_texts(table->processes.size());
+	char text[1024];
+	for (size_t n = 0; n < table->processes.size(); ++n) {
+		FormatStatText(&table->processes[n], text, sizeof(text));
+		stat_texts[n] = text;
+		FormatIoText(&table->processes[n], text, sizeof(text));
+		io_texts[n] = text;
+	}
+	NameTable names;
+	ProcStat stat;
+	ProcIo io;
+	unsigned long long failures = 0;
+	for (DWORD tick = 0; tick < tick_count; ++tick) {
+		unsigned long long start = GetMonotonicNanoseconds();
+		for (size_t n = 0; n < stat_texts.size(); ++n) {
+			if (!ParseProcStat(stat_texts[n].data(), stat_texts[n].length(), &stat)) ++failures;
+			else names.Intern(stat.name, stat.name_length);
+			if (!ParseProcIo(io_texts[n].data(), io_texts[n].length(), &io)) ++failures;
+		}
+		result->Record(GetMonotonicNanoseconds() - start);
+	}
+	if (failures != 0) wcout << L"Parsing failed " << failures << L" times." << endl;
+}
+
+bool BenchmarkTree(SyntheticTable* table, DWORD tick_count, StageResult* result) {
+	//Writes a /proc-style tree of [pid]/stat and [pid]/io files to a
+	// temporary directory, then times opening, reading and parsing them.
+	char root[] = "/tmp/spotbottlebench.XXXXXX";
+	if (mkdtemp(root) == 0) {
+		wcout << L"Could not create a temporary directory." << endl;
+		return false;
+	}
+	char path[256];
+	char text[1024];
+	bool written = true;
+	for (size_t n = 0; written && (n < table->processes.size()); ++n) {
+		const SyntheticProcess* process = &table->processes[n];
+		snprintf(path, sizeof(path), "%s/%d", root, process->PID);
+		if (mkdir(path, 0755) == -1) written = false;
+		snprintf(path, sizeof(path), "%s/%d/stat", root, process->PID);
+		FormatStatText(process, text, sizeof(text));
+		FILE* file = fopen(path, "w");
+		if ((file == 0) || (fputs(text, file) < 0)) written = false;
+		if (file != 0) fclose(file);
+		snprintf(path, sizeof(path), "%s/%d/io", root, process->PID);
+		FormatIoText(process, text, sizeof(text));
+		file = fopen(path, "w");
+		if ((file == 0) || (fputs(text, file) < 0)) written = false;
+		if (file != 0) fclose(file);
+	}
+
+	vector<char> stat_buffer;
+	vector<char> io_buffer;
+	ProcStat stat;
+	ProcIo io;
+	unsigned long long failures = 0;
+	for (DWORD tick = 0; written && (tick < tick_count); ++tick) {
+		unsigned long long start = GetMonotonicNanoseconds();
+		for (size_t n = 0; n < table->processes.size(); ++n) {
+			int PID = table->processes[n].PID;
+			snprintf(path, sizeof(path), "%s/%d/stat", root, PID);
+			long length = ReadWholeFile(path, &stat_buffer);
+			if ((length <= 0) || !ParseProcStat(stat_buffer.data(), length, &stat)) ++failures;
+			snprintf(path, sizeof(path), "%s/%d/io", root, PID);
+			length = ReadWholeFile(path, &io_buffer);
+			if ((length <= 0) || !ParseProcIo(io_buffer.data(), length, &io)) ++failures;
+		}
+		result->Record(GetMonotonicNanoseconds() - start);
+	}
+	if (failures != 0) wcout << L"Reading the tree failed " << failures << L" times." << endl;
+
+	//Remove the tree
+	for (size_t n = 0; n < table->processes.size(); ++n) {
+		int PID = table->processes[n].PID;
+		snprintf(path, sizeof(path), "%s/%d/stat", root, PID);
+		unlink(path);
+		snprintf(path, sizeof(path), "%s/%d/io", root, PID);
+		unlink(path);
+		snprintf(path, sizeof(path), "%s/%d", root, PID);
+		rmdir(path);
+	}
+	rmdir(root);
+	if (!written) wcout << L"Could not write the tree in " << root << L"." << endl;
+	return written;
+}
+
+#endif
+
+void BenchmarkPipeline(SyntheticTable* table, DWORD tick_count, DWORD thread_count, DWORD top_count,
+	StageResult* fetch, StageResult* join, StageResult* rates, StageResult* select, StageResult* format) {
+	//Ticks a collector over the advancing table, ranking by CPU and then
+	// formatting the ranked processes the way wmain() does with /TSV /TOP.
+	SyntheticCollector collector(table);
+	collector.SetThreadCount(thread_count);
+	collector.SetRankCount(top_count);
+	collector.CollectProcesses(cpu);//The first tick has nothing to join
+
+	vector<BottleneckProcess> processes(top_count);
+	OutputEncoder* encoder = CreateEncoder(format_tsv);
+	LineBuffer text;
+	size_t formatted_length = 0;
+	for (DWORD tick = 0; tick < tick_count; ++tick) {
+		table->Advance();
+		collector.CollectProcesses(cpu);
+		const ProcessTimings* timings = collector.GetTimings();
+		fetch->Record(timings->fetch);
+		join->Record(timings->join);
+		rates->Record(timings->rates);
+		select->Record(timings->select);
+
+		unsigned long long format_start = GetMonotonicNanoseconds();
+		for (DWORD rank = 0; rank < collector.GetRankedCount(); ++rank) {
+			processes[rank].Copy(collector.GetProcesses(), collector.GetRankedIndex(rank), collector.GetNames(), collector.GetCommands());
+		}
+		OutputTick output;
+		output.time = GetUnixTimeNanoseconds();
+		output.disk_pct = 12.5;
+		output.recv_bytes = 123456;
+		output.sent_bytes = 7890;
+		output.cpu_pct = 95.5;
+		output.core_max_pct = 100.0;
+		output.busiest_core = 0;
+		output.ram_pct = 42.0;
+		output.cause = cpu;
+		output.processes = processes.data();
+		output.process_count = collector.GetRankedCount();
+		output.processor_count = 8;
+		output.show_io_value = top_count > 1;
+		output.disks = 0;
+		output.disk_count = 0;
+		output.interfaces = 0;
+		output.interface_count = 0;
+		output.pressure = 0;
+		output.threads = 0;
+		output.thread_count = 0;
+		output.cgroups = 0;
+		output.cgroup_count = 0;
+		output.interval_ns = 0;
+		text.Clear();
+		encoder->EncodeTick(&output, &text);
+		formatted_length += text.GetLength();
+		format->Record(GetMonotonicNanoseconds() - format_start);
+	}
+	delete encoder;
+	if (formatted_length == 0) wcout << L"";//Keeps the formatting from being optimized away
+}
+
+void WriteResult(StageResult* result, bool last) {
+	//One JSON object per line, in nanoseconds per tick
+	unsigned long long count = result->ticks.GetCount();
+	unsigned long long mean = (count > 0) ? result->total / count : 0;
+	wcout << L"    {\"stage\": \"" << result->stage << L"\""
+		<< L", \"processes\": " << result->process_count
+		<< L", \"ticks\": " << count
+		<< L", \"mean_ns\": " << mean
+		<< L", \"p50_ns\": " << result->ticks.GetPercentile(50.0)
+		<< L", \"p99_ns\": " << result->ticks.GetPercentile(99.0)
+		<< L", \"max_ns\": " << result->ticks.GetMax()
+		<< L"}" << (last ? L"" : L",") << endl;
+}
+
+int main(int argc, char* argv[]) {
+	DWORD max_ticks = 50;
+	DWORD max_processes = 100000;
+	DWORD thread_count = 1;
+	DWORD top_count = 10;
+	bool read_tree = true;
+
+	//Argument parsing
+	for (int argn = 1; argn < argc; ++argn) {
+		wstring argument = WidenString(argv[argn]);
+		if ((argument.length() > 1) && (argument[0] == L'-')) argument[0] = L'/';
+		ConvertCStringToUpper(&argument[0]);
+		bool has_value = (argn + 1 < argc);
+		if (StringsMatch(argument.c_str(), L"/TICKS") && has_value) {
+			max_ticks = (DWORD)strtoul(argv[++argn], 0, 10);
+			if (max_ticks < 1) max_ticks = 1;
+		}
+		else if (StringsMatch(argument.c_str(), L"/MAX") && has_value) {
+			max_processes = (DWORD)strtoul(argv[++argn], 0, 10);
+		}
+		else if (StringsMatch(argument.c_str(), L"/J") && has_value) {
+			thread_count = (DWORD)strtoul(argv[++argn], 0, 10);
+			if (thread_count < 1) thread_count = 1;
+		}
+		else if (StringsMatch(argument.c_str(), L"/TOP") && has_value) {
+			top_count = (DWORD)strtoul(argv[++argn], 0, 10);
+			if (top_count < 1) top_count = 1;
+		}
+		else if (StringsMatch(argument.c_str(), L"/NOTREE")) {
+			read_tree = false;
+		}
+		else {
+			wcout << USAGE_TEXT;
+			return (StringsMatch(argument.c_str(), L"/H")) ? EXIT_SUCCESS : EXIT_FAILURE;
+		}
+	}
+
+	vector<StageResult*> results;
+	for (DWORD size_index = 0; size_index < sizeof(TABLE_SIZES) / sizeof(TABLE_SIZES[0]); ++size_index) {
+		DWORD process_count = TABLE_SIZES[size_index];
+		if (process_count > max_processes) break;
+		DWORD tick_count = (DWORD)(PROCESSES_PER_SIZE / process_count);
+		if (tick_count > max_ticks) tick_count = max_ticks;
+		if (tick_count < 5) tick_count = 5;
+
+		SyntheticTable table(process_count);
+		StageResult* parse = new StageResult("parse", process_count);
+		BenchmarkParse(&table, tick_count, parse);
+		results.push_back(parse);
+#ifndef _WIN32
+		if (read_tree) {
+			StageResult* tree = new StageResult("read_tree", process_count);
+			if (BenchmarkTree(&table, tick_count, tree)) results.push_back(tree);
+			else delete tree;
+		}
+#endif
+		StageResult* fetch = new StageResult("fetch", process_count);
+		StageResult* join = new StageResult("join", process_count);
+		StageResult* rates = new StageResult("rates", process_count);
+		StageResult* select = new StageResult("select", process_count);
+		StageResult* format = new StageResult("format", process_count);
+		BenchmarkPipeline(&table, tick_count, thread_count, top_count, fetch, join, rates, select, format);
+		results.push_back(fetch);
+		results.push_back(join);
+		results.push_back(rates);
+		results.push_back(select);
+		results.push_back(format);
+	}
+
+	wcout << L"{" << endl;
+	wcout << L"  \"benchmark\": \"spotbottle\"," << endl;
+#ifdef _WIN32
+	wcout << L"  \"platform\": \"windows\"," << endl;
+#else
+	wcout << L"  \"platform\": \"linux\"," << endl;
+#endif
+	wcout << L"  \"threads\": " << thread_count << L"," << endl;
+	wcout << L"  \"top\": " << top_count << L"," << endl;
+	wcout << L"  \"results\": [" << endl;
+	for (size_t n = 0; n < results.size(); ++n) {
+		WriteResult(results[n], n + 1 == results.size());
+		delete results[n];
+	}
+	wcout << L"  ]" << endl;
+	wcout << L"}" << endl;
+	return EXIT_SUCCESS;
+}
@@ -0,0 +1,349 @@
+//Fuzz test of the /proc/[pid]/stat and /proc/[pid]/io parsers (Linux).
+//Feeds them real lines, odd process names, every truncation and random
+// mutations, each placed against a guard page so reading past the given
+// length crashes instead of passing unnoticed.
+
+#include "ProcReader.h"
+#include <iostream>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+using namespace std;
+
+const wchar_t USAGE_TEXT[] =
+L"SPOTBOTTLEFUZZ [/ROUNDS n]\n\n"
+" /ROUNDS\tIndicates the number of random mutations of each line is given.\n"
+"    \tDefaults to 200000.\n\n"
+"Prints each failed check and a count of them. Exits with 1 if any failed.\n";
+
+//A line as the kernel writes it, with the fields the parsers return
+struct StatCase {
+	const char* text;
+	const char* name;
+	int ppid;
+	unsigned long long major_faults;
+	unsigned long long utime;
+	unsigned long long stime;
+	unsigned long long start_time;
+	int processor;
+};
+
+//Names may hold spaces and parentheses, the name ends at the last ')'
+const StatCase STAT_CASES[] = {
+	{ "1 (systemd) S 0 1 1 0 -1 4194560 52091 3141592 91 1204 310 282 6714 2280 20 0 1 0 14 172158976 3259 18446744073709551615 1 1 0 0 0 0 671173123 4096 1260 0 0 0 17 3 0 0 0 0 0 0 0 0 0 0 0 0 0\n",
+		"systemd", 0, 91, 310, 282, 14, 3 },
+	{ "2417 (Web Content) R 2380 2380 2380 0 -1 4194560 120944 0 7 0 5120 610 0 0 20 0 30 0 88231 2879660032 96420 18446744073709551615 1 1 0 0 0 0 0 16781312 1082131704 0 0 0 17 11 0 0 0 0 0 0 0 0 0 0 0 0 0\n",
+		"Web Content", 2380, 7, 5120, 610, 88231, 11 },
+	{ "310 (() S 1 310 310 0 -1 4194560 10 0 0 0 1 2 0 0 20 0 1 0 500 1000 10 18446744073709551615 1 1 0 0 0 0 0 0 0 0 0 0 17 0 0 0 0 0 0 0 0 0 0 0 0 0 0\n",
+		"(", 1, 0, 1, 2, 500, 0 },
+	{ "311 ()) S 1 311 311 0 -1 4194560 10 0 4 0 1 2 0 0 20 0 1 0 501 1000 10 18446744073709551615 1 1 0 0 0 0 0 0 0 0 0 0 17 1 0 0 0 0 0 0 0 0 0 0 0 0 0\n",
+		")", 1, 4, 1, 2, 501, 1 },
+	{ "312 () () D 1 312 312 0 -1 4194560 10 0 5 0 9 8 0 0 20 0 1 0 502 1000 10 18446744073709551615 1 1 0 0 0 0 0 0 0 0 0 0 17 2 0 0 0 0 0 0 0 0 0 0 0 0 0\n",
+		") (", 1, 5, 9, 8, 502, 2 },
+	{ "313 (a) (b) 3 c) S 77 313 313 0 -1 4194560 10 0 6 0 3 4 0 0 20 0 1 0 503 1000 10 18446744073709551615 1 1 0 0 0 0 0 0 0 0 0 0 17 7 0 0 0 0 0 0 0 0 0 0 0 0 0\n",
+		"a) (b) 3 c", 77, 6, 3, 4, 503, 7 },
+	{ "314 () Z 1 314 314 0 -1 4194560 0 0 0 0 0 0 0 0 20 0 1 0 504 0 0 18446744073709551615 0 0 0 0 0 0 0 0 0 0 0 0 17 0 0 0 0 0 0 0 0 0 0 0 0 0 0\n",
+		"", 1, 0, 0, 0, 504, 0 },
+	//Old kernels end before the processor
+	{ "315 (old) S 1 315 315 0 -1 4194560 10 0 1 0 2 3 0 0 20 0 1 0 505 1000 10\n",
+		"old", 1, 1, 2, 3, 505, -1 },
+};
+const size_t STAT_CASE_COUNT = sizeof(STAT_CASES) / sizeof(STAT_CASES[0]);
+
+//Missing or misplaced parentheses, fields that are not numbers and lines
+// that end before the starttime
+const char* BAD_STAT_LINES[] = {
+	"",
+	"1",
+	"1 (name S 1 2 3",
+	"1 name) S 1 1 1 0 -1 4194560 1 0 1 0 1 1 0 0 20 0 1 0 5 1 1\n",
+	"1 )name( S 1 1 1 0 -1 4194560 1 0 1 0 1 1 0 0 20 0 1 0 5 1 1\n",
+	"1 (name)S 1 1 1 0 -1 4194560 1 0 1 0 1 1 0 0 20 0 1 0 5 1 1\n",
+	"1 (name) S x 1 1 0 -1 4194560 1 0 1 0 1 1 0 0 20 0 1 0 5 1 1\n",
+	"1 (name) S 1 1 1 0 -1 4194560 1 0 -1 0 1 1 0 0 20 0 1 0 5 1 1\n",
+	"1 (name) S 1 1 1 0 -1 4194560 1 0 1 0 1x 1 0 0 20 0 1 0 5 1 1\n",
+	"1 (name) S 1 1 1 0 -1 4194560 1 0 1 0 1 ? 0 0 20 0 1 0 5 1 1\n",
+	"1 (name) S 1 1 1 0 -1 4194560 1 0 1 0 1 1 0 0 20 0 1 0 0x5 1 1\n",
+	"1 (name) S 1 1 1 0 -1 4194560 1 0 1 0 1 1 0 0 20 0 1 0 ) 1 1\n",
+	"1 (name) S 1 1 1 0 -1 4194560 1 0 1 0 1 1 0 0 20 0 1 0\n",
+	"1 (name) S\n",
+	"1 (name) ",
+	"1 (name)",
+};
+const size_t BAD_STAT_LINE_COUNT = sizeof(BAD_STAT_LINES) / sizeof(BAD_STAT_LINES[0]);
+
+const char IO_TEXT[] =
+	"rchar: 323934931\n"
+	"wchar: 323929600\n"
+	"syscr: 632687\n"
+	"syscw: 632675\n"
+	"read_bytes: 4096\n"
+	"write_bytes: 323932160\n"
+	"cancelled_write_bytes: 0\n";
+
+const char* BAD_IO_TEXTS[] = {
+	"",
+	"rchar: 1\n",
+	"wchar: 1\n",
+	"rchar: x\nwchar: 1\n",
+	"rchar: 1\nwchar: -1\n",
+	"rchar: 1\nwchar: 12ab\n",
+	"rchar 1\nwchar 1\n",
+	"rchar: 1\nwchar:\n",
+	"rchar: 1\nwchar: 1",
+};
+const size_t BAD_IO_TEXT_COUNT = sizeof(BAD_IO_TEXTS) / sizeof(BAD_IO_TEXTS[0]);
+
+DWORD failure_count = 0;
+
+void Fail(const char* check, const char* text, size_t length) {
+	//Prints the check and the input, cut to one line
+	++failure_count;
+	if (failure_count > 50) return;
+	printf("FAILED %s: \"", check);
+	for (size_t n = 0; (n < length) && (n < 160); ++n) {
+		putchar(((unsigned char)text[n] < ' ') ? '.' : text[n]);
+	}
+	printf("\" (%zu bytes)\n", length);
+}
+
+//An input area between two pages that cannot be read
+class GuardedBuffer {
+public:
+	GuardedBuffer() {
+		//Constructor
+		page_size = (size_t)sysconf(_SC_PAGESIZE);
+		mapping = (char*)mmap(0, page_size * 3, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+		if (mapping == (char*)MAP_FAILED) {
+			wcout << "mmap() error." << endl;
+			exit(1);
+		}
+		mprotect(mapping, page_size, PROT_NONE);
+		mprotect(mapping + page_size * 2, page_size, PROT_NONE);
+	}
+	~GuardedBuffer() {
+		munmap(mapping, page_size * 3);
+	}
+
+	//Copies text against the end guard, then against the start guard.
+	// Lengths over a page are cut.
+	const char* PlaceAtEnd(const char* text, size_t length) {
+		if (length > page_size) length = page_size;
+		char* start = mapping + page_size * 2 - length;
+		memcpy(start, text, length);
+		return start;
+	}
+	const char* PlaceAtStart(const char* text, size_t length) {
+		if (length > page_size) length = page_size;
+		char* start = mapping + page_size;
+		memcpy(start, text, length);
+		return start;
+	}
+
+private:
+	char* mapping;
+	size_t page_size;
+
+	//Not copyable
+	GuardedBuffer(const GuardedBuffer&);
+	GuardedBuffer& operator=(const GuardedBuffer&);
+};
+
+GuardedBuffer guarded;
+
+bool ParseStat(const char* text, size_t length, ProcStat* stat) {
+	//Parses at both guards, which must agree, and checks the name is inside
+	// the text
+	const char* at_end = guarded.PlaceAtEnd(text, length);
+	bool parsed = ParseProcStat(at_end, length, stat);
+	if (parsed && ((stat->name < at_end) || (stat->name + stat->name_length > at_end + length))) {
+		Fail("stat name outside the text", text, length);
+	}
+	ProcStat stat_at_start;
+	const char* at_start = guarded.PlaceAtStart(text, length);
+	if (ParseProcStat(at_start, length, &stat_at_start) != parsed) {
+		Fail("stat parsed differently at the start guard", text, length);
+	}
+	return parsed;
+}
+
+bool ParseIo(const char* text, size_t length, ProcIo* io) {
+	const char* at_end = guarded.PlaceAtEnd(text, length);
+	bool parsed = ParseProcIo(at_end, length, io);
+	ProcIo io_at_start;
+	const char* at_start = guarded.PlaceAtStart(text, length);
+	if (ParseProcIo(at_start, length, &io_at_start) != parsed) {
+		Fail("io parsed differently at the start guard", text, length);
+	}
+	return parsed;
+}
+
+bool StatMatches(const ProcStat* stat, const StatCase* expected) {
+	return (stat->name_length == strlen(expected->name)) &&
+		(memcmp(stat->name, expected->name, stat->name_length) == 0) &&
+		(stat->ppid == expected->ppid) &&
+		(stat->major_faults == expected->major_faults) &&
+		(stat->utime == expected->utime) &&
+		(stat->stime == expected->stime) &&
+		(stat->start_time == expected->start_time);
+}
+
+//Returns the end of the field count spaces after the name, or 0
+const char* FindFieldEnd(const char* text, int count) {
+	const char* position = strrchr(text, ')');
+	for (int n = 0; n < count; ++n) {
+		position = strchr(position + 1, ' ');
+		if (position == 0) return 0;
+	}
+	return position;
+}
+
+void TestStatCases() {
+	//Whole lines parse to their fields. Cut at every byte they are rejected
+	// until the starttime and the space after it are in, and after that only
+	// the processor may be missing.
+	for (size_t n = 0; n < STAT_CASE_COUNT; ++n) {
+		const StatCase* expected = &STAT_CASES[n];
+		size_t length = strlen(expected->text);
+		ProcStat stat;
+		if (!ParseStat(expected->text, length, &stat) || !StatMatches(&stat, expected) ||
+			(stat.processor != expected->processor)) {
+			Fail("stat fields", expected->text, length);
+		}
+		const char* start_time_end = FindFieldEnd(expected->text, 21);
+		const char* processor_end = FindFieldEnd(expected->text, 38);
+		for (size_t cut = 0; cut < length; ++cut) {
+			bool parsed = ParseStat(expected->text, cut, &stat);
+			const char* cut_end = expected->text + cut;
+			if (cut_end <= start_time_end) {
+				if (parsed) Fail("truncated stat accepted", expected->text, cut);
+			}
+			else if (!parsed || !StatMatches(&stat, expected)) {
+				Fail("truncated stat fields", expected->text, cut);
+			}
+			else if ((processor_end == 0) || (cut_end <= processor_end)) {
+				if (stat.processor != -1) Fail("truncated stat processor", expected->text, cut);
+			}
+			else if (stat.processor != expected->processor) {
+				Fail("truncated stat processor", expected->text, cut);
+			}
+		}
+	}
+	for (size_t n = 0; n < BAD_STAT_LINE_COUNT; ++n) {
+		ProcStat stat;
+		if (ParseStat(BAD_STAT_LINES[n], strlen(BAD_STAT_LINES[n]), &stat)) {
+			Fail("bad stat accepted", BAD_STAT_LINES[n], strlen(BAD_STAT_LINES[n]));
+		}
+	}
+}
+
+void TestIoCases() {
+	//Cut at every byte the text is rejected until the wchar line is in, and
+	// the optional counters are 0 until their lines are in
+	size_t length = strlen(IO_TEXT);
+	const char* wchar_end = strstr(IO_TEXT, "wchar:");
+	wchar_end = strchr(wchar_end, '\n');
+	const char* read_bytes_end = strchr(strstr(IO_TEXT, "read_bytes:"), '\n');
+	const char* write_bytes_end = strchr(strstr(IO_TEXT, "\nwrite_bytes:") + 1, '\n');
+	for (size_t cut = 0; cut <= length; ++cut) {
+		ProcIo io;
+		bool parsed = ParseIo(IO_TEXT, cut, &io);
+		const char* cut_end = IO_TEXT + cut;
+		if (cut_end <= wchar_end) {
+			if (parsed) Fail("truncated io accepted", IO_TEXT, cut);
+			continue;
+		}
+		if (!parsed || (io.rchar != 323934931) || (io.wchar != 323929600)) {
+			Fail("truncated io fields", IO_TEXT, cut);
+			continue;
+		}
+		if (io.read_bytes != ((cut_end > read_bytes_end) ? 4096 : 0)) {
+			Fail("truncated io read_bytes", IO_TEXT, cut);
+		}
+		if (io.write_bytes != ((cut_end > write_bytes_end) ? 323932160 : 0)) {
+			Fail("truncated io write_bytes", IO_TEXT, cut);
+		}
+	}
+	for (size_t n = 0; n < BAD_IO_TEXT_COUNT; ++n) {
+		ProcIo io;
+		if (ParseIo(BAD_IO_TEXTS[n], strlen(BAD_IO_TEXTS[n]), &io)) {
+			Fail("bad io accepted", BAD_IO_TEXTS[n], strlen(BAD_IO_TEXTS[n]));
+		}
+	}
+}
+
+//xorshift64, the mutations are the same every run
+unsigned long long random_state = 0x9E3779B97F4A7C15ULL;
+unsigned long long NextRandom() {
+	random_state ^= random_state << 13;
+	random_state ^= random_state >> 7;
+	random_state ^= random_state << 17;
+	return random_state;
+}
+
+//Mostly the characters the parsers look for
+const char MUTATION_BYTES[] = "0123456789 ()\n:-x\t";
+
+void Mutate(const char* text, size_t length, char* mutated, size_t* mutated_length) {
+	//Changes, removes or repeats a few bytes, then maybe cuts the end off
+	DWORD changes = 1 + (DWORD)(NextRandom() % 4);
+	memcpy(mutated, text, length);
+	size_t out = length;
+	for (DWORD n = 0; (n < changes) && (out > 0); ++n) {
+		size_t position = (size_t)(NextRandom() % out);
+		switch (NextRandom() % 3) {
+		case 0:
+			mutated[position] = MUTATION_BYTES[NextRandom() % (sizeof(MUTATION_BYTES) - 1)];
+			break;
+		case 1:
+			memmove(mutated + position, mutated + position + 1, out - position - 1);
+			--out;
+			break;
+		default:
+			if (out < 1024) {
+				memmove(mutated + position + 1, mutated + position, out - position);
+				++out;
+			}
+			break;
+		}
+	}
+	if ((NextRandom() % 4) == 0) out = (size_t)(NextRandom() % (out + 1));
+	*mutated_length = out;
+}
+
+void TestMutations(DWORD rounds) {
+	//Only crashes and names outside the text are failures here
+	char mutated[1024];
+	size_t mutated_length = 0;
+	for (DWORD round = 0; round < rounds; ++round) {
+		const StatCase* stat_case = &STAT_CASES[round % STAT_CASE_COUNT];
+		Mutate(stat_case->text, strlen(stat_case->text), mutated, &mutated_length);
+		ProcStat stat;
+		ParseStat(mutated, mutated_length, &stat);
+
+		Mutate(IO_TEXT, strlen(IO_TEXT), mutated, &mutated_length);
+		ProcIo io;
+		ParseIo(mutated, mutated_length, &io);
+	}
+}
+
+int main(int argc, char* argv[]) {
+	DWORD rounds = 200000;
+	for (int n = 1; n < argc; ++n) {
+		if ((strcmp(argv[n], "/ROUNDS") == 0) && (n + 1 < argc)) {
+			rounds = (DWORD)strtoul(argv[++n], 0, 10);
+		}
+		else {
+			wcout << USAGE_TEXT;
+			return 1;
+		}
+	}
+	TestStatCases();
+	TestIoCases();
+	TestMutations(rounds);
+	printf("%u failed checks\n", (unsigned int)failure_count);
+	return (failure_count == 0) ? 0 : 1;
+}